@@ -0,0 +1,749 @@
+/******************************************************************************
+Module: BULK.CPP
+
+Description: This file contains the bulk-transfer receiver. Large images sent
+             over TCP are streamed into a flash partition with two RAM blocks:
+             the TCP thread fills one block while the writer thread erases and
+             programs the other. Progress is saved, so an interrupted transfer
+             resumes from the last programmed page, and the image is checked
+             against its CRC-32 at the end. A compressed image is decoded
+             as the segments arrive, so only the compressed bytes travel
+             over the air
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/storage/stream_flash.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/settings/settings.h>
+
+// Project specific headers
+#include "bulk.h"
+#include "heatshrink.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(bulk, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// The devicetree gives the target partition the "bulk_partition" label (see the board overlays)
+#if defined(CONFIG_APP_BULK_TRANSFER) && FIXED_PARTITION_EXISTS(bulk_partition)
+#define BULK_ENABLED 1
+#define BULK_PARTITION_ID FIXED_PARTITION_ID(bulk_partition)
+#else
+#define BULK_ENABLED 0
+#endif
+
+#if BULK_ENABLED && defined(CONFIG_APP_BULK_COMPRESSION)
+#define BULK_COMPRESSION_ENABLED 1
+#else
+#define BULK_COMPRESSION_ENABLED 0
+#endif
+
+// Receive buffer for compressed data, decoded from there into the blocks
+#define BULK_RX_CHUNK_SIZE  1024
+
+// Settings key of the saved progress
+#define BULK_PROGRESS_KEY "bulk/progress"
+
+// While waiting for the writer, the TCP thread checks the stop flag this often. Once it is set, the writer
+// is given this long to finish the block it is programming. Both stay well below the TCP server's join timeout.
+#define BULK_STOP_POLL_MS           100
+#define BULK_WRITER_STOP_TIMEOUT_MS 250
+
+// Header layout (little-endian)
+#define BULK_HDR_MAGIC_OFS  0
+#define BULK_HDR_SIZE_OFS   4
+#define BULK_HDR_CRC_OFS    8
+#define BULK_HDR_FLAGS_OFS  12
+
+
+
+#if BULK_ENABLED
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_bulk_writer_stack, BULK_WRITER_STACK_SIZE);
+static struct k_thread s_writer_thread;
+static bool s_writer_started;
+
+
+
+/******************************************************************************
+  STATE
+ *****************************************************************************/
+// Index of an end marker that carries no data and no block
+#define BULK_NO_BLOCK 0xFF
+
+// One block handed from the TCP thread to the writer thread
+struct bulk_block
+{
+    uint8_t  index;     // Which of the two RAM blocks, or BULK_NO_BLOCK
+    uint32_t len;       // Bytes of image data in it (0 for an end marker)
+    bool     last;      // Flush and finish after this block
+};
+
+// The identity of the image being received and how far it has been programmed
+struct bulk_progress
+{
+    uint32_t size;
+    uint32_t crc;
+    uint32_t flags;
+    uint32_t offset;    // Always on an erase-page boundary
+};
+
+// Double buffer: one block is filled from the socket while the other is written to flash
+static uint8_t s_blocks[2][CONFIG_APP_BULK_BLOCK_SIZE] __aligned(4);
+// The full queue has room for both blocks and an end marker that carries no block
+K_MSGQ_DEFINE(s_full_q, sizeof(struct bulk_block), 3, 4);
+K_MSGQ_DEFINE(s_free_q, sizeof(uint8_t), 2, 1);
+static K_SEM_DEFINE(s_writer_done, 0, 1);
+
+// Set while the writer owns a transfer (from the first block to the end marker), and to make it skip the rest
+static atomic_t s_writer_busy;
+static atomic_t s_writer_abort;
+static const struct flash_area *s_fa;
+
+// Bytes that arrived after the header in the same read, handed out before reading the socket again
+static const uint8_t *s_pending;
+static size_t s_pending_len;
+
+// Flash stream, owned by the writer thread during a transfer
+static struct stream_flash_ctx s_stream;
+static uint8_t s_write_buf[CONFIG_APP_BULK_BLOCK_SIZE] __aligned(4);
+static size_t s_page_size;
+static uint32_t s_resume_base;
+static uint32_t s_crc;
+static volatile int s_write_rc;
+static struct bulk_progress s_progress;
+
+// Bytes received for the image, and cycles spent decoding it
+static uint32_t s_wire_bytes;
+static uint64_t s_decode_cycles;
+#endif
+
+#if BULK_COMPRESSION_ENABLED
+// Decoder of compressed transfers. Its window is the only history kept, so RAM does not grow with the image.
+static struct heatshrink_decoder s_decoder;
+static uint8_t s_hs_window[1U << CONFIG_APP_BULK_HEATSHRINK_WINDOW_BITS];
+static uint8_t s_rx_buf[BULK_RX_CHUNK_SIZE];
+static size_t s_rx_pos;
+static size_t s_rx_len;
+#endif
+
+static struct bulk_stats s_bulk_stats;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+#if BULK_ENABLED
+/**
+ * @brief Settings loader callback for the saved progress
+ */
+static int progress_load_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg, void *param)
+{
+    struct bulk_progress progress;
+
+    if (len != sizeof(progress))
+    {
+        return 0;
+    }
+
+    // A short or failed read leaves 'param' zeroed: no progress, the image starts over
+    if (read_cb(cb_arg, &progress, sizeof(progress)) != (ssize_t)sizeof(progress))
+    {
+        LOG_WRN("Failed to read the saved bulk progress");
+        return 0;
+    }
+
+    memcpy(param, &progress, sizeof(progress));
+    return 0;
+}
+
+/**
+ * @brief Persist how far the current image has been programmed, rounded down to a whole erase page
+ * Only whole pages are trusted: stream_flash erases a page the first time it writes into it.
+ */
+static void progress_save(void)
+{
+    uint32_t written = s_resume_base + stream_flash_bytes_written(&s_stream);
+
+    s_progress.offset = ROUND_DOWN(written, s_page_size);
+    settings_save_one(BULK_PROGRESS_KEY, &s_progress, sizeof(s_progress));
+}
+
+/**
+ * @brief Writer thread: programs each filled block and hands it back to the TCP thread
+ */
+static void bulk_writer_thread(void *p1, void *p2, void *p3)
+{
+    struct bulk_block block;
+    uint32_t last_saved = 0;
+
+    while (1)
+    {
+        k_msgq_get(&s_full_q, &block, K_FOREVER);
+        const uint8_t *data = (block.index == BULK_NO_BLOCK) ? s_blocks[0] : s_blocks[block.index];
+
+        // The session gave up on us: drop the rest, what is already programmed stays resumable
+        if ((s_write_rc == 0) && atomic_get(&s_writer_abort))
+        {
+            s_write_rc = -ECANCELED;
+        }
+
+        if (s_write_rc == 0)
+        {
+            // stream_flash erases each page on first use and programs whole write buffers
+            int rc = stream_flash_buffered_write(&s_stream, data, block.len, block.last);
+            if (rc)
+            {
+                LOG_ERR("Flash write failed at %u: %d", s_resume_base + stream_flash_bytes_written(&s_stream), rc);
+                s_write_rc = rc;
+            }
+            else
+            {
+                s_crc = crc32_ieee_update(s_crc, data, block.len);
+            }
+        }
+
+        // Save progress now and then, so a disconnect does not restart the image from zero
+        uint32_t written = s_resume_base + stream_flash_bytes_written(&s_stream);
+        if (block.last || (written - MIN(written, last_saved) >= CONFIG_APP_BULK_PROGRESS_INTERVAL_KB * 1024U))
+        {
+            progress_save();
+            last_saved = written;
+        }
+
+        // The block is free again
+        if (block.index != BULK_NO_BLOCK)
+        {
+            k_msgq_put(&s_free_q, &block.index, K_NO_WAIT);
+        }
+
+        // The transfer is over for the writer. It closes the area, as the session may have stopped waiting.
+        if (block.last)
+        {
+            last_saved = 0;
+            flash_area_close(s_fa);
+            atomic_set(&s_writer_busy, 0);
+            k_sem_give(&s_writer_done);
+        }
+    }
+}
+
+/**
+ * @brief Receive at least one byte, waking up on every socket timeout to check the stop flag and the stall timer
+ */
+static int recv_some(int sock, uint8_t *buf, size_t len, int idle_timeout_ms, const atomic_t *stop)
+{
+    int64_t last_rx_ms = k_uptime_get();
+
+    while (!atomic_get(stop))
+    {
+        int ret = recv(sock, buf, len, 0);
+        if (ret > 0)
+        {
+            return ret;
+        }
+        if (ret == 0)
+        {
+            return -ECONNRESET;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        {
+            return -errno;
+        }
+        if ((idle_timeout_ms > 0) && (k_uptime_get() - last_rx_ms >= idle_timeout_ms))
+        {
+            return -ETIMEDOUT;
+        }
+    }
+
+    return -ECANCELED;
+}
+
+/**
+ * @brief Receive image data: first the bytes that came with the header, then from the socket
+ */
+static int recv_data(int sock, uint8_t *buf, size_t len, int idle_timeout_ms, const atomic_t *stop)
+{
+    if (s_pending_len > 0)
+    {
+        size_t n = MIN(len, s_pending_len);
+
+        memcpy(buf, s_pending, n);
+        s_pending += n;
+        s_pending_len -= n;
+        return (int)n;
+    }
+
+    return recv_some(sock, buf, len, idle_timeout_ms, stop);
+}
+
+#if BULK_COMPRESSION_ENABLED
+/**
+ * @brief Receive compressed data and decode at least one byte of image into 'buf'
+ * Input left over when 'buf' is full stays in s_rx_buf for the next call.
+ */
+static int recv_decoded(int sock, uint8_t *buf, size_t len, int idle_timeout_ms, const atomic_t *stop)
+{
+    while (1)
+    {
+        if (s_rx_pos < s_rx_len)
+        {
+            size_t used;
+            uint32_t start = k_cycle_get_32();
+            size_t produced = heatshrink_decode(&s_decoder, &s_rx_buf[s_rx_pos], s_rx_len - s_rx_pos, &used, buf, len);
+            s_decode_cycles += k_cycle_get_32() - start;
+
+            s_rx_pos += used;
+            if (produced > 0)
+            {
+                return (int)produced;
+            }
+        }
+
+        int ret = recv_data(sock, s_rx_buf, sizeof(s_rx_buf), idle_timeout_ms, stop);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        s_rx_pos = 0;
+        s_rx_len = ret;
+        s_wire_bytes += ret;
+    }
+}
+
+/**
+ * @brief Check the encoding in the header flags and prepare the decoder
+ * A sender may use a smaller window than ours, never a larger one.
+ */
+static int decoder_setup(uint32_t flags)
+{
+    uint8_t window_bits    = (flags >> BULK_FLAG_HS_WINDOW_SHIFT) & 0x0F;
+    uint8_t lookahead_bits = (flags >> BULK_FLAG_HS_LOOKAHEAD_SHIFT) & 0x0F;
+
+    if (window_bits > CONFIG_APP_BULK_HEATSHRINK_WINDOW_BITS)
+    {
+        LOG_ERR("Compressed with a 2^%u byte window, ours is 2^%u", window_bits, CONFIG_APP_BULK_HEATSHRINK_WINDOW_BITS);
+        return -ENOTSUP;
+    }
+
+    s_rx_pos = 0;
+    s_rx_len = 0;
+
+    return heatshrink_decoder_init(&s_decoder, s_hs_window, window_bits, lookahead_bits);
+}
+#endif
+
+/**
+ * @brief Send a 32-bit little-endian status word to the peer
+ */
+static void send_word(int sock, int32_t value)
+{
+    uint8_t word[4];
+
+    sys_put_le32((uint32_t)value, word);
+    send(sock, word, sizeof(word), 0);
+}
+
+/**
+ * @brief CRC-32 of the part of the image that is already in flash, needed when resuming
+ */
+static uint32_t crc_of_flash(const struct flash_area *fa, uint32_t len)
+{
+    uint32_t crc = 0;
+
+    for (uint32_t off = 0; off < len; off += CONFIG_APP_BULK_BLOCK_SIZE)
+    {
+        uint32_t chunk = MIN((uint32_t)CONFIG_APP_BULK_BLOCK_SIZE, len - off);
+        flash_area_read(fa, off, s_blocks[0], chunk);
+        crc = crc32_ieee_update(crc, s_blocks[0], chunk);
+    }
+
+    return crc;
+}
+
+/**
+ * @brief Hand a block to the writer thread
+ */
+static void submit_block(uint8_t index, uint32_t len, bool last)
+{
+    struct bulk_block block = { .index = index, .len = len, .last = last };
+
+    k_msgq_put(&s_full_q, &block, K_FOREVER);
+}
+
+/**
+ * @brief Once the session is stopping, tell the writer to drop what it has not started and check the grace period
+ * '*deadline_ms' starts at 0 and is shared by every wait of the session, so the total wait is bounded.
+ */
+static bool stop_grace_over(const atomic_t *stop, int64_t *deadline_ms)
+{
+    if (!atomic_get(stop))
+    {
+        return false;
+    }
+
+    atomic_set(&s_writer_abort, 1);
+    if (*deadline_ms == 0)
+    {
+        *deadline_ms = k_uptime_get() + BULK_WRITER_STOP_TIMEOUT_MS;
+    }
+
+    return k_uptime_get() >= *deadline_ms;
+}
+
+/**
+ * @brief Wait for a free block while the writer is busy with both
+ */
+static int take_free_block(uint8_t *index, const atomic_t *stop, int64_t *deadline_ms)
+{
+    while (k_msgq_get(&s_free_q, index, K_MSEC(BULK_STOP_POLL_MS)) != 0)
+    {
+        if (stop_grace_over(stop, deadline_ms))
+        {
+            return -ETIMEDOUT;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Wait for the writer to finish the transfer
+ */
+static int wait_writer_done(const atomic_t *stop, int64_t *deadline_ms)
+{
+    while (k_sem_take(&s_writer_done, K_MSEC(BULK_STOP_POLL_MS)) != 0)
+    {
+        if (stop_grace_over(stop, deadline_ms))
+        {
+            return -ETIMEDOUT;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief Start the flash writer thread
+ */
+int bulk_init(void)
+{
+#if BULK_ENABLED
+    if (s_writer_started)
+    {
+        return 0;
+    }
+
+    k_tid_t tid = k_thread_create(&s_writer_thread, m_bulk_writer_stack,
+                                  K_THREAD_STACK_SIZEOF(m_bulk_writer_stack),
+                                  bulk_writer_thread, NULL, NULL, NULL,
+                                  BULK_WRITER_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "bulk_writer");
+    s_writer_started = true;
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Check whether the first bytes of a session are a bulk transfer header
+ */
+bool bulk_is_header(const uint8_t *data, size_t len)
+{
+#if BULK_ENABLED
+    return (len >= sizeof(uint32_t)) && (sys_get_le32(&data[BULK_HDR_MAGIC_OFS]) == BULK_MAGIC);
+#else
+    ARG_UNUSED(data);
+    ARG_UNUSED(len);
+
+    return false;
+#endif
+}
+
+/**
+ * @brief Run one bulk transfer
+ * Protocol: the peer sends the 16-byte header, the device answers with the offset to (re)start from
+ * (or a negative error), the peer sends the image from that offset, and the device answers with the final status.
+ */
+int bulk_run_session(int sock, const uint8_t *prefix, size_t prefix_len, int idle_timeout_ms, const atomic_t *stop)
+{
+#if BULK_ENABLED
+    uint8_t header[BULK_HEADER_SIZE];
+    size_t have = MIN(prefix_len, sizeof(header));
+    const struct flash_area *fa;
+    struct flash_pages_info page;
+    int rc = 0;
+
+    // Collect the complete header
+    memcpy(header, prefix, have);
+    while (have < sizeof(header))
+    {
+        int ret = recv_some(sock, &header[have], sizeof(header) - have, idle_timeout_ms, stop);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        have += ret;
+    }
+
+    uint32_t size  = sys_get_le32(&header[BULK_HDR_SIZE_OFS]);
+    uint32_t crc   = sys_get_le32(&header[BULK_HDR_CRC_OFS]);
+    uint32_t flags = sys_get_le32(&header[BULK_HDR_FLAGS_OFS]);
+    bool compressed = (flags & BULK_FLAG_HEATSHRINK) != 0;
+
+    // The encoding only concerns this session: a compressed upload may resume a plain one and vice versa
+    if (compressed)
+    {
+#if BULK_COMPRESSION_ENABLED
+        rc = decoder_setup(flags);
+#else
+        rc = -ENOTSUP;
+#endif
+        if (rc)
+        {
+            LOG_ERR("Unsupported transfer encoding %08x: %d", flags, rc);
+            send_word(sock, rc);
+            s_bulk_stats.transfers_failed++;
+            return rc;
+        }
+    }
+    flags &= ~BULK_FLAG_ENCODING_MASK;
+
+    // A session that stopped waiting left the writer finishing the previous transfer
+    if (atomic_get(&s_writer_busy))
+    {
+        LOG_WRN("The flash writer is still busy with the previous transfer");
+        send_word(sock, -EBUSY);
+        s_bulk_stats.transfers_failed++;
+        return -EBUSY;
+    }
+
+    rc = flash_area_open(BULK_PARTITION_ID, &fa);
+    if (rc)
+    {
+        LOG_ERR("Failed to open the bulk partition: %d", rc);
+        send_word(sock, rc);
+        s_bulk_stats.transfers_failed++;
+        return rc;
+    }
+
+    if ((size == 0) || (size > fa->fa_size))
+    {
+        LOG_ERR("Image of %u bytes does not fit the %u byte partition", size, (uint32_t)fa->fa_size);
+        send_word(sock, -EFBIG);
+        flash_area_close(fa);
+        s_bulk_stats.transfers_failed++;
+        return -EFBIG;
+    }
+
+    flash_get_page_info_by_offs(fa->fa_dev, fa->fa_off, &page);
+    s_page_size = page.size;
+
+    // Resume only the very same image, and only from a programmed page boundary
+    struct bulk_progress saved = { 0 };
+    settings_load_subtree_direct(BULK_PROGRESS_KEY, progress_load_cb, &saved);
+
+    uint32_t resume = 0;
+    if ((saved.size == size) && (saved.crc == crc) && (saved.flags == flags) && (saved.offset < size))
+    {
+        resume = saved.offset;
+        s_bulk_stats.transfers_resumed += (resume > 0) ? 1 : 0;
+    }
+
+    // Prepare the writer: the stream starts at the resume point, the CRC covers what is already in flash
+    s_progress = { .size = size, .crc = crc, .flags = flags, .offset = resume };
+    s_resume_base = resume;
+    s_crc = crc_of_flash(fa, resume);
+    s_write_rc = 0;
+    s_wire_bytes = 0;
+    s_decode_cycles = 0;
+    rc = stream_flash_init(&s_stream, fa->fa_dev, s_write_buf, sizeof(s_write_buf),
+                           fa->fa_off + resume, fa->fa_size - resume, NULL);
+    if (rc)
+    {
+        LOG_ERR("Failed to start the flash stream: %d", rc);
+        send_word(sock, rc);
+        flash_area_close(fa);
+        s_bulk_stats.transfers_failed++;
+        return rc;
+    }
+
+    // Both blocks start free
+    k_msgq_purge(&s_full_q);
+    k_msgq_purge(&s_free_q);
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        k_msgq_put(&s_free_q, &i, K_NO_WAIT);
+    }
+    k_sem_reset(&s_writer_done);
+    atomic_set(&s_writer_abort, 0);
+    atomic_set(&s_writer_busy, 1);
+    s_fa = fa;
+
+    // A sender that does not wait for our reply has its first bytes in the prefix already: they are the start of the data
+    s_pending = prefix + MIN(prefix_len, sizeof(header));
+    s_pending_len = prefix_len - MIN(prefix_len, sizeof(header));
+
+    LOG_INF("Bulk transfer of %u bytes%s, starting at %u", size, compressed ? " (compressed)" : "", resume);
+    send_word(sock, (int32_t)resume);
+
+    // Receive into one block while the writer programs the other
+    uint32_t remaining = size - resume;
+    int64_t start_ms = k_uptime_get();
+    int64_t stop_deadline_ms = 0;
+    bool last_sent = false;
+
+    while ((remaining > 0) && (s_write_rc == 0))
+    {
+        uint8_t index;
+        rc = take_free_block(&index, stop, &stop_deadline_ms);
+        if (rc < 0)
+        {
+            break;
+        }
+
+        uint32_t want = MIN((uint32_t)CONFIG_APP_BULK_BLOCK_SIZE, remaining);
+        uint32_t fill = 0;
+        while (fill < want)
+        {
+            int ret;
+#if BULK_COMPRESSION_ENABLED
+            if (compressed)
+            {
+                ret = recv_decoded(sock, &s_blocks[index][fill], want - fill, idle_timeout_ms, stop);
+            }
+            else
+#endif
+            {
+                ret = recv_data(sock, &s_blocks[index][fill], want - fill, idle_timeout_ms, stop);
+                s_wire_bytes += MAX(ret, 0);
+            }
+            if (ret < 0)
+            {
+                rc = ret;
+                break;
+            }
+            fill += ret;
+        }
+
+        remaining -= fill;
+        last_sent = (remaining == 0) || (rc < 0);
+        submit_block(index, fill, last_sent);
+
+        if (rc < 0)
+        {
+            LOG_WRN("Bulk transfer interrupted at %u: %d", size - remaining, rc);
+            break;
+        }
+    }
+
+    // A flash error, or stopping while the writer holds both blocks, ends the loop early: flush with an empty end marker
+    if (!last_sent)
+    {
+        submit_block(BULK_NO_BLOCK, 0, true);
+    }
+
+    // The writer closes the area. When stopping, it gets a bounded time to finish the block it is programming;
+    // past that the session ends without it, and the writer completes on its own.
+    if (wait_writer_done(stop, &stop_deadline_ms) < 0)
+    {
+        LOG_WRN("Stopped without waiting for the flash writer");
+        s_pending_len = 0;
+        s_bulk_stats.transfers_failed++;
+        return -ECANCELED;
+    }
+    s_pending_len = 0;
+
+    uint32_t elapsed_ms = MAX((uint32_t)(k_uptime_get() - start_ms), 1U);
+    uint32_t decode_us = (uint32_t)k_cyc_to_us_floor64(s_decode_cycles);
+
+    if (rc == 0)
+    {
+        rc = s_write_rc;
+    }
+    if ((rc == 0) && (s_crc != crc))
+    {
+        LOG_ERR("CRC mismatch: expected %08x, got %08x", crc, s_crc);
+        rc = -EBADMSG;
+    }
+
+    if (rc == 0)
+    {
+        // Done: the next image starts from scratch
+        settings_delete(BULK_PROGRESS_KEY);
+        s_bulk_stats.transfers_completed++;
+        s_bulk_stats.last_kbps = (uint32_t)(((uint64_t)(size - resume) * 1000U) / (elapsed_ms * 1024U));
+        s_bulk_stats.last_wire_bytes = s_wire_bytes;
+        s_bulk_stats.last_decode_us = decode_us;
+        LOG_INF("Bulk transfer complete: %u bytes in %u ms, %u KB/s",
+                size - resume, elapsed_ms, s_bulk_stats.last_kbps);
+        if (compressed)
+        {
+            LOG_INF("Received %u bytes compressed (%u%%), decoding took %u us (%u%% of the transfer)",
+                    s_wire_bytes, (uint32_t)(((uint64_t)s_wire_bytes * 100U) / (size - resume)),
+                    decode_us, decode_us / (elapsed_ms * 10U));
+        }
+    }
+    else
+    {
+        // A corrupt image is not worth resuming
+        if (rc == -EBADMSG)
+        {
+            settings_delete(BULK_PROGRESS_KEY);
+        }
+        s_bulk_stats.transfers_failed++;
+    }
+
+    send_word(sock, rc);
+
+    // A compressed upload also reports the decoding time, so the sender can weigh it against the time saved on air
+    if (compressed && (rc == 0))
+    {
+        send_word(sock, (int32_t)decode_us);
+    }
+
+    return rc;
+#else
+    ARG_UNUSED(sock);
+    ARG_UNUSED(prefix);
+    ARG_UNUSED(prefix_len);
+    ARG_UNUSED(idle_timeout_ms);
+    ARG_UNUSED(stop);
+
+    return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Read the transfer statistics
+ */
+struct bulk_stats bulk_get_stats(void)
+{
+    return s_bulk_stats;
+}
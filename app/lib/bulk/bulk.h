@@ -0,0 +1,64 @@
+#ifndef LIB_BULK_H
+#define LIB_BULK_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+// Standard Library
+#include <cstddef>
+#include <cstdint>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// A TCP session is a bulk transfer when it starts with this magic ("BLK1", little-endian)
+#define BULK_MAGIC             0x314B4C42u
+
+// Size of the transfer header: magic, total size, CRC-32 of the image, flags
+#define BULK_HEADER_SIZE       16
+
+// Header flags: the image follows heatshrink-compressed, with the window and lookahead sizes (log2) in bits 8-11 and 12-15.
+// The size and CRC in the header are those of the decompressed image.
+#define BULK_FLAG_HEATSHRINK            0x00000001u
+#define BULK_FLAG_HS_WINDOW_SHIFT       8
+#define BULK_FLAG_HS_LOOKAHEAD_SHIFT    12
+#define BULK_FLAG_ENCODING_MASK         0x0000FF01u
+
+#define BULK_WRITER_STACK_SIZE     2048
+#define BULK_WRITER_THREAD_PRIORITY 9
+
+// Transfer statistics, accumulated since boot
+struct bulk_stats
+{
+    uint32_t transfers_completed;  // Images received with a matching CRC
+    uint32_t transfers_failed;     // CRC mismatch, flash error or bad header
+    uint32_t transfers_resumed;    // Transfers that continued from a saved offset
+    uint32_t last_kbps;            // Sustained rate of the last completed transfer (KB/s of image)
+    uint32_t last_wire_bytes;      // Bytes received for it, smaller than the image when compressed
+    uint32_t last_decode_us;       // Time spent decompressing it
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Start the flash writer thread. Safe to call more than once.
+int bulk_init(void);
+
+// Check whether the first bytes of a session are a bulk transfer header
+bool bulk_is_header(const uint8_t *data, size_t len);
+
+// Run one bulk transfer on a connected socket. 'prefix' holds the bytes already read from the socket (at least the magic);
+// any bytes after the header are the start of the image data. The session ends when the image is complete, the peer leaves,
+// it stalls for 'idle_timeout_ms', or 'stop' is set. Once 'stop' is set, it waits at most a few hundred ms for the flash writer.
+int bulk_run_session(int sock, const uint8_t *prefix, size_t prefix_len, int idle_timeout_ms, const atomic_t *stop);
+
+// Read the transfer statistics
+struct bulk_stats bulk_get_stats(void);
+
+#endif // LIB_BULK_H
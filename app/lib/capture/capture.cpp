@@ -0,0 +1,458 @@
+/******************************************************************************
+Module: CAPTURE.CPP
+
+Description: This file contains the packet capture ring. The receive and
+             send paths record a timestamp, the peer and the first bytes of
+             every packet into a fixed circular buffer, without taking a
+             lock. A TCP client connecting to the capture port receives the
+             recent packets as a pcap stream, with synthesized IPv4 and
+             UDP/TCP headers, e.g. nc <board-ip> 4322 > capture.pcap
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/socket.h>
+
+// Project specific headers
+#include "capture.h"
+#include "timesync.h"
+#include "instance.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(capture, LOG_LEVEL_INF);
+
+
+
+#if defined(CONFIG_APP_CAPTURE)
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_capture_thread_stack, CAPTURE_STACK_SIZE);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// pcap file format (little-endian), microsecond timestamps, raw IPv4 packets
+#define PCAP_MAGIC            0xA1B2C3D4u
+#define PCAP_VERSION_MAJOR    2
+#define PCAP_VERSION_MINOR    4
+#define PCAP_LINKTYPE_RAW     101
+#define PCAP_FILE_HDR_SIZE    24
+#define PCAP_RECORD_HDR_SIZE  16
+
+// Synthesized headers
+#define CAPTURE_IPV4_HDR_SIZE 20
+#define CAPTURE_UDP_HDR_SIZE  8
+#define CAPTURE_TCP_HDR_SIZE  20
+#define CAPTURE_TCP_PSH_ACK   0x18
+
+// TCP streams followed by one dump to number the bytes; extra streams share the last entry
+#define CAPTURE_MAX_STREAMS   8
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_CAPTURE_SLOTS), "The ring index must wrap together with the 32-bit counter");
+
+
+
+/******************************************************************************
+  RING
+ *****************************************************************************/
+// 'state' is 0 while a writer fills the record, else capture_state_of() its ring sequence number
+struct capture_record
+{
+    atomic_t  state;
+    int64_t   local_us;
+    uint32_t  peer_addr;    // Network order
+    uint16_t  peer_port;    // Network order
+    uint16_t  local_port;   // Host order
+    uint16_t  len;          // Original payload length
+    uint8_t   proto;
+    uint8_t   dir;
+    uint8_t   data[CONFIG_APP_CAPTURE_SNAPLEN];
+};
+
+static struct capture_record s_ring[CONFIG_APP_CAPTURE_SLOTS];
+
+// Next ring sequence number. A writer claims its record with one atomic increment.
+static atomic_t s_head;
+
+static struct capture_stats s_capture_stats;
+
+static struct k_thread s_capture_thread;
+
+// Byte offsets of the TCP streams in one dump, so the synthesized sequence numbers are consistent
+struct capture_stream
+{
+    uint32_t peer_addr;
+    uint16_t peer_port;
+    uint16_t local_port;
+    uint32_t offset[2];     // Per direction
+};
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - RECORDING
+******************************************************************************/
+/**
+ * @brief Committed state of the record with ring sequence number 'seq'. Never 0.
+ */
+static inline atomic_val_t capture_state_of(uint32_t seq)
+{
+    return (atomic_val_t)((seq & 0x7FFFFFFFu) | 0x80000000u);
+}
+
+/**
+ * @brief Record one packet into the next slot of the ring
+ */
+void capture_record(uint8_t proto, enum capture_dir dir, const struct sockaddr *peer, uint16_t local_port,
+                    const void *data, size_t len)
+{
+    uint32_t seq = (uint32_t)atomic_inc(&s_head);
+    struct capture_record *rec = &s_ring[seq & (CONFIG_APP_CAPTURE_SLOTS - 1)];
+
+    // Readers skip the record until it is committed again below. atomic_set() is a full barrier.
+    atomic_set(&rec->state, 0);
+
+    rec->local_us   = timesync_local_us();
+    rec->local_port = local_port;
+    rec->len        = (uint16_t)MIN(len, (size_t)UINT16_MAX);
+    rec->proto      = proto;
+    rec->dir        = (uint8_t)dir;
+
+    if ((peer != NULL) && (peer->sa_family == AF_INET))
+    {
+        const struct sockaddr_in *peer4 = (const struct sockaddr_in *)peer;
+        rec->peer_addr = peer4->sin_addr.s_addr;
+        rec->peer_port = peer4->sin_port;
+    }
+    else
+    {
+        rec->peer_addr = 0;
+        rec->peer_port = 0;
+    }
+
+    memcpy(rec->data, data, MIN(len, sizeof(rec->data)));
+
+    atomic_set(&rec->state, capture_state_of(seq));
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - DUMP
+******************************************************************************/
+/**
+ * @brief Copy the record with ring sequence number 'seq' if it is still intact. Slots never written are simply absent.
+ */
+static bool capture_read(uint32_t seq, struct capture_record *out)
+{
+    const struct capture_record *rec = &s_ring[seq & (CONFIG_APP_CAPTURE_SLOTS - 1)];
+    atomic_val_t expected = capture_state_of(seq);
+    atomic_val_t state = atomic_get(&rec->state);
+
+    if (state != expected)
+    {
+        s_capture_stats.skipped += (state != 0) ? 1 : 0;
+        return false;
+    }
+
+    memcpy(out, rec, sizeof(*out));
+
+    // A writer that lapped the ring in the meantime changed the state: the copy may be torn
+    if (atomic_get(&rec->state) != expected)
+    {
+        s_capture_stats.skipped++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Address of the default interface (network order), or 0 when it has none (e.g. offloaded sockets)
+ */
+static uint32_t capture_local_addr(void)
+{
+    struct net_if *iface = net_if_get_default();
+
+    if ((iface == NULL) || (iface->config.ip.ipv4 == NULL))
+    {
+        return 0;
+    }
+
+    return iface->config.ip.ipv4->unicast[0].ipv4.address.in_addr.s_addr;
+}
+
+/**
+ * @brief Find (or add) the TCP stream of a record
+ */
+static struct capture_stream *capture_find_stream(struct capture_stream *streams, size_t *num_streams,
+                                                  const struct capture_record *rec)
+{
+    for (size_t i = 0; i < *num_streams; i++)
+    {
+        if ((streams[i].peer_addr == rec->peer_addr) && (streams[i].peer_port == rec->peer_port) &&
+            (streams[i].local_port == rec->local_port))
+        {
+            return &streams[i];
+        }
+    }
+
+    struct capture_stream *stream = &streams[MIN(*num_streams, (size_t)(CAPTURE_MAX_STREAMS - 1))];
+    *num_streams = MIN(*num_streams + 1, (size_t)CAPTURE_MAX_STREAMS);
+
+    stream->peer_addr  = rec->peer_addr;
+    stream->peer_port  = rec->peer_port;
+    stream->local_port = rec->local_port;
+    stream->offset[0]  = 1;
+    stream->offset[1]  = 1;
+
+    return stream;
+}
+
+/**
+ * @brief IPv4 header checksum
+ */
+static uint16_t capture_ipv4_checksum(const uint8_t *hdr)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < CAPTURE_IPV4_HDR_SIZE; i += 2)
+    {
+        sum += sys_get_be16(&hdr[i]);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief Build the pcap record of one captured packet. Returns its size.
+ */
+static size_t capture_build_packet(const struct capture_record *rec, uint32_t local_addr, uint16_t ip_id,
+                                   struct capture_stream *stream, uint8_t *out)
+{
+    size_t l4_size   = (rec->proto == IPPROTO_TCP) ? CAPTURE_TCP_HDR_SIZE : CAPTURE_UDP_HDR_SIZE;
+    size_t snap      = MIN((size_t)rec->len, sizeof(rec->data));
+    size_t orig_size = CAPTURE_IPV4_HDR_SIZE + l4_size + rec->len;
+    size_t cap_size  = CAPTURE_IPV4_HDR_SIZE + l4_size + snap;
+    bool rx          = (rec->dir == CAPTURE_DIR_RX);
+    int64_t ts_us    = timesync_is_synced() ? timesync_local_to_utc_us(rec->local_us) : rec->local_us;
+
+    // pcap record header
+    sys_put_le32((uint32_t)(ts_us / USEC_PER_SEC), &out[0]);
+    sys_put_le32((uint32_t)(ts_us % USEC_PER_SEC), &out[4]);
+    sys_put_le32(cap_size, &out[8]);
+    sys_put_le32(orig_size, &out[12]);
+
+    // IPv4 header. Addresses are already in network order.
+    uint8_t *ip = &out[PCAP_RECORD_HDR_SIZE];
+    uint32_t src = rx ? rec->peer_addr : local_addr;
+    uint32_t dst = rx ? local_addr : rec->peer_addr;
+
+    memset(ip, 0, CAPTURE_IPV4_HDR_SIZE);
+    ip[0] = 0x45;
+    sys_put_be16((uint16_t)MIN(orig_size, (size_t)UINT16_MAX), &ip[2]);
+    sys_put_be16(ip_id, &ip[4]);
+    sys_put_be16(0x4000, &ip[6]);   // Don't fragment
+    ip[8] = 64;
+    ip[9] = rec->proto;
+    memcpy(&ip[12], &src, sizeof(src));
+    memcpy(&ip[16], &dst, sizeof(dst));
+    sys_put_be16(capture_ipv4_checksum(ip), &ip[10]);
+
+    // UDP/TCP header. Checksums are left at 0, which Wireshark does not check by default.
+    uint8_t *l4 = &ip[CAPTURE_IPV4_HDR_SIZE];
+    uint16_t local_port_be = htons(rec->local_port);
+    uint16_t src_port = rx ? rec->peer_port : local_port_be;
+    uint16_t dst_port = rx ? local_port_be : rec->peer_port;
+
+    memset(l4, 0, l4_size);
+    memcpy(&l4[0], &src_port, sizeof(src_port));
+    memcpy(&l4[2], &dst_port, sizeof(dst_port));
+
+    if (rec->proto == IPPROTO_TCP)
+    {
+        // recv()/send() chunks become consecutive segments of the stream
+        sys_put_be32(stream->offset[rec->dir], &l4[4]);
+        sys_put_be32(stream->offset[rec->dir ^ 1], &l4[8]);
+        l4[12] = (CAPTURE_TCP_HDR_SIZE / 4) << 4;
+        l4[13] = CAPTURE_TCP_PSH_ACK;
+        sys_put_be16(UINT16_MAX, &l4[14]);
+        stream->offset[rec->dir] += rec->len;
+    }
+    else
+    {
+        sys_put_be16((uint16_t)(CAPTURE_UDP_HDR_SIZE + rec->len), &l4[4]);
+    }
+
+    memcpy(&l4[l4_size], rec->data, snap);
+
+    return PCAP_RECORD_HDR_SIZE + cap_size;
+}
+
+/**
+ * @brief Send a whole buffer
+ */
+static int capture_send_all(int sock, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        int ret = send(sock, data, len, 0);
+        if (ret < 0)
+        {
+            return -errno;
+        }
+        data += ret;
+        len  -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stream the ring, oldest packet first, as a pcap file
+ */
+static void capture_dump(int sock)
+{
+    static struct capture_record rec;
+    static struct capture_stream streams[CAPTURE_MAX_STREAMS];
+    static uint8_t packet[PCAP_RECORD_HDR_SIZE + CAPTURE_IPV4_HDR_SIZE + CAPTURE_TCP_HDR_SIZE + CONFIG_APP_CAPTURE_SNAPLEN];
+    uint8_t header[PCAP_FILE_HDR_SIZE];
+    size_t num_streams = 0;
+
+    sys_put_le32(PCAP_MAGIC, &header[0]);
+    sys_put_le16(PCAP_VERSION_MAJOR, &header[4]);
+    sys_put_le16(PCAP_VERSION_MINOR, &header[6]);
+    sys_put_le32(0, &header[8]);     // Time zone
+    sys_put_le32(0, &header[12]);    // Timestamp accuracy
+    sys_put_le32(sizeof(packet) - PCAP_RECORD_HDR_SIZE, &header[16]);
+    sys_put_le32(PCAP_LINKTYPE_RAW, &header[20]);
+
+    if (capture_send_all(sock, header, sizeof(header)) < 0)
+    {
+        return;
+    }
+
+    // Snapshot of the window. Capturing goes on meanwhile; records overwritten before they are read are skipped.
+    uint32_t head = (uint32_t)atomic_get(&s_head);
+    uint32_t first = head - CONFIG_APP_CAPTURE_SLOTS;
+    uint32_t local_addr = capture_local_addr();
+    uint32_t sent = 0;
+
+    for (uint32_t seq = first; seq != head; seq++)
+    {
+        if (!capture_read(seq, &rec))
+        {
+            continue;
+        }
+
+        struct capture_stream *stream = (rec.proto == IPPROTO_TCP) ? capture_find_stream(streams, &num_streams, &rec) : NULL;
+        size_t len = capture_build_packet(&rec, local_addr, (uint16_t)seq, stream, packet);
+
+        if (capture_send_all(sock, packet, len) < 0)
+        {
+            return;
+        }
+        sent++;
+    }
+
+    s_capture_stats.dumps++;
+    LOG_INF("Capture dumped: %u packets", sent);
+}
+
+/**
+ * @brief Serve one dump per connection on the capture port
+ */
+static void capture_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        LOG_ERR("Failed to create capture socket: %d", errno);
+        return;
+    }
+
+    uint16_t port = instance_port(CONFIG_APP_CAPTURE_PORT);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = instance_bind_addr();
+
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(sock, 1) < 0))
+    {
+        LOG_ERR("Failed to listen on capture port %d: %d", port, errno);
+        close(sock);
+        return;
+    }
+
+    LOG_INF("Capture ring of %d packets (%d bytes each), dumped as pcap on port %d",
+            CONFIG_APP_CAPTURE_SLOTS, CONFIG_APP_CAPTURE_SNAPLEN, port);
+
+    while (1)
+    {
+        int client = accept(sock, NULL, NULL);
+        if (client < 0)
+        {
+            LOG_WRN("Capture accept failed: %d", errno);
+            k_msleep(1000);
+            continue;
+        }
+
+        capture_dump(client);
+        close(client);
+    }
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Start the dump server
+ */
+void capture_init(void)
+{
+    k_tid_t tid = k_thread_create(&s_capture_thread, m_capture_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_capture_thread_stack),
+                                  capture_thread, NULL, NULL, NULL,
+                                  CAPTURE_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "capture");
+}
+
+/**
+ * @brief Return a snapshot of the statistics
+ */
+struct capture_stats capture_get_stats(void)
+{
+    struct capture_stats stats = s_capture_stats;
+
+    stats.recorded = (uint32_t)atomic_get(&s_head);
+
+    return stats;
+}
+#endif // CONFIG_APP_CAPTURE
@@ -0,0 +1,61 @@
+#ifndef LIB_CAPTURE_H
+#define LIB_CAPTURE_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define CAPTURE_STACK_SIZE       2048
+#define CAPTURE_THREAD_PRIORITY  12
+
+// Packets are recorded at the socket level (payload as seen by recv()/send()). The dump synthesizes
+// IPv4 + UDP/TCP headers around them, as a pcap with LINKTYPE_RAW.
+//
+// With CONFIG_APP_CAPTURE=n the macro expands to nothing, so the receive path pays nothing.
+
+// Direction of a recorded packet
+enum capture_dir
+{
+    CAPTURE_DIR_RX = 0,
+    CAPTURE_DIR_TX = 1,
+};
+
+// Capture statistics
+struct capture_stats
+{
+    uint32_t recorded;     // Packets written into the ring since boot
+    uint32_t dumps;        // pcap dumps served
+    uint32_t skipped;      // Records skipped by a dump because they were being overwritten
+};
+
+#if defined(CONFIG_APP_CAPTURE)
+#define APP_CAPTURE(_proto, _dir, _peer, _local_port, _data, _len) \
+    capture_record((_proto), (_dir), (_peer), (_local_port), (_data), (_len))
+#else
+#define APP_CAPTURE(_proto, _dir, _peer, _local_port, _data, _len) do { } while (0)
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Start the dump server on CONFIG_APP_CAPTURE_PORT. Every client gets the ring as a pcap stream, then the connection closes.
+void capture_init(void);
+
+// Record one packet. Lock-free: callable from any thread or ISR, and never blocks.
+// 'proto' is IPPROTO_UDP or IPPROTO_TCP, 'local_port' is in host order, the payload is truncated to CONFIG_APP_CAPTURE_SNAPLEN.
+void capture_record(uint8_t proto, enum capture_dir dir, const struct sockaddr *peer, uint16_t local_port,
+                    const void *data, size_t len);
+
+// Read the statistics
+struct capture_stats capture_get_stats(void);
+
+#endif // LIB_CAPTURE_H
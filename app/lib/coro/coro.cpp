@@ -0,0 +1,438 @@
+/******************************************************************************
+Module: CORO.CPP
+
+Description: This file contains a small C++20 coroutine runtime. Coroutines
+             wait for sockets and timers through awaitables, and a single
+             reactor thread resumes them from one poll() call. Coroutine
+             frames are taken from a fixed memory slab
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+// Project specific headers
+#include "coro.h"
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_coro_thread_stack, CONFIG_APP_CORO_STACK_SIZE);
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(coro, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  FRAME POOL
+ *****************************************************************************/
+K_MEM_SLAB_DEFINE_STATIC(coro_frame_slab, CONFIG_APP_CORO_FRAME_SIZE, CONFIG_APP_CORO_MAX_FRAMES, 8);
+
+static struct coro_frame_stats s_frame_stats;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - TASK
+******************************************************************************/
+/**
+ * @brief Allocate a coroutine frame from the pool. Returning NULL makes the coroutine call return an empty task.
+ */
+void *coro_task::promise_type::operator new(size_t size) noexcept
+{
+    void *frame = NULL;
+
+    s_frame_stats.largest_frame = MAX(s_frame_stats.largest_frame, (uint32_t)size);
+
+    if ((size > CONFIG_APP_CORO_FRAME_SIZE) || (k_mem_slab_alloc(&coro_frame_slab, &frame, K_NO_WAIT) != 0))
+    {
+        s_frame_stats.alloc_failures++;
+        LOG_WRN("No coroutine frame for %u bytes (block %u, %u in use)",
+                (uint32_t)size, CONFIG_APP_CORO_FRAME_SIZE, k_mem_slab_num_used_get(&coro_frame_slab));
+        return NULL;
+    }
+
+    // Tracked here rather than by the slab, whose watermark needs CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+    s_frame_stats.frames_max_used = MAX(s_frame_stats.frames_max_used, k_mem_slab_num_used_get(&coro_frame_slab));
+
+    return frame;
+}
+
+/**
+ * @brief Return a coroutine frame to the pool
+ */
+void coro_task::promise_type::operator delete(void *ptr, size_t size) noexcept
+{
+    ARG_UNUSED(size);
+
+    k_mem_slab_free(&coro_frame_slab, ptr);
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - AWAITABLES
+******************************************************************************/
+/**
+ * @brief Prepare a waiter. A negative timeout waits forever.
+ */
+coro_wait::coro_wait(CORO_REACTOR *reactor, int fd, short events, int timeout_ms)
+    : m_reactor(reactor), m_registered(false)
+{
+    m_waiter.fd          = fd;
+    m_waiter.events      = events;
+    m_waiter.revents     = 0;
+    m_waiter.deadline_ms = (timeout_ms < 0) ? CORO_NO_DEADLINE : (k_uptime_get() + timeout_ms);
+}
+
+/**
+ * @brief Hand the waiter to the reactor. If it cannot take it, the coroutine continues immediately.
+ */
+bool coro_wait::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    m_waiter.handle = handle;
+    m_registered = m_reactor->add_waiter(&m_waiter);
+
+    return m_registered;
+}
+
+/**
+ * @brief 0 when the socket is ready, -EAGAIN when the deadline passed first
+ */
+int coro_wait::await_resume() noexcept
+{
+    if (!m_registered)
+    {
+        return -ENOMEM;
+    }
+
+    return (m_waiter.revents != 0) ? 0 : -EAGAIN;
+}
+
+/**
+ * @brief The listening socket is readable: accept the pending client
+ */
+int coro_accept::await_resume() noexcept
+{
+    int ret = coro_wait::await_resume();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int client = accept(m_waiter.fd, NULL, NULL);
+
+    return (client < 0) ? -errno : client;
+}
+
+/**
+ * @brief The socket is readable (or timed out): read what is there without blocking
+ */
+int coro_recv::await_resume() noexcept
+{
+    int ret = coro_wait::await_resume();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = recv(m_waiter.fd, m_buf, m_len, MSG_DONTWAIT);
+
+    return (ret < 0) ? -errno : ret;
+}
+
+/**
+ * @brief The socket is writable (or timed out): queue as much as fits without blocking
+ */
+int coro_send::await_resume() noexcept
+{
+    int ret = coro_wait::await_resume();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = send(m_waiter.fd, m_buf, m_len, MSG_DONTWAIT);
+
+    return (ret < 0) ? -errno : ret;
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - REACTOR
+******************************************************************************/
+/**
+ * @brief Constructor for the reactor class
+ */
+CORO_REACTOR::CORO_REACTOR()
+    : m_started(false), m_entry(NULL), m_entry_arg(NULL), m_num_waiters(0), m_ready_head(0), m_ready_count(0)
+{
+    atomic_set(&m_stop_requested, 0);
+}
+
+/**
+ * @brief Destructor: stop the thread, then destroy the coroutines that are still suspended
+ * Destroying a suspended coroutine runs the destructors of its locals, so sockets held by RAII guards get closed.
+ */
+CORO_REACTOR::~CORO_REACTOR()
+{
+    if (!m_started)
+    {
+        return;
+    }
+
+    atomic_set(&m_stop_requested, 1);
+
+    int ret = k_thread_join(&m_thread_data, K_MSEC(2 * CONFIG_APP_CORO_TICK_MS + 500));
+    if (ret)
+    {
+        LOG_WRN("Failed to join the coroutine reactor: %d, aborting it", ret);
+        k_thread_abort(&m_thread_data);
+    }
+
+    while (m_num_waiters > 0)
+    {
+        coro_waiter *waiter = m_waiters[--m_num_waiters];
+        waiter->handle.destroy();
+    }
+    while (m_ready_count > 0)
+    {
+        m_ready[m_ready_head].destroy();
+        m_ready_head = (m_ready_head + 1) % ARRAY_SIZE(m_ready);
+        m_ready_count--;
+    }
+
+    LOG_INF("Coroutine reactor stopped.");
+}
+
+/**
+ * @brief Create the reactor thread and start it
+ */
+void CORO_REACTOR::start(void (*entry)(CORO_REACTOR *reactor, void *arg), void *arg)
+{
+    m_entry = entry;
+    m_entry_arg = arg;
+
+    k_tid_t reactor_thread = k_thread_create(&m_thread_data, m_coro_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_coro_thread_stack),
+                                  CORO_REACTOR::static_run_reactor,
+                                  this, NULL, NULL,
+                                  CORO_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_name_set(reactor_thread, "coro_reactor");
+    m_started = true;
+}
+
+/**
+ * @brief Read how much of the reactor stack has been used so far
+ */
+int CORO_REACTOR::get_stack_used(size_t *used)
+{
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    size_t unused;
+
+    int ret = k_thread_stack_space_get(&m_thread_data, &unused);
+    if (ret == 0)
+    {
+        *used = K_THREAD_STACK_SIZEOF(m_coro_thread_stack) - unused;
+    }
+
+    return ret;
+#else
+    ARG_UNUSED(used);
+
+    return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief This function is a static wrapper for the actual function to run the reactor thread
+ */
+void CORO_REACTOR::static_run_reactor(void *p1, void *p2, void *p3)
+{
+    CORO_REACTOR* self = static_cast<CORO_REACTOR*>(p1);
+
+    self->run_reactor();
+}
+
+/**
+ * @brief Schedule a new coroutine
+ */
+bool CORO_REACTOR::spawn(coro_task task)
+{
+    if (!task.handle)
+    {
+        return false;
+    }
+
+    if (!push_ready(task.handle))
+    {
+        task.handle.destroy();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Register a suspended coroutine
+ */
+bool CORO_REACTOR::add_waiter(coro_waiter *waiter)
+{
+    if (m_num_waiters >= ARRAY_SIZE(m_waiters))
+    {
+        return false;
+    }
+
+    m_waiters[m_num_waiters++] = waiter;
+
+    return true;
+}
+
+/**
+ * @brief Unregister a waiter (order does not matter, so the last one fills the hole)
+ */
+void CORO_REACTOR::remove_waiter(coro_waiter *waiter)
+{
+    for (size_t i = 0; i < m_num_waiters; i++)
+    {
+        if (m_waiters[i] == waiter)
+        {
+            m_waiters[i] = m_waiters[--m_num_waiters];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Append a coroutine to the ready ring
+ */
+bool CORO_REACTOR::push_ready(std::coroutine_handle<> handle)
+{
+    if (m_ready_count >= ARRAY_SIZE(m_ready))
+    {
+        return false;
+    }
+
+    m_ready[(m_ready_head + m_ready_count) % ARRAY_SIZE(m_ready)] = handle;
+    m_ready_count++;
+
+    return true;
+}
+
+/**
+ * @brief Sleep in one poll() over every waiting socket until something is ready, a deadline passes or a tick elapses
+ */
+void CORO_REACTOR::poll_waiters()
+{
+    struct pollfd fds[CONFIG_APP_CORO_MAX_FRAMES];
+    coro_waiter *polled[CONFIG_APP_CORO_MAX_FRAMES];
+    int nfds = 0;
+
+    // Wake up at least once per tick to notice a stop request, earlier if a deadline is due
+    int64_t now = k_uptime_get();
+    int64_t timeout_ms = CONFIG_APP_CORO_TICK_MS;
+
+    for (size_t i = 0; i < m_num_waiters; i++)
+    {
+        coro_waiter *waiter = m_waiters[i];
+
+        if (waiter->deadline_ms != CORO_NO_DEADLINE)
+        {
+            timeout_ms = MIN(timeout_ms, MAX(waiter->deadline_ms - now, (int64_t)0));
+        }
+
+        if (waiter->fd >= 0)
+        {
+            fds[nfds].fd      = waiter->fd;
+            fds[nfds].events  = waiter->events;
+            fds[nfds].revents = 0;
+            polled[nfds]      = waiter;
+            nfds++;
+        }
+    }
+
+    if (nfds > 0)
+    {
+        if (poll(fds, nfds, (int)timeout_ms) < 0)
+        {
+            LOG_ERR("Reactor poll failed: %d", errno);
+            k_msleep(CONFIG_APP_CORO_TICK_MS);
+        }
+    }
+    else
+    {
+        k_msleep((int32_t)timeout_ms);
+    }
+
+    for (int i = 0; i < nfds; i++)
+    {
+        polled[i]->revents = fds[i].revents;
+    }
+
+    // Move every waiter whose socket is ready, or whose deadline passed, to the ready ring
+    now = k_uptime_get();
+    size_t i = 0;
+    while (i < m_num_waiters)
+    {
+        coro_waiter *waiter = m_waiters[i];
+
+        if ((waiter->revents != 0) || (waiter->deadline_ms <= now))
+        {
+            m_waiters[i] = m_waiters[--m_num_waiters];
+            push_ready(waiter->handle);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief This is the actual function that will run the reactor thread logic
+ */
+void CORO_REACTOR::run_reactor()
+{
+    // Let the owner spawn the first coroutines on this thread
+    m_entry(this, m_entry_arg);
+
+    while (!atomic_get(&m_stop_requested))
+    {
+        // Run every ready coroutine until it suspends again or finishes
+        while (m_ready_count > 0)
+        {
+            std::coroutine_handle<> handle = m_ready[m_ready_head];
+            m_ready_head = (m_ready_head + 1) % ARRAY_SIZE(m_ready);
+            m_ready_count--;
+
+            handle.resume();
+        }
+
+        poll_waiters();
+    }
+}
+
+/**
+ * @brief Read the frame pool usage
+ */
+struct coro_frame_stats CORO_REACTOR::get_frame_stats()
+{
+    struct coro_frame_stats stats = s_frame_stats;
+
+    stats.block_size      = CONFIG_APP_CORO_FRAME_SIZE;
+    stats.frames_in_use   = k_mem_slab_num_used_get(&coro_frame_slab);
+
+    return stats;
+}
@@ -0,0 +1,203 @@
+#ifndef LIB_CORO_H
+#define LIB_CORO_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/posix/poll.h>
+
+// Standard Library
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define CORO_THREAD_PRIORITY  8
+
+// Deadline value of a waiter without timeout
+#define CORO_NO_DEADLINE      INT64_MAX
+
+// Coroutine frame pool usage
+struct coro_frame_stats
+{
+    uint32_t block_size;        // Size of one frame block (CONFIG_APP_CORO_FRAME_SIZE)
+    uint32_t frames_in_use;
+    uint32_t frames_max_used;
+    uint32_t largest_frame;     // Largest frame the compiler asked for
+    uint32_t alloc_failures;    // Coroutines that could not start: pool empty or frame too large
+};
+
+class CORO_REACTOR;
+
+
+
+/******************************************************************************
+TASK
+******************************************************************************/
+// A detached coroutine. It starts suspended, runs once handed to CORO_REACTOR::spawn(),
+// and frees its frame when it returns. Frames come from a fixed pool, never from the heap.
+struct coro_task
+{
+    struct promise_type
+    {
+        coro_task get_return_object() noexcept
+        {
+            return coro_task{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        // Called instead of get_return_object() when the frame pool is exhausted
+        static coro_task get_return_object_on_allocation_failure() noexcept
+        {
+            return coro_task{ nullptr };
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { k_oops(); }
+
+        // Frame allocation from the fixed pool
+        static void *operator new(size_t size) noexcept;
+        static void operator delete(void *ptr, size_t size) noexcept;
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+
+
+/******************************************************************************
+AWAITABLES
+******************************************************************************/
+// One suspended coroutine waiting for a socket event and/or a deadline
+struct coro_waiter
+{
+    int                     fd;          // -1 for a pure timer
+    short                   events;      // POLLIN / POLLOUT
+    short                   revents;     // Filled in by the reactor
+    int64_t                 deadline_ms; // Uptime, or CORO_NO_DEADLINE
+    std::coroutine_handle<> handle;
+};
+
+// Suspend until the socket is ready or the timeout expires. await_resume() returns 0, -EAGAIN on timeout, or -ENOMEM.
+class coro_wait
+{
+public:
+    coro_wait(CORO_REACTOR *reactor, int fd, short events, int timeout_ms);
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept;
+    int  await_resume() noexcept;
+
+protected:
+    CORO_REACTOR *m_reactor;
+    coro_waiter   m_waiter;
+    bool          m_registered;
+};
+
+// co_await coro_sleep(...) suspends for a number of milliseconds
+class coro_sleep : public coro_wait
+{
+public:
+    coro_sleep(CORO_REACTOR *reactor, int timeout_ms) : coro_wait(reactor, -1, 0, timeout_ms) {}
+    int await_resume() noexcept { return 0; }
+};
+
+// co_await coro_accept(...) returns the new client socket or a negative errno
+class coro_accept : public coro_wait
+{
+public:
+    coro_accept(CORO_REACTOR *reactor, int fd) : coro_wait(reactor, fd, POLLIN, -1) {}
+    int await_resume() noexcept;
+};
+
+// co_await coro_recv(...) returns the number of bytes, 0 when the peer closed, -EAGAIN on timeout, or a negative errno
+class coro_recv : public coro_wait
+{
+public:
+    coro_recv(CORO_REACTOR *reactor, int fd, void *buf, size_t len, int timeout_ms)
+        : coro_wait(reactor, fd, POLLIN, timeout_ms), m_buf(buf), m_len(len) {}
+    int await_resume() noexcept;
+
+private:
+    void   *m_buf;
+    size_t  m_len;
+};
+
+// co_await coro_send(...) returns the number of bytes queued (possibly fewer than 'len'), -EAGAIN on timeout, or a negative errno
+class coro_send : public coro_wait
+{
+public:
+    coro_send(CORO_REACTOR *reactor, int fd, const void *buf, size_t len, int timeout_ms)
+        : coro_wait(reactor, fd, POLLOUT, timeout_ms), m_buf(buf), m_len(len) {}
+    int await_resume() noexcept;
+
+private:
+    const void *m_buf;
+    size_t      m_len;
+};
+
+
+
+/******************************************************************************
+REACTOR CLASS
+******************************************************************************/
+// Runs every coroutine on one thread. The thread sleeps in a single poll() over all waiting sockets.
+class CORO_REACTOR
+{
+public:
+    // Constructor
+    CORO_REACTOR();
+
+    // Destructor, which stops the thread and destroys the coroutines still suspended
+    ~CORO_REACTOR();
+
+    // Start the reactor thread. 'entry' runs on that thread and spawns the first coroutines.
+    void start(void (*entry)(CORO_REACTOR *reactor, void *arg), void *arg);
+
+    // Schedule a coroutine. Must be called from the reactor thread. Returns false if the task could not be created.
+    bool spawn(coro_task task);
+
+    // Register / unregister a waiter. Used by the awaitables.
+    bool add_waiter(coro_waiter *waiter);
+    void remove_waiter(coro_waiter *waiter);
+
+    // Read the frame pool usage
+    static struct coro_frame_stats get_frame_stats();
+
+    // Measured high-water mark of the reactor stack. -ENOTSUP without CONFIG_INIT_STACKS and CONFIG_THREAD_STACK_INFO.
+    int get_stack_used(size_t *used);
+
+private:
+    // Thread
+    struct k_thread m_thread_data;
+    atomic_t m_stop_requested;
+    bool m_started;
+    void (*m_entry)(CORO_REACTOR *reactor, void *arg);
+    void *m_entry_arg;
+
+    // Coroutines waiting for a socket or a deadline. Every suspended coroutine owns a frame, so the pool size bounds both lists.
+    coro_waiter *m_waiters[CONFIG_APP_CORO_MAX_FRAMES];
+    size_t m_num_waiters;
+
+    // Coroutines ready to run (ring buffer)
+    std::coroutine_handle<> m_ready[CONFIG_APP_CORO_MAX_FRAMES];
+    size_t m_ready_head;
+    size_t m_ready_count;
+
+    // Functions to run the reactor
+    void run_reactor();
+    bool push_ready(std::coroutine_handle<> handle);
+    void poll_waiters();
+
+    // Static function for the thread entry, which in turns call the actual "run_reactor"
+    static void static_run_reactor(void *p1, void *p2, void *p3);
+};
+
+#endif // LIB_CORO_H
@@ -0,0 +1,316 @@
+/******************************************************************************
+Module: DDP.CPP
+
+Description: This file contains a UDP pixel-streaming server speaking the
+             Distributed Display Protocol. Packets are copied into the back
+             buffer of the strip while the previous frame shifts out, and the
+             frame is shown when a packet carries the PUSH flag
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+
+// Project specific headers
+#include "ddp.h"
+#include "dhcp_cache.h"
+#include "latency.h"
+#include "app_trace.h"
+#include "instance.h"
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_ddp_thread_stack, DDP_STACK_SIZE);
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(ddp, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Header: flags, sequence, data type, destination id, offset (BE32), length (BE16) [, timecode (BE32)]
+#define DDP_HEADER_SIZE           10
+#define DDP_TIMECODE_SIZE         4
+
+#define DDP_FLAGS_VERSION_MASK    0xC0
+#define DDP_FLAGS_VERSION_1       0x40
+#define DDP_FLAGS_TIMECODE        0x10
+#define DDP_FLAGS_QUERY           0x02
+#define DDP_FLAGS_PUSH            0x01
+
+#define DDP_SEQ_MASK              0x0F
+#define DDP_ID_DISPLAY            1
+
+// Largest packet: 480 RGB pixels plus the longest header
+#define DDP_MAX_PACKET_SIZE       (DDP_HEADER_SIZE + DDP_TIMECODE_SIZE + 1440)
+
+// Period of the frame-rate report
+#define DDP_REPORT_INTERVAL_MS    5000
+
+// recvfrom() returns at least this often, so the thread notices a stop request
+#define DDP_RCV_TIMEOUT_MS        250
+
+// How long the destructor waits for the server thread
+#define DDP_THREAD_JOIN_TIMEOUT   K_MSEC(2 * DDP_RCV_TIMEOUT_MS + 500)
+
+#define DDP_BYTES_PER_PIXEL       3
+
+
+
+/******************************************************************************
+  RECEIVE BUFFER
+ *****************************************************************************/
+// Kept off the thread stack: one full-size packet
+static uint8_t s_ddp_rx_buffer[DDP_MAX_PACKET_SIZE];
+
+// Sequence number of the received messages, used as the packet id in the trace
+static uint32_t s_ddp_pkt_seq;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Constructor for the DDP class
+ */
+DDP_SERVER::DDP_SERVER(uint16_t port, RGB_LED_STRIP_WS2812* strip, SINGLE_RGB_LED_WS2812* rgb_led)
+    : m_sock(-1), m_port(port), m_strip(strip), m_led_indicator(rgb_led),
+      m_frame_open(false), m_frame_start(0), m_last_seq(0), m_stats{}
+{
+    atomic_set(&m_stop_requested, 0);
+}
+
+/**
+ * @brief Destructor for the DDP class
+ */
+DDP_SERVER::~DDP_SERVER()
+{
+    // Ask the server thread to stop. It notices the request within one receive timeout,
+    // closes its socket and returns, so the join below is bounded.
+    atomic_set(&m_stop_requested, 1);
+
+    int ret = k_thread_join(&m_thread_data, DDP_THREAD_JOIN_TIMEOUT);
+    if (ret)
+    {
+        LOG_WRN("Failed to join DDP thread: %d, aborting it", ret);
+        k_thread_abort(&m_thread_data);
+    }
+
+    // Close the socket if the thread could not do it
+    if (m_sock >= 0)
+    {
+        close(m_sock);
+        m_sock = -1;
+    }
+
+    LOG_INF("DDP object is deleted and socket is closed.");
+}
+
+/**
+ * @brief This function create the DDP thread and start it
+ */
+void DDP_SERVER::start_ddp_server()
+{
+    k_tid_t ddp_server_thread = k_thread_create(&m_thread_data, m_ddp_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_ddp_thread_stack),
+                                  DDP_SERVER::static_run_ddp_server,
+                                  this, NULL, NULL,
+                                  DDP_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_name_set(ddp_server_thread, "ddp_server");
+}
+
+/**
+ * @brief This function is a static wrapper for the actual function to run the ddp thread
+ */
+void DDP_SERVER::static_run_ddp_server(void *p1, void *p2, void *p3)
+{
+    DDP_SERVER* self = static_cast<DDP_SERVER*>(p1);
+
+    self->run_ddp_server();
+}
+
+/**
+ * @brief This is the actual function that will run the DDP thread logic
+ */
+void DDP_SERVER::run_ddp_server()
+{
+    struct sockaddr_in bind_addr;
+
+    m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_sock < 0)
+    {
+        LOG_ERR("Failed to create socket: %d", errno);
+        return;
+    }
+
+    // The pixel stream is the bulkiest traffic on the device: keep it away from the control lane
+    net_lane_attach_socket(m_sock, NET_LANE_BULK);
+
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_addr.s_addr = instance_bind_addr();
+    bind_addr.sin_port = htons(m_port);
+    if (bind(m_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0)
+    {
+        LOG_ERR("Failed to bind socket: %d", errno);
+        close(m_sock);
+        m_sock = -1;
+        return;
+    }
+
+    // Wake up regularly even if the stream stops, to report and to check for a stop request
+    struct timeval rcv_timeout = {
+        .tv_sec  = DDP_RCV_TIMEOUT_MS / 1000,
+        .tv_usec = (DDP_RCV_TIMEOUT_MS % 1000) * 1000,
+    };
+    if (setsockopt(m_sock, SOL_SOCKET, SO_RCVTIMEO, &rcv_timeout, sizeof(rcv_timeout)) < 0)
+    {
+        LOG_WRN("Failed to set SO_RCVTIMEO: %d", errno);
+    }
+
+    LOG_INF("Listening DDP pixel data on the port %d (%u pixels)", m_port, (uint32_t)m_strip->num_pixels());
+
+    int64_t last_report_ms = k_uptime_get();
+    uint32_t last_report_frames = 0;
+
+    while (!atomic_get(&m_stop_requested))
+    {
+        int recv_len = recvfrom(m_sock, s_ddp_rx_buffer, sizeof(s_ddp_rx_buffer), 0, NULL, NULL);
+        uint32_t rx_time = latency_now();
+
+        if (recv_len > 0)
+        {
+            s_ddp_pkt_seq++;
+            APP_TRACE(APP_TRACE_PKT_RX, APP_TRACE_PKT_ID(APP_TRACE_SRC_UDP, s_ddp_pkt_seq), recv_len);
+            rejoin_timing_mark_first_packet();
+
+            handle_packet(s_ddp_rx_buffer, recv_len, rx_time);
+
+            APP_TRACE(APP_TRACE_PKT_DONE, APP_TRACE_PKT_ID(APP_TRACE_SRC_UDP, s_ddp_pkt_seq), 0);
+        }
+        else if ((recv_len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+        {
+            LOG_WRN("recvfrom failed: %d", errno);
+            m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::RED);
+            break;
+        }
+
+        int64_t now_ms = k_uptime_get();
+        if (now_ms - last_report_ms >= DDP_REPORT_INTERVAL_MS)
+        {
+            uint32_t frames = m_strip->get_stats().frames_presented;
+            report((uint32_t)(now_ms - last_report_ms), frames - last_report_frames);
+            last_report_ms = now_ms;
+            last_report_frames = frames;
+        }
+    }
+
+    close(m_sock);
+    m_sock = -1;
+}
+
+/**
+ * @brief Copy the pixel data of one packet into the back buffer and present it on PUSH
+ */
+void DDP_SERVER::handle_packet(const uint8_t *packet, int len, uint32_t rx_time)
+{
+    m_stats.packets++;
+
+    if (len < DDP_HEADER_SIZE)
+    {
+        m_stats.bad_packets++;
+        return;
+    }
+
+    uint8_t flags = packet[0];
+    uint8_t seq   = packet[1] & DDP_SEQ_MASK;
+    uint8_t id    = packet[3];
+    uint32_t offset = sys_get_be32(&packet[4]);
+    uint16_t data_len = sys_get_be16(&packet[8]);
+    int header_len = (flags & DDP_FLAGS_TIMECODE) ? (DDP_HEADER_SIZE + DDP_TIMECODE_SIZE) : DDP_HEADER_SIZE;
+
+    // Only version 1 data for the default output. The data type byte is not checked: every sender uses 8-bit RGB.
+    if (((flags & DDP_FLAGS_VERSION_MASK) != DDP_FLAGS_VERSION_1) || (flags & DDP_FLAGS_QUERY) ||
+        (id != DDP_ID_DISPLAY) || (header_len + data_len > len))
+    {
+        m_stats.bad_packets++;
+        return;
+    }
+
+    // Sequence numbers run 1..15; 0 means the sender does not number its packets
+    if ((seq != 0) && (m_last_seq != 0))
+    {
+        uint8_t expected = (m_last_seq % 15) + 1;
+        m_stats.lost_packets += (seq + 15 - expected) % 15;
+    }
+    m_last_seq = seq;
+
+    if (!m_frame_open)
+    {
+        m_frame_open = true;
+        m_frame_start = rx_time;
+    }
+
+    // Copy the channels. Offsets are in bytes, so a packet may start in the middle of a pixel.
+    struct led_rgb *frame = m_strip->back_buffer();
+    size_t frame_bytes = m_strip->num_pixels() * DDP_BYTES_PER_PIXEL;
+    const uint8_t *data = &packet[header_len];
+
+    if (offset < frame_bytes)
+    {
+        size_t count = MIN((size_t)data_len, frame_bytes - offset);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t byte = offset + i;
+            struct led_rgb *pixel = &frame[byte / DDP_BYTES_PER_PIXEL];
+
+            switch (byte % DDP_BYTES_PER_PIXEL)
+            {
+            case 0:  pixel->r = data[i]; break;
+            case 1:  pixel->g = data[i]; break;
+            default: pixel->b = data[i]; break;
+            }
+        }
+    }
+
+    if (flags & DDP_FLAGS_PUSH)
+    {
+        m_stats.frames_pushed++;
+        m_frame_open = false;
+
+        // A dropped frame is not lost: its pixels stay in the back buffer and the next packets build on them
+        m_strip->present(m_frame_start);
+    }
+}
+
+/**
+ * @brief Log the frame rate over the last interval, the counters and the strip latency histograms
+ */
+void DDP_SERVER::report(uint32_t elapsed_ms, uint32_t frames)
+{
+    if (m_stats.packets == 0)
+    {
+        return;
+    }
+
+    LOG_INF("DDP: %u.%u fps | %u packets, %u bad, %u lost | %u frames pushed",
+            frames * 1000 / elapsed_ms, (frames * 10000 / elapsed_ms) % 10,
+            m_stats.packets, m_stats.bad_packets, m_stats.lost_packets, m_stats.frames_pushed);
+
+    m_strip->report();
+}
@@ -0,0 +1,92 @@
+#ifndef LIB_DDP_H
+#define LIB_DDP_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+// Project specific headers
+#include "led.h"
+#include "led_strip.h"
+#include "netpool.h"
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define DDP_STACK_SIZE       2048
+#define DDP_THREAD_PRIORITY  8
+
+// Standard DDP port
+#define DDP_DEFAULT_PORT     4048
+
+
+/******************************************************************************
+DDP SERVER STATISTICS
+******************************************************************************/
+struct ddp_server_stats
+{
+    uint32_t packets;          // DDP packets received
+    uint32_t bad_packets;      // Packets too short, of another version, or for another output
+    uint32_t lost_packets;     // Gaps in the DDP sequence numbers
+    uint32_t frames_pushed;    // Packets with the PUSH flag, i.e. complete frames
+};
+
+
+/******************************************************************************
+DDP SERVER CLASS
+******************************************************************************/
+// Receives pixel data in the Distributed Display Protocol (as sent by xLights, WLED, ...)
+// and shows every pushed frame on the strip
+class DDP_SERVER
+{
+public:
+    // Constructor
+    DDP_SERVER(uint16_t port, RGB_LED_STRIP_WS2812* strip, SINGLE_RGB_LED_WS2812* rgb_led);
+
+    // Destructor
+    ~DDP_SERVER();
+
+    // Start the DDP server
+    void start_ddp_server();
+
+    // Read the statistics
+    struct ddp_server_stats get_stats() const { return m_stats; }
+
+private:
+
+    // Socket file descriptor and port to listen on
+    int m_sock;
+    uint16_t m_port;
+
+    // Thread, and the flag that asks it to stop
+    struct k_thread m_thread_data;
+    atomic_t m_stop_requested;
+
+    // Strip the frames are shown on, and LED indicator
+    RGB_LED_STRIP_WS2812* m_strip;
+    SINGLE_RGB_LED_WS2812* m_led_indicator;
+
+    // Frame in progress
+    bool m_frame_open;
+    uint32_t m_frame_start;
+    uint8_t m_last_seq;
+
+    struct ddp_server_stats m_stats;
+
+    // Functions to start running the ddp server
+    void run_ddp_server();
+
+    // Copy one packet into the back buffer, and present it on PUSH
+    void handle_packet(const uint8_t *packet, int len, uint32_t rx_time);
+
+    // Log the frame rate and the counters
+    void report(uint32_t elapsed_ms, uint32_t frames);
+
+    // Static function for the thread entry, which in turns call the actual "run_ddp_server"
+    static void static_run_ddp_server(void *p1, void *p2, void *p3);
+};
+
+#endif // LIB_DDP_H
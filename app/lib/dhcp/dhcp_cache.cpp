@@ -0,0 +1,472 @@
+/******************************************************************************
+Module: DHCP_CACHE.CPP
+
+Description: This file contains the DHCPv4 lease cache. The last lease is kept
+             in the settings subsystem, so after a reconnect (or a reboot) the
+             device can serve on its previous address immediately while the
+             regular DHCP exchange confirms it in the background
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_event.h>
+
+// Project specific headers
+#include "dhcp_cache.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(dhcp_cache, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+#define LEASE_SETTINGS_ROOT  "lease"
+#define LEASE_SETTINGS_KEY   "last"
+
+#if defined(CONFIG_NET_IPV4_ACD)
+#define LEASE_EVENT_MASK (NET_EVENT_IPV4_DHCP_BOUND | NET_EVENT_IPV4_ACD_CONFLICT)
+#else
+#define LEASE_EVENT_MASK (NET_EVENT_IPV4_DHCP_BOUND)
+#endif
+
+
+
+/******************************************************************************
+  STATE
+ *****************************************************************************/
+// Lease loaded from (and saved to) settings
+static struct dhcp_lease s_cached;
+static bool s_cache_valid;
+
+// The cached lease was loaded at boot and DHCP has not bound since. Its age is unknown: the device
+// may have been bound, or powered off, for any time before the reboot.
+static bool s_cache_from_boot;
+
+// Address configured by lease_cache_apply(), removed again if DHCP hands out a different one
+// or the cached lifetime runs out first. Cleared by whichever thread drops the address.
+static struct net_if *s_iface;
+static struct in_addr s_applied;
+static atomic_t s_applied_valid;
+
+// Removes the cached address once its remaining lifetime is over without DHCP confirming it
+static struct k_work_delayable s_expire_work;
+
+// Writes the lease to flash on the system workqueue, away from the net_mgmt and Wi-Fi threads
+static struct k_work s_save_work;
+static struct k_spinlock s_cached_lock;
+
+// Uptime when DHCP last bound, used to compute the remaining lifetime
+static int64_t s_bound_ms;
+static bool s_bound;
+
+// DHCP event callback
+static struct net_mgmt_event_callback s_lease_cb;
+
+// Settings handler
+static struct settings_handler s_lease_settings;
+
+// Rejoin timing
+static int64_t s_link_up_ms;
+static atomic_t s_first_packet_pending;
+static bool s_fast_path;
+static struct rejoin_timing_stats s_rejoin_stats;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Settings loader for the "lease/last" key
+ */
+static int lease_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    const char *next;
+
+    if (settings_name_steq(name, LEASE_SETTINGS_KEY, &next) && !next)
+    {
+        // A layout change between firmware versions simply invalidates the cache
+        if (len != sizeof(s_cached))
+        {
+            return -EINVAL;
+        }
+
+        int rc = read_cb(cb_arg, &s_cached, sizeof(s_cached));
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        s_cache_valid = true;
+        s_cache_from_boot = true;
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+/**
+ * @brief Work handler that persists a snapshot of the current lease, or deletes it once invalidated
+ */
+static void lease_save_work_handler(struct k_work *work)
+{
+    struct dhcp_lease lease;
+
+    if (!s_cache_valid)
+    {
+        settings_delete(LEASE_SETTINGS_ROOT "/" LEASE_SETTINGS_KEY);
+        return;
+    }
+
+    K_SPINLOCK(&s_cached_lock)
+    {
+        lease = s_cached;
+    }
+
+    int rc = settings_save_one(LEASE_SETTINGS_ROOT "/" LEASE_SETTINGS_KEY, &lease, sizeof(lease));
+    if (rc)
+    {
+        LOG_WRN("Failed to save the DHCP lease: %d", rc);
+    }
+}
+
+/**
+ * @brief Persist the current lease together with its remaining lifetime, in the background
+ */
+static void lease_cache_save(void)
+{
+    k_work_submit(&s_save_work);
+}
+
+/**
+ * @brief Remove the address configured from the cache, if it is still there
+ */
+static void lease_cache_drop_applied(const char *reason)
+{
+    char buf[NET_IPV4_ADDR_LEN];
+
+    if (!atomic_cas(&s_applied_valid, 1, 0))
+    {
+        return;
+    }
+
+    k_work_cancel_delayable(&s_expire_work);
+    net_if_ipv4_addr_rm(s_iface, &s_applied);
+
+    LOG_INF("Dropped cached address %s: %s", net_addr_ntop(AF_INET, &s_applied, buf, sizeof(buf)), reason);
+}
+
+/**
+ * @brief The cached lifetime ran out and DHCP never confirmed the address (no server, or it refused us)
+ */
+static void lease_expire_work_handler(struct k_work *work)
+{
+    lease_cache_drop_applied("lease expired before DHCP confirmed it");
+}
+
+/**
+ * @brief Remember a freshly bound lease and drop the cached address if the server handed out another one
+ */
+static void lease_cache_on_bound(struct net_if *iface)
+{
+    struct in_addr address = iface->config.dhcpv4.requested_ip;
+    char buf[NET_IPV4_ADDR_LEN];
+
+    if (atomic_get(&s_applied_valid) && net_ipv4_addr_cmp(&s_applied, &address))
+    {
+        // Same address: the DHCP client found our manual entry and left it as it was.
+        // Hand it over, so it follows the lease from now on instead of living forever.
+        struct net_if_addr *ifaddr = net_if_ipv4_addr_lookup(&address, &iface);
+        if (ifaddr != NULL)
+        {
+            ifaddr->addr_type   = NET_ADDR_DHCP;
+            ifaddr->is_infinite = false;
+        }
+        atomic_set(&s_applied_valid, 0);
+        k_work_cancel_delayable(&s_expire_work);
+    }
+    else
+    {
+        // The server moved us: the cached address must go, or we would answer on both
+        lease_cache_drop_applied("DHCP assigned a different address");
+    }
+
+    struct dhcp_lease lease;
+    lease.address        = address;
+    lease.netmask        = net_if_ipv4_get_netmask_by_addr(iface, &address);
+    lease.gateway        = iface->config.ip.ipv4->gw;
+    lease.lease_time_sec = iface->config.dhcpv4.lease_time;
+    lease.remaining_sec  = iface->config.dhcpv4.lease_time;
+
+    K_SPINLOCK(&s_cached_lock)
+    {
+        s_cached = lease;
+    }
+    s_cache_valid = true;
+    s_cache_from_boot = false;
+
+    s_bound_ms = k_uptime_get();
+    s_bound = true;
+
+    LOG_INF("DHCP bound to %s for %u s, lease cached",
+            net_addr_ntop(AF_INET, &address, buf, sizeof(buf)), s_cached.lease_time_sec);
+
+    lease_cache_save();
+}
+
+/**
+ * @brief net_mgmt callback for DHCP and address-conflict events
+ */
+static void lease_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface)
+{
+    switch (mgmt_event)
+    {
+        case NET_EVENT_IPV4_DHCP_BOUND:
+        {
+            lease_cache_on_bound(iface);
+            break;
+        }
+
+#if defined(CONFIG_NET_IPV4_ACD)
+        // Somebody else answers ARP for the cached address: give it up and wait for DHCP
+        case NET_EVENT_IPV4_ACD_CONFLICT:
+        {
+            if (atomic_get(&s_applied_valid))
+            {
+                LOG_WRN("Address conflict on the cached address, waiting for DHCP");
+                lease_cache_drop_applied("address conflict");
+                lease_cache_invalidate();
+            }
+            break;
+        }
+#endif
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Load the cached lease and start following DHCP on this interface
+ */
+int lease_cache_init(struct net_if *iface)
+{
+    s_iface = iface;
+    k_work_init(&s_save_work, lease_save_work_handler);
+    k_work_init_delayable(&s_expire_work, lease_expire_work_handler);
+
+    // Follow DHCP so every new lease is cached
+    net_mgmt_init_event_callback(&s_lease_cb, lease_event_handler, LEASE_EVENT_MASK);
+    net_mgmt_add_event_callback(&s_lease_cb);
+
+    int rc = settings_subsys_init();
+    if (rc)
+    {
+        LOG_ERR("Failed to initialize settings: %d", rc);
+        return rc;
+    }
+
+    s_lease_settings.name  = LEASE_SETTINGS_ROOT;
+    s_lease_settings.h_set = lease_settings_set;
+    rc = settings_register(&s_lease_settings);
+    if (rc)
+    {
+        LOG_ERR("Failed to register the lease settings handler: %d", rc);
+        return rc;
+    }
+
+    rc = settings_load_subtree(LEASE_SETTINGS_ROOT);
+    if (rc)
+    {
+        LOG_WRN("Failed to load the cached lease: %d", rc);
+    }
+
+    LOG_INF("Cached DHCP lease %s", s_cache_valid ? "found" : "not found");
+
+    return 0;
+}
+
+/**
+ * @brief Fill a lease from the static fallback configuration
+ */
+static bool lease_cache_static_fallback(struct dhcp_lease *lease)
+{
+    if (strlen(CONFIG_APP_DHCP_STATIC_FALLBACK_ADDR) == 0)
+    {
+        return false;
+    }
+
+    if ((net_addr_pton(AF_INET, CONFIG_APP_DHCP_STATIC_FALLBACK_ADDR, &lease->address) < 0) ||
+        (net_addr_pton(AF_INET, CONFIG_APP_DHCP_STATIC_FALLBACK_NETMASK, &lease->netmask) < 0))
+    {
+        LOG_ERR("Invalid static fallback address configuration");
+        return false;
+    }
+
+    // The gateway is optional: without it the device is only reachable from its own subnet
+    memset(&lease->gateway, 0, sizeof(lease->gateway));
+    if ((strlen(CONFIG_APP_DHCP_STATIC_FALLBACK_GW) > 0) &&
+        (net_addr_pton(AF_INET, CONFIG_APP_DHCP_STATIC_FALLBACK_GW, &lease->gateway) < 0))
+    {
+        LOG_ERR("Invalid static fallback gateway");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Configure the cached lease (or the static fallback) so the interface serves immediately
+ */
+int lease_cache_apply(struct net_if *iface)
+{
+    struct dhcp_lease lease;
+    struct net_if *addr_iface;
+    bool from_cache = false;
+    char buf[NET_IPV4_ADDR_LEN];
+
+    s_fast_path = false;
+
+    if (!IS_ENABLED(CONFIG_APP_DHCP_LEASE_CACHE))
+    {
+        return -ENOTSUP;
+    }
+
+    // Prefer the last lease, unless it ran out while we were connected
+    if (s_cache_valid && (s_cached.remaining_sec > 0))
+    {
+        K_SPINLOCK(&s_cached_lock)
+        {
+            lease = s_cached;
+        }
+        from_cache = true;
+    }
+    else if (!lease_cache_static_fallback(&lease))
+    {
+        return -ENOENT;
+    }
+
+    // Still configured from the last link (by DHCP, or by us): nothing to add, and not ours to remove later
+    if (net_if_ipv4_addr_lookup(&lease.address, &addr_iface) != NULL)
+    {
+        s_fast_path = true;
+        return 0;
+    }
+
+    // A manual address is left alone by the DHCP client, which needs the second address slot
+    // (CONFIG_NET_IF_MAX_IPV4_COUNT) if the server hands out another one. With CONFIG_NET_IPV4_ACD
+    // the stack probes the address first.
+    if (net_if_ipv4_addr_add(iface, &lease.address, NET_ADDR_MANUAL, 0) == NULL)
+    {
+        LOG_WRN("Failed to configure the cached address");
+        return -EIO;
+    }
+    net_if_ipv4_set_netmask_by_addr(iface, &lease.address, &lease.netmask);
+    net_if_ipv4_set_gw(iface, &lease.gateway);
+
+    s_iface = iface;
+    s_applied = lease.address;
+    atomic_set(&s_applied_valid, 1);
+    s_fast_path = true;
+
+    // The server only promised the address for the rest of the lease. The DHCP client raises no event
+    // when it is refused (NAK), so without a confirmation the address goes when the lease would have ended.
+    // A lease loaded at boot cannot be aged (no clock ran while the device was off): it only bridges
+    // the DHCP exchange, for CONFIG_APP_DHCP_UNVERIFIED_LEASE_SEC at most.
+    uint32_t expire_sec = lease.remaining_sec;
+    if (from_cache && s_cache_from_boot)
+    {
+        expire_sec = MIN(expire_sec, (uint32_t)CONFIG_APP_DHCP_UNVERIFIED_LEASE_SEC);
+    }
+    if (from_cache)
+    {
+        k_work_reschedule(&s_expire_work, K_SECONDS(expire_sec));
+    }
+
+    LOG_INF("Serving on cached address %s while DHCP confirms it (%s, dropped after %u s)",
+            net_addr_ntop(AF_INET, &lease.address, buf, sizeof(buf)),
+            !from_cache ? "static fallback" : (s_cache_from_boot ? "saved before the reboot" : "from this boot"),
+            from_cache ? expire_sec : 0);
+
+    return 0;
+}
+
+/**
+ * @brief Forget the cached lease
+ */
+void lease_cache_invalidate(void)
+{
+    s_cache_valid = false;
+    lease_cache_save();
+}
+
+/**
+ * @brief Mark the link coming up. The remaining lifetime of the previous lease is saved on the way.
+ */
+void rejoin_timing_mark_link_up(void)
+{
+    s_link_up_ms = k_uptime_get();
+    atomic_set(&s_first_packet_pending, 1);
+
+    // Account the time spent on the previous link against the cached lifetime
+    if (s_bound && s_cache_valid)
+    {
+        uint32_t elapsed_sec = (uint32_t)((s_link_up_ms - s_bound_ms) / 1000);
+        K_SPINLOCK(&s_cached_lock)
+        {
+            s_cached.remaining_sec = (elapsed_sec < s_cached.lease_time_sec) ? (s_cached.lease_time_sec - elapsed_sec) : 0;
+        }
+        s_bound = false;
+        lease_cache_save();
+    }
+}
+
+/**
+ * @brief Mark the first packet served after the link came up
+ */
+void rejoin_timing_mark_first_packet(void)
+{
+    // Only the first packet after each link-up is measured
+    if (!atomic_cas(&s_first_packet_pending, 1, 0))
+    {
+        return;
+    }
+
+    uint32_t elapsed_ms = (uint32_t)(k_uptime_get() - s_link_up_ms);
+
+    s_rejoin_stats.last_ms  = elapsed_ms;
+    s_rejoin_stats.best_ms  = (s_rejoin_stats.count == 0) ? elapsed_ms : MIN(s_rejoin_stats.best_ms, elapsed_ms);
+    s_rejoin_stats.worst_ms = MAX(s_rejoin_stats.worst_ms, elapsed_ms);
+    s_rejoin_stats.count++;
+    if (s_fast_path)
+    {
+        s_rejoin_stats.fast_path_count++;
+    }
+
+    LOG_INF("Link-up to first packet: %u ms (%s, best %u ms, worst %u ms)",
+            elapsed_ms, s_fast_path ? "cached lease" : "full DHCP",
+            s_rejoin_stats.best_ms, s_rejoin_stats.worst_ms);
+}
+
+/**
+ * @brief Read the link-up to first-packet measurements
+ */
+struct rejoin_timing_stats rejoin_timing_get_stats(void)
+{
+    return s_rejoin_stats;
+}
@@ -0,0 +1,61 @@
+#ifndef LIB_DHCP_CACHE_H
+#define LIB_DHCP_CACHE_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_ip.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// The last DHCPv4 lease, as persisted in the settings subsystem
+struct dhcp_lease
+{
+    struct in_addr address;
+    struct in_addr netmask;
+    struct in_addr gateway;
+    uint32_t       lease_time_sec;       // Lease duration granted by the server
+    uint32_t       remaining_sec;        // Lifetime left when the lease was saved. Only trusted within the boot
+                                         // that saved it: after a reboot the time spent off is unknown.
+};
+
+// Link-up to first-packet measurements
+struct rejoin_timing_stats
+{
+    uint32_t count;            // Rejoins measured
+    uint32_t fast_path_count;  // Rejoins that started serving on the cached lease
+    uint32_t last_ms;          // Link-up to first packet of the last rejoin
+    uint32_t best_ms;
+    uint32_t worst_ms;
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Load the cached lease from settings and start following DHCP on this interface
+int lease_cache_init(struct net_if *iface);
+
+// Configure the cached lease (or the static fallback) on the interface right away.
+// Returns 0 when an address was applied and the interface can serve traffic immediately.
+int lease_cache_apply(struct net_if *iface);
+
+// Forget the cached lease, e.g. after an address conflict
+void lease_cache_invalidate(void);
+
+// Mark the moment the Wi-Fi link came up
+void rejoin_timing_mark_link_up(void);
+
+// Mark the first packet served after the link came up. Only the first call per link-up is measured.
+void rejoin_timing_mark_first_packet(void);
+
+// Read the link-up to first-packet measurements
+struct rejoin_timing_stats rejoin_timing_get_stats(void);
+
+#endif // LIB_DHCP_CACHE_H
@@ -0,0 +1,169 @@
+/******************************************************************************
+Module: HEATSHRINK.CPP
+
+Description: This file contains a streaming decoder of the heatshrink
+             compression format. The stream is a sequence of bit-packed
+             tokens, most significant bit first: a 1 bit followed by a
+             literal byte, or a 0 bit followed by a back-reference (offset
+             and length) into the last 2^window_bits bytes of output. The
+             decoder needs no heap and can stop and resume at any byte of
+             input or output
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Project specific headers
+#include "heatshrink.h"
+
+// Standard Library
+#include <cerrno>
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// What the decoder reads next
+enum heatshrink_state : uint8_t
+{
+    HEATSHRINK_STATE_TAG = 0,       // 1 bit: literal or back-reference
+    HEATSHRINK_STATE_LITERAL,       // 8 bits
+    HEATSHRINK_STATE_BACKREF_INDEX, // window_bits bits: offset - 1
+    HEATSHRINK_STATE_BACKREF_COUNT, // lookahead_bits bits: length - 1
+    HEATSHRINK_STATE_BACKREF_COPY,  // No input, output the back-reference
+};
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Move input bytes into the bit buffer until it holds 'count' bits
+ * @return true if the bits are available
+ */
+static bool need_bits(struct heatshrink_decoder *dec, uint8_t count, const uint8_t *in, size_t in_len, size_t *pos)
+{
+    while ((dec->bit_count < count) && (*pos < in_len))
+    {
+        dec->bit_buf = (dec->bit_buf << 8) | in[(*pos)++];
+        dec->bit_count += 8;
+    }
+
+    return dec->bit_count >= count;
+}
+
+/**
+ * @brief Take 'count' bits from the bit buffer, which must hold them
+ */
+static uint16_t take_bits(struct heatshrink_decoder *dec, uint8_t count)
+{
+    dec->bit_count -= count;
+
+    return (uint16_t)((dec->bit_buf >> dec->bit_count) & ((1U << count) - 1U));
+}
+
+/**
+ * @brief Output one byte and append it to the window
+ */
+static inline void emit(struct heatshrink_decoder *dec, uint8_t byte, uint8_t *out, size_t *produced)
+{
+    out[(*produced)++] = byte;
+    dec->window[dec->head & dec->window_mask] = byte;
+    dec->head++;
+}
+
+/**
+ * @brief Prepare a decoder for a new stream
+ */
+int heatshrink_decoder_init(struct heatshrink_decoder *dec, uint8_t *window, uint8_t window_bits, uint8_t lookahead_bits)
+{
+    if ((window_bits < HEATSHRINK_MIN_WINDOW_BITS) || (window_bits > HEATSHRINK_MAX_WINDOW_BITS) ||
+        (lookahead_bits < HEATSHRINK_MIN_LOOKAHEAD_BITS) || (lookahead_bits >= window_bits))
+    {
+        return -EINVAL;
+    }
+
+    dec->window         = window;
+    dec->window_bits    = window_bits;
+    dec->lookahead_bits = lookahead_bits;
+    dec->window_mask    = (uint16_t)((1U << window_bits) - 1U);
+    dec->head           = 0;
+    dec->state          = HEATSHRINK_STATE_TAG;
+    dec->bit_count      = 0;
+    dec->bit_buf        = 0;
+    dec->backref_offset = 0;
+    dec->backref_left   = 0;
+
+    // References before the start of the stream read zeros, as in the reference implementation
+    for (uint32_t i = 0; i <= dec->window_mask; i++)
+    {
+        window[i] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Decode until the input is used up or the output is full
+ */
+size_t heatshrink_decode(struct heatshrink_decoder *dec, const uint8_t *in, size_t in_len, size_t *in_used,
+                         uint8_t *out, size_t out_len)
+{
+    size_t pos = 0;
+    size_t produced = 0;
+
+    while (produced < out_len)
+    {
+        if (dec->state == HEATSHRINK_STATE_BACKREF_COPY)
+        {
+            // The source may overlap the bytes being written (runs), so copy one byte at a time
+            while ((dec->backref_left > 0) && (produced < out_len))
+            {
+                emit(dec, dec->window[(uint16_t)(dec->head - dec->backref_offset) & dec->window_mask], out, &produced);
+                dec->backref_left--;
+            }
+            if (dec->backref_left > 0)
+            {
+                break;
+            }
+            dec->state = HEATSHRINK_STATE_TAG;
+            continue;
+        }
+
+        uint8_t width = (dec->state == HEATSHRINK_STATE_TAG)           ? 1 :
+                        (dec->state == HEATSHRINK_STATE_LITERAL)       ? 8 :
+                        (dec->state == HEATSHRINK_STATE_BACKREF_INDEX) ? dec->window_bits :
+                                                                         dec->lookahead_bits;
+        if (!need_bits(dec, width, in, in_len, &pos))
+        {
+            break;
+        }
+
+        uint16_t bits = take_bits(dec, width);
+        switch (dec->state)
+        {
+        case HEATSHRINK_STATE_TAG:
+            dec->state = bits ? HEATSHRINK_STATE_LITERAL : HEATSHRINK_STATE_BACKREF_INDEX;
+            break;
+
+        case HEATSHRINK_STATE_LITERAL:
+            emit(dec, (uint8_t)bits, out, &produced);
+            dec->state = HEATSHRINK_STATE_TAG;
+            break;
+
+        case HEATSHRINK_STATE_BACKREF_INDEX:
+            dec->backref_offset = bits + 1;
+            dec->state = HEATSHRINK_STATE_BACKREF_COUNT;
+            break;
+
+        default:
+            dec->backref_left = bits + 1;
+            dec->state = HEATSHRINK_STATE_BACKREF_COPY;
+            break;
+        }
+    }
+
+    *in_used = pos;
+    return produced;
+}
@@ -0,0 +1,49 @@
+#ifndef LIB_HEATSHRINK_H
+#define LIB_HEATSHRINK_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Standard Library
+#include <cstddef>
+#include <cstdint>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Limits of the stream parameters (log2 of the window and of the longest back-reference)
+#define HEATSHRINK_MIN_WINDOW_BITS     4
+#define HEATSHRINK_MAX_WINDOW_BITS     15
+#define HEATSHRINK_MIN_LOOKAHEAD_BITS  3
+
+// Streaming decoder of the heatshrink format (LZSS with a 2^window_bits byte window).
+// All of its memory is this struct and the window buffer handed to heatshrink_decoder_init().
+struct heatshrink_decoder
+{
+    uint8_t  *window;          // 2^window_bits bytes of history
+    uint16_t  window_mask;
+    uint8_t   window_bits;
+    uint8_t   lookahead_bits;
+    uint16_t  head;            // Next position written in the window
+    uint8_t   state;
+    uint8_t   bit_count;       // Valid bits in bit_buf
+    uint32_t  bit_buf;         // Input bits not consumed yet, MSB first
+    uint16_t  backref_offset;  // Distance of the back-reference being copied
+    uint16_t  backref_left;    // Bytes of it still to output
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Prepare a decoder for a new stream. 'window' must hold 2^window_bits bytes. Returns -EINVAL on unsupported parameters.
+int heatshrink_decoder_init(struct heatshrink_decoder *dec, uint8_t *window, uint8_t window_bits, uint8_t lookahead_bits);
+
+// Decode from 'in' into 'out' until the input is used up or the output is full. The stream can be split anywhere:
+// state is kept between calls. '*in_used' receives the number of input bytes consumed. Returns the bytes written to 'out'.
+size_t heatshrink_decode(struct heatshrink_decoder *dec, const uint8_t *in, size_t in_len, size_t *in_used,
+                         uint8_t *out, size_t out_len);
+
+#endif // LIB_HEATSHRINK_H
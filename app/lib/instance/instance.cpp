@@ -0,0 +1,139 @@
+/******************************************************************************
+Module: INSTANCE.CPP
+
+Description: This file contains the per-instance network settings. On
+             native_sim the servers listen on host sockets, so every
+             instance of a simulated fleet needs its own address or port.
+             They are taken from the native_sim command line
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+#if defined(CONFIG_ARCH_POSIX)
+#include "cmdline.h"
+#include "posix_native_task.h"
+#endif
+
+// Project specific headers
+#include "instance.h"
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(instance, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  STATE
+ *****************************************************************************/
+#if defined(CONFIG_ARCH_POSIX)
+// Filled in by the command line parser before the kernel starts
+static char *s_bind_addr_arg;
+static uint32_t s_port_arg;
+static uint32_t s_port_offset_arg;
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+#if defined(CONFIG_ARCH_POSIX)
+/**
+ * @brief Register the command line options of the instance
+ */
+static void instance_add_options(void)
+{
+    static struct args_struct_t instance_options[] = {
+        {
+            .option   = (char *)"bind_addr",
+            .name     = (char *)"ipv4",
+            .type     = 's',
+            .dest     = (void *)&s_bind_addr_arg,
+            .descript = (char *)"Host address the servers bind to (default: any)",
+        },
+        {
+            .option   = (char *)"port",
+            .name     = (char *)"port",
+            .type     = 'u',
+            .dest     = (void *)&s_port_arg,
+            .descript = (char *)"Port of the main UDP/TCP server (default: its own port plus the offset)",
+        },
+        {
+            .option   = (char *)"port_offset",
+            .name     = (char *)"offset",
+            .type     = 'u',
+            .dest     = (void *)&s_port_offset_arg,
+            .descript = (char *)"Added to every server port, so instances on one address do not collide",
+        },
+        ARG_TABLE_ENDMARKER
+    };
+
+    native_add_command_line_opts(instance_options);
+}
+
+NATIVE_TASK(instance_add_options, PRE_BOOT_1, 1);
+#endif
+
+/**
+ * @brief Port of the main UDP/TCP server
+ */
+uint16_t instance_server_port(uint16_t default_port)
+{
+#if defined(CONFIG_ARCH_POSIX)
+    if ((s_port_arg > 0) && (s_port_arg <= UINT16_MAX))
+    {
+        return (uint16_t)s_port_arg;
+    }
+#endif
+
+    return instance_port(default_port);
+}
+
+/**
+ * @brief Port of any other server, shifted by the instance's port offset
+ */
+uint16_t instance_port(uint16_t default_port)
+{
+#if defined(CONFIG_ARCH_POSIX)
+    if (s_port_offset_arg > 0)
+    {
+        if (default_port + s_port_offset_arg <= UINT16_MAX)
+        {
+            return (uint16_t)(default_port + s_port_offset_arg);
+        }
+        LOG_WRN("--port_offset=%u puts port %u out of range, keeping it", s_port_offset_arg, default_port);
+    }
+#endif
+
+    return default_port;
+}
+
+/**
+ * @brief Address every server binds to, in network byte order
+ */
+uint32_t instance_bind_addr(void)
+{
+#if defined(CONFIG_ARCH_POSIX)
+    struct in_addr addr;
+
+    if (s_bind_addr_arg != NULL)
+    {
+        if (inet_pton(AF_INET, s_bind_addr_arg, &addr) == 1)
+        {
+            return addr.s_addr;
+        }
+        LOG_WRN("Invalid --bind_addr '%s', binding to any address", s_bind_addr_arg);
+    }
+#endif
+
+    return htonl(INADDR_ANY);
+}
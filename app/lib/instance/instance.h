@@ -0,0 +1,29 @@
+#ifndef LIB_INSTANCE_H
+#define LIB_INSTANCE_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+// Standard Library
+#include <cstdint>
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Per-instance network settings. On native_sim they come from the command line, so several instances can run on one
+// host, e.g. "zephyr.exe --bind_addr=127.0.1.2" or "zephyr.exe --port_offset=10". Elsewhere the defaults are returned.
+
+// Port of the main UDP/TCP server: the --port option, or 'default_port' shifted like every other port
+uint16_t instance_server_port(uint16_t default_port);
+
+// Port of any other server (pcap dump, DDP, ...): 'default_port' plus the --port_offset option
+uint16_t instance_port(uint16_t default_port);
+
+// Address every server binds to, in network byte order: the --bind_addr option, or INADDR_ANY
+uint32_t instance_bind_addr(void);
+
+#endif // LIB_INSTANCE_H
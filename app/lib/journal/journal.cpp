@@ -0,0 +1,530 @@
+/******************************************************************************
+Module: JOURNAL.CPP
+
+Description: This file contains the persistent event journal. Events are
+             written as fixed-size records into a RAM ring, without touching
+             flash. A low-priority thread moves them in batches into a flash
+             circular buffer (FCB) on the journal partition, erasing the
+             oldest sector when it is full, so the last events survive a
+             reboot for post-mortem analysis
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/fs/fcb.h>
+#if defined(CONFIG_HWINFO)
+#include <zephyr/drivers/hwinfo.h>
+#endif
+
+// Project specific headers
+#include "journal.h"
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(journal, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// The devicetree gives the journal partition the "journal_partition" label (see the board overlays)
+#if defined(CONFIG_APP_JOURNAL) && FIXED_PARTITION_EXISTS(journal_partition)
+#define JOURNAL_ENABLED 1
+#define JOURNAL_PARTITION_ID FIXED_PARTITION_ID(journal_partition)
+#else
+#define JOURNAL_ENABLED 0
+#endif
+
+// FCB sector header. The decoder looks for this magic at the start of every sector.
+#define JOURNAL_FCB_MAGIC    0x4C4E524Au   // "JRNL" in flash (little-endian)
+#define JOURNAL_FCB_VERSION  1
+#define JOURNAL_FCB_VER_OFS  4             // fd_ver, right after the magic
+
+// Record layout
+#define JOURNAL_REC_SEQ_OFS     0
+#define JOURNAL_REC_UPTIME_OFS  4
+#define JOURNAL_REC_BOOT_OFS    8
+#define JOURNAL_REC_EVENT_OFS   10
+#define JOURNAL_REC_ARG_OFS     12
+
+// How long journal_flush() waits for the flusher
+#define JOURNAL_FLUSH_TIMEOUT   K_SECONDS(2)
+
+
+
+#if JOURNAL_ENABLED
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_journal_thread_stack, JOURNAL_STACK_SIZE);
+static struct k_thread s_journal_thread;
+
+
+
+/******************************************************************************
+  RAM RING
+ *****************************************************************************/
+struct journal_record
+{
+    uint32_t seq;
+    uint32_t uptime_ms;
+    uint16_t event;
+    int32_t  arg;
+};
+
+// Written by journal_log() under the spinlock, emptied by the flusher
+static struct k_spinlock s_ring_lock;
+static struct journal_record s_ring[CONFIG_APP_JOURNAL_RAM_RECORDS];
+static uint32_t s_ring_head;     // Next record to write
+static uint32_t s_ring_count;
+static uint32_t s_seq;
+static uint32_t s_pending_dropped;
+
+static struct journal_stats s_journal_stats;
+
+// Wakes the flusher early (batch full or explicit flush), and reports an explicit flush done
+static struct k_sem s_wake_sem;
+static struct k_sem s_flushed_sem;
+static atomic_t s_flush_requested;
+
+
+
+/******************************************************************************
+  FLASH
+ *****************************************************************************/
+static struct fcb s_fcb;
+static struct flash_sector s_sectors[CONFIG_APP_JOURNAL_MAX_SECTORS];
+static bool s_fcb_ready;
+
+// One FCB entry: a batch of encoded records
+static uint8_t s_entry_buf[CONFIG_APP_JOURNAL_BATCH * JOURNAL_RECORD_SIZE];
+#endif
+
+
+
+#if JOURNAL_ENABLED
+/******************************************************************************
+FUNCTIONS DEFINITIONS - FLASH
+******************************************************************************/
+/**
+ * @brief Describe the partition as equal erase sectors, up to CONFIG_APP_JOURNAL_MAX_SECTORS of them
+ */
+static int journal_build_sectors(uint32_t *count)
+{
+    const struct flash_area *fa;
+    struct flash_pages_info page;
+
+    int rc = flash_area_open(JOURNAL_PARTITION_ID, &fa);
+    if (rc)
+    {
+        return rc;
+    }
+
+    rc = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off, &page);
+    if (rc == 0)
+    {
+        *count = MIN(fa->fa_size / page.size, (size_t)CONFIG_APP_JOURNAL_MAX_SECTORS);
+        for (uint32_t i = 0; i < *count; i++)
+        {
+            s_sectors[i].fs_off  = i * page.size;
+            s_sectors[i].fs_size = page.size;
+        }
+    }
+
+    flash_area_close(fa);
+
+    return rc;
+}
+
+/**
+ * @brief Erase the whole partition
+ */
+static int journal_erase_partition(void)
+{
+    const struct flash_area *fa;
+
+    int rc = flash_area_open(JOURNAL_PARTITION_ID, &fa);
+    if (rc == 0)
+    {
+        rc = flash_area_erase(fa, 0, fa->fa_size);
+        flash_area_close(fa);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Check that the journal in flash was written with this layout. 'written' counts its sectors.
+ * A journal from a build with more sectors (CONFIG_APP_JOURNAL_MAX_SECTORS) or another record version
+ * does not match: the FCB would mount the sectors it knows of and leave the rest behind.
+ */
+static bool journal_layout_matches(uint32_t count, uint32_t *written)
+{
+    const struct flash_area *fa;
+    uint32_t sector_size = s_sectors[0].fs_size;
+    bool matches = true;
+
+    *written = 0;
+    if (flash_area_open(JOURNAL_PARTITION_ID, &fa) != 0)
+    {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < fa->fa_size / sector_size; i++)
+    {
+        uint8_t header[JOURNAL_FCB_VER_OFS + 1];
+
+        if ((flash_area_read(fa, i * sector_size, header, sizeof(header)) != 0) ||
+            (sys_get_le32(header) != JOURNAL_FCB_MAGIC))
+        {
+            continue;
+        }
+
+        (*written)++;
+        if ((i >= count) || (header[JOURNAL_FCB_VER_OFS] != JOURNAL_FCB_VERSION))
+        {
+            matches = false;
+        }
+    }
+
+    flash_area_close(fa);
+
+    return matches;
+}
+
+/**
+ * @brief fcb_walk() callback: count the entries and remember the last one
+ */
+static int journal_walk_cb(struct fcb_entry_ctx *loc_ctx, void *arg)
+{
+    struct fcb_entry_ctx *last = (struct fcb_entry_ctx *)arg;
+
+    *last = *loc_ctx;
+    s_journal_stats.entries_at_mount++;
+
+    return 0;
+}
+
+/**
+ * @brief Mount the FCB, formatting the partition if it holds something else, and pick this boot's number
+ * Only foreign content or a journal of another layout is erased. Any other error leaves the flash untouched.
+ */
+static int journal_mount(void)
+{
+    uint32_t count = 0;
+    uint32_t written = 0;
+
+    int rc = journal_build_sectors(&count);
+    if ((rc != 0) || (count < 2))
+    {
+        LOG_ERR("Journal partition unusable: %d (%u sectors)", rc, count);
+        return (rc != 0) ? rc : -EINVAL;
+    }
+
+    s_fcb.f_magic       = JOURNAL_FCB_MAGIC;
+    s_fcb.f_version     = JOURNAL_FCB_VERSION;
+    s_fcb.f_sector_cnt  = (uint8_t)count;
+    s_fcb.f_scratch_cnt = 0;
+    s_fcb.f_sectors     = s_sectors;
+
+    if (!journal_layout_matches(count, &written))
+    {
+        // Written by a build with another sector count or record version: it cannot be read back as is
+        LOG_WRN("Journal layout changed (now %u sectors, version %u): erasing %u sectors of history",
+                count, JOURNAL_FCB_VERSION, written);
+        journal_erase_partition();
+    }
+
+    rc = fcb_init(JOURNAL_PARTITION_ID, &s_fcb);
+    if (rc == -ENOMSG)
+    {
+        // A sector header with another magic: the partition was used for something else
+        LOG_WRN("Journal partition holds foreign data (no journal history): erasing it");
+        journal_erase_partition();
+
+        rc = fcb_init(JOURNAL_PARTITION_ID, &s_fcb);
+    }
+    if (rc != 0)
+    {
+        // Read errors and the like: keep the history in flash for a later boot or a host-side dump
+        LOG_ERR("Failed to mount the journal: %d", rc);
+        return rc;
+    }
+
+    // The boot number continues from the last record in flash
+    struct fcb_entry_ctx last = {};
+
+    s_journal_stats.entries_at_mount = 0;
+    fcb_walk(&s_fcb, NULL, journal_walk_cb, &last);
+    if ((s_journal_stats.entries_at_mount > 0) && (last.loc.fe_data_len >= JOURNAL_RECORD_SIZE))
+    {
+        uint8_t record[JOURNAL_RECORD_SIZE];
+        off_t ofs = FCB_ENTRY_FA_DATA_OFF(last.loc) + last.loc.fe_data_len - JOURNAL_RECORD_SIZE;
+
+        if (flash_area_read(last.fap, ofs, record, sizeof(record)) == 0)
+        {
+            s_journal_stats.boot = sys_get_le16(&record[JOURNAL_REC_BOOT_OFS]) + 1;
+        }
+    }
+
+    LOG_INF("Journal mounted: %u sectors of %u bytes, %u entries from earlier boots, boot %u",
+            count, s_sectors[0].fs_size, s_journal_stats.entries_at_mount, s_journal_stats.boot);
+
+    s_fcb_ready = true;
+
+    return 0;
+}
+
+/**
+ * @brief Append one batch as an FCB entry, erasing the oldest sector when the buffer is full
+ */
+static int journal_write_entry(const uint8_t *data, uint16_t len)
+{
+    struct fcb_entry loc;
+
+    int rc = fcb_append(&s_fcb, len, &loc);
+    if (rc == -ENOSPC)
+    {
+        // Circular: the oldest sector goes, the most recent history stays
+        rc = fcb_rotate(&s_fcb);
+        if (rc == 0)
+        {
+            s_journal_stats.rotations++;
+            rc = fcb_append(&s_fcb, len, &loc);
+        }
+    }
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    rc = flash_area_write(s_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), data, len);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    return fcb_append_finish(&s_fcb, &loc);
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - FLUSHER
+******************************************************************************/
+/**
+ * @brief Move every record from the RAM ring to flash, one batch per FCB entry
+ */
+static void journal_drain(void)
+{
+    while (true)
+    {
+        size_t n = 0;
+
+        // Encode a batch under the lock, write it without: journal_log() never waits on flash
+        K_SPINLOCK(&s_ring_lock)
+        {
+            uint32_t tail = (s_ring_head + CONFIG_APP_JOURNAL_RAM_RECORDS - s_ring_count) % CONFIG_APP_JOURNAL_RAM_RECORDS;
+
+            n = MIN(s_ring_count, (uint32_t)CONFIG_APP_JOURNAL_BATCH);
+            for (size_t i = 0; i < n; i++)
+            {
+                const struct journal_record *rec = &s_ring[(tail + i) % CONFIG_APP_JOURNAL_RAM_RECORDS];
+                uint8_t *out = &s_entry_buf[i * JOURNAL_RECORD_SIZE];
+
+                sys_put_le32(rec->seq, &out[JOURNAL_REC_SEQ_OFS]);
+                sys_put_le32(rec->uptime_ms, &out[JOURNAL_REC_UPTIME_OFS]);
+                sys_put_le16(s_journal_stats.boot, &out[JOURNAL_REC_BOOT_OFS]);
+                sys_put_le16(rec->event, &out[JOURNAL_REC_EVENT_OFS]);
+                sys_put_le32((uint32_t)rec->arg, &out[JOURNAL_REC_ARG_OFS]);
+            }
+            s_ring_count -= n;
+        }
+
+        if (n == 0)
+        {
+            return;
+        }
+
+        int rc = journal_write_entry(s_entry_buf, (uint16_t)(n * JOURNAL_RECORD_SIZE));
+        if (rc != 0)
+        {
+            s_journal_stats.flash_errors++;
+            LOG_WRN("Journal write failed: %d, %u records lost", rc, (unsigned int)n);
+            return;
+        }
+
+        s_journal_stats.entries++;
+        s_journal_stats.flushed += n;
+    }
+}
+
+/**
+ * @brief Flush once per interval, or earlier when a batch is full or a flush is requested
+ */
+static void journal_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    if (journal_mount() != 0)
+    {
+        return;
+    }
+
+    while (1)
+    {
+        k_sem_take(&s_wake_sem, K_SECONDS(CONFIG_APP_JOURNAL_FLUSH_SEC));
+
+        journal_drain();
+
+        if (atomic_cas(&s_flush_requested, 1, 0))
+        {
+            k_sem_give(&s_flushed_sem);
+        }
+    }
+}
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Start the flusher thread, which mounts the partition first
+ */
+int journal_init(void)
+{
+#if JOURNAL_ENABLED
+    uint32_t reset_cause = 0;
+
+    k_sem_init(&s_wake_sem, 0, 1);
+    k_sem_init(&s_flushed_sem, 0, 1);
+
+#if defined(CONFIG_HWINFO)
+    hwinfo_get_reset_cause(&reset_cause);
+    hwinfo_clear_reset_cause();
+#endif
+
+    // First record of every boot. The flusher gives it the boot number once the partition is mounted.
+    journal_log(JOURNAL_EV_BOOT, (int32_t)reset_cause);
+
+    k_tid_t tid = k_thread_create(&s_journal_thread, m_journal_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_journal_thread_stack),
+                                  journal_thread, NULL, NULL, NULL,
+                                  JOURNAL_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "journal");
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Append one record to the RAM ring. A full ring drops the record and counts it.
+ */
+void journal_log(enum journal_event event, int32_t arg)
+{
+#if JOURNAL_ENABLED
+    bool wake = false;
+    uint32_t now = k_uptime_get_32();
+
+    K_SPINLOCK(&s_ring_lock)
+    {
+        // Report earlier losses first, in the slot they free up
+        if ((s_pending_dropped > 0) && (s_ring_count < CONFIG_APP_JOURNAL_RAM_RECORDS - 1))
+        {
+            struct journal_record *rec = &s_ring[s_ring_head];
+            rec->seq       = s_seq++;
+            rec->uptime_ms = now;
+            rec->event     = JOURNAL_EV_OVERFLOW;
+            rec->arg       = (int32_t)s_pending_dropped;
+            s_ring_head    = (s_ring_head + 1) % CONFIG_APP_JOURNAL_RAM_RECORDS;
+            s_ring_count++;
+            s_pending_dropped = 0;
+        }
+
+        if (s_ring_count >= CONFIG_APP_JOURNAL_RAM_RECORDS)
+        {
+            s_pending_dropped++;
+            s_journal_stats.dropped++;
+            K_SPINLOCK_BREAK;
+        }
+
+        struct journal_record *rec = &s_ring[s_ring_head];
+        rec->seq       = s_seq++;
+        rec->uptime_ms = now;
+        rec->event     = (uint16_t)event;
+        rec->arg       = arg;
+        s_ring_head    = (s_ring_head + 1) % CONFIG_APP_JOURNAL_RAM_RECORDS;
+        s_ring_count++;
+        s_journal_stats.logged++;
+
+        wake = (s_ring_count == CONFIG_APP_JOURNAL_BATCH);
+    }
+
+    // A full batch is worth one flash write now rather than at the next interval
+    if (wake)
+    {
+        k_sem_give(&s_wake_sem);
+    }
+#else
+    ARG_UNUSED(event);
+    ARG_UNUSED(arg);
+#endif
+}
+
+/**
+ * @brief Ask the flusher to write everything now and wait for it
+ */
+void journal_flush(void)
+{
+#if JOURNAL_ENABLED
+    if (!s_fcb_ready)
+    {
+        return;
+    }
+
+    atomic_set(&s_flush_requested, 1);
+    k_sem_give(&s_wake_sem);
+    k_sem_take(&s_flushed_sem, JOURNAL_FLUSH_TIMEOUT);
+#endif
+}
+
+/**
+ * @brief Return a snapshot of the statistics
+ */
+struct journal_stats journal_get_stats(void)
+{
+#if JOURNAL_ENABLED
+    return s_journal_stats;
+#else
+    return {};
+#endif
+}
+
+/**
+ * @brief Log the statistics
+ */
+void journal_report(void)
+{
+#if JOURNAL_ENABLED
+    LOG_INF("Journal (boot %u): %u logged, %u dropped, %u flushed in %u entries, %u rotations, %u flash errors",
+            s_journal_stats.boot, s_journal_stats.logged, s_journal_stats.dropped, s_journal_stats.flushed,
+            s_journal_stats.entries, s_journal_stats.rotations, s_journal_stats.flash_errors);
+#endif
+}
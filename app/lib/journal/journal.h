@@ -0,0 +1,72 @@
+#ifndef LIB_JOURNAL_H
+#define LIB_JOURNAL_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define JOURNAL_STACK_SIZE       2048
+#define JOURNAL_THREAD_PRIORITY  14
+
+// Record layout (little-endian, 16 bytes):
+//   seq u32 (since boot), uptime_ms u32, boot u16, event u16, arg i32
+// Records are written to the FCB in entries of up to CONFIG_APP_JOURNAL_BATCH records.
+// scripts/journal_decode.py decodes a dump of the partition (or of the whole flash).
+#define JOURNAL_RECORD_SIZE      16
+
+// Events. Keep the numbers stable: they are stored in flash and known to the decoder.
+enum journal_event
+{
+    JOURNAL_EV_BOOT               = 1,    // arg = RESET_* cause bits of the hwinfo API (0 without CONFIG_HWINFO)
+    JOURNAL_EV_OVERFLOW           = 2,    // arg = records dropped because the RAM ring was full
+    JOURNAL_EV_WIFI_CONNECTING    = 10,   // arg = credential index
+    JOURNAL_EV_WIFI_CONNECTED     = 11,   // arg = credential index
+    JOURNAL_EV_WIFI_CONNECT_FAIL  = 12,   // arg = status
+    JOURNAL_EV_WIFI_DISCONNECTED  = 13,   // arg = disconnect reason
+    JOURNAL_EV_WIFI_ROAM          = 14,   // arg = RSSI of the new access point (dBm)
+    JOURNAL_EV_SERVER_START       = 20,   // arg = port
+    JOURNAL_EV_SERVER_ERROR       = 21,   // arg = errno
+    JOURNAL_EV_SESSION_DEAD       = 22,   // arg = time the dead session held the server (ms)
+    JOURNAL_EV_TIME_SYNC          = 30,   // arg = UTC seconds (unsigned), maps uptime to wall-clock time
+    JOURNAL_EV_MQTT_CONNECTED     = 40,   // arg = 1 when the session was resumed
+    JOURNAL_EV_MQTT_LOST          = 41,   // arg = error
+};
+
+// Journal statistics
+struct journal_stats
+{
+    uint16_t boot;               // Boot number stored in every record of this boot
+    uint32_t logged;             // Records accepted into the RAM ring
+    uint32_t dropped;            // Records lost because the ring was full
+    uint32_t flushed;            // Records written to flash
+    uint32_t entries;            // FCB entries written during this boot
+    uint32_t entries_at_mount;   // FCB entries already in flash when the journal was mounted (earlier boots)
+    uint32_t rotations;          // Oldest sectors erased to make room
+    uint32_t flash_errors;
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Mount the journal partition and start the flusher thread
+int journal_init(void);
+
+// Record one event. Callable from any thread or ISR; never touches flash and never blocks.
+void journal_log(enum journal_event event, int32_t arg);
+
+// Write the records still in RAM now (e.g. before a planned reboot). Blocks until they are in flash.
+void journal_flush(void);
+
+// Read and log the statistics
+struct journal_stats journal_get_stats(void);
+void journal_report(void);
+
+#endif // LIB_JOURNAL_H
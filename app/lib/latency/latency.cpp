@@ -0,0 +1,124 @@
+/******************************************************************************
+Module: LATENCY.CPP
+
+Description: This file contains the on-device latency histograms. Samples are
+             sorted into power-of-two microsecond buckets, so the memory used
+             is fixed no matter how many samples are recorded
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_stats.h>
+
+// Project specific headers
+#include "latency.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(latency, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Add one sample. The cycle counter wraps, so the difference is taken in 32-bit unsigned arithmetic.
+ */
+void latency_record(struct latency_histogram *hist, uint32_t start, uint32_t end)
+{
+    uint32_t us = k_cyc_to_us_floor32(end - start);
+
+    // Index of the highest set bit, i.e. floor(log2(us)), with 0 us going into bucket 0
+    uint32_t bucket = (us == 0) ? 0 : (31 - __builtin_clz(us));
+    bucket = MIN(bucket, (uint32_t)(LATENCY_BUCKETS - 1));
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum_us += us;
+    hist->max_us = MAX(hist->max_us, us);
+}
+
+/**
+ * @brief Walk the buckets until the requested share of samples is covered and return that bucket's upper bound
+ */
+uint32_t latency_percentile_us(const struct latency_histogram *hist, uint32_t percentile)
+{
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t target = ((uint64_t)hist->count * percentile + 99) / 100;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= target)
+        {
+            // Never report more than the real maximum
+            return MIN((uint32_t)((2ULL << i) - 1), hist->max_us);
+        }
+    }
+
+    return hist->max_us;
+}
+
+/**
+ * @brief Log a summary of the histogram
+ */
+void latency_report(const struct latency_histogram *hist)
+{
+    if (hist->count == 0)
+    {
+        LOG_INF("%s: no samples", hist->name);
+        return;
+    }
+
+    LOG_INF("%s: n=%u mean=%u us p50<=%u us p90<=%u us p99<=%u us max=%u us",
+            hist->name, hist->count, (uint32_t)(hist->sum_us / hist->count),
+            latency_percentile_us(hist, 50), latency_percentile_us(hist, 90),
+            latency_percentile_us(hist, 99), hist->max_us);
+}
+
+/**
+ * @brief Forget all samples
+ */
+void latency_reset(struct latency_histogram *hist)
+{
+    memset(hist->buckets, 0, sizeof(hist->buckets));
+    hist->count = 0;
+    hist->max_us = 0;
+    hist->sum_us = 0;
+}
+
+/**
+ * @brief Log the mean time packets spend in the stack, from the driver allocating them to recv() handing them over
+ */
+void latency_report_stack_rx(void)
+{
+#if defined(CONFIG_NET_PKT_RXTIME_STATS) && defined(CONFIG_NET_STATISTICS_USER_API)
+    struct net_stats stats;
+
+    // Zephyr keeps the sum in microseconds and only the mean can be derived from it
+    if ((net_mgmt(NET_REQUEST_STATS_GET_ALL, NULL, &stats, sizeof(stats)) < 0) || (stats.rx_time.count == 0))
+    {
+        return;
+    }
+
+    LOG_INF("stack rx->recv: n=%u mean=%u us",
+            (uint32_t)stats.rx_time.count, (uint32_t)(stats.rx_time.sum / stats.rx_time.count));
+#endif
+}
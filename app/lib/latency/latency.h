@@ -0,0 +1,59 @@
+#ifndef LIB_LATENCY_H
+#define LIB_LATENCY_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Bucket i counts samples in [2^i, 2^(i+1)) microseconds, bucket 0 also holds 0 us.
+// 24 buckets cover up to ~16 s with a fixed 100-byte footprint per histogram.
+#define LATENCY_BUCKETS 24
+
+// A fixed-memory, log2-bucketed latency histogram. Written by a single thread.
+struct latency_histogram
+{
+    const char *name;
+    uint32_t    buckets[LATENCY_BUCKETS];
+    uint32_t    count;
+    uint32_t    max_us;
+    uint64_t    sum_us;
+};
+
+// Define a histogram with a name used in the reports
+#define LATENCY_HISTOGRAM_DEFINE(_var, _name) \
+    static struct latency_histogram _var = { .name = _name, .buckets = { 0 }, .count = 0, .max_us = 0, .sum_us = 0 }
+
+// Timestamp for latency measurements (hardware cycles, cheap to take on the hot path)
+static inline uint32_t latency_now(void)
+{
+    return k_cycle_get_32();
+}
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Add the time elapsed between two latency_now() timestamps
+void latency_record(struct latency_histogram *hist, uint32_t start, uint32_t end);
+
+// Upper bound (us) of the bucket holding the given percentile (0-100)
+uint32_t latency_percentile_us(const struct latency_histogram *hist, uint32_t percentile);
+
+// Log count, mean, p50/p90/p99 and max
+void latency_report(const struct latency_histogram *hist);
+
+// Forget all samples
+void latency_reset(struct latency_histogram *hist);
+
+// Log the stack's own receive time (driver to recv(), averaged by Zephyr). Needs CONFIG_NET_PKT_RXTIME_STATS
+// and CONFIG_NET_STATISTICS_USER_API, the socket API gives no per-packet RX timestamp to start a histogram from.
+void latency_report_stack_rx(void);
+
+#endif // LIB_LATENCY_H
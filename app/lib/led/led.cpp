@@ -15,6 +15,7 @@ INCLUDE
 
 // Project specific headers
 #include "led.h"
+#include "app_trace.h"
 
 // Standard Library
 #include <cstring>
@@ -56,11 +57,19 @@ void SINGLE_RGB_LED_WS2812::set_color_for_rgb_led(uint8_t r, uint8_t g, uint8_t
  */
 void SINGLE_RGB_LED_WS2812::set_color_for_rgb_led(const struct led_rgb &color)
 {
+    // Boards without the LED (e.g. native_sim) run with the indicator disabled
+    if (m_strip == NULL)
+    {
+        return;
+    }
+
     // Set the color 
     m_pixels[0] = color;
 
     // Update the color
+    APP_TRACE(APP_TRACE_LED_QUEUED, 1, 0);
     int result = led_strip_update_rgb(m_strip, m_pixels, 1);
+    APP_TRACE(APP_TRACE_LED_FLUSHED, 1, result);
 
     // Show the result
     if (result) 
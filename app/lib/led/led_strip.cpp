@@ -0,0 +1,185 @@
+/******************************************************************************
+Module: LED_STRIP.CPP
+
+Description: This file contains functions of the led strip class, which shows
+             full frames on a WS2812 chain. Frames are double buffered: the
+             producer fills one while the flush thread shifts the other out
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+// Project specific headers
+#include "led_strip.h"
+#include "app_trace.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_led_strip_flush_stack, LED_STRIP_FLUSH_STACK_SIZE);
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(led_strip, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  LATENCY
+ *****************************************************************************/
+// Time from the first data of a frame to the driver starting on it, and the driver update itself
+LATENCY_HISTOGRAM_DEFINE(s_strip_fill_to_flush, "strip fill->flush");
+LATENCY_HISTOGRAM_DEFINE(s_strip_flush, "strip flush");
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Constructor for the LED strip class
+ */
+RGB_LED_STRIP_WS2812::RGB_LED_STRIP_WS2812(const struct device *strip_dev, struct led_rgb *frame_buffers, size_t num_pixels)
+    : m_strip(strip_dev), m_front(frame_buffers), m_back(&frame_buffers[num_pixels]), m_num_pixels(num_pixels),
+      m_started(false), m_front_start(0), m_stats{}
+{
+    memset(frame_buffers, 0, 2 * num_pixels * sizeof(struct led_rgb));
+
+    k_sem_init(&m_frame_ready, 0, 1);
+    atomic_set(&m_flushing, 0);
+    atomic_set(&m_stop_requested, 0);
+}
+
+/**
+ * @brief Destructor for the LED strip class
+ */
+RGB_LED_STRIP_WS2812::~RGB_LED_STRIP_WS2812()
+{
+    if (!m_started)
+    {
+        return;
+    }
+
+    // Wake the flush thread so it sees the request
+    atomic_set(&m_stop_requested, 1);
+    k_sem_give(&m_frame_ready);
+
+    int ret = k_thread_join(&m_thread_data, K_FOREVER);
+    if (ret)
+    {
+        LOG_WRN("Failed to join LED strip thread: %d", ret);
+    }
+}
+
+/**
+ * @brief This function create the flush thread and start it
+ */
+void RGB_LED_STRIP_WS2812::start()
+{
+    k_tid_t flush_thread = k_thread_create(&m_thread_data, m_led_strip_flush_stack,
+                                  K_THREAD_STACK_SIZEOF(m_led_strip_flush_stack),
+                                  RGB_LED_STRIP_WS2812::static_run_flush,
+                                  this, NULL, NULL,
+                                  LED_STRIP_FLUSH_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_name_set(flush_thread, "led_strip");
+    m_started = true;
+
+    LOG_INF("LED strip: %u pixels, double buffered", (uint32_t)m_num_pixels);
+}
+
+/**
+ * @brief This function is a static wrapper for the actual function to run the flush thread
+ */
+void RGB_LED_STRIP_WS2812::static_run_flush(void *p1, void *p2, void *p3)
+{
+    RGB_LED_STRIP_WS2812* self = static_cast<RGB_LED_STRIP_WS2812*>(p1);
+
+    self->run_flush();
+}
+
+/**
+ * @brief Swap the buffers and wake the flush thread
+ */
+bool RGB_LED_STRIP_WS2812::present(uint32_t frame_start)
+{
+    // The front buffer is still being shifted out: drop this frame and let the producer overwrite it
+    if (!atomic_cas(&m_flushing, 0, 1))
+    {
+        m_stats.frames_dropped++;
+        return false;
+    }
+
+    struct led_rgb *shown = m_back;
+    m_back = m_front;
+    m_front = shown;
+    m_front_start = frame_start;
+
+    // Senders may update only part of the strip, so the next frame starts from this one.
+    // The copy is taken before the driver runs, since drivers may rewrite the pixels in place.
+    memcpy(m_back, m_front, m_num_pixels * sizeof(struct led_rgb));
+
+    k_sem_give(&m_frame_ready);
+
+    return true;
+}
+
+/**
+ * @brief This is the actual function that will run the flush thread logic
+ */
+void RGB_LED_STRIP_WS2812::run_flush()
+{
+    while (1)
+    {
+        k_sem_take(&m_frame_ready, K_FOREVER);
+        if (atomic_get(&m_stop_requested))
+        {
+            break;
+        }
+
+        uint32_t flush_start = latency_now();
+        latency_record(&s_strip_fill_to_flush, m_front_start, flush_start);
+
+        APP_TRACE(APP_TRACE_LED_QUEUED, m_num_pixels, 0);
+        int result = led_strip_update_rgb(m_strip, m_front, m_num_pixels);
+        APP_TRACE(APP_TRACE_LED_FLUSHED, m_num_pixels, result);
+
+        latency_record(&s_strip_flush, flush_start, latency_now());
+
+        if (result)
+        {
+            m_stats.flush_errors++;
+            LOG_ERR("Couldn't update strip: %d", result);
+        }
+        else
+        {
+            m_stats.frames_presented++;
+        }
+
+        atomic_set(&m_flushing, 0);
+    }
+}
+
+/**
+ * @brief Log the frame counters and the latency histograms
+ */
+void RGB_LED_STRIP_WS2812::report()
+{
+    LOG_INF("Strip frames: %u shown, %u dropped, %u errors",
+            m_stats.frames_presented, m_stats.frames_dropped, m_stats.flush_errors);
+
+    latency_report(&s_strip_fill_to_flush);
+    latency_report(&s_strip_flush);
+}
@@ -0,0 +1,89 @@
+#ifndef LIB_LED_STRIP_H
+#define LIB_LED_STRIP_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/drivers/led_strip.h>
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+
+// Project specific headers
+#include "latency.h"
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define LED_STRIP_FLUSH_STACK_SIZE       1024
+#define LED_STRIP_FLUSH_THREAD_PRIORITY  7
+
+
+
+/******************************************************************************
+LED STRIP STATISTICS
+******************************************************************************/
+struct led_strip_stats
+{
+    uint32_t frames_presented;   // Frames handed to the driver
+    uint32_t frames_dropped;     // Frames completed while the previous one was still shifting out
+    uint32_t flush_errors;       // Driver updates that failed
+};
+
+
+
+/******************************************************************************
+LED STRIP CLASS
+******************************************************************************/
+// Double-buffered WS2812 strip. The producer fills the back buffer while a flush thread
+// shifts the front buffer out, so receiving the next frame overlaps the DMA of the current one.
+class RGB_LED_STRIP_WS2812
+{
+public:
+    // Constructor. 'frame_buffers' holds two frames of 'num_pixels' pixels each.
+    RGB_LED_STRIP_WS2812(const struct device *strip_dev, struct led_rgb *frame_buffers, size_t num_pixels);
+
+    // Destructor, which stops the flush thread
+    ~RGB_LED_STRIP_WS2812();
+
+    // Start the flush thread
+    void start();
+
+    // Frame being filled, and its length in pixels
+    struct led_rgb *back_buffer() { return m_back; }
+    size_t num_pixels() const { return m_num_pixels; }
+
+    // Show the back buffer. 'frame_start' is the latency_now() of the frame's first data.
+    // Returns false (and counts a drop) if the previous frame is still shifting out.
+    bool present(uint32_t frame_start);
+
+    // Read the statistics and report them with the latency histograms
+    struct led_strip_stats get_stats() const { return m_stats; }
+    void report();
+
+private:
+
+    const struct device *m_strip;       // Pointer to the LED strip device
+    struct led_rgb      *m_front;       // Frame owned by the flush thread
+    struct led_rgb      *m_back;        // Frame owned by the producer
+    size_t               m_num_pixels;
+
+    // Thread
+    struct k_thread m_thread_data;
+    struct k_sem m_frame_ready;
+    atomic_t m_flushing;
+    atomic_t m_stop_requested;
+    bool m_started;
+    uint32_t m_front_start;             // latency_now() of the first data of the front frame
+
+    struct led_strip_stats m_stats;
+
+    // Function to run the flush thread
+    void run_flush();
+
+    // Static function for the thread entry, which in turns call the actual "run_flush"
+    static void static_run_flush(void *p1, void *p2, void *p3);
+};
+
+#endif // LIB_LED_STRIP_H
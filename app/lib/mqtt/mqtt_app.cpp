@@ -0,0 +1,751 @@
+/******************************************************************************
+Module: MQTT_APP.CPP
+
+Description: This file contains the MQTT client, built on Zephyr's MQTT
+             library. The session is persistent (clean session off), so a
+             reconnect after a Wi-Fi drop resumes the subscriptions and the
+             unacknowledged QoS 1 messages without subscribing again.
+             Messages are queued by reference and written in batches, one
+             pass per flush window, with several QoS 1 messages in flight
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/posix/poll.h>
+
+// Project specific headers
+#include "mqtt_app.h"
+#include "netpool.h"
+#include "journal.h"
+
+// Standard Library
+#include <cstdio>
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(mqtt_app, LOG_LEVEL_INF);
+
+
+
+// The library is only linked in with CONFIG_MQTT_LIB (see overlay-mqtt.conf)
+#if defined(CONFIG_APP_MQTT)
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_mqtt_thread_stack, MQTT_APP_STACK_SIZE);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// MQTT control packets only: payloads are sent straight from the caller's buffer, so the TX buffer holds headers
+#define MQTT_APP_BUFFER_SIZE         256
+
+// Largest command payload read; longer ones are discarded
+#define MQTT_APP_RX_PAYLOAD_SIZE     64
+
+// How long to wait for the CONNACK, and before retrying a failed connection
+#define MQTT_APP_CONNACK_TIMEOUT_MS  3000
+#define MQTT_APP_RETRY_MS            2000
+
+// Statistics are logged this often while connected
+#define MQTT_APP_REPORT_INTERVAL_MS  10000
+
+// Topic length: "<client id>/<suffix>"
+#define MQTT_APP_TOPIC_SIZE          64
+
+#if CONFIG_APP_MQTT_BENCH_RATE > 0
+// Benchmark messages: sequence number, uptime (ms), connection number, padding.
+// The connection number tells the host which messages were published after a reconnect.
+#define MQTT_APP_BENCH_PAYLOAD_SIZE  32
+#define MQTT_APP_BENCH_TICK_MS       10
+#endif
+
+BUILD_ASSERT(CONFIG_APP_MQTT_MAX_PENDING <= UINT8_MAX, "Slot indices are queued as uint8_t");
+
+
+
+/******************************************************************************
+  MESSAGE SLOTS
+ *****************************************************************************/
+// One message handed over by the application. The slot references the caller's buffers; nothing is copied.
+struct mqtt_app_slot
+{
+    const char          *topic;
+    const uint8_t       *payload;
+    uint32_t             len;
+    uint8_t              qos;
+    uint16_t             message_id;   // QoS 1 only, assigned when first written
+    mqtt_app_release_cb  release;
+    void                *user_data;
+};
+
+static struct mqtt_app_slot s_slots[CONFIG_APP_MQTT_MAX_PENDING];
+
+// Free slots, and slots waiting for the next flush pass, in publish order (indices)
+K_MSGQ_DEFINE(s_mqtt_free_q, sizeof(uint8_t), CONFIG_APP_MQTT_MAX_PENDING, 1);
+K_MSGQ_DEFINE(s_mqtt_queued_q, sizeof(uint8_t), CONFIG_APP_MQTT_MAX_PENDING, 1);
+
+// QoS 1 messages written but not acknowledged yet, oldest first. Only the client thread touches it.
+static uint8_t s_inflight[CONFIG_APP_MQTT_MAX_INFLIGHT];
+static size_t s_num_inflight;
+static uint16_t s_next_message_id;
+
+
+
+/******************************************************************************
+  CLIENT STATE
+ *****************************************************************************/
+static struct mqtt_client s_client;
+static struct sockaddr_storage s_broker;
+static uint8_t s_rx_buffer[MQTT_APP_BUFFER_SIZE];
+static uint8_t s_tx_buffer[MQTT_APP_BUFFER_SIZE];
+static uint8_t s_rx_payload[MQTT_APP_RX_PAYLOAD_SIZE];
+
+// Set by the event handler
+static bool s_connected;
+static bool s_session_present;
+static uint16_t s_subscribe_id;
+
+static char s_cmd_topic[MQTT_APP_TOPIC_SIZE];
+static mqtt_app_message_cb s_on_message;
+
+// Uptime at which the session was lost (or the link came up). Cleared once publishing resumes.
+static int64_t s_resume_from_ms;
+
+static struct mqtt_app_stats s_mqtt_stats;
+
+static struct k_thread s_mqtt_thread;
+static struct k_sem s_wake_sem;
+static atomic_t s_network_up;
+
+#if CONFIG_APP_MQTT_BENCH_RATE > 0
+static char s_bench_topic[MQTT_APP_TOPIC_SIZE];
+static uint8_t s_bench_buffers[CONFIG_APP_MQTT_MAX_PENDING][MQTT_APP_BENCH_PAYLOAD_SIZE];
+static ATOMIC_DEFINE(s_bench_busy, CONFIG_APP_MQTT_MAX_PENDING);
+static uint32_t s_bench_seq;
+static uint32_t s_bench_credit;
+static struct k_work_delayable s_bench_work;
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - SLOTS
+******************************************************************************/
+/**
+ * @brief Hand a slot back to its owner and to the free list
+ */
+static void mqtt_app_release_slot(uint8_t index, int result)
+{
+    struct mqtt_app_slot *slot = &s_slots[index];
+
+    if (result < 0)
+    {
+        s_mqtt_stats.dropped++;
+    }
+
+    if (slot->release != NULL)
+    {
+        slot->release(slot->user_data, result);
+    }
+
+    k_msgq_put(&s_mqtt_free_q, &index, K_NO_WAIT);
+}
+
+/**
+ * @brief Write one message. Only the PUBLISH header goes through the TX buffer; the payload is sent from the slot's buffer.
+ */
+static int mqtt_app_write(struct mqtt_app_slot *slot, bool dup)
+{
+    struct mqtt_publish_param param = {};
+
+    param.message.topic.topic.utf8 = (const uint8_t *)slot->topic;
+    param.message.topic.topic.size = strlen(slot->topic);
+    param.message.topic.qos        = slot->qos;
+    param.message.payload.data     = (uint8_t *)slot->payload;
+    param.message.payload.len      = slot->len;
+    param.message_id               = slot->message_id;
+    param.dup_flag                 = dup ? 1 : 0;
+    param.retain_flag              = 0;
+
+    int ret = mqtt_publish(&s_client, &param);
+    net_lane_sample(NET_LANE_BULK);
+
+    return ret;
+}
+
+/**
+ * @brief Write every queued message, keeping QoS 1 within the in-flight window and in publish order
+ */
+static int mqtt_app_flush(void)
+{
+    uint32_t batch = 0;
+    uint8_t index;
+    int ret = 0;
+
+    while (k_msgq_peek(&s_mqtt_queued_q, &index) == 0)
+    {
+        struct mqtt_app_slot *slot = &s_slots[index];
+
+        // The window is full: the rest waits for PUBACKs, so messages never overtake each other
+        if ((slot->qos == MQTT_QOS_1_AT_LEAST_ONCE) && (s_num_inflight >= CONFIG_APP_MQTT_MAX_INFLIGHT))
+        {
+            break;
+        }
+
+        k_msgq_get(&s_mqtt_queued_q, &index, K_NO_WAIT);
+
+        if (slot->qos == MQTT_QOS_1_AT_LEAST_ONCE)
+        {
+            s_next_message_id = (s_next_message_id == UINT16_MAX) ? 1 : (s_next_message_id + 1);
+            slot->message_id = s_next_message_id;
+
+            // In flight from here on, even if the write fails: it is re-sent after the reconnect
+            s_inflight[s_num_inflight++] = index;
+            ret = mqtt_app_write(slot, false);
+        }
+        else
+        {
+            ret = mqtt_app_write(slot, false);
+            if (ret == 0)
+            {
+                s_mqtt_stats.published_qos0++;
+            }
+            mqtt_app_release_slot(index, ret);
+        }
+
+        if (ret < 0)
+        {
+            LOG_WRN("MQTT publish failed: %d", ret);
+            break;
+        }
+        batch++;
+    }
+
+    if (batch > 0)
+    {
+        s_mqtt_stats.batches++;
+        s_mqtt_stats.max_batch = MAX(s_mqtt_stats.max_batch, batch);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Re-send the unacknowledged QoS 1 messages, oldest first, with the DUP flag set
+ */
+static int mqtt_app_resend_inflight(void)
+{
+    for (size_t i = 0; i < s_num_inflight; i++)
+    {
+        int ret = mqtt_app_write(&s_slots[s_inflight[i]], true);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        s_mqtt_stats.retransmitted++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Release the in-flight message acknowledged by a PUBACK
+ */
+static void mqtt_app_acknowledge(uint16_t message_id)
+{
+    for (size_t i = 0; i < s_num_inflight; i++)
+    {
+        uint8_t index = s_inflight[i];
+
+        if (s_slots[index].message_id == message_id)
+        {
+            memmove(&s_inflight[i], &s_inflight[i + 1], (s_num_inflight - i - 1) * sizeof(s_inflight[0]));
+            s_num_inflight--;
+            s_mqtt_stats.acked_qos1++;
+            mqtt_app_release_slot(index, 0);
+            return;
+        }
+    }
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - CLIENT
+******************************************************************************/
+/**
+ * @brief Publishing works again: account the time since the session was lost
+ */
+static void mqtt_app_mark_resumed(const char *how)
+{
+    if (s_resume_from_ms == 0)
+    {
+        return;
+    }
+
+    uint32_t elapsed = (uint32_t)(k_uptime_get() - s_resume_from_ms);
+
+    s_resume_from_ms = 0;
+    s_mqtt_stats.last_resume_ms = elapsed;
+    s_mqtt_stats.max_resume_ms  = MAX(s_mqtt_stats.max_resume_ms, elapsed);
+
+    LOG_INF("MQTT resumed in %u ms (%s), %u messages in flight", elapsed, how, (unsigned int)s_num_inflight);
+}
+
+/**
+ * @brief Deliver a received message to the application and acknowledge it
+ */
+static void mqtt_app_handle_publish(struct mqtt_client *client, const struct mqtt_publish_param *param)
+{
+    uint32_t len  = param->message.payload.len;
+    uint32_t keep = MIN(len, (uint32_t)sizeof(s_rx_payload));
+    int ret = mqtt_readall_publish_payload(client, s_rx_payload, keep);
+
+    // The whole payload has to be read out of the stream, even the part that does not fit
+    for (uint32_t left = len - keep; (ret == 0) && (left > 0); )
+    {
+        uint8_t discard[16];
+        uint32_t chunk = MIN(left, (uint32_t)sizeof(discard));
+
+        ret = mqtt_readall_publish_payload(client, discard, chunk);
+        left -= chunk;
+    }
+
+    if (ret < 0)
+    {
+        LOG_WRN("Failed to read MQTT payload: %d", ret);
+        return;
+    }
+
+    s_mqtt_stats.received++;
+    if (s_on_message != NULL)
+    {
+        s_on_message(s_rx_payload, keep);
+    }
+
+    if (param->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE)
+    {
+        struct mqtt_puback_param ack = { .message_id = param->message_id };
+        mqtt_publish_qos1_ack(client, &ack);
+    }
+}
+
+/**
+ * @brief MQTT library events (client thread, from mqtt_input() / mqtt_connect() / mqtt_abort())
+ */
+static void mqtt_app_event_handler(struct mqtt_client *client, const struct mqtt_evt *evt)
+{
+    switch (evt->type)
+    {
+        case MQTT_EVT_CONNACK:
+            if (evt->result != 0)
+            {
+                LOG_WRN("MQTT connection refused: %d", evt->result);
+                break;
+            }
+            s_connected       = true;
+            s_session_present = evt->param.connack.session_present_flag;
+            s_mqtt_stats.connects++;
+            break;
+
+        case MQTT_EVT_DISCONNECT:
+            s_connected = false;
+            break;
+
+        case MQTT_EVT_PUBACK:
+            mqtt_app_acknowledge(evt->param.puback.message_id);
+            break;
+
+        case MQTT_EVT_SUBACK:
+            if (evt->param.suback.message_id == s_subscribe_id)
+            {
+                mqtt_app_mark_resumed("new session, subscribed");
+            }
+            break;
+
+        case MQTT_EVT_PUBLISH:
+            mqtt_app_handle_publish(client, &evt->param.publish);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Resolve the broker and open the session. Returns once the CONNACK arrived.
+ */
+static int mqtt_app_connect(void)
+{
+    struct addrinfo hints = {};
+    struct addrinfo *res = NULL;
+    char port[8];
+
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", CONFIG_APP_MQTT_BROKER_PORT);
+
+    int ret = getaddrinfo(CONFIG_APP_MQTT_BROKER, port, &hints, &res);
+    if (ret != 0)
+    {
+        LOG_WRN("Cannot resolve %s: %d", CONFIG_APP_MQTT_BROKER, ret);
+        return -EHOSTUNREACH;
+    }
+    memcpy(&s_broker, res->ai_addr, MIN(res->ai_addrlen, sizeof(s_broker)));
+    freeaddrinfo(res);
+
+    mqtt_client_init(&s_client);
+
+    s_client.broker           = &s_broker;
+    s_client.evt_cb           = mqtt_app_event_handler;
+    s_client.client_id.utf8   = (const uint8_t *)CONFIG_APP_MQTT_CLIENT_ID;
+    s_client.client_id.size   = strlen(CONFIG_APP_MQTT_CLIENT_ID);
+    s_client.protocol_version = MQTT_VERSION_3_1_1;
+    s_client.keepalive        = CONFIG_APP_MQTT_KEEPALIVE_SEC;
+    s_client.rx_buf           = s_rx_buffer;
+    s_client.rx_buf_size      = sizeof(s_rx_buffer);
+    s_client.tx_buf           = s_tx_buffer;
+    s_client.tx_buf_size      = sizeof(s_tx_buffer);
+    s_client.transport.type   = MQTT_TRANSPORT_NON_SECURE;
+
+    // Persistent session: the broker keeps the subscriptions and the QoS 1 state while the board is away
+    s_client.clean_session    = 0;
+
+    s_connected = false;
+    ret = mqtt_connect(&s_client);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    struct pollfd fds = { .fd = s_client.transport.tcp.sock, .events = POLLIN };
+    if ((poll(&fds, 1, MQTT_APP_CONNACK_TIMEOUT_MS) <= 0) || (mqtt_input(&s_client) < 0) || !s_connected)
+    {
+        mqtt_abort(&s_client);
+        return s_connected ? -EIO : -ECONNREFUSED;
+    }
+
+    // The lanes only cover what the board sends, and here that is almost all publishes (up to
+    // thousands per second when benchmarking). Commands arrive on the RX path and are not affected.
+    net_lane_attach_socket(s_client.transport.tcp.sock, NET_LANE_BULK);
+
+    return 0;
+}
+
+/**
+ * @brief Subscribe to the command topic. Only needed when the broker had no session for us.
+ */
+static int mqtt_app_subscribe(void)
+{
+    struct mqtt_topic topic = {};
+    struct mqtt_subscription_list list = {};
+
+    topic.topic.utf8 = (const uint8_t *)s_cmd_topic;
+    topic.topic.size = strlen(s_cmd_topic);
+    topic.qos        = MQTT_QOS_1_AT_LEAST_ONCE;
+
+    s_next_message_id = (s_next_message_id == UINT16_MAX) ? 1 : (s_next_message_id + 1);
+    s_subscribe_id    = s_next_message_id;
+
+    list.list       = &topic;
+    list.list_count = 1;
+    list.message_id = s_subscribe_id;
+
+    return mqtt_subscribe(&s_client, &list);
+}
+
+/**
+ * @brief Serve one session until the connection or the network is lost
+ */
+static void mqtt_app_run_session(void)
+{
+    int64_t next_report_ms = k_uptime_get() + MQTT_APP_REPORT_INTERVAL_MS;
+    int ret;
+
+    if (s_session_present)
+    {
+        s_mqtt_stats.sessions_resumed++;
+        mqtt_app_mark_resumed("session present");
+        ret = 0;
+    }
+    else
+    {
+        ret = mqtt_app_subscribe();
+    }
+
+    if (ret == 0)
+    {
+        ret = mqtt_app_resend_inflight();
+    }
+
+    while ((ret >= 0) && s_connected && atomic_get(&s_network_up))
+    {
+        // Wake up at least once per flush window; queued messages go out together on the next pass
+        int timeout = MIN(mqtt_keepalive_time_left(&s_client), CONFIG_APP_MQTT_FLUSH_MS);
+        struct pollfd fds = { .fd = s_client.transport.tcp.sock, .events = POLLIN };
+
+        ret = poll(&fds, 1, timeout);
+        if (ret < 0)
+        {
+            ret = -errno;
+            break;
+        }
+
+        if (fds.revents & POLLIN)
+        {
+            ret = mqtt_input(&s_client);
+            if (ret < 0)
+            {
+                break;
+            }
+        }
+        if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+            ret = -ECONNRESET;
+            break;
+        }
+
+        ret = mqtt_live(&s_client);
+        if ((ret < 0) && (ret != -EAGAIN))
+        {
+            break;
+        }
+
+        ret = mqtt_app_flush();
+
+        if (k_uptime_get() >= next_report_ms)
+        {
+            mqtt_app_report();
+            next_report_ms += MQTT_APP_REPORT_INTERVAL_MS;
+        }
+    }
+
+    LOG_WRN("MQTT session lost: %d", ret);
+    journal_log(JOURNAL_EV_MQTT_LOST, ret);
+
+    if (s_connected)
+    {
+        mqtt_abort(&s_client);
+    }
+    s_connected = false;
+}
+
+/**
+ * @brief Connect while the network is up, and serve the session
+ */
+static void mqtt_app_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1)
+    {
+        if (!atomic_get(&s_network_up))
+        {
+            k_sem_take(&s_wake_sem, K_FOREVER);
+            continue;
+        }
+
+        if (s_resume_from_ms == 0)
+        {
+            s_resume_from_ms = k_uptime_get();
+        }
+
+        int ret = mqtt_app_connect();
+        if (ret < 0)
+        {
+            LOG_WRN("MQTT connection to %s failed: %d", CONFIG_APP_MQTT_BROKER, ret);
+
+            // A new network-up event cuts the wait short
+            k_sem_take(&s_wake_sem, K_MSEC(MQTT_APP_RETRY_MS));
+            continue;
+        }
+
+        LOG_INF("MQTT connected to %s as %s (session %s)", CONFIG_APP_MQTT_BROKER, CONFIG_APP_MQTT_CLIENT_ID,
+                s_session_present ? "resumed" : "new");
+        journal_log(JOURNAL_EV_MQTT_CONNECTED, s_session_present ? 1 : 0);
+
+        mqtt_app_run_session();
+    }
+}
+
+
+
+#if CONFIG_APP_MQTT_BENCH_RATE > 0
+/******************************************************************************
+FUNCTIONS DEFINITIONS - BENCHMARK
+******************************************************************************/
+/**
+ * @brief A benchmark buffer is free again
+ */
+static void mqtt_app_bench_release(void *user_data, int result)
+{
+    ARG_UNUSED(result);
+
+    atomic_clear_bit(s_bench_busy, (int)(uintptr_t)user_data);
+}
+
+/**
+ * @brief Publish CONFIG_APP_MQTT_BENCH_RATE messages per second from a fixed set of buffers
+ */
+static void mqtt_app_bench_handler(struct k_work *work)
+{
+    s_bench_credit = MIN(s_bench_credit + (CONFIG_APP_MQTT_BENCH_RATE * MQTT_APP_BENCH_TICK_MS) / 1000 + 1,
+                         (uint32_t)CONFIG_APP_MQTT_MAX_PENDING);
+
+    for (int i = 0; (i < CONFIG_APP_MQTT_MAX_PENDING) && (s_bench_credit > 0) && mqtt_app_is_connected(); i++)
+    {
+        if (atomic_test_and_set_bit(s_bench_busy, i))
+        {
+            continue;
+        }
+
+        // The buffer itself is handed to the client; it comes back through mqtt_app_bench_release()
+        uint8_t *buffer = s_bench_buffers[i];
+        sys_put_le32(s_bench_seq, &buffer[0]);
+        sys_put_le32(k_uptime_get_32(), &buffer[4]);
+        sys_put_le32(s_mqtt_stats.connects, &buffer[8]);
+
+        if (mqtt_app_publish(s_bench_topic, buffer, MQTT_APP_BENCH_PAYLOAD_SIZE, CONFIG_APP_MQTT_BENCH_QOS,
+                             mqtt_app_bench_release, (void *)(uintptr_t)i) != 0)
+        {
+            atomic_clear_bit(s_bench_busy, i);
+            break;
+        }
+
+        s_bench_seq++;
+        s_bench_credit--;
+    }
+
+    k_work_schedule(k_work_delayable_from_work(work), K_MSEC(MQTT_APP_BENCH_TICK_MS));
+}
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Create the client thread
+ */
+void mqtt_app_init(mqtt_app_message_cb on_message)
+{
+    s_on_message = on_message;
+    snprintf(s_cmd_topic, sizeof(s_cmd_topic), "%s/cmd", CONFIG_APP_MQTT_CLIENT_ID);
+
+    for (uint8_t i = 0; i < CONFIG_APP_MQTT_MAX_PENDING; i++)
+    {
+        k_msgq_put(&s_mqtt_free_q, &i, K_NO_WAIT);
+    }
+
+    k_sem_init(&s_wake_sem, 0, 1);
+    atomic_set(&s_network_up, 0);
+
+    k_tid_t tid = k_thread_create(&s_mqtt_thread, m_mqtt_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_mqtt_thread_stack),
+                                  mqtt_app_thread, NULL, NULL, NULL,
+                                  MQTT_APP_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "mqtt");
+
+#if CONFIG_APP_MQTT_BENCH_RATE > 0
+    snprintf(s_bench_topic, sizeof(s_bench_topic), "%s/bench", CONFIG_APP_MQTT_CLIENT_ID);
+    k_work_init_delayable(&s_bench_work, mqtt_app_bench_handler);
+    k_work_schedule(&s_bench_work, K_MSEC(MQTT_APP_BENCH_TICK_MS));
+#endif
+}
+
+/**
+ * @brief Connect (or reconnect at once after a Wi-Fi drop)
+ */
+void mqtt_app_network_up(void)
+{
+    atomic_set(&s_network_up, 1);
+    k_sem_give(&s_wake_sem);
+}
+
+/**
+ * @brief Drop the connection. The session stays on the broker, and the queued messages stay here.
+ */
+void mqtt_app_network_down(void)
+{
+    atomic_set(&s_network_up, 0);
+}
+
+/**
+ * @brief Queue a message for the next flush pass
+ */
+int mqtt_app_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos,
+                     mqtt_app_release_cb release, void *user_data)
+{
+    uint8_t index;
+
+    if (qos > MQTT_QOS_1_AT_LEAST_ONCE)
+    {
+        return -EINVAL;
+    }
+
+    if (k_msgq_get(&s_mqtt_free_q, &index, K_NO_WAIT) != 0)
+    {
+        s_mqtt_stats.rejected++;
+        return -ENOBUFS;
+    }
+
+    struct mqtt_app_slot *slot = &s_slots[index];
+    slot->topic      = topic;
+    slot->payload    = payload;
+    slot->len        = (uint32_t)len;
+    slot->qos        = qos;
+    slot->message_id = 0;
+    slot->release    = release;
+    slot->user_data  = user_data;
+
+    k_msgq_put(&s_mqtt_queued_q, &index, K_NO_WAIT);
+
+    return 0;
+}
+
+/**
+ * @brief True while the session is up
+ */
+bool mqtt_app_is_connected(void)
+{
+    return s_connected;
+}
+
+/**
+ * @brief Return a snapshot of the statistics
+ */
+struct mqtt_app_stats mqtt_app_get_stats(void)
+{
+    return s_mqtt_stats;
+}
+
+/**
+ * @brief Log the statistics
+ */
+void mqtt_app_report(void)
+{
+    LOG_INF("MQTT: %u connects (%u resumed), last resume %u ms (max %u) | %u qos0, %u qos1 acked, %u resent, "
+            "%u rejected, %u dropped | %u batches (max %u) | %u received",
+            s_mqtt_stats.connects, s_mqtt_stats.sessions_resumed, s_mqtt_stats.last_resume_ms, s_mqtt_stats.max_resume_ms,
+            s_mqtt_stats.published_qos0, s_mqtt_stats.acked_qos1, s_mqtt_stats.retransmitted,
+            s_mqtt_stats.rejected, s_mqtt_stats.dropped, s_mqtt_stats.batches, s_mqtt_stats.max_batch,
+            s_mqtt_stats.received);
+}
+#endif // CONFIG_APP_MQTT
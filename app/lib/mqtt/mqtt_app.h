@@ -0,0 +1,65 @@
+#ifndef LIB_MQTT_APP_H
+#define LIB_MQTT_APP_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define MQTT_APP_STACK_SIZE       3072
+#define MQTT_APP_THREAD_PRIORITY  9
+
+// Called once a message handed to mqtt_app_publish() is done with: 0 when it was sent (QoS 0) or
+// acknowledged (QoS 1), a negative errno when it was dropped. The payload may be reused from here on.
+typedef void (*mqtt_app_release_cb)(void *user_data, int result);
+
+// Called from the client thread for every message received on the command topic
+typedef void (*mqtt_app_message_cb)(const uint8_t *payload, size_t len);
+
+// Client statistics
+struct mqtt_app_stats
+{
+    uint32_t connects;            // Successful CONNACKs
+    uint32_t sessions_resumed;    // CONNACKs with the session present: no re-subscription needed
+    uint32_t published_qos0;      // QoS 0 messages written to the socket
+    uint32_t acked_qos1;          // QoS 1 messages acknowledged by the broker
+    uint32_t retransmitted;       // QoS 1 messages re-sent (DUP) after a reconnect
+    uint32_t rejected;            // mqtt_app_publish() calls refused because every slot was in use
+    uint32_t dropped;             // Messages released with an error
+    uint32_t received;            // Messages received on the command topic
+    uint32_t batches;             // Flush passes that wrote at least one message
+    uint32_t max_batch;           // Most messages written in one pass
+    uint32_t last_resume_ms;      // Connection loss (or link-up) to publishing again, last time
+    uint32_t max_resume_ms;       // Same, worst case
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Create the client thread. It stays idle until the network is up.
+void mqtt_app_init(mqtt_app_message_cb on_message);
+
+// The network is usable (connected state) / gone. Queued and unacknowledged messages are kept while down.
+void mqtt_app_network_up(void);
+void mqtt_app_network_down(void);
+
+// Queue a message. Nothing is copied: 'topic' and 'payload' must stay valid until 'release' is called.
+// Callable from any thread or ISR; never blocks. -ENOBUFS if every slot is in use, -EINVAL for QoS above 1.
+int mqtt_app_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos,
+                     mqtt_app_release_cb release, void *user_data);
+
+// True while a session with the broker is established
+bool mqtt_app_is_connected(void);
+
+// Read and log the statistics
+struct mqtt_app_stats mqtt_app_get_stats(void);
+void mqtt_app_report(void);
+
+#endif // LIB_MQTT_APP_H
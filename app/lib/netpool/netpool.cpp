@@ -0,0 +1,207 @@
+/******************************************************************************
+Module: NETPOOL.CPP
+
+Description: This file contains the dedicated net_pkt pools used by the servers.
+             Each traffic lane gets its own TX packet slab and data buffer pool,
+             which are bound to the lane's sockets via net_context_setup_pools()
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/fdtable.h>
+#include <zephyr/net/net_context.h>
+
+// Project specific headers
+#include "netpool.h"
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(netpool, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  POOLS
+ *****************************************************************************/
+// Control lane: small, so a flood of bulk data can never take the packets that carry commands
+NET_PKT_TX_SLAB_DEFINE(control_tx_pkts, CONFIG_APP_NET_LANE_CONTROL_TX_PKT_COUNT);
+NET_PKT_DATA_POOL_DEFINE(control_data_bufs, CONFIG_APP_NET_LANE_CONTROL_DATA_BUF_COUNT);
+
+// Bulk lane: sized for throughput
+NET_PKT_TX_SLAB_DEFINE(bulk_tx_pkts, CONFIG_APP_NET_LANE_BULK_TX_PKT_COUNT);
+NET_PKT_DATA_POOL_DEFINE(bulk_data_bufs, CONFIG_APP_NET_LANE_BULK_DATA_BUF_COUNT);
+
+// net_context_setup_pools() takes getter functions rather than the pools themselves
+static struct k_mem_slab *control_tx_slab(void)       { return &control_tx_pkts; }
+static struct net_buf_pool *control_data_pool(void)   { return &control_data_bufs; }
+static struct k_mem_slab *bulk_tx_slab(void)          { return &bulk_tx_pkts; }
+static struct net_buf_pool *bulk_data_pool(void)      { return &bulk_data_bufs; }
+
+// Per-lane bookkeeping
+struct net_lane_pools
+{
+    const char            *name;
+    struct k_mem_slab     *(*tx_slab)(void);
+    struct net_buf_pool   *(*data_pool)(void);
+    uint32_t               data_buf_total;
+    uint32_t               tx_pkt_max_used;     // Sampled watermarks, see net_lane_sample()
+    uint32_t               data_buf_max_used;
+};
+
+static struct net_lane_pools s_lanes[NET_LANE_COUNT] = {
+    { "control", control_tx_slab, control_data_pool, CONFIG_APP_NET_LANE_CONTROL_DATA_BUF_COUNT, 0, 0 },
+    { "bulk",    bulk_tx_slab,    bulk_data_pool,    CONFIG_APP_NET_LANE_BULK_DATA_BUF_COUNT,    0, 0 },
+};
+
+// Protects the sampled watermarks, which every sending thread updates
+static struct k_spinlock s_lanes_lock;
+
+// Periodic report
+static struct k_work_delayable s_report_work;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Work handler that logs the lane occupancy and re-arms itself
+ */
+static void report_work_handler(struct k_work *work)
+{
+    net_lane_report();
+    k_work_schedule(&s_report_work, K_SECONDS(CONFIG_APP_NET_LANE_REPORT_INTERVAL_SEC));
+}
+
+/**
+ * @brief Start the periodic occupancy report, if enabled
+ */
+void net_lane_init(void)
+{
+    k_work_init_delayable(&s_report_work, report_work_handler);
+
+    if (CONFIG_APP_NET_LANE_REPORT_INTERVAL_SEC > 0)
+    {
+        k_work_schedule(&s_report_work, K_SECONDS(CONFIG_APP_NET_LANE_REPORT_INTERVAL_SEC));
+    }
+}
+
+/**
+ * @brief Bind the lane's TX slab and data pool to the net_context behind a socket
+ * Every packet this socket sends afterwards is allocated from the lane instead of the global pools.
+ */
+int net_lane_attach_socket(int sock, enum net_lane lane)
+{
+#if defined(CONFIG_NET_CONTEXT_NET_PKT_POOL)
+    // The socket layer keeps the net_context as the file descriptor object
+    struct net_context *ctx = static_cast<struct net_context *>(zvfs_get_fd_obj(sock, NULL, EBADF));
+    if (ctx == NULL)
+    {
+        LOG_ERR("No net_context behind socket %d", sock);
+        return -EBADF;
+    }
+
+    net_context_setup_pools(ctx, s_lanes[lane].tx_slab, s_lanes[lane].data_pool);
+    LOG_DBG("Socket %d uses the %s lane pools", sock, s_lanes[lane].name);
+
+    return 0;
+#else
+    ARG_UNUSED(sock);
+    ARG_UNUSED(lane);
+
+    return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Number of data buffers currently taken from a lane's pool
+ * The pool only exposes its free count when CONFIG_NET_BUF_POOL_USAGE is enabled.
+ */
+static uint32_t data_bufs_used(struct net_lane_pools *pools)
+{
+#if defined(CONFIG_NET_BUF_POOL_USAGE)
+    return pools->data_buf_total - atomic_get(&pools->data_pool()->avail_count);
+#else
+    ARG_UNUSED(pools);
+
+    return 0;
+#endif
+}
+
+/**
+ * @brief Sample the lane's pools and update the watermarks
+ * Called right after a send, when the packets just queued are still held by the stack,
+ * so the watermarks catch bursts that the periodic report would miss.
+ */
+void net_lane_sample(enum net_lane lane)
+{
+    struct net_lane_pools *pools = &s_lanes[lane];
+    uint32_t tx_used  = k_mem_slab_num_used_get(pools->tx_slab());
+    uint32_t buf_used = data_bufs_used(pools);
+
+    K_SPINLOCK(&s_lanes_lock)
+    {
+        pools->tx_pkt_max_used   = MAX(pools->tx_pkt_max_used, tx_used);
+        pools->data_buf_max_used = MAX(pools->data_buf_max_used, buf_used);
+    }
+}
+
+/**
+ * @brief Read the current occupancy and watermarks of a lane
+ */
+void net_lane_get_usage(enum net_lane lane, struct net_lane_usage *usage)
+{
+    struct net_lane_pools *pools = &s_lanes[lane];
+    struct k_mem_slab *slab = pools->tx_slab();
+
+    net_lane_sample(lane);
+
+    // TX packet slab. The kernel tracks the exact watermark when slab tracing is enabled.
+    usage->tx_pkt_total = slab->info.num_blocks;
+    usage->tx_pkt_used  = k_mem_slab_num_used_get(slab);
+
+    // Data buffer pool
+    usage->data_buf_total = pools->data_buf_total;
+    usage->data_buf_used  = data_bufs_used(pools);
+
+    K_SPINLOCK(&s_lanes_lock)
+    {
+        usage->tx_pkt_max_used   = pools->tx_pkt_max_used;
+        usage->data_buf_max_used = pools->data_buf_max_used;
+    }
+
+#if defined(CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION)
+    usage->tx_pkt_max_used = k_mem_slab_max_used_get(slab);
+#endif
+}
+
+/**
+ * @brief Log the occupancy and watermarks of every lane
+ */
+void net_lane_report(void)
+{
+    struct net_lane_usage usage;
+
+    for (int lane = 0; lane < NET_LANE_COUNT; lane++)
+    {
+        net_lane_get_usage(static_cast<enum net_lane>(lane), &usage);
+
+#if defined(CONFIG_NET_BUF_POOL_USAGE)
+        LOG_INF("Lane %s: tx pkts %u/%u (max %u), data bufs %u/%u (max %u)",
+                s_lanes[lane].name,
+                usage.tx_pkt_used, usage.tx_pkt_total, usage.tx_pkt_max_used,
+                usage.data_buf_used, usage.data_buf_total, usage.data_buf_max_used);
+#else
+        LOG_INF("Lane %s: tx pkts %u/%u (max %u), data bufs n/a of %u (no CONFIG_NET_BUF_POOL_USAGE)",
+                s_lanes[lane].name,
+                usage.tx_pkt_used, usage.tx_pkt_total, usage.tx_pkt_max_used, usage.data_buf_total);
+#endif
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef LIB_NETPOOL_H
+#define LIB_NETPOOL_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_pkt.h>
+#include <zephyr/net_buf.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Traffic lanes. Each lane owns its own TX packet slab and data buffer pool,
+// so a busy lane can only exhaust its own packets, never the other lanes' or the global ones.
+enum net_lane
+{
+    NET_LANE_CONTROL = 0,   // Commands and short replies
+    NET_LANE_BULK,          // Large transfers and streaming data
+    NET_LANE_COUNT
+};
+
+// Occupancy of one lane's pools
+struct net_lane_usage
+{
+    uint32_t tx_pkt_total;       // Packets in the TX slab
+    uint32_t tx_pkt_used;        // Packets currently allocated
+    uint32_t tx_pkt_max_used;    // Highest number of packets allocated at once
+    uint32_t data_buf_total;     // Buffers in the data pool
+    uint32_t data_buf_used;      // Buffers currently allocated. 0 without CONFIG_NET_BUF_POOL_USAGE.
+    uint32_t data_buf_max_used;  // Highest number of buffers seen allocated at once. 0 without it too.
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Start the periodic occupancy report
+void net_lane_init(void);
+
+// Make every packet sent through this socket come from the lane's pools
+int net_lane_attach_socket(int sock, enum net_lane lane);
+
+// Sample the lane's pools and update the watermarks. Cheap enough to call after every send.
+void net_lane_sample(enum net_lane lane);
+
+// Read the current occupancy and watermarks of a lane
+void net_lane_get_usage(enum net_lane lane, struct net_lane_usage *usage);
+
+// Log the occupancy and watermarks of every lane
+void net_lane_report(void);
+
+#endif // LIB_NETPOOL_H
@@ -0,0 +1,510 @@
+/******************************************************************************
+Module: RUDP.CPP
+
+Description: This file contains a lightweight reliable-datagram transport on
+             top of a UDP socket. Messages carry sequence numbers, the
+             receiver answers every message with a cumulative plus selective
+             ACK and drops duplicates, and the sender keeps a sliding window
+             of preallocated retransmit buffers. Messages are delivered as
+             soon as they arrive, so one lost message does not hold back the
+             ones behind it
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/random/random.h>
+
+// Project specific headers
+#include "rudp.h"
+#include "latency.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(rudp, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Header layout
+#define RUDP_HDR_MAGIC_OFS    0
+#define RUDP_HDR_TYPE_OFS     2
+#define RUDP_HDR_FLAGS_OFS    3
+#define RUDP_HDR_SESSION_OFS  4
+#define RUDP_HDR_SEQ_OFS      8
+#define RUDP_ACK_SACK_OFS     12
+
+// Width of the selective-ACK bitmap, hence the largest usable window
+#define RUDP_SACK_BITS        32
+
+// Bounds of the retransmission timeout
+#define RUDP_MAX_RTO_MS       2000
+
+BUILD_ASSERT(CONFIG_APP_RUDP_WINDOW <= RUDP_SACK_BITS, "The send window cannot exceed the SACK bitmap");
+
+
+
+/******************************************************************************
+  PEERS
+ *****************************************************************************/
+// One message in flight, kept until it is acknowledged
+struct rudp_tx_slot
+{
+    bool     in_use;
+    uint8_t  retries;
+    uint16_t len;           // Datagram length, header included
+    uint32_t seq;
+    int64_t  sent_ms;       // Last (re)transmission
+    uint32_t first_sent;    // latency_now() of the first transmission
+    uint8_t  datagram[RUDP_MAX_DATAGRAM];
+};
+
+struct rudp_peer
+{
+    bool               in_use;
+    struct sockaddr_in addr;
+    uint32_t           rx_session;    // Session id chosen by the peer
+    uint32_t           tx_session;    // Session id of our messages to the peer
+    int64_t            last_seen_ms;
+
+    // Receive side: next sequence number expected and which later ones already arrived
+    uint32_t           rx_next;
+    uint32_t           rx_sack;
+
+    // Send side: oldest unacknowledged and next sequence numbers, and the window buffers
+    uint32_t           tx_base;
+    uint32_t           tx_next;
+    struct rudp_tx_slot slots[CONFIG_APP_RUDP_WINDOW];
+
+    // Retransmission timeout estimate (RFC 6298, in ms)
+    int32_t            srtt_ms;
+    int32_t            rttvar_ms;
+    int32_t            rto_ms;
+};
+
+static struct rudp_peer s_peers[CONFIG_APP_RUDP_MAX_PEERS];
+static struct rudp_stats s_rudp_stats;
+static int s_rudp_sock = -1;
+
+// Time from the first transmission of a message to its acknowledgement
+LATENCY_HISTOGRAM_DEFINE(s_rudp_send_to_ack, "rudp send->ack");
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - HELPERS
+******************************************************************************/
+/**
+ * @brief Signed distance between two sequence numbers, valid across the 32-bit wrap
+ */
+static inline int32_t rudp_seq_diff(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b);
+}
+
+/**
+ * @brief Forget everything about a peer and start a new session with it
+ */
+static void rudp_peer_reset(struct rudp_peer *peer, const struct sockaddr_in *addr, uint32_t session)
+{
+    memset(peer, 0, sizeof(*peer));
+
+    peer->in_use     = true;
+    peer->addr       = *addr;
+    peer->rx_session = session;
+    peer->tx_session = sys_rand32_get();
+    peer->rto_ms     = CONFIG_APP_RUDP_INITIAL_RTO_MS;
+}
+
+/**
+ * @brief Find the peer of a source address, or take a free (or the least recently seen) entry
+ */
+static int rudp_peer_lookup(const struct sockaddr_in *addr, uint32_t session)
+{
+    int oldest = 0;
+
+    for (int i = 0; i < CONFIG_APP_RUDP_MAX_PEERS; i++)
+    {
+        struct rudp_peer *peer = &s_peers[i];
+
+        if (peer->in_use && (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr) &&
+            (peer->addr.sin_port == addr->sin_port))
+        {
+            // A new session id means the peer restarted: its sequence numbers start over
+            if (peer->rx_session != session)
+            {
+                s_rudp_stats.peers_reset++;
+                rudp_peer_reset(peer, addr, session);
+            }
+            return i;
+        }
+
+        if (!peer->in_use || (s_peers[oldest].in_use && (peer->last_seen_ms < s_peers[oldest].last_seen_ms)))
+        {
+            oldest = i;
+        }
+    }
+
+    if (s_peers[oldest].in_use)
+    {
+        LOG_WRN("Peer table full, dropping the least recent peer");
+    }
+    rudp_peer_reset(&s_peers[oldest], addr, session);
+
+    return oldest;
+}
+
+/**
+ * @brief Write the common header
+ */
+static void rudp_put_header(uint8_t *buf, uint8_t type, uint32_t session, uint32_t seq)
+{
+    sys_put_le16(RUDP_MAGIC, &buf[RUDP_HDR_MAGIC_OFS]);
+    buf[RUDP_HDR_TYPE_OFS]  = type;
+    buf[RUDP_HDR_FLAGS_OFS] = 0;
+    sys_put_le32(session, &buf[RUDP_HDR_SESSION_OFS]);
+    sys_put_le32(seq, &buf[RUDP_HDR_SEQ_OFS]);
+}
+
+/**
+ * @brief Send a datagram to a peer
+ */
+static void rudp_transmit(struct rudp_peer *peer, const uint8_t *buf, size_t len)
+{
+    if (sendto(s_rudp_sock, buf, len, 0, (const struct sockaddr *)&peer->addr, sizeof(peer->addr)) < 0)
+    {
+        LOG_WRN("sendto failed: %d", errno);
+    }
+}
+
+/**
+ * @brief Update the retransmission timeout with a new round-trip sample
+ */
+static void rudp_update_rto(struct rudp_peer *peer, int32_t rtt_ms)
+{
+    if (peer->srtt_ms == 0)
+    {
+        peer->srtt_ms   = rtt_ms;
+        peer->rttvar_ms = rtt_ms / 2;
+    }
+    else
+    {
+        peer->rttvar_ms = (3 * peer->rttvar_ms + ABS(peer->srtt_ms - rtt_ms)) / 4;
+        peer->srtt_ms   = (7 * peer->srtt_ms + rtt_ms) / 8;
+    }
+
+    peer->rto_ms = CLAMP(peer->srtt_ms + 4 * peer->rttvar_ms, CONFIG_APP_RUDP_MIN_RTO_MS, RUDP_MAX_RTO_MS);
+}
+
+/**
+ * @brief Record a DATA sequence number in the receive window
+ * Returns true if the message is new, false if it is a duplicate or out of the window.
+ */
+static bool rudp_accept_seq(struct rudp_peer *peer, uint32_t seq)
+{
+    int32_t distance = rudp_seq_diff(seq, peer->rx_next);
+
+    if (distance < 0)
+    {
+        s_rudp_stats.rx_duplicates++;
+        return false;
+    }
+
+    if (distance == 0)
+    {
+        // Slide the window over this message and every later one that already arrived
+        peer->rx_next++;
+        while (peer->rx_sack & 1)
+        {
+            peer->rx_sack >>= 1;
+            peer->rx_next++;
+        }
+        peer->rx_sack >>= 1;
+        return true;
+    }
+
+    if (distance > RUDP_SACK_BITS)
+    {
+        s_rudp_stats.rx_out_of_window++;
+        return false;
+    }
+
+    uint32_t bit = BIT(distance - 1);
+    if (peer->rx_sack & bit)
+    {
+        s_rudp_stats.rx_duplicates++;
+        return false;
+    }
+
+    peer->rx_sack |= bit;
+    return true;
+}
+
+/**
+ * @brief Release the slots acknowledged by a cumulative ACK and its selective bitmap
+ */
+static void rudp_handle_ack(struct rudp_peer *peer, uint32_t cumulative, uint32_t sack)
+{
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < CONFIG_APP_RUDP_WINDOW; i++)
+    {
+        struct rudp_tx_slot *slot = &peer->slots[i];
+        if (!slot->in_use)
+        {
+            continue;
+        }
+
+        int32_t distance = rudp_seq_diff(slot->seq, cumulative);
+        bool acked = (distance < 0) || ((distance >= 1) && (distance <= RUDP_SACK_BITS) && (sack & BIT(distance - 1)));
+        if (!acked)
+        {
+            continue;
+        }
+
+        // Karn's rule: only messages sent once give an unambiguous round-trip sample
+        if (slot->retries == 0)
+        {
+            rudp_update_rto(peer, (int32_t)MAX(now - slot->sent_ms, (int64_t)1));
+        }
+        latency_record(&s_rudp_send_to_ack, slot->first_sent, latency_now());
+
+        slot->in_use = false;
+        s_rudp_stats.tx_acked++;
+    }
+
+    // The window starts at the oldest message still in flight
+    while ((peer->tx_base != peer->tx_next) && !peer->slots[peer->tx_base % CONFIG_APP_RUDP_WINDOW].in_use)
+    {
+        peer->tx_base++;
+    }
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Reset every peer and remember the socket used to send
+ */
+void rudp_init(int sock)
+{
+    memset(s_peers, 0, sizeof(s_peers));
+    s_rudp_sock = sock;
+
+    LOG_INF("Reliable UDP: window %d, %d B payload, %d peers (%u B of retransmit buffers)",
+            CONFIG_APP_RUDP_WINDOW, CONFIG_APP_RUDP_MAX_PAYLOAD, CONFIG_APP_RUDP_MAX_PEERS,
+            (uint32_t)sizeof(s_peers));
+}
+
+/**
+ * @brief Process one received datagram and acknowledge it
+ */
+int rudp_receive(const uint8_t *buf, int len, const struct sockaddr *from, socklen_t from_len,
+                 const uint8_t **payload, int *peer_index)
+{
+    if ((len < RUDP_DATA_HEADER_SIZE) || (sys_get_le16(&buf[RUDP_HDR_MAGIC_OFS]) != RUDP_MAGIC) ||
+        (from->sa_family != AF_INET) || (from_len < sizeof(struct sockaddr_in)))
+    {
+        return -EINVAL;
+    }
+
+    uint8_t type     = buf[RUDP_HDR_TYPE_OFS];
+    uint32_t session = sys_get_le32(&buf[RUDP_HDR_SESSION_OFS]);
+    uint32_t seq     = sys_get_le32(&buf[RUDP_HDR_SEQ_OFS]);
+
+    if (type == RUDP_TYPE_ACK)
+    {
+        // ACKs carry our own session id: find the peer by address only
+        const struct sockaddr_in *addr = (const struct sockaddr_in *)from;
+        for (int i = 0; i < CONFIG_APP_RUDP_MAX_PEERS; i++)
+        {
+            struct rudp_peer *peer = &s_peers[i];
+            if (peer->in_use && (peer->tx_session == session) &&
+                (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr) && (peer->addr.sin_port == addr->sin_port) &&
+                (len >= RUDP_ACK_SIZE))
+            {
+                peer->last_seen_ms = k_uptime_get();
+                rudp_handle_ack(peer, seq, sys_get_le32(&buf[RUDP_ACK_SACK_OFS]));
+            }
+        }
+        return 0;
+    }
+
+    if ((type != RUDP_TYPE_DATA) || (len == RUDP_DATA_HEADER_SIZE))
+    {
+        return -EINVAL;
+    }
+
+    int index = rudp_peer_lookup((const struct sockaddr_in *)from, session);
+    struct rudp_peer *peer = &s_peers[index];
+    peer->last_seen_ms = k_uptime_get();
+
+    // Flow control: while our send window to this peer is full, the application could not answer a new
+    // message, so it is neither delivered nor acknowledged. The peer retransmits it after its timeout.
+    int32_t distance = rudp_seq_diff(seq, peer->rx_next);
+    bool would_be_new = (distance == 0) ||
+                        ((distance > 0) && (distance <= RUDP_SACK_BITS) && !(peer->rx_sack & BIT(distance - 1)));
+    if (would_be_new && (peer->tx_next - peer->tx_base >= CONFIG_APP_RUDP_WINDOW))
+    {
+        s_rudp_stats.rx_deferred++;
+        return 0;
+    }
+
+    bool is_new = rudp_accept_seq(peer, seq);
+
+    // Acknowledge duplicates too: the peer retransmits because our previous ACK was lost
+    uint8_t ack[RUDP_ACK_SIZE];
+    rudp_put_header(ack, RUDP_TYPE_ACK, session, peer->rx_next);
+    sys_put_le32(peer->rx_sack, &ack[RUDP_ACK_SACK_OFS]);
+    rudp_transmit(peer, ack, sizeof(ack));
+    s_rudp_stats.acks_sent++;
+
+    if (!is_new)
+    {
+        return 0;
+    }
+
+    s_rudp_stats.rx_delivered++;
+    *payload = &buf[RUDP_DATA_HEADER_SIZE];
+    *peer_index = index;
+
+    return len - RUDP_DATA_HEADER_SIZE;
+}
+
+/**
+ * @brief Copy a message into a free window slot and send it
+ */
+int rudp_send(int peer_index, const void *data, size_t len)
+{
+    struct rudp_peer *peer = &s_peers[peer_index];
+
+    if (len > CONFIG_APP_RUDP_MAX_PAYLOAD)
+    {
+        return -EMSGSIZE;
+    }
+    if (!peer->in_use || (peer->tx_next - peer->tx_base >= CONFIG_APP_RUDP_WINDOW))
+    {
+        return -EAGAIN;
+    }
+
+    struct rudp_tx_slot *slot = &peer->slots[peer->tx_next % CONFIG_APP_RUDP_WINDOW];
+
+    slot->in_use     = true;
+    slot->retries    = 0;
+    slot->seq        = peer->tx_next++;
+    slot->len        = RUDP_DATA_HEADER_SIZE + len;
+    slot->sent_ms    = k_uptime_get();
+    slot->first_sent = latency_now();
+    rudp_put_header(slot->datagram, RUDP_TYPE_DATA, peer->tx_session, slot->seq);
+    memcpy(&slot->datagram[RUDP_DATA_HEADER_SIZE], data, len);
+
+    rudp_transmit(peer, slot->datagram, slot->len);
+    s_rudp_stats.tx_messages++;
+
+    return 0;
+}
+
+/**
+ * @brief Retransmit every message whose timeout expired, backing off exponentially per message
+ */
+void rudp_service(void)
+{
+    int64_t now = k_uptime_get();
+
+    for (int p = 0; p < CONFIG_APP_RUDP_MAX_PEERS; p++)
+    {
+        struct rudp_peer *peer = &s_peers[p];
+        if (!peer->in_use)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < CONFIG_APP_RUDP_WINDOW; i++)
+        {
+            struct rudp_tx_slot *slot = &peer->slots[i];
+            if (!slot->in_use || (now - slot->sent_ms < MIN(peer->rto_ms << slot->retries, RUDP_MAX_RTO_MS)))
+            {
+                continue;
+            }
+
+            if (slot->retries >= CONFIG_APP_RUDP_MAX_RETRIES)
+            {
+                LOG_WRN("Giving up message %u after %d retries", slot->seq, slot->retries);
+                slot->in_use = false;
+                s_rudp_stats.tx_failed++;
+                continue;
+            }
+
+            slot->retries++;
+            slot->sent_ms = now;
+            rudp_transmit(peer, slot->datagram, slot->len);
+            s_rudp_stats.tx_retransmits++;
+        }
+
+        // Given-up messages leave the window too
+        while ((peer->tx_base != peer->tx_next) && !peer->slots[peer->tx_base % CONFIG_APP_RUDP_WINDOW].in_use)
+        {
+            peer->tx_base++;
+        }
+    }
+}
+
+/**
+ * @brief Time until the earliest retransmission
+ */
+int rudp_next_timeout_ms(void)
+{
+    int64_t now = k_uptime_get();
+    int64_t timeout = CONFIG_APP_RUDP_TICK_MS;
+
+    for (int p = 0; p < CONFIG_APP_RUDP_MAX_PEERS; p++)
+    {
+        struct rudp_peer *peer = &s_peers[p];
+
+        for (int i = 0; peer->in_use && (i < CONFIG_APP_RUDP_WINDOW); i++)
+        {
+            struct rudp_tx_slot *slot = &peer->slots[i];
+            if (slot->in_use)
+            {
+                int64_t due = slot->sent_ms + MIN(peer->rto_ms << slot->retries, RUDP_MAX_RTO_MS);
+                timeout = MIN(timeout, MAX(due - now, (int64_t)1));
+            }
+        }
+    }
+
+    return (int)timeout;
+}
+
+/**
+ * @brief Return a snapshot of the statistics
+ */
+struct rudp_stats rudp_get_stats(void)
+{
+    return s_rudp_stats;
+}
+
+/**
+ * @brief Log the statistics and the send->ack latency
+ */
+void rudp_report(void)
+{
+    LOG_INF("RUDP rx: %u delivered, %u duplicates, %u out of window, %u deferred | tx: %u sent, %u retransmits, %u acked, %u failed",
+            s_rudp_stats.rx_delivered, s_rudp_stats.rx_duplicates, s_rudp_stats.rx_out_of_window, s_rudp_stats.rx_deferred,
+            s_rudp_stats.tx_messages, s_rudp_stats.tx_retransmits, s_rudp_stats.tx_acked, s_rudp_stats.tx_failed);
+
+    latency_report(&s_rudp_send_to_ack);
+}
@@ -0,0 +1,73 @@
+#ifndef LIB_RUDP_H
+#define LIB_RUDP_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Wire format (little-endian). Every datagram starts with:
+//   magic u16 ("RU"), type u8, flags u8, session u32, seq u32
+// An ACK adds a u32 selective-ACK bitmap. In an ACK, 'seq' is the cumulative ACK: the next
+// sequence number expected, all earlier ones were received. Bit i of the bitmap acknowledges
+// sequence number seq + 1 + i.
+#define RUDP_MAGIC             0x5552
+#define RUDP_TYPE_DATA         0x01
+#define RUDP_TYPE_ACK          0x02
+#define RUDP_DATA_HEADER_SIZE  12
+#define RUDP_ACK_SIZE          16
+
+// Largest reliable datagram on the wire
+#define RUDP_MAX_DATAGRAM      (RUDP_DATA_HEADER_SIZE + CONFIG_APP_RUDP_MAX_PAYLOAD)
+
+// Transport statistics, accumulated over every peer since boot
+struct rudp_stats
+{
+    uint32_t rx_delivered;      // New messages handed to the application
+    uint32_t rx_duplicates;     // Retransmissions of messages already delivered
+    uint32_t rx_out_of_window;  // Messages too far ahead of the receive window
+    uint32_t rx_deferred;       // New messages left unacknowledged while the send window to their peer was full
+    uint32_t acks_sent;
+    uint32_t tx_messages;       // Messages accepted by rudp_send()
+    uint32_t tx_retransmits;
+    uint32_t tx_acked;
+    uint32_t tx_failed;         // Messages given up after CONFIG_APP_RUDP_MAX_RETRIES
+    uint32_t peers_reset;       // Peers that started a new session
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Reset every peer and send through this (bound, IPv4) socket
+void rudp_init(int sock);
+
+// Process one received datagram. The ACK is sent from here.
+// Returns the length of a newly delivered message ('*payload' and '*peer' are set),
+// 0 if nothing is delivered (ACK, duplicate), or -EINVAL if it is not a reliable datagram.
+// While the send window to a peer is full, its new messages are not delivered nor acknowledged, so an
+// application that answers each message with one rudp_send() always finds room for the answer.
+int rudp_receive(const uint8_t *buf, int len, const struct sockaddr *from, socklen_t from_len,
+                 const uint8_t **payload, int *peer);
+
+// Queue a message to a peer and send it. -EAGAIN if the send window is full, -EMSGSIZE if too long.
+int rudp_send(int peer, const void *data, size_t len);
+
+// Retransmit the messages whose timeout expired. Call at least every rudp_next_timeout_ms().
+void rudp_service(void);
+
+// Time (ms) until the next retransmission is due, or CONFIG_APP_RUDP_TICK_MS if nothing is in flight
+int rudp_next_timeout_ms(void);
+
+// Read and log the statistics
+struct rudp_stats rudp_get_stats(void);
+void rudp_report(void);
+
+#endif // LIB_RUDP_H
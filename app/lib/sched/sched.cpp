@@ -0,0 +1,334 @@
+/******************************************************************************
+Module: SCHED.CPP
+
+Description: This file contains the scheduler of time-triggered commands.
+             Commands carry a target time on the synchronised clock. A kernel
+             timer wakes a high-priority thread shortly before the earliest
+             one, and the thread spins on the cycle counter for the rest, so
+             the action does not inherit the jitter of the network, the
+             logging or the receive thread
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+
+// Project specific headers
+#include "sched.h"
+#include "timesync.h"
+
+// Standard Library
+#include <cstring>
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_sched_thread_stack, SCHED_STACK_SIZE);
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(sched, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Datagram layout
+#define SCHED_PKT_MAGIC_OFS   0
+#define SCHED_PKT_TIME_OFS    4
+#define SCHED_PKT_ACTION_OFS  12
+#define SCHED_PKT_ARGS_OFS    13
+
+
+
+/******************************************************************************
+  QUEUE
+ *****************************************************************************/
+// Pending commands, sorted by target time (earliest first)
+static struct sched_command s_queue[CONFIG_APP_SCHED_MAX_COMMANDS];
+static size_t s_queue_len;
+static struct k_spinlock s_queue_lock;
+
+static struct k_thread s_sched_thread;
+static struct k_timer s_sched_timer;
+static struct k_sem s_sched_wake;
+static sched_action_fn s_action;
+
+// Written by the UDP thread (queued, rejected) and the scheduler thread (firing), so always under the lock
+static struct sched_stats s_sched_stats;
+static struct k_spinlock s_stats_lock;
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Timer expiry (interrupt context): wake the scheduler thread
+ */
+static void sched_timer_expired(struct k_timer *timer)
+{
+    ARG_UNUSED(timer);
+
+    k_sem_give(&s_sched_wake);
+}
+
+/**
+ * @brief Account the firing error and the action duration of one command. Returns the number of commands fired.
+ */
+static uint32_t sched_record_error(int32_t error_us, uint32_t action_us, uint32_t uncertainty_us)
+{
+    uint32_t fired;
+
+    K_SPINLOCK(&s_stats_lock)
+    {
+        if (s_sched_stats.fired == 0)
+        {
+            s_sched_stats.error_min_us = error_us;
+            s_sched_stats.error_max_us = error_us;
+        }
+
+        s_sched_stats.fired++;
+        s_sched_stats.error_min_us = MIN(s_sched_stats.error_min_us, error_us);
+        s_sched_stats.error_max_us = MAX(s_sched_stats.error_max_us, error_us);
+        s_sched_stats.error_abs_sum_us += (uint32_t)ABS(error_us);
+        s_sched_stats.last_error_us = error_us;
+        s_sched_stats.action_max_us = MAX(s_sched_stats.action_max_us, action_us);
+        s_sched_stats.last_action_us = action_us;
+        s_sched_stats.last_uncertainty_us = uncertainty_us;
+        fired = s_sched_stats.fired;
+    }
+
+    return fired;
+}
+
+/**
+ * @brief Fire every command that is due, then arm the timer for the next one
+ */
+static void sched_run_due(void)
+{
+    while (true)
+    {
+        struct sched_command cmd;
+        bool have_cmd = false;
+
+        K_SPINLOCK(&s_queue_lock)
+        {
+            if (s_queue_len > 0)
+            {
+                cmd = s_queue[0];
+                have_cmd = true;
+            }
+        }
+        if (!have_cmd)
+        {
+            return;
+        }
+
+        // Converted at fire time, so a resync since the command was queued is taken into account
+        int64_t target_local = timesync_utc_to_local_us(cmd.at_utc_us);
+        int64_t remaining = target_local - timesync_local_us();
+
+        if (remaining > CONFIG_APP_SCHED_SPIN_US)
+        {
+            // Wake up a little early: the timer is only as precise as the system tick
+            k_timer_start(&s_sched_timer, K_USEC(remaining - CONFIG_APP_SCHED_SPIN_US), K_NO_WAIT);
+            return;
+        }
+
+        // Take the command out before the spin; a command inserted meanwhile is handled on the next pass
+        K_SPINLOCK(&s_queue_lock)
+        {
+            for (size_t i = 0; i < s_queue_len; i++)
+            {
+                if ((s_queue[i].at_utc_us == cmd.at_utc_us) && (s_queue[i].action == cmd.action) &&
+                    (memcmp(s_queue[i].args, cmd.args, sizeof(cmd.args)) == 0))
+                {
+                    s_queue_len--;
+                    memmove(&s_queue[i], &s_queue[i + 1], (s_queue_len - i) * sizeof(s_queue[0]));
+                    break;
+                }
+            }
+        }
+
+        // The last stretch is a busy wait on the cycle counter. A cooperative thread is not preempted here.
+        int64_t now_local;
+        do
+        {
+            now_local = timesync_local_us();
+        } while (now_local < target_local);
+
+        // The firing error is the scheduling jitter: taken when the action starts. How long the action itself
+        // takes (e.g. a 300-pixel LED frame shifting out) is accounted separately.
+        int64_t start_local = timesync_local_us();
+        s_action(&cmd);
+        uint32_t action_us = (uint32_t)(timesync_local_us() - start_local);
+
+        int32_t error_us = (int32_t)(timesync_local_to_utc_us(start_local) - cmd.at_utc_us);
+
+        // The error is only as good as the clock: half the round trip of the last sync bounds its offset
+        uint32_t uncertainty_us = timesync_get_status().delay_us / 2;
+        uint32_t fired = sched_record_error(error_us, action_us, uncertainty_us);
+
+        LOG_INF("Command %u fired %d us after its target, ran %u us (clock uncertainty +/-%u us)",
+                cmd.action, error_us, action_us, uncertainty_us);
+
+        if (fired % CONFIG_APP_SCHED_REPORT_INTERVAL == 0)
+        {
+            sched_report();
+        }
+    }
+}
+
+/**
+ * @brief Scheduler thread: sleep until the timer fires or a new command arrives
+ */
+static void sched_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1)
+    {
+        k_sem_take(&s_sched_wake, K_FOREVER);
+        sched_run_due();
+    }
+}
+
+/**
+ * @brief Create the scheduler thread
+ */
+void sched_init(sched_action_fn action)
+{
+    s_action = action;
+
+    k_sem_init(&s_sched_wake, 0, 1);
+    k_timer_init(&s_sched_timer, sched_timer_expired, NULL);
+
+    k_tid_t tid = k_thread_create(&s_sched_thread, m_sched_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_sched_thread_stack),
+                                  sched_thread, NULL, NULL, NULL,
+                                  SCHED_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_name_set(tid, "sched");
+}
+
+/**
+ * @brief Decode a command datagram
+ */
+int sched_parse(const uint8_t *buf, int len, struct sched_command *cmd)
+{
+    if ((len < SCHED_PACKET_SIZE) || (sys_get_le32(&buf[SCHED_PKT_MAGIC_OFS]) != SCHED_MAGIC))
+    {
+        return -EINVAL;
+    }
+
+    cmd->at_utc_us = (int64_t)sys_get_le64(&buf[SCHED_PKT_TIME_OFS]);
+    cmd->action    = buf[SCHED_PKT_ACTION_OFS];
+    memcpy(cmd->args, &buf[SCHED_PKT_ARGS_OFS], sizeof(cmd->args));
+
+    return 0;
+}
+
+/**
+ * @brief Insert a command in time order and let the thread re-arm its timer
+ */
+int sched_submit(const struct sched_command *cmd)
+{
+    int ret = 0;
+
+    if (!timesync_is_synced())
+    {
+        ret = -ENODATA;
+    }
+    else if (cmd->at_utc_us <= timesync_utc_us())
+    {
+        ret = -ETIME;
+    }
+    else
+    {
+        K_SPINLOCK(&s_queue_lock)
+        {
+            if (s_queue_len >= ARRAY_SIZE(s_queue))
+            {
+                ret = -ENOSPC;
+                K_SPINLOCK_BREAK;
+            }
+
+            size_t pos = s_queue_len;
+            while ((pos > 0) && (s_queue[pos - 1].at_utc_us > cmd->at_utc_us))
+            {
+                s_queue[pos] = s_queue[pos - 1];
+                pos--;
+            }
+            s_queue[pos] = *cmd;
+            s_queue_len++;
+        }
+    }
+
+    K_SPINLOCK(&s_stats_lock)
+    {
+        if (ret < 0)
+        {
+            s_sched_stats.rejected++;
+        }
+        else
+        {
+            s_sched_stats.queued++;
+        }
+    }
+
+    if (ret < 0)
+    {
+        LOG_WRN("Command rejected: %d", ret);
+        return ret;
+    }
+
+    k_sem_give(&s_sched_wake);
+
+    return 0;
+}
+
+/**
+ * @brief Return a snapshot of the firing accuracy
+ */
+struct sched_stats sched_get_stats(void)
+{
+    struct sched_stats stats;
+
+    K_SPINLOCK(&s_stats_lock)
+    {
+        stats = s_sched_stats;
+    }
+
+    return stats;
+}
+
+/**
+ * @brief Log the firing accuracy
+ */
+void sched_report(void)
+{
+    struct sched_stats stats = sched_get_stats();
+
+    if (stats.fired == 0)
+    {
+        return;
+    }
+
+    LOG_INF("Scheduled commands: %u fired, %u rejected | error min %d us, max %d us, mean |error| %u us "
+            "(clock uncertainty +/-%u us) | action max %u us",
+            stats.fired, stats.rejected, stats.error_min_us, stats.error_max_us,
+            (uint32_t)(stats.error_abs_sum_us / stats.fired), stats.last_uncertainty_us, stats.action_max_us);
+}
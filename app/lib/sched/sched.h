@@ -0,0 +1,76 @@
+#ifndef LIB_SCHED_H
+#define LIB_SCHED_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define SCHED_STACK_SIZE       1536
+
+// Cooperative and above every other application thread: nothing preempts the final spin to the target time
+#define SCHED_THREAD_PRIORITY  K_PRIO_COOP(2)
+
+// Command datagram (little-endian): magic "SCH1", target time (us since 1970, synchronised clock), action, 3 argument bytes.
+// The device answers with an i32 status: 0 when queued, a negative errno otherwise.
+#define SCHED_MAGIC            0x31484353u
+#define SCHED_PACKET_SIZE      16
+
+// Actions
+enum sched_action
+{
+    SCHED_ACTION_LED = 1,      // Set the status LED to the RGB color in the arguments
+};
+
+// A command to run at a given time
+struct sched_command
+{
+    int64_t at_utc_us;
+    uint8_t action;
+    uint8_t args[3];
+};
+
+// Runs the command; called from the scheduler thread at the target time
+typedef void (*sched_action_fn)(const struct sched_command *cmd);
+
+// Firing accuracy. The error is the time the action started minus the target, both on the synchronised clock.
+// It cannot be trusted below the clock uncertainty (half the round trip of the last time sync). The time the
+// action itself took is kept apart.
+struct sched_stats
+{
+    uint32_t queued;
+    uint32_t fired;
+    uint32_t rejected;          // Queue full, clock not synced, or target already passed
+    int32_t  error_min_us;
+    int32_t  error_max_us;
+    uint64_t error_abs_sum_us;
+    int32_t  last_error_us;
+    uint32_t action_max_us;     // Longest action (start to return)
+    uint32_t last_action_us;
+    uint32_t last_uncertainty_us;
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Start the scheduler thread. 'action' runs every command.
+void sched_init(sched_action_fn action);
+
+// Decode a command datagram. -EINVAL if it is not one.
+int sched_parse(const uint8_t *buf, int len, struct sched_command *cmd);
+
+// Queue a command. -ENODATA if the clock is not synced, -ETIME if the target passed, -ENOSPC if the queue is full.
+int sched_submit(const struct sched_command *cmd);
+
+// Read and log the firing accuracy
+struct sched_stats sched_get_stats(void);
+void sched_report(void);
+
+#endif // LIB_SCHED_H
@@ -11,9 +11,17 @@ INCLUDE
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 #include <zephyr/sys/util.h>
+#include <zephyr/posix/poll.h>
 
 // Project specific headers
 #include "tcp.h"
+#include "dhcp_cache.h"
+#include "bulk.h"
+#include "latency.h"
+#include "app_trace.h"
+#include "capture.h"
+#include "journal.h"
+#include "instance.h"
 
 
 
@@ -38,6 +46,24 @@ LOG_MODULE_REGISTER(tcp, LOG_LEVEL_INF);
 // Defines the maximum number of pending connections the kernel will queue. '1' means we'll handle one client at a time.
 #define TCP_LISTEN_BACKLOG 1
 
+// How long the destructor waits for the server thread. The thread wakes up at least once per reaper tick.
+#define TCP_THREAD_JOIN_TIMEOUT K_MSEC(2 * CONFIG_APP_TCP_REAPER_INTERVAL_MS + 500)
+
+
+
+/******************************************************************************
+  STATISTICS
+ *****************************************************************************/
+// Kept outside the object so the counters survive the TCP object being re-created on every Wi-Fi reconnect
+static struct tcp_server_stats s_tcp_stats;
+
+// Time from recv() returning to the handler finishing (tracing, capture and the echo send included).
+// The time spent in the stack before recv() is reported separately, see latency_report_stack_rx().
+LATENCY_HISTOGRAM_DEFINE(s_tcp_recv_to_done, "tcp recv->done");
+
+// Sequence number of the received messages, used as the packet id in the trace
+static uint32_t s_tcp_pkt_seq;
+
 
 
 /******************************************************************************
@@ -47,9 +73,10 @@ FUNCTIONS DEFINITIONS
  * @brief Constructor for the TCP class
  */
 TCP_SERVER::TCP_SERVER(uint16_t port, SINGLE_RGB_LED_WS2812* rgb_led)
-    : m_sock(-1), m_client_sock(-1), m_port(port), m_led_indicator(rgb_led)
+    : m_sock(-1), m_client_sock(-1), m_port(port), m_client_addr(), m_last_rx_ms(0), m_led_indicator(rgb_led)
 {
     // Initialize socket as -1 to indicate that it has not been initialized yet
+    atomic_set(&m_stop_requested, 0);
 }
 
 /**
@@ -57,25 +84,58 @@ TCP_SERVER::TCP_SERVER(uint16_t port, SINGLE_RGB_LED_WS2812* rgb_led)
  */
 TCP_SERVER::~TCP_SERVER()
 {
-    // Close the active client socket
+    // Ask the server thread to stop. It notices the request within one reaper tick,
+    // closes its own sockets and returns, so the join below is bounded.
+    atomic_set(&m_stop_requested, 1);
+
+    int ret = k_thread_join(&m_thread_data, TCP_THREAD_JOIN_TIMEOUT);
+    if (ret) 
+    {
+        LOG_WRN("Failed to join TCP thread: %d, aborting it", ret);
+        k_thread_abort(&m_thread_data);
+    }
+
+    // Close the active client socket if the thread could not do it
     if (m_client_sock >= 0) 
     {
         close(m_client_sock);
+        m_client_sock = -1;
     }
 
-    // Close the active socket
+    // Close the active socket if the thread could not do it
     if (m_sock >= 0) 
     {
         close(m_sock);
+        m_sock = -1;
     }
 
-    int ret = k_thread_join(&m_thread_data, K_FOREVER);
-    if (ret) 
+    LOG_INF("TCP object is deleted and socket is closed.");
+}
+
+/**
+ * @brief Log what serving a client cost: the thread object plus the stack it actually used.
+ * Compare with the "Session RAM" line of the coroutine build, which reports its measured frame size.
+ */
+void TCP_SERVER::report_session_ram()
+{
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    size_t unused;
+
+    if (k_thread_stack_space_get(&m_thread_data, &unused) == 0)
     {
-        LOG_WRN("Failed to join TCP thread: %d", ret);
+        LOG_INF("Session RAM (thread model): k_thread %u B + stack %u/%u B used",
+                (uint32_t)sizeof(struct k_thread), (uint32_t)(K_THREAD_STACK_SIZEOF(m_tcp_thread_stack) - unused),
+                (uint32_t)K_THREAD_STACK_SIZEOF(m_tcp_thread_stack));
     }
+#endif
+}
 
-    LOG_INF("TCP object is deleted and socket is closed.");
+/**
+ * @brief Return a snapshot of the session statistics
+ */
+struct tcp_server_stats TCP_SERVER::get_stats()
+{
+    return s_tcp_stats;
 }
 
 /**
@@ -112,11 +172,9 @@ void TCP_SERVER::run_tcp_server()
 {
     // Necessary variables
     struct sockaddr_in bind_addr;
-    char buffer[128];
     
-    // Variables for the client connection
-    struct sockaddr_storage client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+    // Variables for the client connection (the address itself is kept in m_client_addr)
+    socklen_t client_addr_len;
 
     // Create a TCP stream socket
     m_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -126,14 +184,19 @@ void TCP_SERVER::run_tcp_server()
         return;
     }
 
+    // Packets sent on behalf of the server come from the control lane, not from the global pools
+    net_lane_attach_socket(m_sock, NET_LANE_CONTROL);
+
     // Bind the socket to our port
     bind_addr.sin_family = AF_INET;
-    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    bind_addr.sin_addr.s_addr = instance_bind_addr();
     bind_addr.sin_port = htons(m_port);
     if (bind(m_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) 
     {
         LOG_ERR("Failed to bind TCP socket: %d", errno);
+        journal_log(JOURNAL_EV_SERVER_ERROR, errno);
         close(m_sock);
+        m_sock = -1;
         return;
     }
 
@@ -142,58 +205,244 @@ void TCP_SERVER::run_tcp_server()
     {
         LOG_ERR("Failed to listen on TCP socket: %d", errno);
         close(m_sock);
+        m_sock = -1;
         return;
     }
 
+    // Start the flash writer used by bulk-transfer sessions
+    bulk_init();
+
     // TCP uses a nested loop 
     LOG_INF("Listening for TCP connections on port %d", m_port);
+    journal_log(JOURNAL_EV_SERVER_START, m_port);
 
     // Set LED as green to indicate TCP server is running
     m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::GREEN);
     
     // Outer loop: Waits for new clients to connect
-    while (1)
+    while (!atomic_get(&m_stop_requested))
     {
-        // Block and wait for a client to connect
-        m_client_sock = accept(m_sock, (struct sockaddr *)&client_addr, &client_addr_len);
+        // Wait for a client with a bounded timeout, so a stop request is noticed even if nobody connects
+        struct pollfd listen_fd = { .fd = m_sock, .events = POLLIN, .revents = 0 };
+        int ready = poll(&listen_fd, 1, CONFIG_APP_TCP_REAPER_INTERVAL_MS);
+        if (ready == 0)
+        {
+            continue;
+        }
+        if (ready < 0)
+        {
+            LOG_ERR("Failed to poll TCP socket: %d", errno);
+            journal_log(JOURNAL_EV_SERVER_ERROR, errno);
+            m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::RED);
+            break;
+        }
+
+        // A client is pending, so accept() will not block
+        client_addr_len = sizeof(m_client_addr);
+        m_client_sock = accept(m_sock, (struct sockaddr *)&m_client_addr, &client_addr_len);
         if (m_client_sock < 0)
         {
             LOG_ERR("Failed to accept connection: %d", errno);
+            journal_log(JOURNAL_EV_SERVER_ERROR, errno);
             // Set LED as red to indicate TCP server error
             m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::RED);
             break;
         }
 
         LOG_INF("TCP client connected");
+        s_tcp_stats.sessions_accepted++;
 
         // Inner loop: Handle data from this *one* client
-        while (1)
+        net_lane_attach_socket(m_client_sock, NET_LANE_CONTROL);
+        configure_client_socket(m_client_sock);
+        handle_client();
+        report_session_ram();
+        
+        // Close the *client's* socket
+        // The outer loop will then wait for a new client
+        close(m_client_sock);
+        m_client_sock = -1;
+    }
+
+    // The thread owns the listening socket, so it closes it on the way out
+    close(m_sock);
+    m_sock = -1;
+}
+
+/**
+ * @brief Apply the session options to a freshly accepted client socket
+ * Failures are only logged: the session still works, it just loses the corresponding protection.
+ */
+void TCP_SERVER::configure_client_socket(int sock)
+{
+    int opt;
+
+    // Wake up recv() once per reaper tick so idle sessions and stop requests are handled
+    struct timeval rcv_timeout = {
+        .tv_sec  = CONFIG_APP_TCP_REAPER_INTERVAL_MS / 1000,
+        .tv_usec = (CONFIG_APP_TCP_REAPER_INTERVAL_MS % 1000) * 1000,
+    };
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcv_timeout, sizeof(rcv_timeout)) < 0)
+    {
+        LOG_WRN("Failed to set SO_RCVTIMEO: %d", errno);
+    }
+
+#if defined(CONFIG_APP_TCP_NODELAY)
+    // Send replies immediately instead of waiting to coalesce them
+    opt = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0)
+    {
+        LOG_WRN("Failed to set TCP_NODELAY: %d", errno);
+    }
+#endif
+
+#if defined(CONFIG_APP_TCP_KEEPALIVE)
+    // Let the stack probe a silent peer and fail the session once it stops answering
+    opt = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt)) < 0)
+    {
+        LOG_WRN("Failed to set SO_KEEPALIVE: %d", errno);
+    }
+
+    // Without these the stack falls back to its own timing, or does not probe at all
+    opt = CONFIG_APP_TCP_KEEPALIVE_IDLE_SEC;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &opt, sizeof(opt)) < 0)
+    {
+        LOG_WRN("Failed to set TCP_KEEPIDLE: %d, dead peers may go undetected", errno);
+    }
+
+    opt = CONFIG_APP_TCP_KEEPALIVE_INTERVAL_SEC;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &opt, sizeof(opt)) < 0)
+    {
+        LOG_WRN("Failed to set TCP_KEEPINTVL: %d, dead peers may go undetected", errno);
+    }
+
+    opt = CONFIG_APP_TCP_KEEPALIVE_COUNT;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &opt, sizeof(opt)) < 0)
+    {
+        LOG_WRN("Failed to set TCP_KEEPCNT: %d, dead peers may go undetected", errno);
+    }
+#endif
+
+    ARG_UNUSED(opt);
+}
+
+/**
+ * @brief Serve the connected client until it leaves, the stack declares it dead, or the reaper closes it
+ */
+void TCP_SERVER::handle_client()
+{
+    char buffer[128];
+    bool first_chunk = true;
+
+    m_last_rx_ms = k_uptime_get();
+
+    while (!atomic_get(&m_stop_requested))
+    {
+        // Use recv() on the *client* socket. It returns at least once per reaper tick.
+        int recv_len = recv(m_client_sock, buffer, sizeof(buffer) - 1, 0);
+        uint32_t rx_time = latency_now();
+
+        if (recv_len > 0) 
         {
-            // Use recv() on the *client* socket 
-            int recv_len = recv(m_client_sock, buffer, sizeof(buffer) - 1, 0);
+            m_last_rx_ms = k_uptime_get();
+            s_tcp_pkt_seq++;
+            APP_TRACE(APP_TRACE_PKT_RX, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_pkt_seq), recv_len);
+            APP_CAPTURE(IPPROTO_TCP, CAPTURE_DIR_RX, (struct sockaddr *)&m_client_addr, m_port, buffer, recv_len);
+            rejoin_timing_mark_first_packet();
 
-            if (recv_len > 0) 
+            // A session that opens with the bulk header streams an image into flash instead of being logged
+            if (first_chunk && bulk_is_header((const uint8_t *)buffer, recv_len))
             {
-                buffer[recv_len] = '\0';
-                LOG_INF("Received data: %s", buffer);
-            } 
-            else if (recv_len == 0)
+                net_lane_attach_socket(m_client_sock, NET_LANE_BULK);
+                bulk_run_session(m_client_sock, (const uint8_t *)buffer, recv_len,
+                                 CONFIG_APP_TCP_IDLE_TIMEOUT_SEC * 1000, &m_stop_requested);
+                break;
+            }
+            first_chunk = false;
+
+            // Dispatch the message, timed from recv() returning
+            APP_TRACE(APP_TRACE_PKT_DISPATCH, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_pkt_seq), 0);
+
+            handle_message(buffer, recv_len);
+
+            APP_TRACE(APP_TRACE_PKT_DONE, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_pkt_seq), 0);
+            latency_record(&s_tcp_recv_to_done, rx_time, latency_now());
+            if ((CONFIG_APP_LATENCY_REPORT_INTERVAL > 0) &&
+                (s_tcp_recv_to_done.count % CONFIG_APP_LATENCY_REPORT_INTERVAL == 0))
             {
-                // Client closed the connection gracefully ---
-                LOG_INF("TCP client disconnected");
-                break; // Break from the *inner* loop
+                latency_report(&s_tcp_recv_to_done);
+                latency_report_stack_rx();
             }
-            else 
+        } 
+        else if (recv_len == 0)
+        {
+            // Client closed the connection gracefully ---
+            LOG_INF("TCP client disconnected");
+            s_tcp_stats.sessions_closed_by_peer++;
+            break; // Break from the *inner* loop
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // Receive timeout: reap the session if it has been silent for too long
+            if ((CONFIG_APP_TCP_IDLE_TIMEOUT_SEC > 0) &&
+                (k_uptime_get() - m_last_rx_ms >= CONFIG_APP_TCP_IDLE_TIMEOUT_SEC * 1000LL))
             {
-                // An error occurred on this connection ---
-                LOG_WRN("recv failed: %d", errno);
-                break; // Break from the *inner* loop
+                LOG_WRN("TCP client idle for %d s, reaping the session", CONFIG_APP_TCP_IDLE_TIMEOUT_SEC);
+                record_dead_session(&s_tcp_stats.sessions_reaped_idle);
+                break;
             }
         }
-        
-        // Close the *client's* socket
-        // The outer loop will then wait for a new client
-        close(m_client_sock);
-        m_client_sock = -1;
+        else 
+        {
+            // An error occurred on this connection, e.g. keepalive gave up or the peer reset it ---
+            LOG_WRN("recv failed: %d", errno);
+            record_dead_session(&s_tcp_stats.sessions_dead_peer);
+            break; // Break from the *inner* loop
+        }
     }
 }
+
+/**
+ * @brief Handle one chunk of data from the client, according to the configured mode
+ * The buffer has room for one extra byte after 'len'.
+ */
+void TCP_SERVER::handle_message(char *buffer, int len)
+{
+#if defined(CONFIG_APP_TCP_MODE_ECHO)
+    // Send the chunk back unchanged. send() may take only part of it when the TX window is full.
+    int sent = 0;
+    while (sent < len)
+    {
+        int ret = send(m_client_sock, &buffer[sent], len - sent, 0);
+        if (ret < 0)
+        {
+            LOG_WRN("Echo send failed: %d", errno);
+            return;
+        }
+        APP_CAPTURE(IPPROTO_TCP, CAPTURE_DIR_TX, (struct sockaddr *)&m_client_addr, m_port, &buffer[sent], ret);
+        sent += ret;
+    }
+    net_lane_sample(NET_LANE_CONTROL);
+#else
+    buffer[len] = '\0';
+    LOG_INF("Received data: %s", buffer);
+#endif
+}
+
+/**
+ * @brief Count a session that ended without a graceful close and record how long it held the server
+ */
+void TCP_SERVER::record_dead_session(uint32_t *counter)
+{
+    uint32_t held_ms = (uint32_t)(k_uptime_get() - m_last_rx_ms);
+
+    (*counter)++;
+    s_tcp_stats.dead_hold_ms_total += held_ms;
+    s_tcp_stats.dead_hold_ms_max = MAX(s_tcp_stats.dead_hold_ms_max, held_ms);
+    journal_log(JOURNAL_EV_SESSION_DEAD, (int32_t)held_ms);
+
+    LOG_INF("Dead session held the server for %u ms (max %u ms, reaped %u, dead peers %u)",
+            held_ms, s_tcp_stats.dead_hold_ms_max,
+            s_tcp_stats.sessions_reaped_idle, s_tcp_stats.sessions_dead_peer);
+}
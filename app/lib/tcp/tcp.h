@@ -9,6 +9,7 @@ INCLUDE
 
 // Project specific headers
 #include "led.h"
+#include "netpool.h"
 
 
 /******************************************************************************
@@ -19,6 +20,21 @@ DEFINE
 
 
 
+/******************************************************************************
+TCP SERVER STATISTICS
+******************************************************************************/
+// Session statistics, accumulated over every TCP_SERVER object since boot
+struct tcp_server_stats
+{
+    uint32_t sessions_accepted;        // Clients accepted
+    uint32_t sessions_closed_by_peer;  // Clients that closed the connection gracefully
+    uint32_t sessions_reaped_idle;     // Sessions closed by the idle reaper
+    uint32_t sessions_dead_peer;       // Sessions closed because the stack declared the peer dead (keepalive/reset)
+    uint64_t dead_hold_ms_total;       // Total time reaped/dead sessions held the server since their last received data
+    uint32_t dead_hold_ms_max;         // Longest time a single reaped/dead session held the server
+};
+
+
 /******************************************************************************
 TCP SERVER CLASS
 ******************************************************************************/
@@ -34,22 +50,49 @@ public:
     // Start the TCP server
     void start_tcp_server();
 
+    // Read the session statistics
+    static struct tcp_server_stats get_stats();
+
+    // Apply keepalive, receive timeout and no-delay options to an accepted client
+    static void configure_client_socket(int sock);
+
 private:
 
     // Socket file descriptor and port to listen on
     int m_sock;   
     int m_client_sock;         
     uint16_t m_port;     
+
+    // Address of the current client
+    struct sockaddr_storage m_client_addr;
     
     // Thread
     struct k_thread m_thread_data;
 
+    // Set by the destructor to ask the server thread to exit
+    atomic_t m_stop_requested;
+
+    // Uptime (ms) of the last data received from the current client
+    int64_t m_last_rx_ms;
+
+    // Log the measured RAM of a session: the thread and its stack high-water mark
+    void report_session_ram();
+
     // LED indicator
     SINGLE_RGB_LED_WS2812* m_led_indicator;
 
     // Functions to start running the tcp server
     void run_tcp_server();
 
+    // Serve one client until it disconnects, dies or is reaped
+    void handle_client();
+
+    // Handle one chunk of data according to the server mode (log or echo)
+    void handle_message(char *buffer, int len);
+
+    // Account a session that was closed without the peer saying goodbye
+    void record_dead_session(uint32_t *counter);
+
     // Static function for the thread entry, which in turns call the actual "run_tcp_server"
     static void static_run_tcp_server(void *p1, void *p2, void *p3);
 };
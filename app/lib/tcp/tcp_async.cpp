@@ -0,0 +1,333 @@
+/******************************************************************************
+Module: TCP_ASYNC.CPP
+
+Description: This file contains a TCP server built on the coroutine reactor.
+             The accept loop, every client session and the periodic report are
+             coroutines sharing one thread, so concurrent clients cost one
+             coroutine frame each instead of one thread and stack each
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+// Project specific headers
+#include "tcp_async.h"
+#include "tcp.h"
+#include "dhcp_cache.h"
+#include "app_trace.h"
+#include "capture.h"
+#include "instance.h"
+#include "latency.h"
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(tcp_async, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Clients queued by the kernel while the accept coroutine is busy
+#define TCP_ASYNC_LISTEN_BACKLOG 4
+
+// Period of the session/frame report
+#define TCP_ASYNC_REPORT_INTERVAL_MS 30000
+
+// How long a single send may wait for TX window before the session is dropped
+#define TCP_ASYNC_SEND_TIMEOUT_MS 5000
+
+
+
+/******************************************************************************
+  STATISTICS
+ *****************************************************************************/
+static uint32_t s_sessions_active;
+static uint32_t s_sessions_accepted;
+static uint32_t s_sessions_rejected;
+static uint32_t s_sessions_closed_by_peer;
+static uint32_t s_sessions_reaped_idle;
+
+// Sequence number of the received messages, used as the packet id in the trace
+static uint32_t s_tcp_async_pkt_seq;
+
+// Time from recv() completing to the message being handled, across all sessions. Only the reactor thread
+// writes it. Waiting for TX window in the echo send is included, as it delays this session's next message.
+LATENCY_HISTOGRAM_DEFINE(s_tcp_async_recv_to_done, "tcp coro recv->done");
+
+
+
+/******************************************************************************
+  SOCKET GUARD
+ *****************************************************************************/
+// Closes the socket when the coroutine returns or is destroyed while suspended
+struct coro_socket_guard
+{
+    int fd;
+    uint32_t *active;   // Session counter to release, or NULL
+
+    ~coro_socket_guard()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (active != NULL)
+        {
+            (*active)--;
+        }
+    }
+};
+
+
+
+/******************************************************************************
+  COROUTINES
+ *****************************************************************************/
+/**
+ * @brief Serve one client until it leaves, fails, or stays silent for the idle timeout
+ */
+static coro_task tcp_session(CORO_REACTOR *reactor, int sock)
+{
+    coro_socket_guard guard = { sock, &s_sessions_active };
+    char buffer[128];
+    int idle_timeout_ms = (CONFIG_APP_TCP_IDLE_TIMEOUT_SEC > 0) ? (CONFIG_APP_TCP_IDLE_TIMEOUT_SEC * 1000) : -1;
+
+#if defined(CONFIG_APP_CAPTURE)
+    // Both ends of the session, looked up once for the capture records
+    struct sockaddr_in peer_addr = {};
+    struct sockaddr_in local_addr = {};
+    socklen_t addr_len = sizeof(peer_addr);
+    getpeername(sock, (struct sockaddr *)&peer_addr, &addr_len);
+    addr_len = sizeof(local_addr);
+    getsockname(sock, (struct sockaddr *)&local_addr, &addr_len);
+    uint16_t local_port = ntohs(local_addr.sin_port);
+#endif
+
+    while (true)
+    {
+        int recv_len = co_await coro_recv(reactor, sock, buffer, sizeof(buffer) - 1, idle_timeout_ms);
+
+        if (recv_len == 0)
+        {
+            LOG_INF("TCP client %d disconnected", sock);
+            s_sessions_closed_by_peer++;
+            break;
+        }
+        if (recv_len == -EAGAIN)
+        {
+            LOG_WRN("TCP client %d idle for %d s, reaping the session", sock, CONFIG_APP_TCP_IDLE_TIMEOUT_SEC);
+            s_sessions_reaped_idle++;
+            break;
+        }
+        if (recv_len < 0)
+        {
+            LOG_WRN("recv failed on client %d: %d", sock, recv_len);
+            break;
+        }
+
+        uint32_t rx_time = latency_now();
+        s_tcp_async_pkt_seq++;
+        APP_TRACE(APP_TRACE_PKT_RX, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_async_pkt_seq), recv_len);
+        APP_CAPTURE(IPPROTO_TCP, CAPTURE_DIR_RX, (struct sockaddr *)&peer_addr, local_port, buffer, recv_len);
+        rejoin_timing_mark_first_packet();
+        APP_TRACE(APP_TRACE_PKT_DISPATCH, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_async_pkt_seq), 0);
+
+#if defined(CONFIG_APP_TCP_MODE_ECHO)
+        // Send the chunk back unchanged, yielding to the other sessions while the TX window is full
+        int sent = 0;
+        while (sent < recv_len)
+        {
+            int ret = co_await coro_send(reactor, sock, &buffer[sent], recv_len - sent, TCP_ASYNC_SEND_TIMEOUT_MS);
+            if (ret < 0)
+            {
+                LOG_WRN("Echo send failed on client %d: %d", sock, ret);
+                co_return;
+            }
+            APP_CAPTURE(IPPROTO_TCP, CAPTURE_DIR_TX, (struct sockaddr *)&peer_addr, local_port, &buffer[sent], ret);
+            sent += ret;
+        }
+        net_lane_sample(NET_LANE_CONTROL);
+#else
+        buffer[recv_len] = '\0';
+        LOG_INF("Received data (client %d): %s", sock, buffer);
+#endif
+
+        APP_TRACE(APP_TRACE_PKT_DONE, APP_TRACE_PKT_ID(APP_TRACE_SRC_TCP, s_tcp_async_pkt_seq), 0);
+        latency_record(&s_tcp_async_recv_to_done, rx_time, latency_now());
+        if ((CONFIG_APP_LATENCY_REPORT_INTERVAL > 0) &&
+            (s_tcp_async_recv_to_done.count % CONFIG_APP_LATENCY_REPORT_INTERVAL == 0))
+        {
+            latency_report(&s_tcp_async_recv_to_done);
+            latency_report_stack_rx();
+        }
+    }
+}
+
+/**
+ * @brief Accept clients and give each one its own session coroutine
+ */
+static coro_task tcp_accept_loop(CORO_REACTOR *reactor, int listen_sock, SINGLE_RGB_LED_WS2812 *led)
+{
+    coro_socket_guard guard = { listen_sock, NULL };
+
+    while (true)
+    {
+        int client = co_await coro_accept(reactor, listen_sock);
+        if (client < 0)
+        {
+            LOG_ERR("Failed to accept connection: %d", client);
+            led->set_color_for_rgb_led(color_for_led_rgb::RED);
+            co_return;
+        }
+
+        if (s_sessions_active >= CONFIG_APP_CORO_MAX_SESSIONS)
+        {
+            LOG_WRN("Session limit (%d) reached, refusing client", CONFIG_APP_CORO_MAX_SESSIONS);
+            s_sessions_rejected++;
+            close(client);
+            continue;
+        }
+
+        net_lane_attach_socket(client, NET_LANE_CONTROL);
+        TCP_SERVER::configure_client_socket(client);
+
+        // The session owns the socket from here. If no frame is left, spawn() fails and the socket is ours to close.
+        s_sessions_active++;
+        if (!reactor->spawn(tcp_session(reactor, client)))
+        {
+            s_sessions_active--;
+            s_sessions_rejected++;
+            close(client);
+            continue;
+        }
+
+        s_sessions_accepted++;
+        LOG_INF("TCP client %d connected (%u active)", client, s_sessions_active);
+    }
+}
+
+/**
+ * @brief Periodically log the sessions, the frame pool usage and the measured RAM per session
+ */
+static coro_task tcp_report_loop(CORO_REACTOR *reactor)
+{
+    while (true)
+    {
+        co_await coro_sleep(reactor, TCP_ASYNC_REPORT_INTERVAL_MS);
+
+        struct coro_frame_stats frames = CORO_REACTOR::get_frame_stats();
+        LOG_INF("Sessions: %u active, %u accepted, %u refused | frames %u/%d in use (max %u, largest %u B, %u failures)",
+                s_sessions_active, s_sessions_accepted, s_sessions_rejected,
+                frames.frames_in_use, CONFIG_APP_CORO_MAX_FRAMES, frames.frames_max_used,
+                frames.largest_frame, frames.alloc_failures);
+
+        // Measured cost of a session: its largest frame. Compare with the "Session RAM" line of the thread model build.
+        size_t stack_used;
+        if (reactor->get_stack_used(&stack_used) == 0)
+        {
+            LOG_INF("Session RAM (coroutine model): largest frame %u B (block %u B), shared reactor stack %u/%u B used",
+                    frames.largest_frame, CONFIG_APP_CORO_FRAME_SIZE, (uint32_t)stack_used, CONFIG_APP_CORO_STACK_SIZE);
+        }
+    }
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Constructor for the coroutine TCP server class
+ */
+CORO_TCP_SERVER::CORO_TCP_SERVER(uint16_t port, SINGLE_RGB_LED_WS2812* rgb_led)
+    : m_port(port), m_led_indicator(rgb_led)
+{
+}
+
+/**
+ * @brief Destructor for the coroutine TCP server class
+ * The reactor member is destroyed after this body: it stops its thread and destroys the
+ * suspended coroutines, whose socket guards close the listening and client sockets.
+ */
+CORO_TCP_SERVER::~CORO_TCP_SERVER()
+{
+    LOG_INF("Coroutine TCP server is deleted.");
+}
+
+/**
+ * @brief Return a snapshot of the session statistics
+ */
+struct tcp_server_stats CORO_TCP_SERVER::get_stats()
+{
+    struct tcp_server_stats stats = {};
+
+    stats.sessions_accepted       = s_sessions_accepted;
+    stats.sessions_closed_by_peer = s_sessions_closed_by_peer;
+    stats.sessions_reaped_idle    = s_sessions_reaped_idle;
+
+    return stats;
+}
+
+/**
+ * @brief Start the reactor. The sockets are created on the reactor thread.
+ */
+void CORO_TCP_SERVER::start_tcp_server()
+{
+    m_reactor.start(CORO_TCP_SERVER::static_start_coroutines, this);
+}
+
+/**
+ * @brief Open the listening socket and spawn the accept and report coroutines
+ */
+void CORO_TCP_SERVER::static_start_coroutines(CORO_REACTOR *reactor, void *arg)
+{
+    CORO_TCP_SERVER* self = static_cast<CORO_TCP_SERVER*>(arg);
+    struct sockaddr_in bind_addr;
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        LOG_ERR("Failed to create TCP socket: %d", errno);
+        return;
+    }
+
+    net_lane_attach_socket(sock, NET_LANE_CONTROL);
+
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_addr.s_addr = instance_bind_addr();
+    bind_addr.sin_port = htons(self->m_port);
+    if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0)
+    {
+        LOG_ERR("Failed to bind TCP socket: %d", errno);
+        close(sock);
+        return;
+    }
+
+    if (listen(sock, TCP_ASYNC_LISTEN_BACKLOG) < 0)
+    {
+        LOG_ERR("Failed to listen on TCP socket: %d", errno);
+        close(sock);
+        return;
+    }
+
+    if (!reactor->spawn(tcp_accept_loop(reactor, sock, self->m_led_indicator)))
+    {
+        LOG_ERR("No coroutine frame for the accept loop");
+        close(sock);
+        return;
+    }
+    reactor->spawn(tcp_report_loop(reactor));
+
+    LOG_INF("Listening for TCP connections on port %d (coroutines, up to %d sessions)",
+            self->m_port, CONFIG_APP_CORO_MAX_SESSIONS);
+
+    self->m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::GREEN);
+}
@@ -0,0 +1,52 @@
+#ifndef LIB_TCP_ASYNC_H
+#define LIB_TCP_ASYNC_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+// Project specific headers
+#include "led.h"
+#include "coro.h"
+#include "tcp.h"
+
+
+
+/******************************************************************************
+CORO TCP SERVER CLASS
+******************************************************************************/
+// TCP server running on the coroutine reactor: every client gets its own coroutine
+// (up to CONFIG_APP_CORO_MAX_SESSIONS at once) instead of the whole server getting a thread.
+class CORO_TCP_SERVER
+{
+public:
+    // Constructor
+    CORO_TCP_SERVER(uint16_t port, SINGLE_RGB_LED_WS2812* rgb_led);
+
+    // Destructor. Stopping the reactor destroys the coroutines, which close their sockets.
+    ~CORO_TCP_SERVER();
+
+    // Start the TCP server
+    void start_tcp_server();
+
+    // Read the session statistics, in the thread server's format. The dead-peer fields stay 0.
+    static struct tcp_server_stats get_stats();
+
+private:
+
+    // Port to listen on
+    uint16_t m_port;
+
+    // Coroutine runtime
+    CORO_REACTOR m_reactor;
+
+    // LED indicator
+    SINGLE_RGB_LED_WS2812* m_led_indicator;
+
+    // Runs on the reactor thread and spawns the first coroutines
+    static void static_start_coroutines(CORO_REACTOR *reactor, void *arg);
+};
+
+#endif // LIB_TCP_ASYNC_H
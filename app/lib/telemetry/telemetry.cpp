@@ -0,0 +1,411 @@
+/******************************************************************************
+Module: TELEMETRY.CPP
+
+Description: This file contains the telemetry publisher. Samples are packed
+             into MTU-sized binary frames taken from a preallocated ring. A
+             frame is sealed when it is full or when its deadline passes, and
+             a low-priority thread sends the sealed frames to the collector
+             over UDP, backing off while the TX packet pool is tight
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/net/socket.h>
+
+// Project specific headers
+#include "telemetry.h"
+#include "netpool.h"
+#include "timesync.h"
+#include "tcp.h"
+#if defined(CONFIG_APP_CORO_TCP_SERVER)
+#include "tcp_async.h"
+#endif
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_telemetry_thread_stack, TELEMETRY_STACK_SIZE);
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(telemetry, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Header layout
+#define TLM_HDR_MAGIC_OFS    0
+#define TLM_HDR_SEQ_OFS      4
+#define TLM_HDR_BASE_OFS     8
+#define TLM_HDR_COUNT_OFS    16
+#define TLM_HDR_DROPPED_OFS  18
+#define TLM_HDR_FLAGS_OFS    20
+
+// Sample layout
+#define TLM_SMP_CHANNEL_OFS  0
+#define TLM_SMP_DT_OFS       2
+#define TLM_SMP_VALUE_OFS    6
+
+// Backoff while the TX pool is tight: doubles from the minimum up to the maximum
+#define TELEMETRY_BACKOFF_MIN_MS  2
+#define TELEMETRY_BACKOFF_MAX_MS  128
+
+// Log the statistics every this many housekeeping runs
+#define TELEMETRY_REPORT_EVERY    30
+
+BUILD_ASSERT(TELEMETRY_SAMPLES_PER_FRAME > 0, "Telemetry frame too small for one sample");
+
+
+
+/******************************************************************************
+  FRAME RING
+ *****************************************************************************/
+struct telemetry_frame
+{
+    int64_t  base_local_us;   // Local time of the first sample
+    int64_t  deadline_ms;     // Uptime at which the frame is sealed even if not full
+    uint16_t count;
+    uint16_t dropped;
+    uint8_t  data[CONFIG_APP_TELEMETRY_FRAME_SIZE];
+};
+
+static struct telemetry_frame s_frames[CONFIG_APP_TELEMETRY_FRAMES];
+
+// Free frames, and sealed frames waiting to be sent (pointers)
+K_MSGQ_DEFINE(s_tlm_free_q, sizeof(struct telemetry_frame *), CONFIG_APP_TELEMETRY_FRAMES, alignof(struct telemetry_frame *));
+K_MSGQ_DEFINE(s_tlm_sealed_q, sizeof(struct telemetry_frame *), CONFIG_APP_TELEMETRY_FRAMES, alignof(struct telemetry_frame *));
+
+// Frame being filled, shared by every producer
+static struct k_spinlock s_tlm_lock;
+static struct telemetry_frame *s_open_frame;
+static uint32_t s_pending_dropped;      // Drops not yet reported in a frame header
+
+static struct telemetry_stats s_tlm_stats;
+static uint32_t s_tlm_seq;
+static int s_tlm_sock = -1;
+static struct sockaddr_in s_collector;
+
+static struct k_thread s_tlm_thread;
+static struct k_work_delayable s_tlm_housekeeping_work;
+
+#if CONFIG_APP_TELEMETRY_TEST_RATE_HZ > 0
+static struct k_timer s_tlm_test_timer;
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - PRODUCERS
+******************************************************************************/
+/**
+ * @brief Hand the open frame to the sender. Called with the lock held.
+ */
+static void telemetry_seal_locked(void)
+{
+    struct telemetry_frame *frame = s_open_frame;
+
+    s_open_frame = NULL;
+    k_msgq_put(&s_tlm_sealed_q, &frame, K_NO_WAIT);
+}
+
+/**
+ * @brief Append one sample to the open frame, opening a new one from the ring if needed
+ */
+int telemetry_record(uint16_t channel, int32_t value)
+{
+    int ret = 0;
+
+    K_SPINLOCK(&s_tlm_lock)
+    {
+        // Stamped under the lock: a producer preempting us between the stamp and the lock could open the frame
+        // with a later base, and the negative delta would wrap in the unsigned dt field
+        int64_t now_us = timesync_local_us();
+
+        if (s_open_frame == NULL)
+        {
+            struct telemetry_frame *frame;
+
+            // Ring exhausted: the sender is behind (or backing off). Count the loss, keep what is queued.
+            if (k_msgq_get(&s_tlm_free_q, &frame, K_NO_WAIT) != 0)
+            {
+                s_tlm_stats.samples_dropped++;
+                s_pending_dropped++;
+                ret = -ENOBUFS;
+                K_SPINLOCK_BREAK;
+            }
+
+            frame->base_local_us = now_us;
+            frame->deadline_ms   = k_uptime_get() + CONFIG_APP_TELEMETRY_FLUSH_MS;
+            frame->count         = 0;
+            frame->dropped       = (uint16_t)MIN(s_pending_dropped, (uint32_t)UINT16_MAX);
+            s_pending_dropped    = 0;
+            s_open_frame         = frame;
+        }
+
+        struct telemetry_frame *frame = s_open_frame;
+        uint8_t *sample = &frame->data[TELEMETRY_HEADER_SIZE + frame->count * TELEMETRY_SAMPLE_SIZE];
+
+        sys_put_le16(channel, &sample[TLM_SMP_CHANNEL_OFS]);
+        sys_put_le32((uint32_t)(now_us - frame->base_local_us), &sample[TLM_SMP_DT_OFS]);
+        sys_put_le32((uint32_t)value, &sample[TLM_SMP_VALUE_OFS]);
+        frame->count++;
+        s_tlm_stats.samples_recorded++;
+
+        // Flush on size
+        if (frame->count >= TELEMETRY_SAMPLES_PER_FRAME)
+        {
+            s_tlm_stats.flush_on_size++;
+            telemetry_seal_locked();
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Record the board's own counters once per housekeeping interval
+ */
+static void telemetry_housekeeping_handler(struct k_work *work)
+{
+    static uint32_t runs;
+    struct net_lane_usage usage;
+
+    telemetry_record(TELEMETRY_CH_UPTIME_MS, (int32_t)k_uptime_get_32());
+
+    net_lane_get_usage(NET_LANE_CONTROL, &usage);
+    telemetry_record(TELEMETRY_CH_CONTROL_TX_PKTS, (int32_t)usage.tx_pkt_used);
+    net_lane_get_usage(NET_LANE_BULK, &usage);
+    telemetry_record(TELEMETRY_CH_BULK_TX_PKTS, (int32_t)usage.tx_pkt_used);
+
+    // Whichever TCP server this image was built with
+#if defined(CONFIG_APP_CORO_TCP_SERVER)
+    telemetry_record(TELEMETRY_CH_TCP_ACCEPTED, (int32_t)CORO_TCP_SERVER::get_stats().sessions_accepted);
+#else
+    telemetry_record(TELEMETRY_CH_TCP_ACCEPTED, (int32_t)TCP_SERVER::get_stats().sessions_accepted);
+#endif
+    telemetry_record(TELEMETRY_CH_SAMPLES_DROPPED, (int32_t)s_tlm_stats.samples_dropped);
+    telemetry_record(TELEMETRY_CH_FRAMES_DEFERRED, (int32_t)s_tlm_stats.frames_deferred);
+
+    if ((++runs % TELEMETRY_REPORT_EVERY) == 0)
+    {
+        telemetry_report();
+    }
+
+    k_work_schedule(k_work_delayable_from_work(work), K_MSEC(CONFIG_APP_TELEMETRY_HOUSEKEEPING_MS));
+}
+
+#if CONFIG_APP_TELEMETRY_TEST_RATE_HZ > 0
+/**
+ * @brief Test signal (interrupt context): a 1 Hz triangle wave between -1000 and 1000, integer only
+ */
+static void telemetry_test_timer_handler(struct k_timer *timer)
+{
+    static uint32_t n;
+
+    ARG_UNUSED(timer);
+
+    int32_t phase = (int32_t)((n++ % CONFIG_APP_TELEMETRY_TEST_RATE_HZ) * 4000 / CONFIG_APP_TELEMETRY_TEST_RATE_HZ);
+    int32_t value = (phase < 2000) ? (phase - 1000) : (3000 - phase);
+
+    telemetry_record(TELEMETRY_CH_TEST_SIGNAL, value);
+}
+#endif
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - SENDER
+******************************************************************************/
+/**
+ * @brief True when the bulk lane TX slab is filled beyond the backoff threshold
+ */
+static bool telemetry_tx_pool_tight(void)
+{
+    struct net_lane_usage usage;
+
+    net_lane_get_usage(NET_LANE_BULK, &usage);
+
+    return (usage.tx_pkt_total > 0) &&
+           (usage.tx_pkt_used * 100 >= usage.tx_pkt_total * CONFIG_APP_TELEMETRY_BACKOFF_PERCENT);
+}
+
+/**
+ * @brief Fill in the header and send one frame, waiting while the TX pool is tight
+ */
+static void telemetry_send_frame(struct telemetry_frame *frame)
+{
+    uint16_t flags = 0;
+    int64_t base_us = frame->base_local_us;
+
+    // Timestamps are converted to UTC here, off the producers' path
+    if (timesync_is_synced())
+    {
+        base_us = timesync_local_to_utc_us(base_us);
+        flags |= TELEMETRY_FLAG_UTC;
+    }
+
+    sys_put_le32(TELEMETRY_MAGIC, &frame->data[TLM_HDR_MAGIC_OFS]);
+    sys_put_le32(s_tlm_seq++, &frame->data[TLM_HDR_SEQ_OFS]);
+    sys_put_le64((uint64_t)base_us, &frame->data[TLM_HDR_BASE_OFS]);
+    sys_put_le16(frame->count, &frame->data[TLM_HDR_COUNT_OFS]);
+    sys_put_le16(frame->dropped, &frame->data[TLM_HDR_DROPPED_OFS]);
+    sys_put_le16(flags, &frame->data[TLM_HDR_FLAGS_OFS]);
+    sys_put_le16(0, &frame->data[TLM_HDR_FLAGS_OFS + 2]);
+
+    size_t len = TELEMETRY_HEADER_SIZE + frame->count * TELEMETRY_SAMPLE_SIZE;
+    int32_t backoff_ms = TELEMETRY_BACKOFF_MIN_MS;
+
+    // Telemetry yields to everything else: while the pool is tight the frame waits, and the ring absorbs the samples
+    while (telemetry_tx_pool_tight())
+    {
+        s_tlm_stats.frames_deferred++;
+        k_msleep(backoff_ms);
+        backoff_ms = MIN(2 * backoff_ms, TELEMETRY_BACKOFF_MAX_MS);
+    }
+
+    while (sendto(s_tlm_sock, frame->data, len, 0, (struct sockaddr *)&s_collector, sizeof(s_collector)) < 0)
+    {
+        // Out of buffers in the stack: back off and retry the same frame
+        if (((errno == ENOMEM) || (errno == ENOBUFS) || (errno == EAGAIN)) && (backoff_ms < TELEMETRY_BACKOFF_MAX_MS))
+        {
+            s_tlm_stats.frames_deferred++;
+            k_msleep(backoff_ms);
+            backoff_ms = 2 * backoff_ms;
+            continue;
+        }
+
+        s_tlm_stats.send_errors++;
+        LOG_DBG("Telemetry sendto failed: %d", errno);
+        return;
+    }
+
+    s_tlm_stats.frames_sent++;
+    net_lane_sample(NET_LANE_BULK);
+}
+
+/**
+ * @brief Sender thread: send sealed frames, and seal the open frame when its deadline passes
+ */
+static void telemetry_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1)
+    {
+        struct telemetry_frame *frame;
+        k_timeout_t timeout = K_MSEC(CONFIG_APP_TELEMETRY_FLUSH_MS);
+
+        // Sleep until a frame is sealed or the open frame's deadline
+        K_SPINLOCK(&s_tlm_lock)
+        {
+            if (s_open_frame != NULL)
+            {
+                timeout = K_MSEC(MAX(s_open_frame->deadline_ms - k_uptime_get(), (int64_t)0));
+            }
+        }
+
+        if (k_msgq_get(&s_tlm_sealed_q, &frame, timeout) != 0)
+        {
+            // Flush on deadline
+            K_SPINLOCK(&s_tlm_lock)
+            {
+                if ((s_open_frame != NULL) && (k_uptime_get() >= s_open_frame->deadline_ms))
+                {
+                    s_tlm_stats.flush_on_deadline++;
+                    telemetry_seal_locked();
+                }
+            }
+            continue;
+        }
+
+        telemetry_send_frame(frame);
+        k_msgq_put(&s_tlm_free_q, &frame, K_NO_WAIT);
+    }
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Open the socket and start the sender, the housekeeping samples and the optional test signal
+ */
+void telemetry_init(void)
+{
+    for (int i = 0; i < CONFIG_APP_TELEMETRY_FRAMES; i++)
+    {
+        struct telemetry_frame *frame = &s_frames[i];
+        k_msgq_put(&s_tlm_free_q, &frame, K_NO_WAIT);
+    }
+
+    s_collector.sin_family = AF_INET;
+    s_collector.sin_port   = htons(CONFIG_APP_TELEMETRY_COLLECTOR_PORT);
+    if (inet_pton(AF_INET, CONFIG_APP_TELEMETRY_COLLECTOR_ADDR, &s_collector.sin_addr) != 1)
+    {
+        LOG_ERR("Invalid telemetry collector address %s", CONFIG_APP_TELEMETRY_COLLECTOR_ADDR);
+        return;
+    }
+
+    s_tlm_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_tlm_sock < 0)
+    {
+        LOG_ERR("Failed to create telemetry socket: %d", errno);
+        return;
+    }
+
+    // Streaming data: its packets come from the bulk lane and can never starve the control lane
+    net_lane_attach_socket(s_tlm_sock, NET_LANE_BULK);
+
+    k_tid_t tid = k_thread_create(&s_tlm_thread, m_telemetry_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_telemetry_thread_stack),
+                                  telemetry_thread, NULL, NULL, NULL,
+                                  TELEMETRY_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "telemetry");
+
+    k_work_init_delayable(&s_tlm_housekeeping_work, telemetry_housekeeping_handler);
+    k_work_schedule(&s_tlm_housekeeping_work, K_MSEC(CONFIG_APP_TELEMETRY_HOUSEKEEPING_MS));
+
+#if CONFIG_APP_TELEMETRY_TEST_RATE_HZ > 0
+    k_timer_init(&s_tlm_test_timer, telemetry_test_timer_handler, NULL);
+    k_timer_start(&s_tlm_test_timer, K_USEC(USEC_PER_SEC / CONFIG_APP_TELEMETRY_TEST_RATE_HZ),
+                  K_USEC(USEC_PER_SEC / CONFIG_APP_TELEMETRY_TEST_RATE_HZ));
+#endif
+
+    LOG_INF("Telemetry to %s:%d: %d frames of %d samples, flush after %d ms",
+            CONFIG_APP_TELEMETRY_COLLECTOR_ADDR, CONFIG_APP_TELEMETRY_COLLECTOR_PORT,
+            CONFIG_APP_TELEMETRY_FRAMES, (int)TELEMETRY_SAMPLES_PER_FRAME, CONFIG_APP_TELEMETRY_FLUSH_MS);
+}
+
+/**
+ * @brief Return a snapshot of the statistics
+ */
+struct telemetry_stats telemetry_get_stats(void)
+{
+    return s_tlm_stats;
+}
+
+/**
+ * @brief Log the statistics
+ */
+void telemetry_report(void)
+{
+    LOG_INF("Telemetry: %u samples, %u dropped | %u frames sent (%u full, %u on deadline), %u deferred, %u errors",
+            s_tlm_stats.samples_recorded, s_tlm_stats.samples_dropped, s_tlm_stats.frames_sent,
+            s_tlm_stats.flush_on_size, s_tlm_stats.flush_on_deadline,
+            s_tlm_stats.frames_deferred, s_tlm_stats.send_errors);
+}
@@ -0,0 +1,72 @@
+#ifndef LIB_TELEMETRY_H
+#define LIB_TELEMETRY_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define TELEMETRY_STACK_SIZE       2048
+#define TELEMETRY_THREAD_PRIORITY  11
+
+// Frame layout (little-endian). Header:
+//   magic u32 ("TLM1"), seq u32, base_us i64, count u16, dropped u16, flags u16, reserved u16
+// followed by 'count' samples of: channel u16, dt_us u32 (since base_us), value i32.
+// 'dropped' is the number of samples lost on the device since the previous frame (saturates at 0xFFFF).
+#define TELEMETRY_MAGIC            0x314D4C54u
+#define TELEMETRY_HEADER_SIZE      24
+#define TELEMETRY_SAMPLE_SIZE      10
+
+// base_us is on the synchronised UTC clock (lib/timesync) when this flag is set, else on the local uptime clock
+#define TELEMETRY_FLAG_UTC         0x0001
+
+// Samples per frame
+#define TELEMETRY_SAMPLES_PER_FRAME ((CONFIG_APP_TELEMETRY_FRAME_SIZE - TELEMETRY_HEADER_SIZE) / TELEMETRY_SAMPLE_SIZE)
+
+// Channels recorded by the board itself. Applications use TELEMETRY_CH_APP and above.
+enum telemetry_channel
+{
+    TELEMETRY_CH_UPTIME_MS        = 1,
+    TELEMETRY_CH_RSSI_DBM         = 2,
+    TELEMETRY_CH_CONTROL_TX_PKTS  = 3,   // Packets in use in the control lane TX slab
+    TELEMETRY_CH_BULK_TX_PKTS     = 4,   // Same for the bulk lane, which telemetry itself uses
+    TELEMETRY_CH_TCP_ACCEPTED     = 5,
+    TELEMETRY_CH_SAMPLES_DROPPED  = 6,   // Total samples dropped since boot
+    TELEMETRY_CH_FRAMES_DEFERRED  = 7,   // Total sends delayed because the TX pool was tight
+    TELEMETRY_CH_TEST_SIGNAL      = 0x80,
+    TELEMETRY_CH_APP              = 0x100,
+};
+
+// Publisher statistics
+struct telemetry_stats
+{
+    uint32_t samples_recorded;
+    uint32_t samples_dropped;     // No free frame in the ring
+    uint32_t frames_sent;
+    uint32_t frames_deferred;     // Sends delayed because the bulk lane TX pool was tight
+    uint32_t send_errors;
+    uint32_t flush_on_size;
+    uint32_t flush_on_deadline;
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Open the socket to the collector and start the sender thread and the housekeeping samples
+void telemetry_init(void);
+
+// Record one sample. Callable from any thread or ISR; never blocks. -ENOBUFS if the sample was dropped.
+int telemetry_record(uint16_t channel, int32_t value);
+
+// Read and log the statistics
+struct telemetry_stats telemetry_get_stats(void);
+void telemetry_report(void);
+
+#endif // LIB_TELEMETRY_H
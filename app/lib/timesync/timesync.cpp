@@ -0,0 +1,398 @@
+/******************************************************************************
+Module: TIMESYNC.CPP
+
+Description: This file contains a small SNTP client that keeps a synchronised
+             UTC clock on top of the local cycle counter. Each sync is a burst
+             of exchanges; only the one with the shortest round trip is kept,
+             since its offset has the smallest error, and the drift of the
+             local clock is estimated between bursts
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/net/socket.h>
+
+// Project specific headers
+#include "timesync.h"
+#include "journal.h"
+
+// Standard Library
+#include <cstring>
+#include <cstdio>
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+// The SNTP client only exists with CONFIG_APP_TIMESYNC. The local clock below is always built: telemetry and the
+// packet capture time their records with it.
+#if defined(CONFIG_APP_TIMESYNC)
+K_THREAD_STACK_DEFINE(m_timesync_thread_stack, TIMESYNC_STACK_SIZE);
+#endif
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(timesync, LOG_LEVEL_INF);
+
+
+
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// NTP packet layout (big-endian), RFC 4330
+#define NTP_PACKET_SIZE       48
+#define NTP_PORT              123
+#define NTP_LI_VN_MODE_CLIENT 0x23   // No leap warning, version 4, client
+#define NTP_LI_SHIFT          6
+#define NTP_LI_UNSYNCHRONIZED 3      // The server's own clock is not synchronised
+#define NTP_MODE_MASK         0x07
+#define NTP_MODE_SERVER       4
+#define NTP_STRATUM_OFS       1
+#define NTP_ORIGINATE_OFS     24
+#define NTP_RECEIVE_OFS       32
+#define NTP_TRANSMIT_OFS      40
+
+// Seconds from 1900 (NTP era 0) to 1970 (UNIX epoch)
+#define NTP_UNIX_EPOCH_DELTA  2208988800ULL
+
+// How long to wait for one answer, and for the next burst after a failure
+#define TIMESYNC_RESPONSE_TIMEOUT_MS  1000
+#define TIMESYNC_RETRY_SEC            5
+
+// Drift is only estimated over intervals long enough for the offset noise to average out
+#define TIMESYNC_MIN_SKEW_INTERVAL_US (10LL * USEC_PER_SEC)
+
+// Largest drift believed. Crystals stay well within 100 ppm; more than this is an offset step, not drift.
+#define TIMESYNC_MAX_SKEW_PPB         500000
+
+
+
+/******************************************************************************
+  CLOCK STATE
+ *****************************************************************************/
+// utc = local + offset + (local - ref_local) * skew. Written by the sync thread, read by the scheduler.
+static struct k_spinlock s_clock_lock;
+static int64_t s_ref_local_us;
+static int64_t s_offset_us;
+static int32_t s_skew_ppb;
+
+// Written under s_clock_lock too, and only read through timesync_get_status()
+static struct timesync_status s_status;
+
+#if defined(CONFIG_APP_TIMESYNC)
+static struct k_thread s_timesync_thread;
+static struct k_sem s_wake_sem;
+static atomic_t s_network_up;
+#endif
+
+
+
+#if defined(CONFIG_APP_TIMESYNC)
+/******************************************************************************
+FUNCTIONS DEFINITIONS - NTP
+******************************************************************************/
+/**
+ * @brief Convert a 64-bit NTP timestamp to microseconds since the UNIX epoch
+ */
+static int64_t ntp_to_unix_us(const uint8_t *ts)
+{
+    uint64_t seconds  = sys_get_be32(ts);
+    uint64_t fraction = sys_get_be32(ts + 4);
+
+    return (int64_t)((seconds - NTP_UNIX_EPOCH_DELTA) * USEC_PER_SEC + ((fraction * USEC_PER_SEC) >> 32));
+}
+
+/**
+ * @brief One request/response exchange. Fills the offset (utc - local) and the round-trip delay.
+ */
+static int ntp_exchange(int sock, const struct sockaddr *server, socklen_t server_len, int64_t *offset_us, int64_t *delay_us)
+{
+    uint8_t packet[NTP_PACKET_SIZE] = { 0 };
+    uint8_t cookie[8];
+
+    // The transmit field is only a cookie: the server echoes it as 'originate', which matches the answer to this request
+    packet[0] = NTP_LI_VN_MODE_CLIENT;
+    int64_t t1 = timesync_local_us();
+    sys_put_be64((uint64_t)t1, cookie);
+    memcpy(&packet[NTP_TRANSMIT_OFS], cookie, sizeof(cookie));
+
+    if (sendto(sock, packet, sizeof(packet), 0, server, server_len) < 0)
+    {
+        return -errno;
+    }
+
+    while (true)
+    {
+        int len = recv(sock, packet, sizeof(packet), 0);
+        int64_t t4 = timesync_local_us();
+
+        if (len < 0)
+        {
+            return -errno;
+        }
+        if ((len < NTP_PACKET_SIZE) || (memcmp(&packet[NTP_ORIGINATE_OFS], cookie, sizeof(cookie)) != 0))
+        {
+            // Late answer to an earlier request of the burst
+            continue;
+        }
+        if (((packet[0] & NTP_MODE_MASK) != NTP_MODE_SERVER) || (packet[NTP_STRATUM_OFS] == 0) ||
+            ((packet[0] >> NTP_LI_SHIFT) == NTP_LI_UNSYNCHRONIZED))
+        {
+            // Not a server answer, a kiss-of-death, or a server that does not know the time itself
+            return -EPROTO;
+        }
+
+        int64_t t2 = ntp_to_unix_us(&packet[NTP_RECEIVE_OFS]);
+        int64_t t3 = ntp_to_unix_us(&packet[NTP_TRANSMIT_OFS]);
+
+        *offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+        *delay_us  = (t4 - t1) - (t3 - t2);
+
+        return 0;
+    }
+}
+
+/**
+ * @brief Run a burst of exchanges with the configured server and apply the best sample
+ */
+static int timesync_run_burst(void)
+{
+    struct addrinfo hints = {};
+    struct addrinfo *res = NULL;
+    char port[8];
+
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(port, sizeof(port), "%d", NTP_PORT);
+
+    int ret = getaddrinfo(CONFIG_APP_TIMESYNC_SERVER, port, &hints, &res);
+    if (ret != 0)
+    {
+        LOG_WRN("Cannot resolve %s: %d", CONFIG_APP_TIMESYNC_SERVER, ret);
+        return -EHOSTUNREACH;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        freeaddrinfo(res);
+        return -errno;
+    }
+
+    struct timeval rcv_timeout = {
+        .tv_sec  = TIMESYNC_RESPONSE_TIMEOUT_MS / 1000,
+        .tv_usec = (TIMESYNC_RESPONSE_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcv_timeout, sizeof(rcv_timeout));
+
+    // Keep the sample with the shortest round trip: its offset error is bounded by the smallest delay
+    int64_t best_offset = 0;
+    int64_t best_delay  = INT64_MAX;
+    for (int i = 0; i < CONFIG_APP_TIMESYNC_SAMPLES; i++)
+    {
+        int64_t offset;
+        int64_t delay;
+
+        if ((ntp_exchange(sock, res->ai_addr, res->ai_addrlen, &offset, &delay) == 0) &&
+            (delay >= 0) && (delay < best_delay))
+        {
+            best_offset = offset;
+            best_delay  = delay;
+        }
+    }
+
+    close(sock);
+    freeaddrinfo(res);
+
+    if (best_delay == INT64_MAX)
+    {
+        return -ETIMEDOUT;
+    }
+
+    int64_t now_local = timesync_local_us();
+
+    K_SPINLOCK(&s_clock_lock)
+    {
+        // Drift: how much the offset moved since the last sync, beyond what the current skew already predicted
+        if (s_status.synced && (now_local - s_ref_local_us >= TIMESYNC_MIN_SKEW_INTERVAL_US))
+        {
+            int64_t predicted = s_offset_us + ((now_local - s_ref_local_us) * s_skew_ppb) / 1000000000LL;
+            int64_t residual_ppb = ((best_offset - predicted) * 1000000000LL) / (now_local - s_ref_local_us);
+
+            // An offset step (server change, clock set on the server) shows up as a huge residual: bound the result
+            s_skew_ppb = (int32_t)CLAMP(s_skew_ppb + residual_ppb / 2, -TIMESYNC_MAX_SKEW_PPB, TIMESYNC_MAX_SKEW_PPB);
+        }
+
+        s_ref_local_us = now_local;
+        s_offset_us    = best_offset;
+
+        s_status.synced       = true;
+        s_status.offset_us    = best_offset;
+        s_status.skew_ppb     = s_skew_ppb;
+        s_status.delay_us     = (uint32_t)best_delay;
+        s_status.syncs++;
+        s_status.last_sync_ms = k_uptime_get();
+    }
+
+    LOG_INF("Clock synced to %s: offset %lld us, round trip %lld us, skew %d ppb",
+            CONFIG_APP_TIMESYNC_SERVER, best_offset, best_delay, s_skew_ppb);
+
+    // Lets the journal decoder put wall-clock times on the records of this boot
+    journal_log(JOURNAL_EV_TIME_SYNC, (int32_t)(uint32_t)(timesync_utc_us() / USEC_PER_SEC));
+
+    return 0;
+}
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - THREAD
+******************************************************************************/
+/**
+ * @brief Sync once per interval while the network is up
+ */
+static void timesync_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1)
+    {
+        if (!atomic_get(&s_network_up))
+        {
+            k_sem_take(&s_wake_sem, K_FOREVER);
+            continue;
+        }
+
+        int ret = timesync_run_burst();
+        if (ret < 0)
+        {
+            K_SPINLOCK(&s_clock_lock)
+            {
+                s_status.failures++;
+            }
+            LOG_WRN("Time sync failed: %d", ret);
+        }
+
+        // A new network-up event cuts the wait short
+        k_sem_take(&s_wake_sem, (ret < 0) ? K_SECONDS(TIMESYNC_RETRY_SEC) : K_SECONDS(CONFIG_APP_TIMESYNC_INTERVAL_SEC));
+    }
+}
+
+/**
+ * @brief Create the sync thread
+ */
+void timesync_init(void)
+{
+    k_sem_init(&s_wake_sem, 0, 1);
+    atomic_set(&s_network_up, 0);
+
+    k_tid_t tid = k_thread_create(&s_timesync_thread, m_timesync_thread_stack,
+                                  K_THREAD_STACK_SIZEOF(m_timesync_thread_stack),
+                                  timesync_thread, NULL, NULL, NULL,
+                                  TIMESYNC_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_name_set(tid, "timesync");
+}
+
+/**
+ * @brief Start syncing (or resync at once after a reconnect)
+ */
+void timesync_network_up(void)
+{
+    atomic_set(&s_network_up, 1);
+    k_sem_give(&s_wake_sem);
+}
+
+/**
+ * @brief Stop syncing. The clock runs on in holdover with the last offset and skew.
+ */
+void timesync_network_down(void)
+{
+    atomic_set(&s_network_up, 0);
+}
+#endif // CONFIG_APP_TIMESYNC
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS - CLOCK
+******************************************************************************/
+/**
+ * @brief True once the first sync succeeded
+ */
+bool timesync_is_synced(void)
+{
+    bool synced;
+
+    K_SPINLOCK(&s_clock_lock)
+    {
+        synced = s_status.synced;
+    }
+
+    return synced;
+}
+
+/**
+ * @brief Convert a local clock reading to UTC
+ */
+int64_t timesync_local_to_utc_us(int64_t local_us)
+{
+    int64_t utc_us;
+
+    K_SPINLOCK(&s_clock_lock)
+    {
+        utc_us = local_us + s_offset_us + ((local_us - s_ref_local_us) * s_skew_ppb) / 1000000000LL;
+    }
+
+    return utc_us;
+}
+
+/**
+ * @brief Convert a UTC time to the local clock. The skew term is small, so evaluating it at the UTC-derived estimate is exact to well under 1 us.
+ */
+int64_t timesync_utc_to_local_us(int64_t utc_us)
+{
+    int64_t local_us;
+
+    K_SPINLOCK(&s_clock_lock)
+    {
+        int64_t estimate = utc_us - s_offset_us;
+        local_us = estimate - ((estimate - s_ref_local_us) * s_skew_ppb) / 1000000000LL;
+    }
+
+    return local_us;
+}
+
+/**
+ * @brief Current synchronised UTC time
+ */
+int64_t timesync_utc_us(void)
+{
+    return timesync_local_to_utc_us(timesync_local_us());
+}
+
+/**
+ * @brief Return a snapshot of the clock state. Taken under the lock: the 64-bit fields would tear on a 32-bit CPU.
+ */
+struct timesync_status timesync_get_status(void)
+{
+    struct timesync_status status;
+
+    K_SPINLOCK(&s_clock_lock)
+    {
+        status = s_status;
+    }
+
+    return status;
+}
@@ -0,0 +1,61 @@
+#ifndef LIB_TIMESYNC_H
+#define LIB_TIMESYNC_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+#define TIMESYNC_STACK_SIZE       2048
+#define TIMESYNC_THREAD_PRIORITY  10
+
+// State of the synchronised clock
+struct timesync_status
+{
+    bool     synced;          // At least one exchange succeeded since boot
+    int64_t  offset_us;       // UTC - local clock at the last sync
+    int32_t  skew_ppb;        // Drift of the local clock against the server
+    uint32_t delay_us;        // Round trip of the best sample of the last burst; the offset error is at most half of it
+    uint32_t syncs;           // Successful bursts
+    uint32_t failures;        // Bursts without a single valid answer
+    int64_t  last_sync_ms;    // Uptime of the last successful burst
+};
+
+
+
+/******************************************************************************
+FUNCTIONS
+******************************************************************************/
+// Local monotonic clock (us) the synchronised time is derived from
+static inline int64_t timesync_local_us(void)
+{
+#if defined(CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER)
+    return (int64_t)k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+    return (int64_t)k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
+// Create the sync thread. It stays idle until the network is up. Only built with CONFIG_APP_TIMESYNC; without it
+// the clock below runs unsynchronised.
+void timesync_init(void);
+
+// The network is usable (connected state) / gone. The clock keeps running on the last estimate while down.
+void timesync_network_up(void);
+void timesync_network_down(void);
+
+// Synchronised UTC time (us since 1970) and the conversions to and from the local clock
+bool timesync_is_synced(void);
+int64_t timesync_utc_us(void);
+int64_t timesync_utc_to_local_us(int64_t utc_us);
+int64_t timesync_local_to_utc_us(int64_t local_us);
+
+// Read the state of the synchronised clock
+struct timesync_status timesync_get_status(void);
+
+#endif // LIB_TIMESYNC_H
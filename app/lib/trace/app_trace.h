@@ -0,0 +1,60 @@
+#ifndef LIB_APP_TRACE_H
+#define LIB_APP_TRACE_H
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/kernel.h>
+#if defined(CONFIG_APP_TRACING)
+#include <zephyr/tracing/tracing.h>
+#endif
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Application trace points. They are emitted as CTF "named_event" records (name, arg0, arg1),
+// which scripts/ctf_to_perfetto.py turns into a timeline. The names must stay below 20 characters.
+//
+// With CONFIG_APP_TRACING=n every macro expands to nothing, so the hot path pays nothing.
+
+// Packet lifecycle. 'id' is built with APP_TRACE_PKT_ID() so packets of different servers do not collide.
+#define APP_TRACE_PKT_RX        "pkt_rx"         // arg0 = id, arg1 = length
+#define APP_TRACE_PKT_DISPATCH  "pkt_dispatch"   // arg0 = id
+#define APP_TRACE_PKT_DONE      "pkt_done"       // arg0 = id
+
+// LED updates
+#define APP_TRACE_LED_QUEUED    "led_queued"     // arg0 = number of pixels
+#define APP_TRACE_LED_FLUSHED   "led_flushed"    // arg0 = number of pixels, arg1 = driver result
+
+// Wi-Fi state transitions
+#define APP_TRACE_WIFI_STATE    "wifi_state"     // arg0 = enum app_trace_wifi_state, arg1 = detail (status, RSSI...)
+
+// Source of a packet id, kept in the top byte
+enum app_trace_source
+{
+    APP_TRACE_SRC_TCP = 1,
+    APP_TRACE_SRC_UDP = 2,
+};
+
+// Wi-Fi states reported with APP_TRACE_WIFI_STATE
+enum app_trace_wifi_state
+{
+    APP_TRACE_WIFI_CONNECTING   = 1,
+    APP_TRACE_WIFI_CONNECTED    = 2,
+    APP_TRACE_WIFI_CONNECT_FAIL = 3,
+    APP_TRACE_WIFI_DISCONNECTED = 4,
+    APP_TRACE_WIFI_SCAN_DONE    = 5,
+    APP_TRACE_WIFI_ROAMING      = 6,
+};
+
+#define APP_TRACE_PKT_ID(_source, _seq) ((((uint32_t)(_source)) << 24) | ((uint32_t)(_seq) & 0x00FFFFFFu))
+
+#if defined(CONFIG_APP_TRACING)
+#define APP_TRACE(_name, _arg0, _arg1) sys_trace_named_event((_name), (uint32_t)(_arg0), (uint32_t)(_arg1))
+#else
+#define APP_TRACE(_name, _arg0, _arg1) do { } while (0)
+#endif
+
+#endif // LIB_APP_TRACE_H
@@ -11,9 +11,19 @@ INCLUDE
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 #include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/posix/poll.h>
 
 // Project specific headers
 #include "udp.h"
+#include "dhcp_cache.h"
+#include "latency.h"
+#include "app_trace.h"
+#include "rudp.h"
+#include "sched.h"
+#include "capture.h"
+#include "journal.h"
+#include "instance.h"
 
 
 
@@ -32,6 +42,42 @@ LOG_MODULE_REGISTER(udp, LOG_LEVEL_INF);
 
 
 
+/******************************************************************************
+  DEFINE
+ *****************************************************************************/
+// Datagrams starting with this magic ("RTT1", little-endian) are RTT probes and get a device-time trailer in echo mode
+#define UDP_RTT_PROBE_MAGIC   0x31545452u
+#define UDP_RTT_TRAILER_SIZE  4
+
+// Receive buffer: a full reliable datagram in reliable mode, short messages otherwise
+#if defined(CONFIG_APP_UDP_MODE_RELIABLE)
+#define UDP_RX_BUFFER_SIZE    (RUDP_MAX_DATAGRAM + UDP_RTT_TRAILER_SIZE)
+#else
+#define UDP_RX_BUFFER_SIZE    128
+#endif
+
+
+
+/******************************************************************************
+  RECEIVE BUFFER
+ *****************************************************************************/
+// Kept off the thread stack: a reliable datagram can take up most of UDP_STACK_SIZE
+static char s_udp_rx_buffer[UDP_RX_BUFFER_SIZE];
+
+
+
+/******************************************************************************
+  LATENCY
+ *****************************************************************************/
+// Time from recvfrom() returning to the handler finishing (tracing, capture and the reply included).
+// The time spent in the stack before recvfrom() is reported separately, see latency_report_stack_rx().
+LATENCY_HISTOGRAM_DEFINE(s_udp_recv_to_done, "udp recv->done");
+
+// Sequence number of the received messages, used as the packet id in the trace
+static uint32_t s_udp_pkt_seq;
+
+
+
 /******************************************************************************
 FUNCTIONS DEFINITIONS
 ******************************************************************************/
@@ -99,7 +145,7 @@ void UDP_SERVER::run_udp_server()
 {
     // Necessary variables
     struct sockaddr_in bind_addr;
-    char buffer[128];
+    char *buffer = s_udp_rx_buffer;
 
     // Create the socket
     m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -109,19 +155,29 @@ void UDP_SERVER::run_udp_server()
         return;
     }
 
+    // Packets sent on behalf of the server come from the control lane, not from the global pools
+    net_lane_attach_socket(m_sock, NET_LANE_CONTROL);
+
     // Bind the socket to our port
     bind_addr.sin_family = AF_INET;
-    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    bind_addr.sin_addr.s_addr = instance_bind_addr();
     bind_addr.sin_port = htons(m_port);
     if (bind(m_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) 
     {
         LOG_ERR("Failed to bind socket: %d", errno);
+        journal_log(JOURNAL_EV_SERVER_ERROR, errno);
         close(m_sock);
         return;
     }
 
+#if defined(CONFIG_APP_UDP_MODE_RELIABLE)
+    // Reliable mode sends its ACKs and retransmissions through the server socket
+    rudp_init(m_sock);
+#endif
+
     // Waiting for UDP data
     LOG_INF("Listening UDP data on the port %d", m_port);
+    journal_log(JOURNAL_EV_SERVER_START, m_port);
 
     // Set LED as green to indicate UDP server is running
     m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::GREEN);
@@ -131,17 +187,50 @@ void UDP_SERVER::run_udp_server()
         struct sockaddr client_addr;
         socklen_t client_addr_len = sizeof(client_addr);
         
-        // Blocking function that wait for the upcoming udp data
-        int recv_len = recvfrom(m_sock, buffer, sizeof(buffer) - 1, 0, &client_addr, &client_addr_len);
+#if defined(CONFIG_APP_UDP_MODE_RELIABLE)
+        // Wake up in time for the next retransmission. The wait changes with every message in flight,
+        // so it is given to poll() rather than set on the socket each time.
+        struct pollfd fds = { .fd = m_sock, .events = POLLIN };
+        int ready = poll(&fds, 1, rudp_next_timeout_ms());
+        rudp_service();
+        if (ready == 0)
+        {
+            continue;
+        }
+#endif
+
+        // Blocking function that wait for the upcoming udp data. Room is left for the RTT trailer.
+        int recv_len = recvfrom(m_sock, buffer, UDP_RX_BUFFER_SIZE - UDP_RTT_TRAILER_SIZE, 0, &client_addr, &client_addr_len);
+        uint32_t rx_time = latency_now();
 
         if (recv_len > 0) 
         {
-            buffer[recv_len] = '\0';
-            LOG_INF("Received data: %s", buffer);
+            s_udp_pkt_seq++;
+            APP_TRACE(APP_TRACE_PKT_RX, APP_TRACE_PKT_ID(APP_TRACE_SRC_UDP, s_udp_pkt_seq), recv_len);
+            APP_CAPTURE(IPPROTO_UDP, CAPTURE_DIR_RX, &client_addr, m_port, buffer, recv_len);
+            rejoin_timing_mark_first_packet();
+
+            // Dispatch the datagram, timed from recvfrom() returning
+            APP_TRACE(APP_TRACE_PKT_DISPATCH, APP_TRACE_PKT_ID(APP_TRACE_SRC_UDP, s_udp_pkt_seq), 0);
+
+            handle_datagram(buffer, recv_len, &client_addr, client_addr_len, rx_time);
+
+            APP_TRACE(APP_TRACE_PKT_DONE, APP_TRACE_PKT_ID(APP_TRACE_SRC_UDP, s_udp_pkt_seq), 0);
+            latency_record(&s_udp_recv_to_done, rx_time, latency_now());
+            if ((CONFIG_APP_LATENCY_REPORT_INTERVAL > 0) &&
+                (s_udp_recv_to_done.count % CONFIG_APP_LATENCY_REPORT_INTERVAL == 0))
+            {
+                latency_report(&s_udp_recv_to_done);
+                latency_report_stack_rx();
+#if defined(CONFIG_APP_UDP_MODE_RELIABLE)
+                rudp_report();
+#endif
+            }
         } 
         else 
         {
             LOG_WRN("recvfrom failed: %d", errno);
+            journal_log(JOURNAL_EV_SERVER_ERROR, errno);
 
             // Set LED as flashing red to indicate UDP server error
             m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::RED);
@@ -150,3 +239,75 @@ void UDP_SERVER::run_udp_server()
         }
     }
 }
+
+/**
+ * @brief Handle one datagram according to the configured mode
+ * The buffer has room for UDP_RTT_TRAILER_SIZE extra bytes after 'len'.
+ */
+void UDP_SERVER::handle_datagram(char *buffer, int len, const struct sockaddr *client_addr, socklen_t client_addr_len, uint32_t rx_time)
+{
+#if defined(CONFIG_APP_TIMESYNC)
+    // Time-triggered commands are recognised in every mode. The sender gets the queueing status back.
+    struct sched_command cmd;
+    if (sched_parse((const uint8_t *)buffer, len, &cmd) == 0)
+    {
+        uint8_t status[4];
+        sys_put_le32((uint32_t)sched_submit(&cmd), status);
+        if (sendto(m_sock, status, sizeof(status), 0, client_addr, client_addr_len) < 0)
+        {
+            LOG_WRN("Command status sendto failed: %d", errno);
+        }
+        APP_CAPTURE(IPPROTO_UDP, CAPTURE_DIR_TX, client_addr, m_port, status, sizeof(status));
+        return;
+    }
+#endif
+
+#if defined(CONFIG_APP_UDP_MODE_ECHO)
+    int reply_len = len;
+
+    // RTT probes carry back how long the device held them, so the host can subtract it
+    if ((len >= 4) && (sys_get_le32((const uint8_t *)buffer) == UDP_RTT_PROBE_MAGIC))
+    {
+        sys_put_le32(k_cyc_to_us_floor32(latency_now() - rx_time), (uint8_t *)&buffer[len]);
+        reply_len += UDP_RTT_TRAILER_SIZE;
+    }
+
+    if (sendto(m_sock, buffer, reply_len, 0, client_addr, client_addr_len) < 0)
+    {
+        LOG_WRN("Echo sendto failed: %d", errno);
+    }
+    net_lane_sample(NET_LANE_CONTROL);
+    APP_CAPTURE(IPPROTO_UDP, CAPTURE_DIR_TX, client_addr, m_port, buffer, reply_len);
+#elif defined(CONFIG_APP_UDP_MODE_RELIABLE)
+    ARG_UNUSED(rx_time);
+
+    const uint8_t *payload;
+    int peer;
+
+    // ACKs and duplicates stop here; each new message is echoed back reliably
+    int payload_len = rudp_receive((const uint8_t *)buffer, len, client_addr, client_addr_len, &payload, &peer);
+    if (payload_len < 0)
+    {
+        LOG_WRN("Dropping a datagram that is not a reliable message (%d bytes)", len);
+        return;
+    }
+    if (payload_len == 0)
+    {
+        return;
+    }
+
+    // rudp_receive() only delivers a message while the window to its peer has room, so the echo always fits
+    int ret = rudp_send(peer, payload, payload_len);
+    if (ret < 0)
+    {
+        LOG_WRN("Reliable echo failed: %d", ret);
+    }
+#else
+    ARG_UNUSED(client_addr);
+    ARG_UNUSED(client_addr_len);
+    ARG_UNUSED(rx_time);
+
+    buffer[len] = '\0';
+    LOG_INF("Received data: %s", buffer);
+#endif
+}
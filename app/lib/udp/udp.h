@@ -9,6 +9,7 @@ INCLUDE
 
 // Project specific headers
 #include "led.h"
+#include "netpool.h"
 
 
 /******************************************************************************
@@ -48,6 +49,9 @@ private:
     // Functions to start running the udp server
     void run_udp_server();
 
+    // Handle one datagram according to the server mode (log, echo or reliable echo)
+    void handle_datagram(char *buffer, int len, const struct sockaddr *client_addr, socklen_t client_addr_len, uint32_t rx_time);
+
     // Static function for the thread entry, which in turns call the actual "run_udp_server"
     static void static_run_udp_server(void *p1, void *p2, void *p3);
 };
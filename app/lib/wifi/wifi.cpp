@@ -2,7 +2,10 @@
 Module: WIFI.CPP
 
 Description: This file contains functions that allows the esp32s3 to interact
-             with WIFI network
+             with WIFI network. The connection is managed by a state machine
+             on its own workqueue: the net_mgmt callbacks only queue events,
+             every wait is a state with a delayable timeout, and other
+             modules subscribe to the state changes
 ******************************************************************************/
 /******************************************************************************
 INCLUDE
@@ -15,6 +18,10 @@ INCLUDE
 // Project specific headers
 #include "wifi.h"
 #include "led.h"
+#include "dhcp_cache.h"
+#include "app_trace.h"
+#include "telemetry.h"
+#include "journal.h"
 
 // Standard Library
 #include <cstring>
@@ -24,7 +31,21 @@ INCLUDE
 /******************************************************************************
   DEFINE
  *****************************************************************************/
-#define NET_EVENT_WIFI_MASK (NET_EVENT_WIFI_CONNECT_RESULT | NET_EVENT_WIFI_DISCONNECT_RESULT)
+#define NET_EVENT_WIFI_MASK (NET_EVENT_WIFI_CONNECT_RESULT | NET_EVENT_WIFI_DISCONNECT_RESULT | \
+                             NET_EVENT_WIFI_SCAN_RESULT | NET_EVENT_WIFI_SCAN_DONE)
+
+// Bits of m_link_events. UP is a level (set while connected). DOWN is a latch: posted on every drop and
+// only cleared by main() once it has torn its servers down, so a quick drop and reconnect is not missed.
+#define WIFI_EVENT_UP   BIT(0)
+#define WIFI_EVENT_DOWN BIT(1)
+
+
+
+/******************************************************************************
+  THREAD
+ *****************************************************************************/
+K_THREAD_STACK_DEFINE(m_wifi_wq_stack, WIFI_WQ_STACK_SIZE);
+
 
 
 /******************************************************************************
@@ -40,20 +61,43 @@ FUNCTIONS DEFINITIONS
 /**
  * @brief Constructor for the WIFI class
  */
-WIFI_STA_NETWORK::WIFI_STA_NETWORK(const char* ssid, const char* psk, SINGLE_RGB_LED_WS2812* rgb_led)
-    : m_ssid(ssid), m_psk(psk), m_led_indicator(rgb_led)
+WIFI_STA_NETWORK::WIFI_STA_NETWORK(const struct wifi_credential *credentials, size_t num_credentials, SINGLE_RGB_LED_WS2812* rgb_led)
+    : m_credentials(credentials), m_num_credentials(num_credentials), m_led_indicator(rgb_led)
 {
-    // Init the semaphore that indicate the readiness of the wifi connection
-    k_sem_init(&m_ip_ready_sem, 0, 1);
-
-    // Init the semaphore that indicate the disconnection
-    k_sem_init(&m_wifi_disconnected_sem, 0, 1);
+    // The credential walk indexes the table modulo its size, so it cannot be empty
+    __ASSERT(num_credentials > 0, "The Wi-Fi credential table is empty");
 
-    // Initialize the connection status
+    // Initialize the connection status. main() waits on these levels instead of counting semaphores.
     m_is_connected = false;
-
-    // Initialize the reconnect work
-    k_work_init_delayable(&m_reconnect_work, static_reconnect_work_handler);
+    k_event_init(&m_link_events);
+
+    // Initialize the scan cache and the roaming state.
+    // The credential walk advances before each unranked attempt, so starting at the last entry makes the first credential go first.
+    m_credential_index = (num_credentials > 0) ? (num_credentials - 1) : 0;
+    m_has_target_ap = false;
+    m_scan_cache_count = 0;
+    m_roam_scan_pending = false;
+    m_last_roam_scan_ms = -(CONFIG_APP_WIFI_ROAM_SCAN_BACKOFF_SEC * 1000LL);
+    m_roaming = false;
+    m_current_rssi = 0;
+    memset(m_current_bssid, 0, sizeof(m_current_bssid));
+
+    // Initialize the state machine, its event queue and its works. They all run on m_wq.
+    m_state = WIFI_STATE_IDLE;
+    m_wq_started = false;
+    m_retry_same_target = false;
+    m_num_subscribers = 0;
+    k_msgq_init(&m_event_q, m_event_q_buf, sizeof(struct wifi_sm_event), CONFIG_APP_WIFI_EVENT_QUEUE_SIZE);
+    k_work_init(&m_event_work, static_event_work_handler);
+    k_work_init_delayable(&m_state_timer, static_state_timer_handler);
+    k_work_init_delayable(&m_link_monitor_work, static_link_monitor_work_handler);
+    k_work_init_delayable(&m_report_work, static_report_work_handler);
+
+    // Initialize the metrics
+    m_stats = {};
+    m_stats.queue_size = CONFIG_APP_WIFI_EVENT_QUEUE_SIZE;
+    m_event_latency = {};
+    m_event_latency.name = "wifi event";
 }
 
 /**
@@ -61,40 +105,81 @@ WIFI_STA_NETWORK::WIFI_STA_NETWORK(const char* ssid, const char* psk, SINGLE_RGB
  */
 WIFI_STA_NETWORK::~WIFI_STA_NETWORK()
 {
-    // Tell the kernel to remove our callback from its list.
+    // Tell the kernel to remove our callbacks from its list.
     LOG_INF("WIFI object is deleted and unregistering WIFI event callback.");
     net_mgmt_del_event_callback(&m_cb);
+    net_mgmt_del_event_callback(&m_ipv4_cb);
+
+    // Stop the background works before the object goes away
+    if (m_wq_started)
+    {
+        k_work_cancel_delayable(&m_state_timer);
+        k_work_cancel_delayable(&m_link_monitor_work);
+        k_work_cancel_delayable(&m_report_work);
+        k_work_queue_drain(&m_wq, true);
+        k_work_queue_stop(&m_wq, K_FOREVER);
+    }
 }
 
 
 /**
- * @brief Initialize the network and start the event call back
+ * @brief Initialize the network and start the state machine
  */
 void WIFI_STA_NETWORK::initialize_network(void)
 {
-    // Initialize the wifi-related callback events
+    // Get the default (and only) Wi-Fi interface, which is the STA interface
+    m_sta_iface = net_if_get_default();
+
+    // Load the last DHCP lease, so reconnects can serve on it right away
+    lease_cache_init(m_sta_iface);
+
+    // Start the workqueue that runs the state machine
+    struct k_work_queue_config wq_config = { .name = "wifi_sm", .no_yield = false, .essential = false };
+    k_work_queue_init(&m_wq);
+    k_work_queue_start(&m_wq, m_wifi_wq_stack, K_THREAD_STACK_SIZEOF(m_wifi_wq_stack), WIFI_WQ_PRIORITY, &wq_config);
+    m_wq_started = true;
+
+    // Initialize the wifi-related callback events. The callbacks only queue events for the workqueue.
 	net_mgmt_init_event_callback(&m_cb, static_wifi_event_handler, NET_EVENT_WIFI_MASK);
 	net_mgmt_add_event_callback(&m_cb);
+	net_mgmt_init_event_callback(&m_ipv4_cb, static_ipv4_event_handler, NET_EVENT_IPV4_ADDR_ADD);
+	net_mgmt_add_event_callback(&m_ipv4_cb);
 
-    // Get the default (and only) Wi-Fi interface, which is the STA interface
-    m_sta_iface = net_if_get_default();
+    if (CONFIG_APP_WIFI_METRICS_REPORT_SEC > 0)
+    {
+        k_work_schedule_for_queue(&m_wq, &m_report_work, K_SECONDS(CONFIG_APP_WIFI_METRICS_REPORT_SEC));
+    }
 
-    // This wait here is a workaround solution to connect to the Wi-Fi network
-    // The correct solution should be check the status of "m_sta_iface".
-    // However, for some reason, the status of this interface is always "down" even net_if_up() is called
-    while (connect_to_wifi() != 0)
+    // Without credentials the state machine stays idle and the link stays down
+    if (m_num_credentials == 0)
     {
-        k_sleep(K_MSEC(500));
+        LOG_ERR("No Wi-Fi credentials, not connecting");
+        return;
     }
 
-    // Sleep another time to ensure the connection is stable and ready
-    // [TODO]: Find a better way to do this. Maybe newer version of Zephyr has fixed this problem
-    // Without this sleep, the connection sometimes failed. Developer is encouraged to investigate further.
-    k_sleep(K_SECONDS(5));
+    // The first scan and connection attempt run in the background
+    post_event(WIFI_SM_EV_START, 0);
 }
 
 /**
- * @brief Connect to the WIFI with preset password and ID
+ * @brief Register a subscriber to the state changes
+ */
+int WIFI_STA_NETWORK::subscribe(wifi_state_cb_t cb, void *user_data)
+{
+    if (m_num_subscribers >= ARRAY_SIZE(m_subscribers))
+    {
+        return -ENOMEM;
+    }
+
+    m_subscribers[m_num_subscribers].cb = cb;
+    m_subscribers[m_num_subscribers].user_data = user_data;
+    m_num_subscribers++;
+
+    return 0;
+}
+
+/**
+ * @brief Connect to the WIFI with the currently selected credential (and access point, if one was picked from the scan)
  */
 int WIFI_STA_NETWORK::connect_to_wifi(void)
 {
@@ -104,15 +189,27 @@ int WIFI_STA_NETWORK::connect_to_wifi(void)
 		return -EIO;
 	}
 
-	m_sta_config.ssid        = (const uint8_t *)m_ssid;
-	m_sta_config.ssid_length = strlen(m_ssid);
-	m_sta_config.psk         = (const uint8_t *)m_psk;
-	m_sta_config.psk_length  = strlen(m_psk);
-	m_sta_config.security = WIFI_SECURITY_TYPE_PSK;
+    const struct wifi_credential *cred = &m_credentials[m_credential_index];
+
+	m_sta_config.ssid        = (const uint8_t *)cred->ssid;
+	m_sta_config.ssid_length = strlen(cred->ssid);
+	m_sta_config.psk         = (const uint8_t *)cred->psk;
+	m_sta_config.psk_length  = strlen(cred->psk);
+	m_sta_config.security = (m_sta_config.psk_length > 0) ? WIFI_SECURITY_TYPE_PSK : WIFI_SECURITY_TYPE_NONE;
 	m_sta_config.channel  = WIFI_CHANNEL_ANY;
 	m_sta_config.band     = WIFI_FREQ_BAND_2_4_GHZ;
+    memset(m_sta_config.bssid, 0, sizeof(m_sta_config.bssid));
 
-	LOG_INF("Connecting to SSID: %s...", m_sta_config.ssid);
+    // Pin the access point picked from the scan, which also saves the driver a full channel sweep
+    if (m_has_target_ap)
+    {
+        m_sta_config.channel = m_target_ap.channel;
+        memcpy(m_sta_config.bssid, m_target_ap.bssid, sizeof(m_sta_config.bssid));
+    }
+
+	LOG_INF("Connecting to SSID: %s...", cred->ssid);
+    APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_CONNECTING, m_credential_index);
+    journal_log(JOURNAL_EV_WIFI_CONNECTING, m_credential_index);
 
 	int ret = net_mgmt(NET_REQUEST_WIFI_CONNECT, m_sta_iface, &m_sta_config,
 			   sizeof(struct wifi_connect_req_params));
@@ -136,87 +233,430 @@ void WIFI_STA_NETWORK::static_wifi_event_handler(struct net_mgmt_event_callback
     }
 }
 
+/**
+ * @brief Trampoline for the IPv4 address events
+ */
+void WIFI_STA_NETWORK::static_ipv4_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface)
+{
+    WIFI_STA_NETWORK *self = CONTAINER_OF(cb, WIFI_STA_NETWORK, m_ipv4_cb);
+
+    if ((mgmt_event == NET_EVENT_IPV4_ADDR_ADD) && (iface == self->m_sta_iface))
+    {
+        self->post_event(WIFI_SM_EV_IPV4_ADDR, 0);
+    }
+}
+
 /**
  * @brief Handle the event callback for the network management
+ * This runs on the net_mgmt event thread: copy what the state machine needs and return.
  */
 void WIFI_STA_NETWORK::wifi_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface)
 {
+    const struct wifi_status *status = (const struct wifi_status *)cb->info;
+
+    ARG_UNUSED(iface);
+
 	switch (mgmt_event) 
     {
-        // Connection result
+        // Connection result, also reported for a failed attempt
         case NET_EVENT_WIFI_CONNECT_RESULT: 
-        {   
-            m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::YELLOW);
-            // Cancel any pending reconnect work
-            k_work_cancel_delayable(&m_reconnect_work);
+            post_event(WIFI_SM_EV_CONNECT_RESULT, (status != NULL) ? status->status : 0);
+            break;
+
+        // Disconnection result, with the reason
+        case NET_EVENT_WIFI_DISCONNECT_RESULT: 
+            post_event(WIFI_SM_EV_DISCONNECTED, (status != NULL) ? status->status : 0);
+            break;
+
+        // One access point found by the scan: only those of known networks are queued
+        case NET_EVENT_WIFI_SCAN_RESULT:
+        {
+            struct wifi_scan_entry entry;
+            if (match_scan_result((const struct wifi_scan_result *)cb->info, &entry))
+            {
+                post_event(WIFI_SM_EV_SCAN_RESULT, 0, &entry);
+            }
+            break;
+        }
+
+        case NET_EVENT_WIFI_SCAN_DONE:
+            post_event(WIFI_SM_EV_SCAN_DONE, 0);
+            break;
+
+        default:
+            break;
+	}
+}
+
+/**
+ * @brief Queue an event for the state machine and wake up the workqueue
+ */
+void WIFI_STA_NETWORK::post_event(enum wifi_sm_event_type type, int32_t status, const struct wifi_scan_entry *scan_entry)
+{
+    struct wifi_sm_event event = {};
+
+    event.type = type;
+    event.status = status;
+    event.enqueued = latency_now();
+    if (scan_entry != nullptr)
+    {
+        event.scan_entry = *scan_entry;
+    }
+
+    int ret = k_msgq_put(&m_event_q, &event, K_NO_WAIT);
+    uint32_t depth = k_msgq_num_used_get(&m_event_q);
+
+    K_SPINLOCK(&m_stats_lock)
+    {
+        if (ret)
+        {
+            m_stats.events_dropped++;
+        }
+        m_stats.queue_peak = MAX(m_stats.queue_peak, depth);
+    }
+
+    if (ret)
+    {
+        LOG_WRN("Wi-Fi event queue full, event %u dropped", type);
+        return;
+    }
+
+    k_work_submit_to_queue(&m_wq, &m_event_work);
+}
+
+/**
+ * @brief Workqueue: run every queued event through the state machine
+ */
+void WIFI_STA_NETWORK::static_event_work_handler(struct k_work *work)
+{
+    WIFI_STA_NETWORK *self = CONTAINER_OF(work, WIFI_STA_NETWORK, m_event_work);
+    struct wifi_sm_event event;
+
+    while (k_msgq_get(&self->m_event_q, &event, K_NO_WAIT) == 0)
+    {
+        // Time the event spent queued
+        latency_record(&self->m_event_latency, event.enqueued, latency_now());
 
-            LOG_INF("Taking IPv4 address....");
+        self->handle_event(&event);
 
-            // [TODO] - Attempt to use the event flag instead of this timer
-            // Explain: If there is no delay here, the net_if_get_config() will return NULL pointer
-            k_sleep(K_SECONDS(10));
+        K_SPINLOCK(&self->m_stats_lock)
+        {
+            self->m_stats.events_handled++;
+        }
+    }
+}
 
-            // Variable to take IPv4 address
-            struct net_if_config *cfg;
-            char buf[NET_IPV4_ADDR_LEN];
+/**
+ * @brief The state timer expired. It runs on the workqueue, so it is handled at once, without queueing latency.
+ */
+void WIFI_STA_NETWORK::static_state_timer_handler(struct k_work *work)
+{
+    WIFI_STA_NETWORK *self = CONTAINER_OF(k_work_delayable_from_work(work), WIFI_STA_NETWORK, m_state_timer);
+    struct wifi_sm_event event = {};
+
+    event.type = WIFI_SM_EV_TIMEOUT;
+    self->handle_event(&event);
 
-            // Take network config 
-            cfg = net_if_get_config(iface);
-            if (!cfg) 
+    K_SPINLOCK(&self->m_stats_lock)
+    {
+        self->m_stats.events_handled++;
+        self->m_stats.timeouts++;
+    }
+}
+
+/**
+ * @brief The state machine. Runs on the workqueue only.
+ */
+void WIFI_STA_NETWORK::handle_event(const struct wifi_sm_event *event)
+{
+    switch (event->type)
+    {
+        case WIFI_SM_EV_START:
+        {
+            // Rank the known networks that are in range, so the first attempt goes to the strongest one
+            if ((m_state == WIFI_STATE_IDLE) && (request_scan() == 0))
             {
-                LOG_INF("Failed to take network configuration");
-                break;
+                set_state(WIFI_STATE_SCANNING);
+                arm_timer(WIFI_INITIAL_SCAN_TIMEOUT_MS);
+            }
+            else if (m_state == WIFI_STATE_IDLE)
+            {
+                start_connect();
             }
+            break;
+        }
+
+        case WIFI_SM_EV_SCAN_RESULT:
+            add_scan_entry(&event->scan_entry);
+            break;
 
-            // We are supposed to loop through NET_IF_MAX_IPV4_ADDR to get all IPv4 address
-            // However, this project set the max no. IPv4 addresses as 1 in prj.conf
-            LOG_INF("The IPv4 address: %s",
-                net_addr_ntop(AF_INET,
-                        &cfg->ip.ipv4->unicast[0].ipv4.address.in_addr,
-                        buf, sizeof(buf)));
-            
-            // Connection success log
-            LOG_INF("Connected to %s", m_ssid);
-
-            // Switch the connection status
-            m_is_connected = true;
-
-            //  Give the semaphore to unblock main()
-            k_sem_give(&m_ip_ready_sem);
-            
-            // [TODO] - Attempt to use the event flag instead of this timer
-            // Explain: If there is no delay here, the while loop in main() behaves erratically
-            // Developer is encouraged to investigate further.
-            k_sleep(K_SECONDS(10));
+        case WIFI_SM_EV_SCAN_DONE:
+        {
+            LOG_INF("Scan done, %u known access point(s) in range", (unsigned int)m_scan_cache_count);
+            APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_SCAN_DONE, m_scan_cache_count);
 
+            if (m_state == WIFI_STATE_SCANNING)
+            {
+                stop_timer();
+                start_connect();
+            }
+            else if (m_roam_scan_pending)
+            {
+                // The link monitor asked for this scan: evaluate a roam
+                m_roam_scan_pending = false;
+                evaluate_roam();
+            }
             break;
         }
 
-        // Disconnection result
-        case NET_EVENT_WIFI_DISCONNECT_RESULT: 
+        case WIFI_SM_EV_CONNECT_RESULT:
         {
-            LOG_INF("Disconnection event is triggered.");
+            // Only the attempt in progress counts. After a connect timeout that attempt was abandoned with a
+            // disconnect request: a late success is about to be torn down, so bringing the link up on it would
+            // start the servers on a dying link. Make sure it goes, and let the backoff timer start over.
+            if (m_state != WIFI_STATE_CONNECTING)
+            {
+                if ((m_state == WIFI_STATE_BACKOFF) && (event->status == 0))
+                {
+                    LOG_WRN("Connection result arrived after the timeout, dropping that link");
+                    net_mgmt(NET_REQUEST_WIFI_DISCONNECT, m_sta_iface, NULL, 0);
+                }
+                break;
+            }
 
-            if (m_is_connected == true)
+            // A failed attempt: drop that access point and try the next candidate
+            if (event->status)
             {
-                // Switch the connection status
-                m_is_connected = false;
+                LOG_WRN("Connection to %s failed: %d", m_credentials[m_credential_index].ssid, event->status);
+                APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_CONNECT_FAIL, event->status);
+                journal_log(JOURNAL_EV_WIFI_CONNECT_FAIL, event->status);
+                retry_after(WIFI_RETRY_FAILED_MS, false);
+                break;
+            }
 
-                //  Give the semaphore to notify main about the wifi disconnection
-                k_sem_give(&m_wifi_disconnected_sem);
+            stop_timer();
+            on_link_up(m_sta_iface);
+            break;
+        }
+
+        case WIFI_SM_EV_IPV4_ADDR:
+        {
+            if (m_state == WIFI_STATE_WAIT_IP)
+            {
+                on_ip_ready();
             }
+            break;
+        }
+
+        case WIFI_SM_EV_DISCONNECTED:
+        {
+            LOG_INF("Disconnection event is triggered.");
+            APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_DISCONNECTED, m_roaming);
+
+            // Keep the reason across reboots: it is the first thing to look at after a field failure
+            journal_log(JOURNAL_EV_WIFI_DISCONNECTED, event->status);
+
+            // The link is gone, so there is nothing left to monitor
+            k_work_cancel_delayable(&m_link_monitor_work);
+            m_roam_scan_pending = false;
 
             // Change LED to red to indicate disconnection. The LED is turned green after the UDP/TCP is ready, which happens after connection is established.
             m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::RED);
 
-            k_work_schedule(&m_reconnect_work, K_SECONDS(5));
+            // A roam is a disconnect we asked for: join the new access point right away
+            if (m_state == WIFI_STATE_ROAMING)
+            {
+                m_roaming = false;
+                stop_timer();
+                start_connect();
+            }
+            else if (m_state != WIFI_STATE_BACKOFF)
+            {
+                retry_after(WIFI_RETRY_DISCONNECTED_MS, false);
+            }
+            break;
+        }
 
+        case WIFI_SM_EV_TIMEOUT:
+        {
+            switch (m_state)
+            {
+                case WIFI_STATE_SCANNING:
+                    // Fall back to the credential order
+                    LOG_WRN("Initial scan timed out");
+                    start_connect();
+                    break;
+
+                case WIFI_STATE_CONNECTING:
+                    LOG_WRN("No connection result after %d ms", WIFI_CONNECT_TIMEOUT_MS);
+                    journal_log(JOURNAL_EV_WIFI_CONNECT_FAIL, -ETIMEDOUT);
+                    net_mgmt(NET_REQUEST_WIFI_DISCONNECT, m_sta_iface, NULL, 0);
+                    retry_after(WIFI_RETRY_FAILED_MS, false);
+                    break;
+
+                case WIFI_STATE_WAIT_IP:
+                    // Associated but DHCP never answered: start over, the disconnect event schedules the retry
+                    LOG_WRN("No IPv4 address after %d ms, reconnecting", WIFI_DHCP_TIMEOUT_MS);
+                    if (net_mgmt(NET_REQUEST_WIFI_DISCONNECT, m_sta_iface, NULL, 0) != 0)
+                    {
+                        retry_after(WIFI_RETRY_FAILED_MS, false);
+                    }
+                    break;
+
+                case WIFI_STATE_ROAMING:
+                    // The disconnect was never confirmed: join the target anyway
+                    m_roaming = false;
+                    start_connect();
+                    break;
+
+                case WIFI_STATE_BACKOFF:
+                    start_connect();
+                    break;
+
+                default:
+                    break;
+            }
             break;
         }
 
         default:
             break;
-	}
+    }
+}
+
+/**
+ * @brief Enter a new state and tell main() and the subscribers
+ */
+void WIFI_STA_NETWORK::set_state(enum wifi_state new_state)
+{
+    enum wifi_state old_state = m_state;
+
+    if (new_state == old_state)
+    {
+        return;
+    }
+
+    m_state = new_state;
+    LOG_INF("Wi-Fi state: %s -> %s", state_name(old_state), state_name(new_state));
+
+    // Switch the connection status and release main()
+    m_is_connected = (new_state == WIFI_STATE_CONNECTED);
+    if (new_state == WIFI_STATE_CONNECTED)
+    {
+        k_event_set_masked(&m_link_events, WIFI_EVENT_UP, WIFI_EVENT_UP);
+    }
+    else if (old_state == WIFI_STATE_CONNECTED)
+    {
+        k_event_clear(&m_link_events, WIFI_EVENT_UP);
+        k_event_post(&m_link_events, WIFI_EVENT_DOWN);
+    }
+
+    for (size_t i = 0; i < m_num_subscribers; i++)
+    {
+        m_subscribers[i].cb(old_state, new_state, m_subscribers[i].user_data);
+    }
+}
+
+/**
+ * @brief (Re)start the timer of the current state
+ */
+void WIFI_STA_NETWORK::arm_timer(uint32_t timeout_ms)
+{
+    k_work_reschedule_for_queue(&m_wq, &m_state_timer, K_MSEC(timeout_ms));
+}
+
+/**
+ * @brief Stop the timer of the state being left
+ */
+void WIFI_STA_NETWORK::stop_timer(void)
+{
+    k_work_cancel_delayable(&m_state_timer);
+}
+
+/**
+ * @brief Send a connection request to the next candidate, or retry shortly if the driver is busy
+ */
+void WIFI_STA_NETWORK::start_connect(void)
+{
+    // Pick the next candidate: the roam target if one is set, otherwise the best cached access point or the next credential
+    if (!m_has_target_ap && !m_retry_same_target)
+    {
+        select_next_target();
+    }
+    m_retry_same_target = false;
+
+    if (connect_to_wifi() != 0)
+    {
+        // The driver did not take the request: same target again, without blocking the workqueue
+        retry_after(WIFI_RETRY_BUSY_MS, true);
+        return;
+    }
+
+    // The target is consumed. A failed attempt falls back to the ranking on the next try.
+    m_has_target_ap = false;
+
+    set_state(WIFI_STATE_CONNECTING);
+    arm_timer(WIFI_CONNECT_TIMEOUT_MS);
+}
+
+/**
+ * @brief Wait before the next connection attempt
+ */
+void WIFI_STA_NETWORK::retry_after(uint32_t delay_ms, bool same_target)
+{
+    m_retry_same_target = same_target;
+    set_state(WIFI_STATE_BACKOFF);
+    arm_timer(delay_ms);
+}
+
+/**
+ * @brief Associated with the access point: use the cached lease or wait for DHCP
+ */
+void WIFI_STA_NETWORK::on_link_up(struct net_if *iface)
+{
+    APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_CONNECTED, 0);
+    journal_log(JOURNAL_EV_WIFI_CONNECTED, m_credential_index);
+    m_led_indicator->set_color_for_rgb_led(color_for_led_rgb::YELLOW);
+
+    // Start the link-up to first-packet measurement
+    rejoin_timing_mark_link_up();
+
+    // Fast path: serve on the cached lease at once, DHCP confirms it in the background.
+    // DHCP may also have been quicker than this event.
+    if ((lease_cache_apply(iface) == 0) ||
+        (net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED) != NULL))
+    {
+        on_ip_ready();
+        return;
+    }
+
+    LOG_INF("Taking IPv4 address....");
+    set_state(WIFI_STATE_WAIT_IP);
+    arm_timer(WIFI_DHCP_TIMEOUT_MS);
+}
+
+/**
+ * @brief The interface has an address: the station is connected
+ */
+void WIFI_STA_NETWORK::on_ip_ready(void)
+{
+    char buf[NET_IPV4_ADDR_LEN];
+    struct in_addr *addr = net_if_ipv4_get_global_addr(m_sta_iface, NET_ADDR_PREFERRED);
+
+    stop_timer();
+
+    if (addr != NULL)
+    {
+        LOG_INF("The IPv4 address: %s", net_addr_ntop(AF_INET, addr, buf, sizeof(buf)));
+    }
+
+    // Connection success log
+    LOG_INF("Connected to %s", m_credentials[m_credential_index].ssid);
+
+    set_state(WIFI_STATE_CONNECTED);
+
+    // Start watching the link quality so we can roam before the link drops
+    k_work_schedule_for_queue(&m_wq, &m_link_monitor_work, K_MSEC(CONFIG_APP_WIFI_LINK_MONITOR_INTERVAL_MS));
 }
 
 /**
@@ -225,38 +665,295 @@ void WIFI_STA_NETWORK::wifi_event_handler(struct net_mgmt_event_callback *cb, ui
 void WIFI_STA_NETWORK::wait_for_ip(void)
 {
     LOG_INF("Waiting for IPv4 address, i.e., WIFI connection completed...");
-    k_sem_take(&m_ip_ready_sem, K_FOREVER);
+
+    // The servers of the last connection are gone: a drop latched before now has been handled
+    k_event_clear(&m_link_events, WIFI_EVENT_DOWN);
+    k_event_wait(&m_link_events, WIFI_EVENT_UP, false, K_FOREVER);
     LOG_INF("WIFI connection is established and IPv4 address is received.");
 }
 
 /**
- * @brief This function will waits until the wifi connection is established, i.e., an IP is ready
+ * @brief This function will waits until the wifi connection is lost
  */
 void WIFI_STA_NETWORK::wait_for_wifi_to_disconnect(void)
 {
     LOG_INF("Pending here until WIFI disconnection is detected...");
-    k_sem_take(&m_wifi_disconnected_sem, K_FOREVER);
+
+    // Returns at once if the link dropped (even if it came back) since wait_for_ip(). The latch is only cleared
+    // here, after the wait: reset=true would clear it before waiting and lose that drop.
+    k_event_wait(&m_link_events, WIFI_EVENT_DOWN, false, K_FOREVER);
+    k_event_clear(&m_link_events, WIFI_EVENT_DOWN);
     LOG_INF("WIFI connection is lost.");
 }
 
 /**
- * @brief This function is to handle the reconnect work, which will attempt to reconnect to the WIFI network
+ * @brief Periodically read the RSSI of the current link
  */
-void WIFI_STA_NETWORK::static_reconnect_work_handler(struct k_work *work)
+void WIFI_STA_NETWORK::static_link_monitor_work_handler(struct k_work *work)
 {
-    // Get the 'self' pointer. We must use CONTAINER_OF to find the parent class that this k_work struct lives inside.
-    // [TODO]: Try to use the C++ way to pass the 'this' pointer to this function, which will remove the warning
-    WIFI_STA_NETWORK *self = CONTAINER_OF(work, WIFI_STA_NETWORK, m_reconnect_work);
-    
-    // Call the connect function
-    LOG_INF("Attempting to reconnect to the WIFI network %s...", self->m_ssid);
-    while (self->connect_to_wifi() != 0) 
+    WIFI_STA_NETWORK *self = CONTAINER_OF(k_work_delayable_from_work(work), WIFI_STA_NETWORK, m_link_monitor_work);
+
+    self->check_link();
+}
+
+/**
+ * @brief Read the RSSI of the current link and start a roaming scan when it gets weak
+ */
+void WIFI_STA_NETWORK::check_link(void)
+{
+    struct wifi_iface_status status = { 0 };
+
+    if (net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, m_sta_iface, &status, sizeof(status)) == 0)
+    {
+        m_current_rssi = status.rssi;
+#if defined(CONFIG_APP_TELEMETRY)
+        telemetry_record(TELEMETRY_CH_RSSI_DBM, status.rssi);
+#endif
+        memcpy(m_current_bssid, status.bssid, sizeof(m_current_bssid));
+
+        // Only scan when the link is weak, and not more often than the backoff allows
+        int64_t now = k_uptime_get();
+        if ((status.rssi < CONFIG_APP_WIFI_ROAM_RSSI_THRESHOLD) &&
+            !m_roam_scan_pending &&
+            (now - m_last_roam_scan_ms >= CONFIG_APP_WIFI_ROAM_SCAN_BACKOFF_SEC * 1000LL))
+        {
+            LOG_INF("RSSI %d dBm is below %d dBm, scanning for a better access point",
+                    status.rssi, CONFIG_APP_WIFI_ROAM_RSSI_THRESHOLD);
+
+            m_last_roam_scan_ms = now;
+            m_roam_scan_pending = (request_scan() == 0);
+        }
+    }
+
+    if (m_state == WIFI_STATE_CONNECTED)
+    {
+        k_work_schedule_for_queue(&m_wq, &m_link_monitor_work, K_MSEC(CONFIG_APP_WIFI_LINK_MONITOR_INTERVAL_MS));
+    }
+}
+
+/**
+ * @brief After a roaming scan, move to the strongest known access point if it is clearly better than the current one
+ */
+void WIFI_STA_NETWORK::evaluate_roam(void)
+{
+    struct wifi_scan_entry best;
+
+    if ((m_state != WIFI_STATE_CONNECTED) || !pick_best_ap(&best))
+    {
+        return;
+    }
+
+    // Require a margin, otherwise two access points of similar strength make us flap between them
+    if ((memcmp(best.bssid, m_current_bssid, WIFI_MAC_ADDR_LEN) == 0) ||
+        (best.rssi < m_current_rssi + CONFIG_APP_WIFI_ROAM_HYSTERESIS_DB))
+    {
+        LOG_INF("No better access point (best %d dBm, current %d dBm)", best.rssi, m_current_rssi);
+        return;
+    }
+
+    LOG_INF("Roaming to %s on channel %u (%d dBm, current %d dBm)",
+            m_credentials[best.credential_index].ssid, best.channel, best.rssi, m_current_rssi);
+
+    // The disconnect event reconnects to this target immediately
+    APP_TRACE(APP_TRACE_WIFI_STATE, APP_TRACE_WIFI_ROAMING, (int32_t)best.rssi);
+    journal_log(JOURNAL_EV_WIFI_ROAM, best.rssi);
+    m_target_ap = best;
+    m_has_target_ap = true;
+    m_credential_index = best.credential_index;
+    m_roaming = true;
+
+    if (net_mgmt(NET_REQUEST_WIFI_DISCONNECT, m_sta_iface, NULL, 0) != 0)
+    {
+        LOG_WRN("Failed to leave the current access point, staying on it");
+        m_roaming = false;
+        m_has_target_ap = false;
+        return;
+    }
+
+    set_state(WIFI_STATE_ROAMING);
+    arm_timer(WIFI_ROAM_TIMEOUT_MS);
+}
+
+/**
+ * @brief Read the event handling metrics
+ */
+struct wifi_sm_stats WIFI_STA_NETWORK::get_stats(void)
+{
+    struct wifi_sm_stats stats;
+
+    K_SPINLOCK(&m_stats_lock)
     {
-        k_sleep(K_MSEC(500));
+        stats = m_stats;
     }
+    stats.latency_max_us = m_event_latency.max_us;
 
-    // Sleep another time to ensure the connection is stable and ready
-    // [TODO]: Find a better way to do this. Maybe newer version of Zephyr has fixed this problem
-    // Without this sleep, the connection sometimes failed. Developer is encouraged to investigate further.
-    k_sleep(K_SECONDS(5));
-}
\ No newline at end of file
+    return stats;
+}
+
+/**
+ * @brief Log the event handling metrics
+ */
+void WIFI_STA_NETWORK::report_stats(void)
+{
+    struct wifi_sm_stats stats = get_stats();
+
+    LOG_INF("Wi-Fi events: %u handled (%u timeouts), %u dropped, queue peak %u/%u, state %s",
+            stats.events_handled, stats.timeouts, stats.events_dropped, stats.queue_peak, stats.queue_size,
+            state_name(m_state));
+    latency_report(&m_event_latency);
+}
+
+/**
+ * @brief Periodic metrics report, on the workqueue
+ */
+void WIFI_STA_NETWORK::static_report_work_handler(struct k_work *work)
+{
+    WIFI_STA_NETWORK *self = CONTAINER_OF(k_work_delayable_from_work(work), WIFI_STA_NETWORK, m_report_work);
+
+    self->report_stats();
+    k_work_schedule_for_queue(&self->m_wq, &self->m_report_work, K_SECONDS(CONFIG_APP_WIFI_METRICS_REPORT_SEC));
+}
+
+/**
+ * @brief Name of a state, for the logs
+ */
+const char *WIFI_STA_NETWORK::state_name(enum wifi_state state)
+{
+    switch (state)
+    {
+        case WIFI_STATE_IDLE:       return "idle";
+        case WIFI_STATE_SCANNING:   return "scanning";
+        case WIFI_STATE_CONNECTING: return "connecting";
+        case WIFI_STATE_WAIT_IP:    return "wait-ip";
+        case WIFI_STATE_CONNECTED:  return "connected";
+        case WIFI_STATE_ROAMING:    return "roaming";
+        case WIFI_STATE_BACKOFF:    return "backoff";
+        default:                    return "?";
+    }
+}
+
+/**
+ * @brief Clear the scan cache and start a new scan
+ */
+int WIFI_STA_NETWORK::request_scan(void)
+{
+    m_scan_cache_count = 0;
+
+    int ret = net_mgmt(NET_REQUEST_WIFI_SCAN, m_sta_iface, NULL, 0);
+    if (ret)
+    {
+        LOG_WRN("Failed to start the Wi-Fi scan: %d", ret);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Check whether a scan result belongs to a known network, and copy what the cache keeps of it
+ * Called from the net_mgmt event thread: it only reads the credential table.
+ */
+bool WIFI_STA_NETWORK::match_scan_result(const struct wifi_scan_result *result, struct wifi_scan_entry *entry)
+{
+    if (result == NULL)
+    {
+        return false;
+    }
+
+    // Only access points of networks we have credentials for are interesting
+    size_t cred;
+    for (cred = 0; cred < m_num_credentials; cred++)
+    {
+        if ((result->ssid_length == strlen(m_credentials[cred].ssid)) &&
+            (memcmp(result->ssid, m_credentials[cred].ssid, result->ssid_length) == 0))
+        {
+            break;
+        }
+    }
+    if (cred == m_num_credentials)
+    {
+        return false;
+    }
+
+    memcpy(entry->bssid, result->mac, WIFI_MAC_ADDR_LEN);
+    entry->rssi             = result->rssi;
+    entry->channel          = result->channel;
+    entry->credential_index = cred;
+
+    return true;
+}
+
+/**
+ * @brief Insert an access point into the cache. The cache stays sorted by RSSI.
+ */
+void WIFI_STA_NETWORK::add_scan_entry(const struct wifi_scan_entry *entry)
+{
+    // Find the insertion point, keeping the strongest access point first
+    size_t pos = 0;
+    while ((pos < m_scan_cache_count) && (m_scan_cache[pos].rssi >= entry->rssi))
+    {
+        pos++;
+    }
+
+    // Weaker than everything in a full cache: not worth keeping
+    if (pos < CONFIG_APP_WIFI_SCAN_CACHE_SIZE)
+    {
+        size_t last = MIN(m_scan_cache_count, (size_t)CONFIG_APP_WIFI_SCAN_CACHE_SIZE - 1);
+        memmove(&m_scan_cache[pos + 1], &m_scan_cache[pos], (last - pos) * sizeof(m_scan_cache[0]));
+
+        m_scan_cache[pos] = *entry;
+        m_scan_cache_count = last + 1;
+    }
+}
+
+/**
+ * @brief Return the strongest cached access point. Equal RSSI is broken by the credential order.
+ */
+bool WIFI_STA_NETWORK::pick_best_ap(struct wifi_scan_entry *best)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < m_scan_cache_count; i++)
+    {
+        if (!found || (m_scan_cache[i].rssi == best->rssi &&
+                       m_scan_cache[i].credential_index < best->credential_index))
+        {
+            *best = m_scan_cache[i];
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * @brief Choose what the next connection attempt goes to
+ * The best cached access point is used and removed from the cache, so a failing one is not retried forever.
+ * When the cache is empty, the credentials are tried in order.
+ */
+void WIFI_STA_NETWORK::select_next_target(void)
+{
+    struct wifi_scan_entry best;
+
+    if (pick_best_ap(&best))
+    {
+        m_target_ap = best;
+        m_has_target_ap = true;
+        m_credential_index = best.credential_index;
+
+        // Consume the entry: if this attempt fails, the next one goes to the runner-up
+        for (size_t i = 0; i < m_scan_cache_count; i++)
+        {
+            if (memcmp(m_scan_cache[i].bssid, best.bssid, WIFI_MAC_ADDR_LEN) == 0)
+            {
+                memmove(&m_scan_cache[i], &m_scan_cache[i + 1], (m_scan_cache_count - i - 1) * sizeof(m_scan_cache[0]));
+                m_scan_cache_count--;
+                break;
+            }
+        }
+        return;
+    }
+
+    // Nothing ranked: walk the credential table
+    m_has_target_ap = false;
+    m_credential_index = (m_credential_index + 1) % m_num_credentials;
+}
@@ -17,6 +17,91 @@ INCLUDE
 
 // Project specific headers
 #include "led.h"
+#include "latency.h"
+
+
+
+/******************************************************************************
+DEFINE
+******************************************************************************/
+// Dedicated workqueue that runs the Wi-Fi state machine, so neither the net_mgmt event thread nor the system workqueue waits on it
+#define WIFI_WQ_STACK_SIZE      3072
+#define WIFI_WQ_PRIORITY        7
+
+// How long each waiting state may last before the state machine gives up on it
+#define WIFI_INITIAL_SCAN_TIMEOUT_MS   10000
+#define WIFI_CONNECT_TIMEOUT_MS        30000
+#define WIFI_DHCP_TIMEOUT_MS           20000
+#define WIFI_ROAM_TIMEOUT_MS           5000
+
+// Delay before the next connection attempt: driver busy, attempt failed, link lost
+#define WIFI_RETRY_BUSY_MS             500
+#define WIFI_RETRY_FAILED_MS           1000
+#define WIFI_RETRY_DISCONNECTED_MS     5000
+
+// States of the station
+enum wifi_state
+{
+    WIFI_STATE_IDLE = 0,      // initialize_network() not called yet
+    WIFI_STATE_SCANNING,      // Initial scan, to rank the known networks in range
+    WIFI_STATE_CONNECTING,    // Connect request sent, waiting for its result
+    WIFI_STATE_WAIT_IP,       // Associated, waiting for DHCP
+    WIFI_STATE_CONNECTED,     // Associated with an IPv4 address
+    WIFI_STATE_ROAMING,       // Leaving the current access point for a better one
+    WIFI_STATE_BACKOFF,       // Waiting before the next connection attempt
+};
+
+// What the state machine reacts to. Callbacks and timers only queue these.
+enum wifi_sm_event_type
+{
+    WIFI_SM_EV_START = 0,
+    WIFI_SM_EV_SCAN_RESULT,   // A known access point was seen (scan_entry)
+    WIFI_SM_EV_SCAN_DONE,
+    WIFI_SM_EV_CONNECT_RESULT, // status: 0 on success
+    WIFI_SM_EV_DISCONNECTED,  // status: reason
+    WIFI_SM_EV_IPV4_ADDR,     // An IPv4 address was added to the interface
+    WIFI_SM_EV_TIMEOUT,       // The state timer expired
+};
+
+// Called on the state machine's workqueue after every state change. Must not block.
+typedef void (*wifi_state_cb_t)(enum wifi_state old_state, enum wifi_state new_state, void *user_data);
+
+// Event handling metrics. State timeouts run straight from the workqueue: they are counted as handled events,
+// but the queue metrics and the latency histogram only cover the events that went through the queue.
+struct wifi_sm_stats
+{
+    uint32_t events_handled;    // Queued events and state timeouts
+    uint32_t timeouts;          // State timeouts among them
+    uint32_t events_dropped;    // Queue full
+    uint32_t queue_peak;        // Highest number of events waiting at once
+    uint32_t queue_size;
+    uint32_t latency_max_us;    // Longest time an event waited in the queue
+};
+
+// One known network. The credential table is ordered by preference, which breaks ties between equal RSSI.
+struct wifi_credential
+{
+    const char *ssid;
+    const char *psk;    // Empty string for an open network
+};
+
+// One access point seen during the last scan that belongs to a known network
+struct wifi_scan_entry
+{
+    uint8_t bssid[WIFI_MAC_ADDR_LEN];
+    int8_t  rssi;
+    uint8_t channel;
+    uint8_t credential_index;   // Index into the credential table
+};
+
+// One queued event
+struct wifi_sm_event
+{
+    uint32_t                enqueued;   // latency_now() when queued
+    int32_t                 status;
+    struct wifi_scan_entry  scan_entry;
+    uint8_t                 type;       // enum wifi_sm_event_type
+};
 
 
 
@@ -27,16 +112,16 @@ class WIFI_STA_NETWORK
 {
 public:
     // Constructor
-    WIFI_STA_NETWORK(const char* ssid, const char* psk, SINGLE_RGB_LED_WS2812* rgb_led);
+    WIFI_STA_NETWORK(const struct wifi_credential *credentials, size_t num_credentials, SINGLE_RGB_LED_WS2812* rgb_led);
 
     // Destructor
     ~WIFI_STA_NETWORK();
 
-    // Functions to initialize the network
+    // Start the state machine. Returns at once; the connection is made in the background.
     void initialize_network(void);
 
-    // Functions to connect to a WIFI
-    int connect_to_wifi(void);
+    // Be told of every state change. Call before initialize_network(). Returns -ENOMEM when all CONFIG_APP_WIFI_MAX_SUBSCRIBERS slots are taken.
+    int subscribe(wifi_state_cb_t cb, void *user_data);
 
     // Functions to wait untile the WIFI connection is established
     void wait_for_ip(void);
@@ -44,13 +129,75 @@ public:
     // A pending function that put on main.cpp to notify its about the WIFI disconnection
     void wait_for_wifi_to_disconnect(void);
 
+    // Current state
+    enum wifi_state get_state(void) const { return m_state; }
+
+    // Event handling metrics, and their log report
+    struct wifi_sm_stats get_stats(void);
+    void report_stats(void);
+
+    // Name of a state, for the logs
+    static const char *state_name(enum wifi_state state);
+
     // Variable to indicate the connection status
     bool m_is_connected;
 
 private:
     // Member variables to store the network credentials
-    const char* m_ssid;
-    const char* m_psk;
+    const struct wifi_credential *m_credentials;
+    size_t m_num_credentials;
+
+    // Credential and access point used by the current (or next) connection attempt
+    size_t m_credential_index;
+    struct wifi_scan_entry m_target_ap;
+    bool m_has_target_ap;
+
+    // Known access points from the last scan, sorted by RSSI (strongest first).
+    // Only the workqueue touches it, like the rest of the state below.
+    struct wifi_scan_entry m_scan_cache[CONFIG_APP_WIFI_SCAN_CACHE_SIZE];
+    size_t m_scan_cache_count;
+
+    // State machine
+    enum wifi_state m_state;
+    struct k_work_q m_wq;
+    bool m_wq_started;
+
+    // Event queue between the callbacks and the workqueue
+    struct k_msgq m_event_q;
+    char __aligned(4) m_event_q_buf[CONFIG_APP_WIFI_EVENT_QUEUE_SIZE * sizeof(struct wifi_sm_event)];
+    struct k_work m_event_work;
+
+    // One timer for the waiting states. It runs on the workqueue too, so cancelling it on a state change is final.
+    struct k_work_delayable m_state_timer;
+
+    // The next attempt keeps the current target (driver was busy) instead of moving on to the next candidate
+    bool m_retry_same_target;
+
+    // Subscribers to the state changes
+    struct
+    {
+        wifi_state_cb_t cb;
+        void *user_data;
+    } m_subscribers[CONFIG_APP_WIFI_MAX_SUBSCRIBERS];
+    size_t m_num_subscribers;
+
+    // Connection state for main(): WIFI_EVENT_UP while connected, WIFI_EVENT_DOWN latched by every drop until consumed
+    struct k_event m_link_events;
+
+    // Metrics: the counters are written from the callbacks, the histogram only from the workqueue
+    struct k_spinlock m_stats_lock;
+    struct wifi_sm_stats m_stats;
+    struct latency_histogram m_event_latency;
+    struct k_work_delayable m_report_work;
+
+    // Scan bookkeeping
+    bool m_roam_scan_pending;
+    int64_t m_last_roam_scan_ms;
+
+    // Roaming: set while we deliberately drop the link to move to a better access point
+    bool m_roaming;
+    int m_current_rssi;
+    uint8_t m_current_bssid[WIFI_MAC_ADDR_LEN];
 
     // STA interface
     struct net_if *m_sta_iface;
@@ -58,29 +205,53 @@ private:
     // STA configuration
     struct wifi_connect_req_params m_sta_config;
 
-    // Callback for the network management event
+    // Callbacks for the network management events: Wi-Fi, and the IPv4 address given by DHCP
     struct net_mgmt_event_callback m_cb;
+    struct net_mgmt_event_callback m_ipv4_cb;
 
     // LED indicator
     SINGLE_RGB_LED_WS2812* m_led_indicator;
 
-    // Semaphore to indicate the wifi connection is established 
-    struct k_sem m_ip_ready_sem;
-
-    // Semaphore to indicate the wifi connection is ended
-    struct k_sem m_wifi_disconnected_sem;
-
     // The static wrapper function that Zephyr's C API will call
     static void static_wifi_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface);
+    static void static_ipv4_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface);
 
-    // The non-static (instance) handler where your actual logic goes
+    // The non-static (instance) handler, which turns the event into a queued state machine event
     void wifi_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface);
 
-    // Reconnect work item
-    struct k_work_delayable m_reconnect_work;
+    // Queue an event for the workqueue. Safe from any thread; never blocks.
+    void post_event(enum wifi_sm_event_type type, int32_t status, const struct wifi_scan_entry *scan_entry = nullptr);
+
+    // Workqueue side: drain the queue and run the state machine
+    static void static_event_work_handler(struct k_work *work);
+    void handle_event(const struct wifi_sm_event *event);
+    void set_state(enum wifi_state new_state);
+    void arm_timer(uint32_t timeout_ms);
+    void stop_timer(void);
+    static void static_state_timer_handler(struct k_work *work);
+
+    // Actions of the state machine
+    int connect_to_wifi(void);
+    void start_connect(void);
+    void retry_after(uint32_t delay_ms, bool same_target);
+    void on_link_up(struct net_if *iface);
+    void on_ip_ready(void);
+    void check_link(void);
+    void evaluate_roam(void);
+
+    // Link-quality monitor, which runs periodically while connected
+    struct k_work_delayable m_link_monitor_work;
+    static void static_link_monitor_work_handler(struct k_work *work);
+
+    // Periodic metrics report
+    static void static_report_work_handler(struct k_work *work);
 
-    // Reconnect work handler
-    static void static_reconnect_work_handler(struct k_work *work);
+    // Scan helpers
+    int request_scan(void);
+    bool match_scan_result(const struct wifi_scan_result *result, struct wifi_scan_entry *entry);
+    void add_scan_entry(const struct wifi_scan_entry *entry);
+    bool pick_best_ap(struct wifi_scan_entry *best);
+    void select_next_target(void);
 
 };
 
@@ -28,9 +28,20 @@ Description: This project attempts to control an ESP32S3 module via WiFi using Z
 
 // Customized Library
 #include "led.h"
+#include "led_strip.h"
 #include "wifi.h"
 #include "udp.h"
 #include "tcp.h"
+#include "tcp_async.h"
+#include "ddp.h"
+#include "netpool.h"
+#include "timesync.h"
+#include "sched.h"
+#include "telemetry.h"
+#include "mqtt_app.h"
+#include "capture.h"
+#include "journal.h"
+#include "instance.h"
 
 
 
@@ -51,16 +62,22 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
 #if DT_NODE_HAS_PROP(DT_ALIAS(rbg_led), chain_length)
 #define RGB_LED_NUM_PIXELS	DT_PROP(DT_ALIAS(rbg_led), chain_length)
+static const struct device *const rgb_led = DEVICE_DT_GET(RGB_LED_NODE);
 #else
 #error Unable to determine length of LED strip
 #endif
 
 static struct led_rgb pixels[RGB_LED_NUM_PIXELS];
 
-static const struct device *const rgb_led = DEVICE_DT_GET(RGB_LED_NODE);
-
 std::unique_ptr<SINGLE_RGB_LED_WS2812> rgb_led_ptr; // Object for the RGB LED
 
+#if defined(CONFIG_APP_UDP_MODE_DDP)
+// Pixel streaming drives the whole strip: two frames, one filled from the network while the other shifts out
+static struct led_rgb strip_frames[2 * RGB_LED_NUM_PIXELS];
+
+std::unique_ptr<RGB_LED_STRIP_WS2812> led_strip_ptr; // Object for the whole strip
+#endif
+
 
 
 /******************************************************************************
@@ -70,6 +87,12 @@ std::unique_ptr<SINGLE_RGB_LED_WS2812> rgb_led_ptr; // Object for the RGB LED
 #define WIFI_SSID "wifi_ssid"     
 #define WIFI_PSK  "wifi_password"
 
+// Known networks, most preferred first. Add one line per network (e.g. one per access point SSID in the plant).
+// The strongest one in range is picked at run time, and the station roams between them when the RSSI drops.
+static const struct wifi_credential wifi_credentials[] = {
+  { WIFI_SSID, WIFI_PSK },
+};
+
 
 
 /******************************************************************************
@@ -88,6 +111,79 @@ std::unique_ptr<SINGLE_RGB_LED_WS2812> rgb_led_ptr; // Object for the RGB LED
 
 
 
+/******************************************************************************
+  SCHEDULED COMMANDS
+ *****************************************************************************/
+#if defined(CONFIG_APP_TIMESYNC)
+// Runs a time-triggered command at its target time (scheduler thread)
+static void run_scheduled_command(const struct sched_command *cmd)
+{
+  switch (cmd->action)
+  {
+    case SCHED_ACTION_LED:
+      rgb_led_ptr->set_color_for_rgb_led(cmd->args[0], cmd->args[1], cmd->args[2]);
+      break;
+
+    default:
+      break;
+  }
+}
+#endif
+
+
+
+/******************************************************************************
+  MQTT
+ *****************************************************************************/
+#if defined(CONFIG_APP_MQTT)
+// Runs a message received on "<client id>/cmd" (MQTT thread). Three bytes set the LED color.
+static void run_mqtt_command(const uint8_t *payload, size_t len)
+{
+  if (len >= 3)
+  {
+    rgb_led_ptr->set_color_for_rgb_led(payload[0], payload[1], payload[2]);
+  }
+}
+#endif
+
+
+
+/******************************************************************************
+  WIFI STATE
+ *****************************************************************************/
+#if defined(CONFIG_WIFI)
+// Follows the Wi-Fi state machine (its workqueue): start and stop what needs the network
+static void on_wifi_state(enum wifi_state old_state, enum wifi_state new_state, void *user_data)
+{
+  ARG_UNUSED(user_data);
+
+  if (new_state == WIFI_STATE_CONNECTED)
+  {
+#if defined(CONFIG_APP_TIMESYNC)
+    // Synchronise the clock used by time-triggered commands
+    timesync_network_up();
+#endif
+#if defined(CONFIG_APP_MQTT)
+    // Reconnect to the broker; the persistent session makes this a resume
+    mqtt_app_network_up();
+#endif
+  }
+  else if (old_state == WIFI_STATE_CONNECTED)
+  {
+#if defined(CONFIG_APP_TIMESYNC)
+    // The clock keeps running on its last estimate until the next connection
+    timesync_network_down();
+#endif
+#if defined(CONFIG_APP_MQTT)
+    // Queued and unacknowledged messages wait for the next connection
+    mqtt_app_network_down();
+#endif
+  }
+}
+#endif
+
+
+
 /******************************************************************************
   MAIN
  *****************************************************************************/
@@ -109,8 +205,15 @@ int main(void)
   {
 		LOG_INF("Found LED strip device %s", rgb_led->name);
 
+#if defined(CONFIG_APP_UDP_MODE_DDP)
+    // The strip belongs to the pixel stream, so the status indicator is disabled
+    led_strip_ptr = std::make_unique<RGB_LED_STRIP_WS2812>(rgb_led, strip_frames, RGB_LED_NUM_PIXELS);
+    led_strip_ptr->start();
+    rgb_led_ptr = std::make_unique<SINGLE_RGB_LED_WS2812>(nullptr, pixels);
+#else
     // Create the unique pointer for 
     rgb_led_ptr = std::make_unique<SINGLE_RGB_LED_WS2812>(rgb_led, pixels);
+#endif
 	} 
   else 
   {
@@ -121,29 +224,82 @@ int main(void)
   // Turn the LED to RED indicate WIFI connection status, which is "disconnected"
   rgb_led_ptr->set_color_for_rgb_led(color_for_led_rgb::RED);
 
-  // ========================= WIFI =============================== //
+  // ========================= JOURNAL =============================== //
+
+  // Start the event journal first, so every later event of this boot is kept
+  journal_init();
+
+  // ========================= NETWORK POOLS =============================== //
 
-  // This sleep is used in the WIFI example
-  LOG_INF("Sleep for 5s to follow the WIFI example initialization procedure...");
-  k_sleep(K_SECONDS(5));
+  // Start reporting the occupancy of the per-lane packet pools
+  net_lane_init();
+
+#if defined(CONFIG_APP_CAPTURE)
+  // Serve the packet capture ring as pcap on its own port
+  capture_init();
+#endif
+
+  // ========================= TIME SYNC =============================== //
+
+#if defined(CONFIG_APP_TIMESYNC)
+  // The clock syncs whenever the network is up; commands fire from the scheduler thread
+  timesync_init();
+  sched_init(run_scheduled_command);
+#if !defined(CONFIG_WIFI)
+  // Without Wi-Fi (native_sim) the host network is always up
+  timesync_network_up();
+#endif
+#endif
 
+  // ========================= TELEMETRY =============================== //
+
+#if defined(CONFIG_APP_TELEMETRY)
+  // Frames go out once the network is up; until then the sends fail and are counted
+  telemetry_init();
+#endif
+
+  // ========================= MQTT =============================== //
+
+#if defined(CONFIG_APP_MQTT)
+  // The client connects whenever the network is up and keeps its session across reconnects
+  mqtt_app_init(run_mqtt_command);
+#if !defined(CONFIG_WIFI)
+  mqtt_app_network_up();
+#endif
+#endif
+
+  // ========================= WIFI =============================== //
+
+#if defined(CONFIG_WIFI)
   // Create the WIFI object
-  WIFI_STA_NETWORK wifi_sta_net(WIFI_SSID, WIFI_PSK, rgb_led_ptr.get());
+  WIFI_STA_NETWORK wifi_sta_net(wifi_credentials, ARRAY_SIZE(wifi_credentials), rgb_led_ptr.get());
 
-  // Initialize the WIFI object and register for callback event
+  // Start and stop the network users on every connection change
+  wifi_sta_net.subscribe(on_wifi_state, nullptr);
+
+  // Start the Wi-Fi state machine. It scans and connects in the background, retrying until it succeeds.
   wifi_sta_net.initialize_network();
+#endif
 
   // ========================= MAIN LOOP =============================== //
   while (1)
   {
+#if defined(CONFIG_WIFI)
     // This function will block main.cpp until an IPv4 address is given to the ESP32S3, i.e., the WIFI connection is done
      wifi_sta_net.wait_for_ip();
+#endif
 
      {      
       // ========================= UDP =============================== //
-#if defined(CONFIG_USING_UDP)
+#if defined(CONFIG_USING_UDP) && defined(CONFIG_APP_UDP_MODE_DDP)
+      // Create the DDP object, which streams pixel frames to the strip
+      DDP_SERVER ddp_server(instance_port(DDP_DEFAULT_PORT), led_strip_ptr.get(), rgb_led_ptr.get());
+
+      // Start the DDP server
+      ddp_server.start_ddp_server();
+#elif defined(CONFIG_USING_UDP)
       // Create UDP object
-      UDP_SERVER udp_server(UDP_SERVER_PORT, rgb_led_ptr.get());
+      UDP_SERVER udp_server(instance_server_port(UDP_SERVER_PORT), rgb_led_ptr.get());
         
       // Start the UDP server
       udp_server.start_udp_server();
@@ -151,16 +307,27 @@ int main(void)
 
       // ========================= TCP =============================== //
 
-#if defined(CONFIG_USING_TCP)
+#if defined(CONFIG_USING_TCP) && defined(CONFIG_APP_CORO_TCP_SERVER)
+      // Create the coroutine TCP object, which serves several clients from one thread
+      CORO_TCP_SERVER tcp_server(instance_server_port(TCP_SERVER_PORT), rgb_led_ptr.get());
+
+      // Start the TCP server
+      tcp_server.start_tcp_server();
+#elif defined(CONFIG_USING_TCP)
       // Create TCP object
-      TCP_SERVER tcp_server(TCP_SERVER_PORT, rgb_led_ptr.get());
+      TCP_SERVER tcp_server(instance_server_port(TCP_SERVER_PORT), rgb_led_ptr.get());
         
       // Start the TCP server
       tcp_server.start_tcp_server();
 #endif 
 
+#if defined(CONFIG_WIFI)
       // The loop will wait here for disconnection semaphore 
       wifi_sta_net.wait_for_wifi_to_disconnect();
+#else
+      // Without Wi-Fi (native_sim) the host network never goes away: keep the servers running
+      k_sleep(K_FOREVER);
+#endif
     }
 
   }
@@ -0,0 +1,126 @@
+/******************************************************************************
+Module: LED_STRIP_STUB.C
+
+Description: This file contains a stub LED strip driver. It has no hardware:
+             every update is copied into RAM and takes as long as shifting the
+             pixels out to a WS2812 chain would, so the streaming code can be
+             measured on native_sim
+******************************************************************************/
+/******************************************************************************
+INCLUDE
+******************************************************************************/
+// Zephyr RTOS
+#include <zephyr/drivers/led_strip.h>
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+// Standard Library
+#include <string.h>
+
+
+
+#define DT_DRV_COMPAT d93_led_strip_stub
+
+
+
+/******************************************************************************
+  LOGGING SETUP
+ *****************************************************************************/
+LOG_MODULE_REGISTER(led_strip_stub, CONFIG_LED_STRIP_LOG_LEVEL);
+
+
+
+/******************************************************************************
+  DRIVER DATA
+ *****************************************************************************/
+struct led_strip_stub_config
+{
+    size_t length;
+    uint32_t ns_per_pixel;
+    uint32_t reset_delay_us;
+};
+
+struct led_strip_stub_data
+{
+    struct led_rgb *frame;   // Last frame shown
+    uint32_t updates;        // Number of updates since boot
+};
+
+
+
+/******************************************************************************
+FUNCTIONS DEFINITIONS
+******************************************************************************/
+/**
+ * @brief Keep the pixels and wait for the time the real strip would need to latch them
+ */
+static int led_strip_stub_update_rgb(const struct device *dev, struct led_rgb *pixels, size_t num_pixels)
+{
+    const struct led_strip_stub_config *config = dev->config;
+    struct led_strip_stub_data *data = dev->data;
+
+    if (num_pixels > config->length)
+    {
+        return -EINVAL;
+    }
+
+    memcpy(data->frame, pixels, num_pixels * sizeof(struct led_rgb));
+    data->updates++;
+
+    // Like the I2S/DMA driver, the caller is blocked while the chain shifts out; other threads keep running
+    k_usleep((int32_t)(((uint64_t)num_pixels * config->ns_per_pixel) / 1000U) + config->reset_delay_us);
+
+    LOG_DBG("Update %u: %u pixels, first #%02x%02x%02x", data->updates, (uint32_t)num_pixels,
+            pixels[0].r, pixels[0].g, pixels[0].b);
+
+    return 0;
+}
+
+/**
+ * @brief The stub only emulates RGB strips
+ */
+static int led_strip_stub_update_channels(const struct device *dev, uint8_t *channels, size_t num_channels)
+{
+    ARG_UNUSED(dev);
+    ARG_UNUSED(channels);
+    ARG_UNUSED(num_channels);
+
+    return -ENOTSUP;
+}
+
+/**
+ * @brief Number of pixels of the emulated strip
+ */
+static size_t led_strip_stub_length(const struct device *dev)
+{
+    const struct led_strip_stub_config *config = dev->config;
+
+    return config->length;
+}
+
+static const struct led_strip_driver_api led_strip_stub_api = {
+    .update_rgb      = led_strip_stub_update_rgb,
+    .update_channels = led_strip_stub_update_channels,
+    .length          = led_strip_stub_length,
+};
+
+#define LED_STRIP_STUB_DEFINE(idx)                                                      \
+    static struct led_rgb led_strip_stub_frame_##idx[DT_INST_PROP(idx, chain_length)]; \
+                                                                                        \
+    static struct led_strip_stub_data led_strip_stub_data_##idx = {                     \
+        .frame = led_strip_stub_frame_##idx,                                            \
+    };                                                                                  \
+                                                                                        \
+    static const struct led_strip_stub_config led_strip_stub_config_##idx = {           \
+        .length         = DT_INST_PROP(idx, chain_length),                              \
+        .ns_per_pixel   = DT_INST_PROP(idx, ns_per_pixel),                              \
+        .reset_delay_us = DT_INST_PROP(idx, reset_delay),                               \
+    };                                                                                  \
+                                                                                        \
+    DEVICE_DT_INST_DEFINE(idx, NULL, NULL, &led_strip_stub_data_##idx,                  \
+                          &led_strip_stub_config_##idx, POST_KERNEL,                    \
+                          CONFIG_LED_STRIP_INIT_PRIORITY, &led_strip_stub_api);
+
+DT_INST_FOREACH_STATUS_OKAY(LED_STRIP_STUB_DEFINE)
@@ -0,0 +1,131 @@
+"""Convert a Zephyr CTF trace of this application into a Chrome/Perfetto trace.
+
+The firmware must be built with app/overlay-tracing.conf. Put the captured
+stream (e.g. channel0_0 from native_sim, or the bytes read from the tracing
+UART) in a directory together with Zephyr's CTF metadata file
+(zephyr/subsys/tracing/ctf/tsdl/metadata), then:
+
+    python3 ctf_to_perfetto.py <trace-dir> -o trace.json
+
+and open trace.json in https://ui.perfetto.dev or chrome://tracing.
+
+Requires the babeltrace2 Python bindings (package python3-bt2).
+"""
+import argparse
+import json
+import sys
+
+try:
+    import bt2
+except ImportError:
+    sys.exit("The babeltrace2 Python bindings are required (apt install python3-bt2)")
+
+# Must match lib/trace/app_trace.h
+PKT_SOURCES = {1: "TCP", 2: "UDP"}
+WIFI_STATES = {
+    1: "connecting",
+    2: "connected",
+    3: "connect failed",
+    4: "disconnected",
+    5: "scan done",
+    6: "roaming",
+}
+
+PID = 1
+# Pseudo thread ids for the application tracks, far away from real thread ids
+TRACK_LED = 1_000_001
+TRACK_WIFI = 1_000_002
+
+
+def track_for_source(source):
+    return 1_000_100 + source
+
+
+def read_events(path):
+    """Yield (timestamp_us, event_name, fields) for every event of the trace."""
+    for msg in bt2.TraceCollectionMessageIterator(path):
+        if type(msg) is not bt2._EventMessageConst:
+            continue
+        ts_us = msg.default_clock_snapshot.ns_from_origin / 1000.0
+        event = msg.event
+        fields = {name: event.payload_field[name] for name in event.payload_field}
+        yield ts_us, event.name, fields
+
+
+def convert(path):
+    out = []
+    running = {}      # thread id -> (switched-in time, name)
+    led_start = None
+
+    def meta(tid, name):
+        out.append({"ph": "M", "name": "thread_name", "pid": PID, "tid": tid, "args": {"name": name}})
+
+    meta(TRACK_LED, "LED")
+    meta(TRACK_WIFI, "Wi-Fi")
+    for source, name in PKT_SOURCES.items():
+        meta(track_for_source(source), f"{name} packets")
+
+    for ts, name, fields in read_events(path):
+        # Kernel scheduling: one slice per time a thread is on the CPU
+        if name == "thread_switched_in":
+            tid = int(fields["thread_id"])
+            running[tid] = (ts, str(fields.get("name", tid)))
+        elif name == "thread_switched_out":
+            tid = int(fields["thread_id"])
+            if tid in running:
+                start, tname = running.pop(tid)
+                out.append({"ph": "X", "name": tname, "pid": PID, "tid": tid, "ts": start, "dur": ts - start})
+
+        # Application trace points
+        elif name == "named_event":
+            ev = str(fields["name"])
+            arg0 = int(fields["arg0"])
+            arg1 = int(fields["arg1"])
+
+            if ev in ("pkt_rx", "pkt_dispatch", "pkt_done"):
+                source = arg0 >> 24
+                tid = track_for_source(source)
+                common = {"cat": "packet", "id": arg0, "pid": PID, "tid": tid, "ts": ts}
+                label = f"{PKT_SOURCES.get(source, source)} pkt {arg0 & 0xFFFFFF}"
+                # One async slice per packet (rx -> done) with the handler as a nested slice
+                if ev == "pkt_rx":
+                    out.append(dict(common, ph="b", name=label, args={"length": arg1}))
+                elif ev == "pkt_dispatch":
+                    out.append(dict(common, ph="b", name="handle"))
+                else:
+                    out.append(dict(common, ph="e", name="handle"))
+                    out.append(dict(common, ph="e", name=label))
+
+            elif ev == "led_queued":
+                led_start = ts
+            elif ev == "led_flushed" and led_start is not None:
+                out.append({"ph": "X", "name": "led update", "pid": PID, "tid": TRACK_LED,
+                            "ts": led_start, "dur": ts - led_start, "args": {"pixels": arg0, "result": arg1}})
+                led_start = None
+
+            elif ev == "wifi_state":
+                out.append({"ph": "i", "s": "t", "name": WIFI_STATES.get(arg0, f"state {arg0}"),
+                            "pid": PID, "tid": TRACK_WIFI, "ts": ts, "args": {"detail": arg1}})
+
+            else:
+                out.append({"ph": "i", "s": "t", "name": ev, "pid": PID, "tid": TRACK_WIFI, "ts": ts,
+                            "args": {"arg0": arg0, "arg1": arg1}})
+
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a Zephyr CTF trace into a Chrome/Perfetto JSON trace.")
+    parser.add_argument("trace_dir", help="directory with the CTF stream and its metadata file")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    trace = convert(args.trace_dir)
+    with open(args.output, "w") as f:
+        json.dump(trace, f)
+
+    print(f"Wrote {len(trace['traceEvents'])} events to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
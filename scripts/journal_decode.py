@@ -0,0 +1,167 @@
+import argparse
+import csv
+import datetime
+import struct
+import sys
+
+# FCB sector header of the journal: magic "JRNL", version, pad, sector id (little-endian)
+SECTOR_HEADER = struct.Struct("<IBBH")
+JOURNAL_MAGIC = 0x4C4E524A
+JOURNAL_VERSION = 1
+
+# Record: seq, uptime (ms), boot, event, arg (little-endian)
+RECORD = struct.Struct("<IIHHi")
+
+ERASED = 0xFF
+
+EVENTS = {
+    1: "BOOT",
+    2: "OVERFLOW",
+    10: "WIFI_CONNECTING",
+    11: "WIFI_CONNECTED",
+    12: "WIFI_CONNECT_FAIL",
+    13: "WIFI_DISCONNECTED",
+    14: "WIFI_ROAM",
+    20: "SERVER_START",
+    21: "SERVER_ERROR",
+    22: "SESSION_DEAD",
+    30: "TIME_SYNC",
+    40: "MQTT_CONNECTED",
+    41: "MQTT_LOST",
+}
+
+# RESET_* bits of Zephyr's hwinfo API, reported by the BOOT record
+RESET_CAUSES = ["PIN", "SOFTWARE", "BROWNOUT", "POR", "WATCHDOG", "DEBUG", "SECURITY", "LOW_POWER_WAKE",
+                "CPU_LOCKUP", "PARITY", "PLL", "CLOCK", "HARDWARE", "USER", "TEMPERATURE"]
+
+
+def crc8_ccitt(crc, data):
+    """Zephyr's crc8_ccitt(): polynomial 0x07, MSB first."""
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def align_up(n, align):
+    return (n + align - 1) // align * align
+
+
+def parse_sector(image, start, size, align):
+    """Return the entries of one FCB sector, or None if they do not check out with this write alignment."""
+    entries = []
+    offset = start + align_up(SECTOR_HEADER.size, align)
+    end = start + size
+    while offset < end:
+        b0 = image[offset]
+        if b0 == ERASED:
+            break
+        if b0 & 0x80:
+            length = (b0 & 0x7F) | (image[offset + 1] << 7)
+            len_bytes = image[offset:offset + 2]
+        else:
+            length = b0
+            len_bytes = image[offset:offset + 1]
+        data_off = offset + align_up(len(len_bytes), align)
+        crc_off = data_off + align_up(length, align)
+        if crc_off >= end:
+            return None
+        data = image[data_off:data_off + length]
+        if crc8_ccitt(crc8_ccitt(0xFF, len_bytes), data) != image[crc_off]:
+            return None
+        entries.append(data)
+        offset = crc_off + align_up(1, align)
+    return entries
+
+
+def find_records(image, sector_size):
+    """Scan the image for journal sectors, oldest first, and return every record."""
+    sectors = []
+    for start in range(0, len(image) - SECTOR_HEADER.size + 1, sector_size):
+        magic, version, _, sector_id = SECTOR_HEADER.unpack_from(image, start)
+        if magic != JOURNAL_MAGIC or version != JOURNAL_VERSION:
+            continue
+        # The write alignment depends on the flash (1 on the native_sim simulator, 4 on the ESP32-S3)
+        for align in (1, 2, 4, 8, 16):
+            entries = parse_sector(image, start, sector_size, align)
+            if entries is not None:
+                sectors.append((sector_id, entries))
+                break
+
+    # Sector ids increase as the buffer rotates, and wrap at 16 bits
+    if sectors and max(s[0] for s in sectors) - min(s[0] for s in sectors) > 0x8000:
+        sectors = [((sid + 0x10000) if sid < 0x8000 else sid, entries) for sid, entries in sectors]
+    sectors.sort(key=lambda s: s[0])
+
+    records = []
+    for _, entries in sectors:
+        for data in entries:
+            for i in range(0, len(data) - RECORD.size + 1, RECORD.size):
+                records.append(RECORD.unpack_from(data, i))
+    return records
+
+
+def describe(event, arg):
+    if event == 1:
+        causes = [name for bit, name in enumerate(RESET_CAUSES) if arg & (1 << bit)]
+        return "reset cause " + ("|".join(causes) if causes else "unknown")
+    if event == 30:
+        return datetime.datetime.fromtimestamp(arg & 0xFFFFFFFF, datetime.timezone.utc).isoformat()
+    if event == 40:
+        return "session resumed" if arg else "new session"
+    return str(arg)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the event journal from a flash dump.")
+    parser.add_argument("image", help="Flash dump: flash.bin of native_sim, or e.g. esptool.py read_flash 0 0x800000 flash.bin")
+    parser.add_argument("--sector-size", type=lambda v: int(v, 0), default=4096, help="Flash erase sector size")
+    parser.add_argument("--boot", type=int, help="Only show this boot number")
+    parser.add_argument("--last", type=int, default=0, help="Only show the last N records")
+    parser.add_argument("--csv", help="Write the records to this CSV file instead of printing them")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    records = find_records(image, args.sector_size)
+    if not records:
+        sys.exit("No journal found in the image")
+
+    # A TIME_SYNC record maps the uptime of its boot to UTC
+    sync = {}
+    for seq, uptime_ms, boot, event, arg in records:
+        if event == 30:
+            sync[boot] = ((arg & 0xFFFFFFFF) * 1000 - uptime_ms)
+
+    if args.boot is not None:
+        records = [r for r in records if r[2] == args.boot]
+    if args.last:
+        records = records[-args.last:]
+
+    rows = []
+    for seq, uptime_ms, boot, event, arg in records:
+        utc = ""
+        if boot in sync:
+            stamp = datetime.datetime.fromtimestamp((sync[boot] + uptime_ms) / 1000, datetime.timezone.utc)
+            utc = stamp.isoformat(timespec="milliseconds")
+        rows.append((boot, seq, uptime_ms, utc, EVENTS.get(event, f"EVENT_{event}"), describe(event, arg)))
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(["boot", "seq", "uptime_ms", "utc", "event", "detail"])
+            writer.writerows(rows)
+        print(f"{len(rows)} records written to {args.csv}")
+        return
+
+    for boot, seq, uptime_ms, utc, name, detail in rows:
+        print(f"boot {boot:5d} #{seq:<6d} {uptime_ms / 1000:10.3f} s  {utc:29s}  {name:18s} {detail}")
+
+    gaps = sum(1 for a, b in zip(records, records[1:]) if a[2] == b[2] and b[0] != a[0] + 1)
+    print(f"\n{len(rows)} records, {len({r[2] for r in records})} boots, {gaps} gaps in the sequence numbers")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,203 @@
+"""Host side of the device's reliable-UDP transport (app/lib/rudp).
+
+Wire format, little-endian: magic u16 ("RU"), type u8, flags u8, session u32, seq u32,
+then the payload (DATA) or a u32 selective-ACK bitmap (ACK). In an ACK, 'seq' is the next
+sequence number expected; bit i of the bitmap acknowledges seq + 1 + i.
+
+Single-threaded: every call pumps the socket, processing ACKs and incoming messages and
+retransmitting what timed out. Messages are delivered as soon as they arrive (no ordering),
+exactly once.
+"""
+import collections
+import random
+import select
+import socket
+import struct
+import time
+
+MAGIC = 0x5552
+TYPE_DATA = 0x01
+TYPE_ACK = 0x02
+HEADER = struct.Struct("<HBBII")
+SACK = struct.Struct("<I")
+SACK_BITS = 32
+MAX_RTO = 2.0
+
+
+def seq_diff(a, b):
+    """Signed distance between two 32-bit sequence numbers."""
+    d = (a - b) & 0xFFFFFFFF
+    return d - (1 << 32) if d & 0x80000000 else d
+
+
+class ReliableUdp:
+    def __init__(self, host, port, window=8, initial_rto=0.2, min_rto=0.02, max_retries=8, loss=0.0, seed=None):
+        if window > SACK_BITS:
+            raise ValueError("window cannot exceed the 32-bit SACK bitmap")
+        self.server = (host, port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setblocking(False)
+        self.window = window
+        self.min_rto = min_rto
+        self.max_retries = max_retries
+        self.loss = loss
+        self.rng = random.Random(seed)
+
+        # Send side
+        self.session = random.getrandbits(32)
+        self.tx_next = 0
+        self.in_flight = {}  # seq -> [datagram, first_sent, last_sent, retries]
+        self.rto = initial_rto
+        self.srtt = None
+        self.rttvar = None
+
+        # Receive side
+        self.peer_session = None
+        self.rx_next = 0
+        self.rx_sack = 0
+        self.delivered = collections.deque()
+
+        self.stats = collections.Counter()
+
+    def close(self):
+        self.sock.close()
+
+    # ------------------------------------------------------------------ sending
+    def _transmit(self, datagram):
+        # Injected loss on the way out
+        if self.loss and self.rng.random() < self.loss:
+            self.stats["tx_dropped_injected"] += 1
+            return
+        self.sock.sendto(datagram, self.server)
+
+    def send(self, payload, timeout=None):
+        """Queue one message, waiting for room in the window. Returns its sequence number."""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while len(self.in_flight) >= self.window:
+            if deadline is not None and time.monotonic() >= deadline:
+                raise TimeoutError("send window full")
+            self.pump(0.05)
+        seq = self.tx_next
+        self.tx_next = (self.tx_next + 1) & 0xFFFFFFFF
+        datagram = HEADER.pack(MAGIC, TYPE_DATA, 0, self.session, seq) + payload
+        now = time.monotonic()
+        self.in_flight[seq] = [datagram, now, now, 0]
+        self._transmit(datagram)
+        self.stats["tx_messages"] += 1
+        return seq
+
+    def flush(self, timeout=5.0):
+        """Wait until every message is acknowledged or given up."""
+        deadline = time.monotonic() + timeout
+        while self.in_flight and time.monotonic() < deadline:
+            self.pump(0.05)
+        return not self.in_flight
+
+    def _update_rto(self, rtt):
+        if self.srtt is None:
+            self.srtt, self.rttvar = rtt, rtt / 2
+        else:
+            self.rttvar = 0.75 * self.rttvar + 0.25 * abs(self.srtt - rtt)
+            self.srtt = 0.875 * self.srtt + 0.125 * rtt
+        self.rto = min(max(self.srtt + 4 * self.rttvar, self.min_rto), MAX_RTO)
+
+    def _handle_ack(self, cumulative, sack):
+        now = time.monotonic()
+        for seq in list(self.in_flight):
+            d = seq_diff(seq, cumulative)
+            if d < 0 or (1 <= d <= SACK_BITS and sack & (1 << (d - 1))):
+                _, first, _, retries = self.in_flight.pop(seq)
+                if retries == 0:
+                    self._update_rto(now - first)
+                self.stats["tx_acked"] += 1
+
+    def _retransmit(self):
+        now = time.monotonic()
+        for seq, entry in list(self.in_flight.items()):
+            datagram, _, last, retries = entry
+            if now - last < min(self.rto * (1 << retries), MAX_RTO):
+                continue
+            if retries >= self.max_retries:
+                del self.in_flight[seq]
+                self.stats["tx_failed"] += 1
+                continue
+            entry[2] = now
+            entry[3] += 1
+            self._transmit(datagram)
+            self.stats["tx_retransmits"] += 1
+
+    def _next_retransmit(self):
+        if not self.in_flight:
+            return None
+        return min(e[2] + min(self.rto * (1 << e[3]), MAX_RTO) for e in self.in_flight.values())
+
+    # ---------------------------------------------------------------- receiving
+    def _accept_seq(self, seq):
+        d = seq_diff(seq, self.rx_next)
+        if d < 0:
+            return False
+        if d == 0:
+            self.rx_next = (self.rx_next + 1) & 0xFFFFFFFF
+            while self.rx_sack & 1:
+                self.rx_sack >>= 1
+                self.rx_next = (self.rx_next + 1) & 0xFFFFFFFF
+            self.rx_sack >>= 1
+            return True
+        if d > SACK_BITS or self.rx_sack & (1 << (d - 1)):
+            return False
+        self.rx_sack |= 1 << (d - 1)
+        return True
+
+    def _handle_datagram(self, data):
+        if len(data) < HEADER.size:
+            return
+        magic, mtype, _, session, seq = HEADER.unpack_from(data)
+        if magic != MAGIC:
+            return
+        if mtype == TYPE_ACK and session == self.session and len(data) >= HEADER.size + SACK.size:
+            self._handle_ack(seq, SACK.unpack_from(data, HEADER.size)[0])
+        elif mtype == TYPE_DATA and len(data) > HEADER.size:
+            if session != self.peer_session:
+                self.peer_session, self.rx_next, self.rx_sack = session, 0, 0
+            new = self._accept_seq(seq)
+            self._transmit(HEADER.pack(MAGIC, TYPE_ACK, 0, session, self.rx_next) + SACK.pack(self.rx_sack))
+            if new:
+                self.delivered.append(data[HEADER.size:])
+                self.stats["rx_delivered"] += 1
+            else:
+                self.stats["rx_duplicates"] += 1
+
+    def pump(self, timeout):
+        """Process incoming datagrams for up to 'timeout' seconds and retransmit what is due."""
+        deadline = time.monotonic() + timeout
+        while True:
+            now = time.monotonic()
+            wait = deadline - now
+            due = self._next_retransmit()
+            if due is not None:
+                wait = min(wait, due - now)
+            readable, _, _ = select.select([self.sock], [], [], max(wait, 0))
+            if readable:
+                while True:
+                    try:
+                        data, _ = self.sock.recvfrom(2048)
+                    except BlockingIOError:
+                        break
+                    # Injected loss on the way in
+                    if self.loss and self.rng.random() < self.loss:
+                        self.stats["rx_dropped_injected"] += 1
+                        continue
+                    self._handle_datagram(data)
+            self._retransmit()
+            if self.delivered or time.monotonic() >= deadline:
+                return
+
+    def recv(self, timeout=None):
+        """Next delivered message, or None on timeout."""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while not self.delivered:
+            remaining = 0.1 if deadline is None else deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.pump(remaining)
+        return self.delivered.popleft()
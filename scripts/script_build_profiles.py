@@ -0,0 +1,205 @@
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import time
+
+from script_rtt_probe import percentile, run_tcp
+
+# Application directory, relative to this script
+APP_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "app")
+
+# TCP server port of the firmware
+SERVER_PORT = 4321
+
+# Overlay files of every profile. LTO is added separately because not every target offers it.
+PROFILES = {
+    "baseline":         [],
+    "production-fast":  ["overlay-production-fast.conf"],
+    "production-small": ["overlay-production-small.conf"],
+    "debug":            ["overlay-debug.conf"],
+}
+LTO_PROFILES = ("production-fast", "production-small")
+LTO_OVERLAY = "overlay-lto.conf"
+
+# Every profile is built as a TCP echo server, so the same benchmark runs against each of them
+BENCH_ARGS = ["-DCONFIG_USING_TCP=y", "-DCONFIG_APP_TCP_MODE_ECHO=y"]
+
+
+def build(board, profile, lto, build_root, pristine):
+    """Build one profile. Returns the build directory, or None if the build failed."""
+    overlays = list(PROFILES[profile])
+    if lto and profile in LTO_PROFILES:
+        overlays.append(LTO_OVERLAY)
+
+    build_dir = os.path.join(build_root, profile)
+    cmd = ["west", "build", "-b", board, "-d", build_dir, APP_DIR]
+    if pristine:
+        cmd += ["-p", "always"]
+    cmd += ["--"] + BENCH_ARGS
+    if overlays:
+        cmd.append("-DEXTRA_CONF_FILE=" + ";".join(overlays))
+
+    print(f"[{profile}] {' '.join(cmd)}")
+    result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if result.returncode != 0:
+        print(result.stdout[-4000:])
+        print(f"[{profile}] build failed")
+        return None
+    return build_dir
+
+
+def footprint(build_dir, report):
+    """Run the ram_report / rom_report target and return the total in bytes."""
+    result = subprocess.run(["west", "build", "-d", build_dir, "-t", report],
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if result.returncode != 0:
+        return None
+
+    # The report target writes the symbol tree next to the build (ram.json / rom.json)
+    path = os.path.join(build_dir, report.split("_")[0] + ".json")
+    try:
+        with open(path) as f:
+            data = json.load(f)
+    except (OSError, ValueError):
+        return None
+    return data.get("total_size", data.get("symbols", {}).get("size"))
+
+
+def wait_for_server(server, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection(server, timeout=1.0):
+                return True
+        except OSError:
+            time.sleep(0.5)
+    return False
+
+
+def measure_throughput(server, duration, chunk, window, timeout):
+    """Stream data through the TCP echo server with at most 'window' bytes unanswered. Returns bytes per second."""
+    payload = bytes([0x55]) * chunk
+    echoed = 0
+    in_flight = 0
+
+    with socket.create_connection(server, timeout=timeout) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        start = time.monotonic()
+        end = start + duration
+        while time.monotonic() < end or in_flight > 0:
+            while in_flight < window and time.monotonic() < end:
+                sock.sendall(payload)
+                in_flight += len(payload)
+            data = sock.recv(65536)
+            if not data:
+                raise ConnectionError("device closed the connection")
+            in_flight -= len(data)
+            echoed += len(data)
+        elapsed = time.monotonic() - start
+
+    return echoed / elapsed
+
+
+def benchmark(args, build_dir, profile):
+    """Start or flash the firmware, then measure echo throughput and round-trip time."""
+    process = None
+    if args.board.startswith("native_sim"):
+        process = subprocess.Popen([os.path.join(build_dir, "zephyr", "zephyr.exe")],
+                                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        host = "127.0.0.1"
+    elif args.host:
+        if args.flash:
+            subprocess.run(["west", "flash", "-d", build_dir], check=True)
+        host = args.host
+    else:
+        return None, None
+
+    try:
+        server = (host, args.port)
+        if not wait_for_server(server, args.boot_timeout):
+            print(f"[{profile}] server did not come up on {host}:{args.port}")
+            return None, None
+        rate = measure_throughput(server, args.duration, args.chunk, args.window, args.timeout)
+        results, _ = run_tcp(server, args.probes, 0.0, 16, args.timeout)
+        rtts = sorted(r for r, _ in results)
+        return rate, rtts
+    except (OSError, ConnectionError) as exc:
+        print(f"[{profile}] benchmark failed: {exc}")
+        return None, None
+    finally:
+        if process:
+            process.terminate()
+            process.wait()
+
+
+def fmt(value, scale=1, unit=""):
+    return "-" if value is None else f"{value / scale:.1f}{unit}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build every profile, then compare RAM, ROM and echo throughput.")
+    parser.add_argument("--board", default="native_sim")
+    parser.add_argument("--profiles", nargs="+", choices=list(PROFILES), default=list(PROFILES))
+    parser.add_argument("--build-root", default="build-profiles")
+    parser.add_argument("--lto", choices=["auto", "on", "off"], default="auto",
+                        help="add overlay-lto.conf to the production profiles (auto: everywhere but native_sim)")
+    parser.add_argument("--no-pristine", action="store_true", help="reuse the existing build directories")
+    parser.add_argument("--no-bench", action="store_true", help="only report the footprint")
+    parser.add_argument("--host", help="board address; without it only native_sim is benchmarked")
+    parser.add_argument("--flash", action="store_true", help="flash each profile before benchmarking it")
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds of streaming per profile")
+    parser.add_argument("--chunk", type=int, default=1024, help="bytes per send")
+    parser.add_argument("--window", type=int, default=8192, help="bytes allowed unanswered")
+    parser.add_argument("--probes", type=int, default=500, help="round-trip probes per profile")
+    parser.add_argument("--boot-timeout", type=float, default=60.0)
+    parser.add_argument("--timeout", type=float, default=2.0)
+    parser.add_argument("--json", help="also write the results to this file")
+    args = parser.parse_args()
+
+    lto = args.lto == "on" or (args.lto == "auto" and not args.board.startswith("native_sim"))
+
+    rows = []
+    for profile in args.profiles:
+        row = {"profile": profile + (" +lto" if lto and profile in LTO_PROFILES else ""),
+               "ram": None, "rom": None, "throughput": None, "rtt_p50": None, "rtt_p99": None}
+        rows.append(row)
+
+        build_dir = build(args.board, profile, lto, args.build_root, not args.no_pristine)
+        if build_dir is None:
+            row["profile"] += " (failed)"
+            continue
+
+        row["ram"] = footprint(build_dir, "ram_report")
+        row["rom"] = footprint(build_dir, "rom_report")
+
+        if not args.no_bench:
+            rate, rtts = benchmark(args, build_dir, profile)
+            row["throughput"] = rate
+            if rtts:
+                row["rtt_p50"] = percentile(rtts, 50)
+                row["rtt_p99"] = percentile(rtts, 99)
+
+    print()
+    print(f"{'Profile':<26} {'RAM':>10} {'ROM':>10} {'Echo':>12} {'RTT p50':>10} {'RTT p99':>10}")
+    for row in rows:
+        print(f"{row['profile']:<26} "
+              f"{fmt(row['ram'], 1024, ' KB'):>10} "
+              f"{fmt(row['rom'], 1024, ' KB'):>10} "
+              f"{fmt(row['throughput'], 1024, ' KB/s'):>12} "
+              f"{fmt(row['rtt_p50'], 1, ' us'):>10} "
+              f"{fmt(row['rtt_p99'], 1, ' us'):>10}")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"board": args.board, "profiles": rows}, f, indent=2)
+
+    if any(row["ram"] is None for row in rows):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,204 @@
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+import zlib
+
+# TODO: Change this to your ESP32's IP address (127.0.0.1 for native_sim)
+SERVER_IP = "192.168.1.1"
+
+# TODO: Change this to the port your ESP32 is listening on
+TCP_PORT = 4321
+
+# Bulk transfer header: magic "BLK1", total size, CRC-32 of the image, flags (all little-endian)
+BULK_MAGIC = 0x314B4C42
+BULK_HEADER = struct.Struct("<IIII")
+
+# Flags: the image is sent heatshrink-compressed, with the window and lookahead sizes (log2) in bits 8-11 and 12-15.
+# The device accepts a window up to CONFIG_APP_BULK_HEATSHRINK_WINDOW_BITS.
+FLAG_HEATSHRINK = 0x01
+WINDOW_BITS = 8
+LOOKAHEAD_BITS = 4
+
+# Size of each send() call
+CHUNK_SIZE = 4096
+
+# Candidate positions kept per 2-byte prefix while searching for matches
+MATCH_CHAIN = 64
+
+
+def heatshrink_compress(data, window_bits, lookahead_bits):
+    """Compress with heatshrink: per token a 1 bit and a literal byte, or a 0 bit, offset - 1 and length - 1, MSB first."""
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # A back-reference must be shorter than the literals it replaces
+    min_len = (1 + window_bits + lookahead_bits) // 9 + 1
+
+    out = bytearray()
+    acc = 0
+    nbits = 0
+    chains = {}
+
+    def put(value, width):
+        nonlocal acc, nbits
+        acc = (acc << width) | value
+        nbits += width
+        while nbits >= 8:
+            nbits -= 8
+            out.append((acc >> nbits) & 0xFF)
+        acc &= (1 << nbits) - 1
+
+    def index(at):
+        if at + 1 < len(data):
+            chains.setdefault(data[at:at + 2], []).append(at)
+
+    pos = 0
+    while pos < len(data):
+        best_len, best_off = 0, 0
+        limit = min(max_len, len(data) - pos)
+        for cand in reversed(chains.get(data[pos:pos + 2], [])[-MATCH_CHAIN:]):
+            if pos - cand > window:
+                break
+            length = 0
+            while length < limit and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_off = length, pos - cand
+                if length == limit:
+                    break
+
+        if best_len >= min_len:
+            put(0, 1)
+            put(best_off - 1, window_bits)
+            put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            put(1, 1)
+            put(data[pos], 8)
+            step = 1
+
+        for at in range(pos, pos + step):
+            index(at)
+        pos += step
+
+    # The last byte is padded with zero bits. The device stops once it has the announced size.
+    if nbits:
+        put(0, 8 - nbits)
+    return bytes(out)
+
+
+def recv_exact(sock, length):
+    """Read exactly 'length' bytes or raise if the device closes the connection."""
+    data = b""
+    while len(data) < length:
+        part = sock.recv(length - len(data))
+        if not part:
+            raise ConnectionError("device closed the connection")
+        data += part
+    return data
+
+
+def recv_word(sock):
+    """Read one signed 32-bit little-endian status word."""
+    return struct.unpack("<i", recv_exact(sock, 4))[0]
+
+
+def send_image(server, image, compress, stop_after):
+    """Run one bulk transfer. Returns the device status (0 on success) and the effective rate (KB/s of image)."""
+    crc = zlib.crc32(image) & 0xFFFFFFFF
+    flags = 0
+    if compress:
+        flags = FLAG_HEATSHRINK | (WINDOW_BITS << 8) | (LOOKAHEAD_BITS << 12)
+
+    with socket.create_connection(server, timeout=30) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+        # 1. Header, then the device tells us where to (re)start
+        sock.sendall(BULK_HEADER.pack(BULK_MAGIC, len(image), crc, flags))
+        offset = recv_word(sock)
+        if offset < 0:
+            print(f"Device rejected the transfer: {offset}")
+            return offset, None
+        if offset > 0:
+            print(f"Resuming at offset {offset}")
+
+        # 2. Image data from that offset. A compressed stream restarts its window at the offset.
+        start = time.monotonic()
+        payload = image[offset:]
+        if compress:
+            payload = heatshrink_compress(payload, WINDOW_BITS, LOOKAHEAD_BITS)
+        sent = 0
+        end = len(payload) if stop_after is None else min(len(payload), stop_after)
+        while sent < end:
+            chunk = payload[sent:min(sent + CHUNK_SIZE, end)]
+            sock.sendall(chunk)
+            sent += len(chunk)
+
+        if sent < len(payload):
+            # Simulated disconnect, used to test resume
+            print(f"Disconnecting after {sent} bytes")
+            return None, None
+
+        # 3. Final status once the device has written and checked the image.
+        # A compressed transfer is followed by the device's decoding time in microseconds.
+        status = recv_word(sock)
+        decode_us = recv_word(sock) if compress and status == 0 else None
+        elapsed = time.monotonic() - start
+
+    image_bytes = len(image) - offset
+    rate = image_bytes / 1024 / elapsed if elapsed > 0 else 0.0
+    line = f"Sent {image_bytes} bytes as {len(payload)} in {elapsed:.2f} s: {rate:.1f} KB/s effective"
+    if decode_us is not None:
+        line += f", {len(payload) * 100 / max(image_bytes, 1):.0f}% of the size, decoding {decode_us / 1000:.1f} ms"
+        line += f" ({decode_us / 10000 / elapsed:.1f}% of the transfer)"
+    print(line + f", status {status}")
+    return status, rate
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Stream a file (or random data) into the device's bulk partition.")
+    parser.add_argument("file", nargs="?", help="image to send")
+    parser.add_argument("--host", default=SERVER_IP)
+    parser.add_argument("--port", type=int, default=TCP_PORT)
+    parser.add_argument("--random", type=int, metavar="BYTES", help="send BYTES of random data instead of a file")
+    parser.add_argument("--config", type=int, metavar="BYTES",
+                        help="send BYTES of generated lookup-table text, which compresses well")
+    parser.add_argument("--stop-after", type=int, metavar="BYTES", help="disconnect after BYTES, then resume")
+    parser.add_argument("--compress", action="store_true", help="send the image heatshrink-compressed")
+    parser.add_argument("--compare", action="store_true", help="send the image plain, then compressed, and compare")
+    args = parser.parse_args()
+
+    if args.random:
+        image = os.urandom(args.random)
+    elif args.config:
+        rows = (f'{{"id": {i}, "gain": {i % 16}, "offset": {i * 7 % 32}, "enabled": true}}\n' for i in range(args.config))
+        image = "".join(rows).encode()[:args.config]
+    elif args.file:
+        with open(args.file, "rb") as f:
+            image = f.read()
+    else:
+        parser.error("give a file, --random BYTES or --config BYTES")
+
+    server = (args.host, args.port)
+
+    if args.compare:
+        plain_status, plain_rate = send_image(server, image, False, None)
+        time.sleep(1)
+        packed_status, packed_rate = send_image(server, image, True, None)
+        if plain_rate and packed_rate:
+            print(f"Compressed upload: {packed_rate / plain_rate:.2f}x the effective rate of the plain upload")
+        sys.exit(0 if plain_status == 0 and packed_status == 0 else 1)
+
+    status, _ = send_image(server, image, args.compress, args.stop_after)
+    if status is None:
+        # The first attempt was cut short on purpose: the second one must resume
+        time.sleep(1)
+        status, _ = send_image(server, image, args.compress, None)
+
+    sys.exit(0 if status == 0 else 1)
+
+
+if __name__ == "__main__":
+    main()
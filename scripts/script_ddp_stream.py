@@ -0,0 +1,83 @@
+import argparse
+import colorsys
+import socket
+import struct
+import time
+
+# TODO: Change this to your ESP32's IP address (127.0.0.1 for native_sim)
+SERVER_IP = "192.168.1.1"
+
+# Standard DDP port, used by the device in CONFIG_APP_UDP_MODE_DDP
+SERVER_PORT = 4048
+
+# DDP header: flags, sequence, data type, destination id, byte offset, data length (big-endian)
+HEADER = struct.Struct(">BBBBIH")
+FLAGS_VERSION_1 = 0x40
+FLAGS_PUSH = 0x01
+TYPE_RGB_8BIT = 0x0B
+ID_DISPLAY = 1
+
+# 480 RGB pixels per packet keeps every datagram under a 1500-byte MTU
+MAX_DATA_PER_PACKET = 1440
+
+
+def rainbow_frame(pixels, frame_index):
+    """A rainbow that moves by one pixel per frame."""
+    data = bytearray()
+    for i in range(pixels):
+        hue = ((i + frame_index) % pixels) / pixels
+        r, g, b = colorsys.hsv_to_rgb(hue, 1.0, 0.25)
+        data += bytes((int(r * 255), int(g * 255), int(b * 255)))
+    return data
+
+
+def send_frame(sock, server, data, seq):
+    """Split one frame into DDP packets; the last one carries PUSH. Returns the next sequence number."""
+    for offset in range(0, len(data), MAX_DATA_PER_PACKET):
+        chunk = data[offset:offset + MAX_DATA_PER_PACKET]
+        flags = FLAGS_VERSION_1
+        if offset + len(chunk) >= len(data):
+            flags |= FLAGS_PUSH
+        sock.sendto(HEADER.pack(flags, seq, TYPE_RGB_8BIT, ID_DISPLAY, offset, len(chunk)) + chunk, server)
+        seq = seq % 15 + 1
+    return seq
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Stream an animation to the device's LED strip over DDP.")
+    parser.add_argument("--host", default=SERVER_IP)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--pixels", type=int, default=300, help="strip length (chain-length in the devicetree)")
+    parser.add_argument("--fps", type=float, default=60.0)
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds")
+    args = parser.parse_args()
+
+    server = (args.host, args.port)
+    period = 1.0 / args.fps
+    frames = int(args.duration * args.fps)
+
+    # Pre-render the animation so the send loop keeps the frame rate
+    animation = [rainbow_frame(args.pixels, i) for i in range(args.pixels)]
+
+    seq = 1
+    late = 0
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        start = time.monotonic()
+        for n in range(frames):
+            seq = send_frame(sock, server, animation[n % len(animation)], seq)
+            deadline = start + (n + 1) * period
+            delay = deadline - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            else:
+                late += 1
+        elapsed = time.monotonic() - start
+
+    packets = -(-args.pixels * 3 // MAX_DATA_PER_PACKET)
+    print(f"Sent {frames} frames of {args.pixels} pixels ({packets} packets each) in {elapsed:.2f} s: "
+          f"{frames / elapsed:.1f} fps, {late} frames sent late")
+    print("Compare with the device log: 'DDP: <fps> fps ...' and 'Strip frames: <shown>, <dropped> dropped'")
+
+
+if __name__ == "__main__":
+    main()
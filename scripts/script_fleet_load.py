@@ -0,0 +1,267 @@
+import argparse
+import asyncio
+import json
+import struct
+import sys
+import time
+
+# Default port of the device's UDP/TCP server
+SERVER_PORT = 4321
+
+# Message layout: magic "FLT1", connection id, sequence number, host send time (ns), all little-endian.
+# The device echoes it (CONFIG_APP_TCP_MODE_ECHO / CONFIG_APP_UDP_MODE_ECHO); in UDP a 4-byte trailer is appended.
+MESSAGE = struct.Struct("<IIIQ")
+MESSAGE_MAGIC = 0x31544C46
+
+# The device echoes at most this many bytes per message
+MAX_SIZE = 120
+
+
+def percentile(sorted_values, pct):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return float("nan")
+    rank = max(1, int(round(pct / 100.0 * len(sorted_values))))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+class TargetStats:
+    """What one device answered: every round trip, and every way a message did not come back."""
+
+    def __init__(self, name):
+        self.name = name
+        self.sent = 0
+        self.received = 0
+        self.bytes = 0
+        self.timeouts = 0
+        self.mismatches = 0
+        self.connect_errors = 0
+        self.io_errors = 0
+        self.rtts_us = []
+
+    def errors(self):
+        return self.timeouts + self.mismatches + self.connect_errors + self.io_errors
+
+    def summary(self, elapsed):
+        rtts = sorted(self.rtts_us)
+        return {
+            "target": self.name,
+            "sent": self.sent,
+            "received": self.received,
+            "msg_per_s": self.received / elapsed,
+            "kb_per_s": self.bytes / 1024 / elapsed,
+            "rtt_p50_us": percentile(rtts, 50),
+            "rtt_p99_us": percentile(rtts, 99),
+            "rtt_max_us": rtts[-1] if rtts else float("nan"),
+            "timeouts": self.timeouts,
+            "mismatches": self.mismatches,
+            "connect_errors": self.connect_errors,
+            "io_errors": self.io_errors,
+        }
+
+
+def make_message(conn_id, seq, size):
+    message = MESSAGE.pack(MESSAGE_MAGIC, conn_id, seq, time.monotonic_ns())
+    return message + bytes(max(0, size - len(message)))
+
+
+async def pace(next_send, interval):
+    """Wait for the next send slot of a rate-limited connection."""
+    if interval <= 0:
+        return next_send
+    delay = next_send - time.monotonic()
+    if delay > 0:
+        await asyncio.sleep(delay)
+    return max(next_send + interval, time.monotonic() - interval)
+
+
+async def tcp_connection(host, port, conn_id, stats, args, end):
+    """Closed loop over one TCP connection: send a message, wait for its echo. Reconnect after an error."""
+    interval = 1.0 / args.rate if args.rate > 0 else 0.0
+    seq = 0
+
+    while time.monotonic() < end:
+        try:
+            reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), args.timeout)
+        except (OSError, asyncio.TimeoutError):
+            stats.connect_errors += 1
+            await asyncio.sleep(min(1.0, max(0.0, end - time.monotonic())))
+            continue
+
+        try:
+            next_send = time.monotonic()
+            while time.monotonic() < end:
+                next_send = await pace(next_send, interval)
+                message = make_message(conn_id, seq, args.size)
+                seq += 1
+                writer.write(message)
+                stats.sent += 1
+                try:
+                    reply = await asyncio.wait_for(reader.readexactly(len(message)), args.timeout)
+                except asyncio.TimeoutError:
+                    # The stream is out of step now: start over on a new connection
+                    stats.timeouts += 1
+                    break
+                now = time.monotonic_ns()
+                if reply != message:
+                    stats.mismatches += 1
+                    break
+                stats.received += 1
+                stats.bytes += len(reply)
+                stats.rtts_us.append((now - MESSAGE.unpack_from(reply)[3]) / 1000.0)
+        except (OSError, asyncio.IncompleteReadError):
+            stats.io_errors += 1
+        finally:
+            writer.close()
+
+
+class UdpEcho(asyncio.DatagramProtocol):
+    """Routes each echoed datagram to the future of the message it answers."""
+
+    def __init__(self):
+        self.waiting = {}
+
+    def datagram_received(self, data, addr):
+        if len(data) < MESSAGE.size:
+            return
+        magic, _, seq, _ = MESSAGE.unpack_from(data)
+        future = self.waiting.pop(seq, None)
+        if magic == MESSAGE_MAGIC and future and not future.done():
+            future.set_result((time.monotonic_ns(), data))
+
+
+async def udp_connection(host, port, conn_id, stats, args, end):
+    """Closed loop over one UDP socket. A message without an echo within the timeout counts as lost."""
+    interval = 1.0 / args.rate if args.rate > 0 else 0.0
+    loop = asyncio.get_running_loop()
+    try:
+        transport, protocol = await loop.create_datagram_endpoint(UdpEcho, remote_addr=(host, port))
+    except OSError:
+        stats.connect_errors += 1
+        return
+
+    seq = 0
+    next_send = time.monotonic()
+    try:
+        while time.monotonic() < end:
+            next_send = await pace(next_send, interval)
+            message = make_message(conn_id, seq, args.size)
+            future = loop.create_future()
+            protocol.waiting[seq] = future
+            seq += 1
+            try:
+                transport.sendto(message)
+            except OSError:
+                stats.io_errors += 1
+                continue
+            stats.sent += 1
+            try:
+                now, reply = await asyncio.wait_for(future, args.timeout)
+            except asyncio.TimeoutError:
+                stats.timeouts += 1
+                continue
+            if reply[:len(message)] != message:
+                stats.mismatches += 1
+                continue
+            stats.received += 1
+            stats.bytes += len(message)
+            stats.rtts_us.append((now - MESSAGE.unpack_from(reply)[3]) / 1000.0)
+    finally:
+        transport.close()
+
+
+async def run_load(targets, args):
+    """Drive every target with 'args.connections' connections at once. Returns the per-target stats and elapsed time."""
+    runner = tcp_connection if args.proto == "tcp" else udp_connection
+    stats = [TargetStats(f"{host}:{port}") for host, port in targets]
+    start = time.monotonic()
+    end = start + args.duration
+
+    tasks = []
+    for index, (host, port) in enumerate(targets):
+        for conn in range(args.connections):
+            conn_id = index * args.connections + conn
+            tasks.append(runner(host, port, conn_id, stats[index], args, end))
+    await asyncio.gather(*tasks)
+
+    return stats, time.monotonic() - start
+
+
+def report(stats, elapsed, json_path=None):
+    """Print one line per target and the fleet totals. Returns the number of errors."""
+    rows = [s.summary(elapsed) for s in stats]
+
+    print(f"{'Target':<22} {'Sent':>8} {'Recv':>8} {'msg/s':>8} {'KB/s':>8} "
+          f"{'p50 us':>9} {'p99 us':>9} {'max us':>9} {'T/O':>5} {'Bad':>4} {'Conn':>5} {'IO':>4}")
+    for row in rows:
+        print(f"{row['target']:<22} {row['sent']:>8} {row['received']:>8} {row['msg_per_s']:>8.0f} "
+              f"{row['kb_per_s']:>8.1f} {row['rtt_p50_us']:>9.0f} {row['rtt_p99_us']:>9.0f} "
+              f"{row['rtt_max_us']:>9.0f} {row['timeouts']:>5} {row['mismatches']:>4} "
+              f"{row['connect_errors']:>5} {row['io_errors']:>4}")
+
+    # Fleet totals. The spread of per-target rates shows whether some devices are starved.
+    all_rtts = sorted(r for s in stats for r in s.rtts_us)
+    rates = [row["msg_per_s"] for row in rows]
+    total = {
+        "targets": len(rows),
+        "sent": sum(s.sent for s in stats),
+        "received": sum(s.received for s in stats),
+        "msg_per_s": sum(rates),
+        "kb_per_s": sum(row["kb_per_s"] for row in rows),
+        "rtt_p50_us": percentile(all_rtts, 50),
+        "rtt_p99_us": percentile(all_rtts, 99),
+        "rtt_max_us": all_rtts[-1] if all_rtts else float("nan"),
+        "min_target_msg_per_s": min(rates) if rates else 0.0,
+        "max_target_msg_per_s": max(rates) if rates else 0.0,
+        "errors": sum(s.errors() for s in stats),
+    }
+    print(f"Fleet: {total['targets']} targets, {total['received']}/{total['sent']} echoed, "
+          f"{total['msg_per_s']:.0f} msg/s ({total['kb_per_s']:.1f} KB/s), "
+          f"RTT p50 {total['rtt_p50_us']:.0f} us p99 {total['rtt_p99_us']:.0f} us, "
+          f"per target {total['min_target_msg_per_s']:.0f}-{total['max_target_msg_per_s']:.0f} msg/s, "
+          f"{total['errors']} errors")
+
+    if json_path:
+        with open(json_path, "w") as f:
+            json.dump({"elapsed_s": elapsed, "targets": rows, "total": total}, f, indent=2)
+
+    return total["errors"]
+
+
+def parse_target(text):
+    host, _, port = text.rpartition(":")
+    if not host:
+        return text, SERVER_PORT
+    return host, int(port)
+
+
+def add_load_arguments(parser):
+    """Options shared with script_fleet_sim.py"""
+    parser.add_argument("--proto", choices=["tcp", "udp"], default="tcp")
+    parser.add_argument("--connections", type=int, default=1, help="concurrent connections per target")
+    parser.add_argument("--rate", type=float, default=0.0, help="messages/s per connection (0: as fast as echoed)")
+    parser.add_argument("--size", type=int, default=64, help=f"message size in bytes ({MESSAGE.size}-{MAX_SIZE})")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds of load")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds to wait for an echo")
+    parser.add_argument("--json", help="also write the results to this file")
+
+
+def check_load_arguments(parser, args):
+    if not MESSAGE.size <= args.size <= MAX_SIZE:
+        parser.error(f"--size must be between {MESSAGE.size} and {MAX_SIZE}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Drive many devices in echo mode at once and compare their answers.")
+    parser.add_argument("targets", nargs="+", metavar="HOST[:PORT]")
+    add_load_arguments(parser)
+    args = parser.parse_args()
+    check_load_arguments(parser, args)
+
+    stats, elapsed = asyncio.run(run_load([parse_target(t) for t in args.targets], args))
+    errors = report(stats, elapsed, args.json)
+    sys.exit(1 if errors else 0)
+
+
+if __name__ == "__main__":
+    main()
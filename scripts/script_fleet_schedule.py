@@ -0,0 +1,59 @@
+import argparse
+import socket
+import struct
+import time
+
+# TODO: Change this to the port your boards are listening on (UDP server)
+SERVER_PORT = 4321
+
+# Command datagram (little-endian): magic "SCH1", target time in us since 1970, action, 3 argument bytes.
+# Each board answers with an i32 status: 0 when queued, a negative errno otherwise.
+COMMAND = struct.Struct("<IqB3s")
+COMMAND_MAGIC = 0x31484353
+STATUS = struct.Struct("<i")
+ACTION_LED = 1
+
+COLORS = [(0x0F, 0x00, 0x00), (0x00, 0x0F, 0x00), (0x00, 0x00, 0x0F), (0x00, 0x00, 0x00)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make several boards change their LED at the same instant.")
+    parser.add_argument("hosts", nargs="+", help="board addresses (a broadcast address works too)")
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--lead", type=float, default=1.0, help="seconds between sending a command and its target time")
+    parser.add_argument("--count", type=int, default=20, help="number of synchronised actions")
+    parser.add_argument("--period", type=float, default=0.5, help="seconds between actions")
+    args = parser.parse_args()
+
+    # Target times are on this machine's clock: sync the boards to it (scripts/script_time_server.py)
+    # or to the same NTP server as this machine
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+        sock.settimeout(0.5)
+        start = time.time_ns() // 1000 + int(args.lead * 1_000_000)
+        for n in range(args.count):
+            target = start + int(n * args.period * 1_000_000)
+            color = bytes(COLORS[n % len(COLORS)])
+            packet = COMMAND.pack(COMMAND_MAGIC, target, ACTION_LED, color)
+            for host in args.hosts:
+                sock.sendto(packet, (host, args.port))
+
+            replies = {}
+            try:
+                while len(replies) < len(args.hosts):
+                    data, addr = sock.recvfrom(64)
+                    if len(data) >= STATUS.size:
+                        replies[addr[0]] = STATUS.unpack_from(data)[0]
+            except socket.timeout:
+                pass
+            print(f"Action {n}: target {target} us, status {replies or 'no reply'}")
+
+            # Send the next command 'lead' seconds before its target
+            next_send = (start + (n + 1) * args.period * 1_000_000 - args.lead * 1_000_000) / 1_000_000
+            time.sleep(max(0.0, next_send - time.time()))
+
+    print("Each board logs 'Command ... fired N us after its target' and a min/max/mean report.")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+import argparse
+import asyncio
+import ipaddress
+import os
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+from script_fleet_load import SERVER_PORT, add_load_arguments, check_load_arguments, report, run_load
+
+# Application directory, relative to this script
+APP_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "app")
+
+# Instances get consecutive loopback addresses from here (Linux routes all of 127.0.0.0/8 to lo)
+ADDR_BASE = "127.0.1.1"
+
+# With --ports, every port of instance i (server, pcap dump, DDP) is moved up by i * PORT_STRIDE.
+# The stride keeps one instance's ports clear of the next one's, e.g. the server (4321) and the pcap dump (4322).
+PORT_STRIDE = 10
+
+
+def build(build_dir, proto, coro):
+    """Build the application for native_sim as an echo server."""
+    cmd = ["west", "build", "-b", "native_sim", "-d", build_dir, APP_DIR, "--"]
+    if proto == "tcp":
+        cmd += ["-DCONFIG_USING_TCP=y", "-DCONFIG_USING_UDP=n", "-DCONFIG_APP_TCP_MODE_ECHO=y"]
+        if coro:
+            cmd.append("-DEXTRA_CONF_FILE=overlay-coro.conf")
+    else:
+        cmd += ["-DCONFIG_USING_TCP=n", "-DCONFIG_USING_UDP=y", "-DCONFIG_APP_UDP_MODE_ECHO=y"]
+    print(" ".join(cmd))
+    subprocess.run(cmd, check=True)
+
+
+def launch(exe, count, run_dir, use_ports, port_base):
+    """Start 'count' instances, each in its own directory (console log, flash.bin) and on its own address or port."""
+    instances = []
+    base = ipaddress.IPv4Address(ADDR_BASE)
+
+    for i in range(count):
+        work_dir = os.path.join(run_dir, f"dev{i:03d}")
+        os.makedirs(work_dir, exist_ok=True)
+
+        if use_ports:
+            host, port = "127.0.0.1", port_base + i * PORT_STRIDE
+            options = [f"--port={port}", f"--port_offset={i * PORT_STRIDE}"]
+        else:
+            host, port = str(base + i), port_base
+            options = [f"--bind_addr={host}"]
+
+        log = open(os.path.join(work_dir, "console.log"), "w")
+        process = subprocess.Popen([os.path.abspath(exe)] + options, cwd=work_dir,
+                                   stdout=log, stderr=subprocess.STDOUT, start_new_session=True)
+        instances.append({"process": process, "log": log, "host": host, "port": port, "dir": work_dir})
+
+    return instances
+
+
+def wait_ready(instances, proto, timeout):
+    """Wait until every TCP instance accepts connections. UDP instances are given the same time to start."""
+    deadline = time.monotonic() + timeout
+    pending = list(instances)
+
+    while pending and time.monotonic() < deadline:
+        for inst in list(pending):
+            if inst["process"].poll() is not None:
+                print(f"{inst['host']}:{inst['port']} exited with {inst['process'].returncode}, see {inst['dir']}")
+                pending.remove(inst)
+                continue
+            if proto == "udp":
+                pending.remove(inst)
+                continue
+            try:
+                with socket.create_connection((inst["host"], inst["port"]), timeout=0.5):
+                    pending.remove(inst)
+            except OSError:
+                pass
+        time.sleep(0.2)
+
+    if proto == "udp":
+        time.sleep(min(2.0, max(0.0, deadline - time.monotonic())))
+    return [i for i in instances if i not in pending and i["process"].poll() is None]
+
+
+def stop(instances):
+    for inst in instances:
+        if inst["process"].poll() is None:
+            os.killpg(inst["process"].pid, signal.SIGTERM)
+    for inst in instances:
+        try:
+            inst["process"].wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            os.killpg(inst["process"].pid, signal.SIGKILL)
+            inst["process"].wait()
+        inst["log"].close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run a fleet of native_sim devices and load them all at once.")
+    parser.add_argument("-n", "--instances", type=int, default=8)
+    parser.add_argument("--build-dir", default="build-fleet")
+    parser.add_argument("--no-build", action="store_true", help="reuse the existing build")
+    parser.add_argument("--coro", action="store_true", help="build the coroutine TCP server (several clients each)")
+    parser.add_argument("--run-dir", default="fleet-run", help="per-instance working directories and logs")
+    parser.add_argument("--ports", action="store_true",
+                        help=f"one port range per instance on 127.0.0.1 (every {PORT_STRIDE} ports) "
+                             f"instead of one address per instance from {ADDR_BASE}")
+    parser.add_argument("--port-base", type=int, default=SERVER_PORT)
+    parser.add_argument("--boot-timeout", type=float, default=30.0)
+    parser.add_argument("--hold", action="store_true", help="keep the fleet running after the load, until Ctrl-C")
+    add_load_arguments(parser)
+    args = parser.parse_args()
+    check_load_arguments(parser, args)
+
+    if not args.no_build:
+        build(args.build_dir, args.proto, args.coro)
+    exe = os.path.join(args.build_dir, "zephyr", "zephyr.exe")
+
+    instances = launch(exe, args.instances, args.run_dir, args.ports, args.port_base)
+    errors = 0
+    try:
+        ready = wait_ready(instances, args.proto, args.boot_timeout)
+        print(f"{len(ready)}/{len(instances)} instances up")
+        if ready:
+            stats, elapsed = asyncio.run(run_load([(i["host"], i["port"]) for i in ready], args))
+            errors = report(stats, elapsed, args.json)
+        if len(ready) < len(instances):
+            errors += len(instances) - len(ready)
+
+        if args.hold:
+            print("Fleet running, Ctrl-C to stop")
+            while True:
+                time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        stop(instances)
+
+    sys.exit(1 if errors else 0)
+
+
+if __name__ == "__main__":
+    main()
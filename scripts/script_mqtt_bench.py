@@ -0,0 +1,198 @@
+import argparse
+import socket
+import struct
+import time
+
+# TODO: Change this to your broker's address
+BROKER_IP = "127.0.0.1"
+BROKER_PORT = 1883
+
+# CONFIG_APP_MQTT_CLIENT_ID of the board
+DEVICE_ID = "esp32s3-socket"
+
+# MQTT 3.1.1 control packet types
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+KEEPALIVE_SEC = 30
+
+
+def encode_length(n):
+    out = bytearray()
+    while True:
+        byte = n % 128
+        n //= 128
+        out.append(byte | (0x80 if n else 0))
+        if not n:
+            return bytes(out)
+
+
+def encode_string(s):
+    data = s.encode()
+    return struct.pack(">H", len(data)) + data
+
+
+def packet(ptype, flags, body):
+    return bytes([(ptype << 4) | flags]) + encode_length(len(body)) + body
+
+
+class MqttConnection:
+    """Just enough MQTT 3.1.1 to subscribe, receive and take over a session, with the standard library only."""
+
+    def __init__(self, host, port, client_id, clean_session):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.buffer = b""
+        flags = 0x02 if clean_session else 0x00
+        body = encode_string("MQTT") + bytes([4, flags]) + struct.pack(">H", KEEPALIVE_SEC) + encode_string(client_id)
+        self.sock.sendall(packet(CONNECT, 0, body))
+        ptype, _, payload = self.read_packet()
+        if ptype != CONNACK or payload[1] != 0:
+            raise ConnectionError(f"Connection refused: {payload!r}")
+        self.session_present = bool(payload[0] & 0x01)
+
+    def _read(self, n):
+        while len(self.buffer) < n:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise ConnectionError("Broker closed the connection")
+            self.buffer += chunk
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def read_packet(self):
+        header = self._read(1)[0]
+        length, shift = 0, 0
+        while True:
+            byte = self._read(1)[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return header >> 4, header & 0x0F, self._read(length)
+
+    def subscribe(self, topic, qos=1):
+        self.sock.sendall(packet(SUBSCRIBE, 0x02, struct.pack(">H", 1) + encode_string(topic) + bytes([qos])))
+
+    def publish(self, topic, payload, qos=0):
+        body = encode_string(topic) + (struct.pack(">H", 1) if qos else b"") + payload
+        self.sock.sendall(packet(PUBLISH, qos << 1, body))
+
+    def ping(self):
+        self.sock.sendall(packet(PINGREQ, 0, b""))
+
+    def receive(self):
+        """Return (topic, payload) of the next PUBLISH, acknowledging QoS 1, or None for any other packet."""
+        ptype, flags, body = self.read_packet()
+        if ptype != PUBLISH:
+            return None
+        topic_len = struct.unpack_from(">H", body)[0]
+        topic = body[2:2 + topic_len].decode(errors="replace")
+        offset = 2 + topic_len
+        if (flags >> 1) & 0x03:
+            packet_id = body[offset:offset + 2]
+            offset += 2
+            self.sock.sendall(packet(PUBACK, 0, packet_id))
+        return topic, body[offset:]
+
+    def close(self):
+        try:
+            self.sock.sendall(packet(DISCONNECT, 0, b""))
+        finally:
+            self.sock.close()
+
+
+def kick_device(host, port, device_id):
+    """Connect with the board's client id: the broker drops the board, which has to reconnect and resume.
+    Clean session stays off, so the board's session (subscriptions, QoS 1 state) survives the takeover."""
+    conn = MqttConnection(host, port, device_id, clean_session=False)
+    conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure the board's MQTT publish rate and reconnect-to-resume time.")
+    parser.add_argument("--host", default=BROKER_IP)
+    parser.add_argument("--port", type=int, default=BROKER_PORT)
+    parser.add_argument("--device", default=DEVICE_ID, help="Client id of the board")
+    parser.add_argument("--duration", type=float, default=30.0)
+    parser.add_argument("--interval", type=float, default=5.0, help="Seconds between rate reports")
+    parser.add_argument("--kick", type=float, default=0, help="Force the board to reconnect every N seconds (0 = never)")
+    parser.add_argument("--led", help="Also send one LED command, e.g. 0,32,0")
+    args = parser.parse_args()
+
+    conn = MqttConnection(args.host, args.port, f"{args.device}-bench-{int(time.time())}", clean_session=True)
+    conn.subscribe(f"{args.device}/bench", qos=1)
+    conn.sock.settimeout(1.0)
+
+    if args.led:
+        conn.publish(f"{args.device}/cmd", bytes(int(v) for v in args.led.split(",")), qos=1)
+
+    expected = None
+    received = lost = duplicates = 0
+    period = 0
+    resume_times = []
+    kick_at = None
+    kick_conn = None
+    last_conn = None
+    start = last_report = last_ping = time.monotonic()
+    next_kick = start + args.kick if args.kick else None
+
+    print(f"Subscribed to {args.device}/bench on {args.host}:{args.port}")
+    while time.monotonic() - start < args.duration:
+        now = time.monotonic()
+
+        if next_kick and now >= next_kick and kick_at is None:
+            kick_device(args.host, args.port, args.device)
+            kick_at = time.monotonic()
+            kick_conn = last_conn
+            next_kick = kick_at + args.kick
+
+        if now - last_ping >= KEEPALIVE_SEC / 2:
+            conn.ping()
+            last_ping = now
+
+        try:
+            message = conn.receive()
+        except socket.timeout:
+            message = None
+
+        if message is not None and len(message[1]) >= 12:
+            seq, _, conn_number = struct.unpack_from("<III", message[1])
+            received += 1
+            period += 1
+
+            # The first message published on a later connection marks the end of the reconnect. Messages the
+            # broker or the board still had queued from before the takeover carry the old connection number.
+            if kick_at is not None and kick_conn is not None and conn_number != kick_conn:
+                resume_times.append(time.monotonic() - kick_at)
+                print(f"  board resumed publishing {resume_times[-1] * 1000:.0f} ms after the takeover")
+                kick_at = None
+            elif kick_at is not None and kick_conn is None:
+                # Kicked before any message was seen: there is nothing to compare with
+                kick_at = None
+            last_conn = conn_number
+
+            # QoS 1 re-sends after a reconnect show up as duplicates, losses as gaps
+            if expected is not None and seq < expected:
+                duplicates += 1
+            else:
+                if expected is not None:
+                    lost += seq - expected
+                expected = seq + 1
+
+        now = time.monotonic()
+        if now - last_report >= args.interval:
+            print(f"{period / (now - last_report):.0f} msg/s | total {received}, {lost} lost, {duplicates} duplicates")
+            period = 0
+            last_report = now
+
+    elapsed = time.monotonic() - start
+    print(f"\n{received} messages in {elapsed:.1f} s: {received / elapsed:.0f} msg/s, {lost} lost, {duplicates} duplicates")
+    if resume_times:
+        resume_times.sort()
+        print(f"Reconnect-to-resume over {len(resume_times)} takeovers: "
+              f"min {resume_times[0] * 1000:.0f} ms, median {resume_times[len(resume_times) // 2] * 1000:.0f} ms, "
+              f"max {resume_times[-1] * 1000:.0f} ms")
+    conn.close()
+
+
+if __name__ == "__main__":
+    main()
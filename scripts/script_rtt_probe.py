@@ -0,0 +1,119 @@
+import argparse
+import socket
+import struct
+import sys
+import time
+
+# TODO: Change this to your ESP32's IP address (127.0.0.1 for native_sim)
+SERVER_IP = "192.168.1.1"
+
+# TODO: Change this to the port your ESP32 is listening on
+SERVER_PORT = 4321
+
+# Probe layout: magic "RTT1", sequence number, host send time (ns), all little-endian.
+# In UDP echo mode the device appends a 4-byte trailer with the time (us) it held the probe.
+PROBE = struct.Struct("<IIQ")
+PROBE_MAGIC = 0x31545452
+TRAILER = struct.Struct("<I")
+
+
+def percentile(sorted_values, pct):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return float("nan")
+    rank = max(1, int(round(pct / 100.0 * len(sorted_values))))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+def make_probe(seq, size):
+    probe = PROBE.pack(PROBE_MAGIC, seq, time.monotonic_ns())
+    return probe + bytes(max(0, size - len(probe)))
+
+
+def run_udp(server, count, interval, size, timeout):
+    """Send probes one at a time and collect (rtt_us, device_us) pairs."""
+    results = []
+    lost = 0
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.settimeout(timeout)
+        for seq in range(count):
+            sock.sendto(make_probe(seq, size), server)
+            while True:
+                try:
+                    reply, _ = sock.recvfrom(2048)
+                except socket.timeout:
+                    lost += 1
+                    break
+                now = time.monotonic_ns()
+                magic, rseq, sent = PROBE.unpack_from(reply)
+                # Late replies of earlier probes are skipped
+                if magic != PROBE_MAGIC or rseq != seq:
+                    continue
+                device_us = TRAILER.unpack_from(reply, len(reply) - TRAILER.size)[0]
+                results.append(((now - sent) / 1000.0, device_us))
+                break
+            time.sleep(interval)
+    return results, lost
+
+
+def run_tcp(server, count, interval, size, timeout):
+    """Same over TCP. The echo is verbatim, so there is no device-time trailer."""
+    results = []
+    lost = 0
+    with socket.create_connection(server, timeout=timeout) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        for seq in range(count):
+            probe = make_probe(seq, size)
+            sock.sendall(probe)
+            reply = b""
+            try:
+                while len(reply) < len(probe):
+                    part = sock.recv(len(probe) - len(reply))
+                    if not part:
+                        raise ConnectionError("device closed the connection")
+                    reply += part
+            except socket.timeout:
+                lost += 1
+                continue
+            now = time.monotonic_ns()
+            _, _, sent = PROBE.unpack_from(reply)
+            results.append(((now - sent) / 1000.0, None))
+            time.sleep(interval)
+    return results, lost
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure round-trip time against the device's echo mode.")
+    parser.add_argument("--host", default=SERVER_IP)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--proto", choices=["udp", "tcp"], default="udp")
+    parser.add_argument("--count", type=int, default=1000)
+    parser.add_argument("--interval", type=float, default=0.01, help="seconds between probes")
+    parser.add_argument("--size", type=int, default=PROBE.size, help="probe size in bytes (min 16)")
+    parser.add_argument("--timeout", type=float, default=1.0)
+    args = parser.parse_args()
+
+    if args.size > 120:
+        parser.error("the device echoes at most 120 bytes per message")
+
+    server = (args.host, args.port)
+    runner = run_udp if args.proto == "udp" else run_tcp
+    results, lost = runner(server, args.count, args.interval, args.size, args.timeout)
+
+    if not results:
+        print("No replies received")
+        sys.exit(1)
+
+    rtts = sorted(r for r, _ in results)
+    print(f"{args.proto.upper()} RTT over {len(results)} probes ({lost} lost):")
+    for pct in (50, 90, 99, 99.9):
+        print(f"  p{pct:<5} {percentile(rtts, pct):10.1f} us")
+    print(f"  max    {rtts[-1]:10.1f} us")
+
+    device = sorted(d for _, d in results if d is not None)
+    if device:
+        print(f"Device hold time: p50 {percentile(device, 50)} us, p99 {percentile(device, 99)} us, max {device[-1]} us")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,169 @@
+import argparse
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+from rudp import ReliableUdp
+
+# TODO: Change this to your ESP32's IP address (127.0.0.1 for native_sim)
+SERVER_IP = "192.168.1.1"
+
+# TODO: Change this to the port your ESP32 is listening on
+SERVER_PORT = 4321
+
+# Message layout: sequence number and host send time (ns), padded to the requested size
+MESSAGE = struct.Struct("<IQ")
+
+
+def percentile(sorted_values, pct):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return float("nan")
+    rank = max(1, int(round(pct / 100.0 * len(sorted_values))))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+def make_message(seq, size):
+    msg = MESSAGE.pack(seq, time.monotonic_ns())
+    return msg + bytes(max(0, size - len(msg)))
+
+
+def run_rudp(args):
+    """Pipeline messages through the reliable-UDP echo; return per-message latencies (us) and stats."""
+    link = ReliableUdp(args.host, args.port, window=args.window, loss=args.loss)
+    latencies = []
+    sent = 0
+    try:
+        deadline = time.monotonic() + args.timeout
+        while len(latencies) < args.count and time.monotonic() < deadline:
+            # Keep up to 'window' messages outstanding
+            while sent < args.count and sent - len(latencies) < args.window and len(link.in_flight) < args.window:
+                link.send(make_message(sent, args.size))
+                sent += 1
+            reply = link.recv(timeout=0.5)
+            if reply is not None:
+                _, t_sent = MESSAGE.unpack_from(reply)
+                latencies.append((time.monotonic_ns() - t_sent) / 1000.0)
+        link.flush(1.0)
+    finally:
+        link.close()
+    return latencies, dict(link.stats)
+
+
+def run_tcp(args):
+    """Same workload over the TCP echo mode."""
+    latencies = []
+    sent = 0
+    with socket.create_connection((args.host, args.port), timeout=args.timeout) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        pending = b""
+        deadline = time.monotonic() + args.timeout
+        while len(latencies) < args.count and time.monotonic() < deadline:
+            while sent < args.count and sent - len(latencies) < args.window:
+                sock.sendall(make_message(sent, args.size))
+                sent += 1
+            try:
+                data = sock.recv(65536)
+            except socket.timeout:
+                break
+            if not data:
+                raise ConnectionError("device closed the connection")
+            pending += data
+            # The echo is a byte stream: cut it back into messages
+            while len(pending) >= args.size:
+                _, t_sent = MESSAGE.unpack_from(pending)
+                latencies.append((time.monotonic_ns() - t_sent) / 1000.0)
+                pending = pending[args.size:]
+    return latencies, {}
+
+
+# Intermediate device that receives the ingress traffic of the host interface, so netem can shape it too
+IFB_DEV = "ifb_rudp"
+
+
+def netem(iface, loss):
+    """Inject loss in both directions of the host interface (root required). Returns a cleanup function.
+
+    A root qdisc only shapes egress (host -> device). The ingress traffic (device -> host: echoes and ACKs)
+    is redirected to an ifb device and dropped there by a second netem. On the loopback interface every
+    packet already leaves through its egress once, so the root qdisc covers both directions there.
+    """
+    rate = f"{loss * 100}%"
+
+    def cleanup():
+        subprocess.run(["tc", "qdisc", "del", "dev", iface, "root"], check=False)
+        subprocess.run(["tc", "qdisc", "del", "dev", iface, "ingress"], check=False)
+        subprocess.run(["ip", "link", "del", IFB_DEV], check=False)
+
+    try:
+        subprocess.run(["tc", "qdisc", "replace", "dev", iface, "root", "netem", "loss", rate], check=True)
+        if iface == "lo":
+            return lambda: subprocess.run(["tc", "qdisc", "del", "dev", iface, "root"], check=False)
+
+        subprocess.run(["modprobe", "ifb", "numifbs=0"], check=False)
+        subprocess.run(["ip", "link", "add", IFB_DEV, "type", "ifb"], check=True)
+        subprocess.run(["ip", "link", "set", IFB_DEV, "up"], check=True)
+        subprocess.run(["tc", "qdisc", "add", "dev", iface, "handle", "ffff:", "ingress"], check=True)
+        subprocess.run(["tc", "filter", "add", "dev", iface, "parent", "ffff:", "protocol", "all", "u32",
+                        "match", "u32", "0", "0", "action", "mirred", "egress", "redirect", "dev", IFB_DEV], check=True)
+        subprocess.run(["tc", "qdisc", "replace", "dev", IFB_DEV, "root", "netem", "loss", rate], check=True)
+    except subprocess.CalledProcessError:
+        cleanup()
+        raise
+
+    return cleanup
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare goodput and tail latency of reliable UDP and TCP echo under loss.")
+    parser.add_argument("--host", default=SERVER_IP)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--proto", choices=["rudp", "tcp"], default="rudp",
+                        help="rudp needs CONFIG_APP_UDP_MODE_RELIABLE, tcp needs CONFIG_APP_TCP_MODE_ECHO")
+    parser.add_argument("--count", type=int, default=2000)
+    parser.add_argument("--size", type=int, default=64, help="message size in bytes (min 12)")
+    parser.add_argument("--window", type=int, default=8, help="messages in flight")
+    parser.add_argument("--loss", type=float, default=0.0,
+                        help="loss rate (0-1). Applied with netem if --netem is given, else inside the rudp library")
+    parser.add_argument("--netem", metavar="IFACE", help="apply the loss with tc netem on this interface, in both directions through an ifb device "
+                             "(fair for both protocols)")
+    parser.add_argument("--timeout", type=float, default=60.0)
+    args = parser.parse_args()
+
+    if args.size < MESSAGE.size:
+        parser.error(f"--size must be at least {MESSAGE.size}")
+    if args.loss and not args.netem and args.proto == "tcp":
+        parser.error("TCP loss needs --netem IFACE")
+
+    cleanup = None
+    if args.netem and args.loss:
+        cleanup = netem(args.netem, args.loss)
+        args.loss = 0.0
+
+    try:
+        start = time.monotonic()
+        latencies, stats = (run_rudp if args.proto == "rudp" else run_tcp)(args)
+        elapsed = time.monotonic() - start
+    finally:
+        if cleanup:
+            cleanup()
+
+    if not latencies:
+        print("No replies received")
+        sys.exit(1)
+
+    latencies.sort()
+    goodput = len(latencies) * args.size / elapsed
+    print(f"{args.proto.upper()}: {len(latencies)}/{args.count} messages of {args.size} B echoed in {elapsed:.2f} s, "
+          f"goodput {goodput / 1024:.1f} KB/s")
+    for pct in (50, 90, 99, 99.9):
+        print(f"  p{pct:<5} {percentile(latencies, pct):10.1f} us")
+    print(f"  max    {latencies[-1]:10.1f} us")
+    if stats:
+        print("  " + ", ".join(f"{k} {v}" for k, v in sorted(stats.items())))
+
+
+if __name__ == "__main__":
+    main()
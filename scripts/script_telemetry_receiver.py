@@ -0,0 +1,150 @@
+import argparse
+import csv
+import socket
+import struct
+import time
+
+# Default UDP port of the collector (CONFIG_APP_TELEMETRY_COLLECTOR_PORT)
+LISTEN_PORT = 4950
+
+# Frame header: magic, sequence, base time (us), sample count, dropped samples, flags, reserved (little-endian)
+HEADER = struct.Struct("<IIqHHHH")
+MAGIC = 0x314D4C54  # "TLM1"
+FLAG_UTC = 0x0001
+
+# Sample: channel, offset from the base time (us), value
+SAMPLE = struct.Struct("<HIi")
+
+# A frame at most this far behind the expected sequence is a late (reordered) one. Further behind, or a sequence
+# back at 0, means the device restarted and counts from 0 again.
+REORDER_WINDOW = 64
+
+CHANNEL_NAMES = {
+    1: "uptime_ms",
+    2: "rssi_dbm",
+    3: "control_tx_pkts",
+    4: "bulk_tx_pkts",
+    5: "tcp_accepted",
+    6: "samples_dropped",
+    7: "frames_deferred",
+    0x80: "test_signal",
+}
+
+
+def channel_name(channel):
+    if channel >= 0x100:
+        return f"app_{channel - 0x100}"
+    return CHANNEL_NAMES.get(channel, f"ch_{channel}")
+
+
+def decode_frame(data):
+    """Return (sequence, dropped, utc, [(time_us, channel, value), ...]), or None if the datagram is not a frame."""
+    if len(data) < HEADER.size:
+        return None
+    magic, seq, base_us, count, dropped, flags, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or len(data) < HEADER.size + count * SAMPLE.size:
+        return None
+    samples = []
+    for i in range(count):
+        channel, dt_us, value = SAMPLE.unpack_from(data, HEADER.size + i * SAMPLE.size)
+        samples.append((base_us + dt_us, channel, value))
+    return seq, dropped, bool(flags & FLAG_UTC), samples
+
+
+class ChannelStats:
+    def __init__(self):
+        self.count = 0
+        self.last = None
+
+    def add(self, value):
+        self.count += 1
+        self.last = value
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receive and decode the board's telemetry frames.")
+    parser.add_argument("--port", type=int, default=LISTEN_PORT)
+    parser.add_argument("--interval", type=float, default=5.0, help="Seconds between summaries")
+    parser.add_argument("--csv", help="Also write every sample to this CSV file")
+    parser.add_argument("--duration", type=float, default=0, help="Stop after this many seconds (0 = run until Ctrl-C)")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+    sock.bind(("0.0.0.0", args.port))
+    sock.settimeout(0.5)
+    print(f"Listening for telemetry on UDP port {args.port}")
+
+    writer = None
+    csv_file = None
+    if args.csv:
+        csv_file = open(args.csv, "w", newline="")
+        writer = csv.writer(csv_file)
+        writer.writerow(["time_us", "utc", "channel", "value"])
+
+    channels = {}
+    expected_seq = {}
+    frames = lost_frames = dropped = bad = restarts = late = 0
+    period_frames = period_samples = 0
+    start = last_report = time.monotonic()
+
+    try:
+        while args.duration == 0 or time.monotonic() - start < args.duration:
+            try:
+                data, addr = sock.recvfrom(2048)
+            except socket.timeout:
+                data = None
+
+            if data is not None:
+                frame = decode_frame(data)
+                if frame is None:
+                    bad += 1
+                    continue
+                seq, frame_dropped, utc, samples = frame
+
+                # Sequence gaps are frames lost on the network; 'dropped' is samples lost on the device
+                if addr in expected_seq and seq != expected_seq[addr]:
+                    behind = (expected_seq[addr] - seq) & 0xFFFFFFFF
+                    if behind < 0x80000000:
+                        if behind <= REORDER_WINDOW and seq != 0:
+                            late += 1
+                        else:
+                            restarts += 1
+                            print(f"{addr[0]}:{addr[1]} restarted (sequence {seq}, expected {expected_seq[addr]})")
+                            expected_seq[addr] = (seq + 1) & 0xFFFFFFFF
+                    else:
+                        lost_frames += (seq - expected_seq[addr]) & 0xFFFFFFFF
+                        expected_seq[addr] = (seq + 1) & 0xFFFFFFFF
+                else:
+                    expected_seq[addr] = (seq + 1) & 0xFFFFFFFF
+                frames += 1
+                period_frames += 1
+                period_samples += len(samples)
+                dropped += frame_dropped
+
+                for time_us, channel, value in samples:
+                    channels.setdefault(channel, ChannelStats()).add(value)
+                    if writer:
+                        writer.writerow([time_us, int(utc), channel, value])
+
+            now = time.monotonic()
+            if now - last_report >= args.interval:
+                elapsed = now - last_report
+                print(f"{period_frames / elapsed:.1f} frames/s, {period_samples / elapsed:.0f} samples/s | "
+                      f"total {frames} frames, {lost_frames} lost, {late} late, {restarts} device restarts, "
+                      f"{dropped} samples dropped on device, {bad} invalid")
+                for channel in sorted(channels):
+                    stats = channels[channel]
+                    print(f"  {channel_name(channel):>16}: {stats.count:8d} samples, last {stats.last}")
+                period_frames = period_samples = 0
+                last_report = now
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if csv_file:
+            csv_file.close()
+        sock.close()
+
+
+if __name__ == "__main__":
+    main()
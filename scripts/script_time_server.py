@@ -0,0 +1,45 @@
+import argparse
+import socket
+import struct
+import time
+
+# Minimal SNTP server (RFC 4330) for the fleet: every board syncs to this machine's clock,
+# so the boards agree with each other and with scripts/script_fleet_schedule.py run here.
+# Port 123 needs root; set CONFIG_APP_TIMESYNC_SERVER to this machine's address.
+
+NTP_UNIX_EPOCH_DELTA = 2208988800
+PACKET = struct.Struct(">BBbb4s4s4sQQQQ")
+
+
+def ntp_now():
+    """Current time as a 64-bit NTP timestamp."""
+    ns = time.time_ns()
+    seconds, rem = divmod(ns, 1_000_000_000)
+    return ((seconds + NTP_UNIX_EPOCH_DELTA) << 32) | ((rem << 32) // 1_000_000_000)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Serve this machine's clock over SNTP.")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=123)
+    parser.add_argument("--stratum", type=int, default=2, help="stratum to announce (the host is assumed NTP-synced)")
+    args = parser.parse_args()
+
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.bind((args.bind, args.port))
+        print(f"SNTP server on {args.bind}:{args.port}")
+        while True:
+            request, client = sock.recvfrom(512)
+            receive = ntp_now()
+            if len(request) < PACKET.size:
+                continue
+            fields = PACKET.unpack_from(request)
+            version = (fields[0] >> 3) & 0x07
+            # Answer in mode 4 with the client's transmit timestamp as originate, so it can match the reply
+            reply = PACKET.pack((version << 3) | 4, args.stratum, 4, -20, b"\0" * 4, b"\0" * 4, b"LOCL",
+                                receive, fields[10], receive, ntp_now())
+            sock.sendto(reply, client)
+
+
+if __name__ == "__main__":
+    main()